@@ -3,10 +3,18 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 
+#include "arm_kinematics.hpp"
+#include "benchmark.hpp"
+#include "boot_profile.hpp"
+#include "calibration_store.hpp"
 #include "commands_protocol.hpp"
 #include "dc_motors_control.hpp"
+#include "irq_tiers.hpp"
 #include "logger.hpp"
+#include "motion_recorder.hpp"
 #include "pico_native_pwm.hpp"
+#include "power_monitor.hpp"
+#include "register_map.hpp"
 #include "servo_control.hpp"
 #include "spi_transport.hpp"
 #include "uart_transport.hpp"
@@ -18,9 +26,43 @@ int main()
     const int led_blink_interval_ms = 1000;
     const int delay_ms = 10;
     uint8_t led = 1;
-    int led_blink_interval = 500;
+    uint32_t led_toggle_us;
+
+    boot_profile_mark(BOOT_STAGE_MAIN);
+
+    // Before any interrupt is enabled, the handlers then start in their tiers.
+    init_irq_tiers();
+
+#if BOOT_FAST_START
+    // Safe actuator state and the transport first. Everything else can wait until commands are accepted.
+    // All PWM outputs start low, which also keeps the DC motors stopped.
+    init_pwms();
+    boot_profile_mark(BOOT_STAGE_PWMS);
+    init_dc_motors();
+    boot_profile_mark(BOOT_STAGE_DC_MOTORS);
+    init_power_monitor();
+    init_calibration_store();
+    init_servos();
+    init_arm_kinematics();
+    init_motion_recorder();
+    boot_profile_mark(BOOT_STAGE_SERVOS);
+    init_commands_protocol();
+    init_register_map();
+    init_spi();
+    boot_profile_mark(BOOT_STAGE_SPI);
 
     stdio_init_all();
+    boot_profile_mark(BOOT_STAGE_STDIO);
+
+    gpio_init(LED_PIN);
+    gpio_set_dir(LED_PIN, GPIO_OUT);
+    gpio_put(LED_PIN, 0);
+
+    init_logger();
+    boot_profile_mark(BOOT_STAGE_LOGGER);
+#else
+    stdio_init_all();
+    boot_profile_mark(BOOT_STAGE_STDIO);
 
 
     gpio_init(LED_PIN);
@@ -28,24 +70,42 @@ int main()
     gpio_put(LED_PIN, 0);
 
     init_logger();
+    boot_profile_mark(BOOT_STAGE_LOGGER);
     init_pwms();
+    boot_profile_mark(BOOT_STAGE_PWMS);
+    init_calibration_store();
     init_servos();
+    init_arm_kinematics();
+    init_motion_recorder();
+    boot_profile_mark(BOOT_STAGE_SERVOS);
     init_dc_motors();
+    boot_profile_mark(BOOT_STAGE_DC_MOTORS);
+    init_power_monitor();
     init_commands_protocol();
+    init_register_map();
     init_spi();
+    boot_profile_mark(BOOT_STAGE_SPI);
     //init_uart_transport();
+#endif // BOOT_FAST_START
 
     gpio_put(LED_PIN, led);
+    led_toggle_us = time_us_32() + 500 * 1000;
+    boot_profile_mark(BOOT_STAGE_COMPLETE);
+
+#if BENCHMARK_IMAGE
+    // Before the main loop takes any command, see benchmark.hpp.
+    benchmark_report(BENCHMARK_ITERATIONS);
+#endif
     
     while (1)
     {
         process_commands_protocol();
 
-        sleep_ms(delay_ms);
-        led_blink_interval  -= delay_ms;
-        if (led_blink_interval <= 0)
+        // Wakes up early for a scheduled command, so the blinking goes by the clock.
+        sleep_us(commands_protocol_sleep_us(delay_ms * 1000));
+        if ((int32_t)(time_us_32() - led_toggle_us) >= 0)
         {
-            led_blink_interval = led_blink_interval_ms;
+            led_toggle_us += led_blink_interval_ms * 1000;
             led = led ^ 1; // Toggle the LED state
             gpio_put(LED_PIN, led);
         }
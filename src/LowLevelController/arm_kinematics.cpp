@@ -0,0 +1,487 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "arm_kinematics.hpp"
+#include "publish_buffer.hpp"
+#include "servo_control.hpp"
+
+#define CORDIC_ITERATIONS 16
+
+// 1 / 1.6467602 (CORDIC gain) in Q16.
+#define CORDIC_GAIN_INVERSE_Q16 39797
+
+#define Q16_ONE (1 << 16)
+
+// Rounding of the fixed-point math. A wrist this close past the stretched or the folded arm is
+// taken as on it, so the arm stretched straight, as it boots, solves.
+#define ARM_REACH_TOLERANCE_UM 10
+
+// atan(2^-i) in millidegrees. Read on every control tick, so kept in RAM.
+const int32_t __not_in_flash("arm_kinematics") cordic_atan_table_mdeg[CORDIC_ITERATIONS] = {
+    45000, 26565, 14036, 7125, 3576, 1790, 895, 448,
+    224, 112, 56, 28, 14, 7, 3, 2
+};
+
+// Joint angles when the servos are at center, see arm_joint_angles_t.
+#define SHOULDER_REFERENCE_MDEG 90000
+
+// The positioning joints, a Cartesian motion stops them jogging on their own.
+constexpr uint32_t ARM_CARTESIAN_JOINTS_MASK =
+    (1u << BASE_MOTOR_INDEX) | (1u << SHOULDER_MOTOR_INDEX) | (1u << ELBOW_MOTOR_INDEX) | (1u << ARM_MOTOR_INDEX);
+
+// Link lengths in micrometers, from the calibration of the positioning joints.
+typedef struct
+{
+    int32_t base_height_um;
+    int32_t upper_link_um;
+    int32_t forearm_link_um;
+    int32_t gripper_link_um;
+} arm_geometry_t;
+
+typedef enum {
+    ARM_MOTION_IDLE = 0,
+    ARM_MOTION_MOVE = 1,
+    ARM_MOTION_VELOCITY = 2,
+} arm_motion_mode_t;
+
+// Request from the command processing to the control tick.
+typedef struct
+{
+    arm_motion_mode_t mode;
+
+    // Target point of a move.
+    int32_t goal_x_um;
+    int32_t goal_y_um;
+    int32_t goal_z_um;
+
+    // Speed of a move. mm/s is the same as um/ms.
+    int32_t speed_um_ms;
+
+    // Velocity of a jog in um/ms and mdeg/ms.
+    int32_t velocity_x_um_ms;
+    int32_t velocity_y_um_ms;
+    int32_t velocity_z_um_ms;
+    int32_t pitch_rate_mdeg_ms;
+
+    // Remaining time of a jog in milliseconds.
+    int32_t timeout_ms;
+} arm_motion_t;
+
+// Written by the command processing, taken over by the control tick.
+PublishBuffer<arm_motion_t> arm_motion_requests;
+
+// Owned by the control tick.
+arm_motion_t arm_motion = {};
+arm_pose_t arm_current_pose;
+bool arm_current_pose_valid = false;
+
+static inline int32_t fx_mul_q16(int32_t value, int32_t q16)
+{
+    return (int32_t)(((int64_t)value * q16) >> 16);
+}
+
+static uint32_t __not_in_flash_func(fx_isqrt64)(uint64_t value)
+{
+    uint64_t result = 0;
+    uint64_t bit = (uint64_t)1 << 62;
+
+    while (bit > value)
+    {
+        bit >>= 2;
+    }
+
+    while (bit != 0)
+    {
+        if (value >= result + bit)
+        {
+            value -= result + bit;
+            result = (result >> 1) + bit;
+        }
+        else
+        {
+            result >>= 1;
+        }
+        bit >>= 2;
+    }
+
+    return (uint32_t)result;
+}
+
+static void __not_in_flash_func(read_arm_geometry)(arm_geometry_t *geometry)
+{
+    geometry->base_height_um = get_servo_info(BASE_MOTOR_INDEX)->link_um;
+    geometry->upper_link_um = get_servo_info(SHOULDER_MOTOR_INDEX)->link_um;
+    geometry->forearm_link_um = get_servo_info(ELBOW_MOTOR_INDEX)->link_um;
+    geometry->gripper_link_um = get_servo_info(ARM_MOTOR_INDEX)->link_um;
+}
+
+// CORDIC in vectoring mode. Returns atan2(y, x) in millidegrees and the length of the vector.
+static int32_t __not_in_flash_func(fx_atan2)(int32_t y, int32_t x, int32_t *magnitude)
+{
+    int32_t angle = 0;
+
+    // CORDIC converges only in the right half plane, turn the vector by 180 degrees if needed.
+    if (x < 0)
+    {
+        angle = (y >= 0) ? 180000 : -180000;
+        x = -x;
+        y = -y;
+    }
+
+    for (int i = 0; i < CORDIC_ITERATIONS; i++)
+    {
+        int32_t x_shifted = x >> i;
+        int32_t y_shifted = y >> i;
+        if (y > 0)
+        {
+            x += y_shifted;
+            y -= x_shifted;
+            angle += cordic_atan_table_mdeg[i];
+        }
+        else
+        {
+            x -= y_shifted;
+            y += x_shifted;
+            angle -= cordic_atan_table_mdeg[i];
+        }
+    }
+
+    if (magnitude != NULL)
+    {
+        *magnitude = fx_mul_q16(x, CORDIC_GAIN_INVERSE_Q16);
+    }
+
+    return angle;
+}
+
+// CORDIC in rotation mode. Sine and cosine in Q16.
+static void __not_in_flash_func(fx_sin_cos)(int32_t angle_mdeg, int32_t *sin_q16, int32_t *cos_q16)
+{
+    while (angle_mdeg > 180000)
+    {
+        angle_mdeg -= 360000;
+    }
+    while (angle_mdeg < -180000)
+    {
+        angle_mdeg += 360000;
+    }
+
+    // Fold into -90..90 degrees where CORDIC converges.
+    int32_t sign = 1;
+    if (angle_mdeg > 90000)
+    {
+        angle_mdeg -= 180000;
+        sign = -1;
+    }
+    else if (angle_mdeg < -90000)
+    {
+        angle_mdeg += 180000;
+        sign = -1;
+    }
+
+    int32_t x = CORDIC_GAIN_INVERSE_Q16;
+    int32_t y = 0;
+    for (int i = 0; i < CORDIC_ITERATIONS; i++)
+    {
+        int32_t x_shifted = x >> i;
+        int32_t y_shifted = y >> i;
+        if (angle_mdeg >= 0)
+        {
+            x -= y_shifted;
+            y += x_shifted;
+            angle_mdeg -= cordic_atan_table_mdeg[i];
+        }
+        else
+        {
+            x += y_shifted;
+            y -= x_shifted;
+            angle_mdeg += cordic_atan_table_mdeg[i];
+        }
+    }
+
+    *sin_q16 = sign * y;
+    *cos_q16 = sign * x;
+}
+
+void __not_in_flash_func(arm_forward_kinematics)(const arm_joint_angles_t *joints, arm_pose_t *pose)
+{
+    arm_geometry_t geometry;
+    read_arm_geometry(&geometry);
+
+    int32_t sin_a, cos_a;
+    int32_t angle = joints->shoulder_mdeg;
+
+    fx_sin_cos(angle, &sin_a, &cos_a);
+    int32_t r = fx_mul_q16(geometry.upper_link_um, cos_a);
+    int32_t z = geometry.base_height_um + fx_mul_q16(geometry.upper_link_um, sin_a);
+
+    angle += joints->elbow_mdeg;
+    fx_sin_cos(angle, &sin_a, &cos_a);
+    r += fx_mul_q16(geometry.forearm_link_um, cos_a);
+    z += fx_mul_q16(geometry.forearm_link_um, sin_a);
+
+    angle += joints->wrist_mdeg;
+    fx_sin_cos(angle, &sin_a, &cos_a);
+    r += fx_mul_q16(geometry.gripper_link_um, cos_a);
+    z += fx_mul_q16(geometry.gripper_link_um, sin_a);
+
+    fx_sin_cos(joints->base_mdeg, &sin_a, &cos_a);
+    pose->x_um = fx_mul_q16(r, cos_a);
+    pose->y_um = fx_mul_q16(r, sin_a);
+    pose->z_um = z;
+    pose->pitch_mdeg = angle;
+}
+
+bool __not_in_flash_func(arm_inverse_kinematics)(const arm_pose_t *pose, arm_joint_angles_t *joints)
+{
+    arm_geometry_t geometry;
+    read_arm_geometry(&geometry);
+
+    int32_t r;
+    joints->base_mdeg = fx_atan2(pose->y_um, pose->x_um, &r);
+
+    // Wrist angle axis in the vertical plane of the arm.
+    int32_t sin_p, cos_p;
+    fx_sin_cos(pose->pitch_mdeg, &sin_p, &cos_p);
+    int32_t wrist_r = r - fx_mul_q16(geometry.gripper_link_um, cos_p);
+    int32_t wrist_z = pose->z_um - geometry.base_height_um - fx_mul_q16(geometry.gripper_link_um, sin_p);
+
+    // Law of cosines for the elbow. A link calibrated to 0 reaches nothing.
+    const int64_t upper = geometry.upper_link_um;
+    const int64_t forearm = geometry.forearm_link_um;
+    int64_t distance_squared = (int64_t)wrist_r * wrist_r + (int64_t)wrist_z * wrist_z;
+    int64_t numerator = distance_squared - upper * upper - forearm * forearm;
+    int64_t denominator = 2 * upper * forearm;
+    int64_t tolerance = 2 * (upper + forearm) * ARM_REACH_TOLERANCE_UM;
+    if (denominator == 0 || numerator > denominator + tolerance || numerator < -denominator - tolerance)
+    {
+        return false;
+    }
+
+    if (numerator > denominator)
+    {
+        numerator = denominator;
+    }
+    else if (numerator < -denominator)
+    {
+        numerator = -denominator;
+    }
+
+    int32_t cos_bend = (int32_t)((numerator * Q16_ONE) / denominator);
+    int32_t sin_bend = (int32_t)fx_isqrt64(((uint64_t)1 << 32) - (int64_t)cos_bend * cos_bend);
+    int32_t bend = fx_atan2(sin_bend, cos_bend, NULL);
+
+    // Elbow up: the forearm bends down, the upper link is raised by the angle it makes with the wrist line.
+    int32_t wrist_line = fx_atan2(wrist_z, wrist_r, NULL);
+    int32_t raise = fx_atan2(
+        fx_mul_q16(geometry.forearm_link_um, sin_bend),
+        geometry.upper_link_um + fx_mul_q16(geometry.forearm_link_um, cos_bend),
+        NULL);
+
+    joints->shoulder_mdeg = wrist_line + raise;
+    joints->elbow_mdeg = -bend;
+    joints->wrist_mdeg = pose->pitch_mdeg - joints->shoulder_mdeg - joints->elbow_mdeg;
+
+    return true;
+}
+
+// Converts a joint angle to servo degrees. Returns false if it is outside of the servo limits.
+static bool __not_in_flash_func(joint_to_servo_degrees)(uint8_t servo, int32_t joint_mdeg, int32_t reference_mdeg, int16_t *degrees)
+{
+    const servo_info_t *info = get_servo_info(servo);
+
+    int32_t offset = joint_mdeg - reference_mdeg;
+    if (info->is_inverted)
+    {
+        offset = -offset;
+    }
+
+    int32_t value_mdeg = (int32_t)info->degrees * 500 + offset;
+    int32_t value = (value_mdeg >= 0 ? value_mdeg + 500 : value_mdeg - 500) / 1000;
+
+    if (value < 0 || value > info->degrees ||
+        value < info->bottom_degrees_limit || value > info->top_degrees_limit)
+    {
+        return false;
+    }
+
+    *degrees = (int16_t)value;
+    return true;
+}
+
+static int32_t __not_in_flash_func(servo_degrees_to_joint)(uint8_t servo, int32_t reference_mdeg)
+{
+    const servo_info_t *info = get_servo_info(servo);
+
+    int32_t offset = (int32_t)info->current_degrees * 1000 - (int32_t)info->degrees * 500;
+    if (info->is_inverted)
+    {
+        offset = -offset;
+    }
+
+    return reference_mdeg + offset;
+}
+
+// Solves the pose and moves the joints. Nothing moves if any joint would leave its limits.
+static bool __not_in_flash_func(apply_arm_pose)(const arm_pose_t *pose)
+{
+    arm_joint_angles_t joints;
+    if (!arm_inverse_kinematics(pose, &joints))
+    {
+        return false;
+    }
+
+    int16_t base, shoulder, elbow, wrist;
+    if (!joint_to_servo_degrees(BASE_MOTOR_INDEX, joints.base_mdeg, 0, &base) ||
+        !joint_to_servo_degrees(SHOULDER_MOTOR_INDEX, joints.shoulder_mdeg, SHOULDER_REFERENCE_MDEG, &shoulder) ||
+        !joint_to_servo_degrees(ELBOW_MOTOR_INDEX, joints.elbow_mdeg, 0, &elbow) ||
+        !joint_to_servo_degrees(ARM_MOTOR_INDEX, joints.wrist_mdeg, 0, &wrist))
+    {
+        return false;
+    }
+
+    set_servo_position_in_degrees(BASE_MOTOR_INDEX, base);
+    set_servo_position_in_degrees(SHOULDER_MOTOR_INDEX, shoulder);
+    set_servo_position_in_degrees(ELBOW_MOTOR_INDEX, elbow);
+    set_servo_position_in_degrees(ARM_MOTOR_INDEX, wrist);
+
+    return true;
+}
+
+static void __not_in_flash_func(read_current_arm_pose)()
+{
+    arm_joint_angles_t joints = {
+        .base_mdeg = servo_degrees_to_joint(BASE_MOTOR_INDEX, 0),
+        .shoulder_mdeg = servo_degrees_to_joint(SHOULDER_MOTOR_INDEX, SHOULDER_REFERENCE_MDEG),
+        .elbow_mdeg = servo_degrees_to_joint(ELBOW_MOTOR_INDEX, 0),
+        .wrist_mdeg = servo_degrees_to_joint(ARM_MOTOR_INDEX, 0)
+    };
+
+    arm_forward_kinematics(&joints, &arm_current_pose);
+    arm_current_pose_valid = true;
+}
+
+static void submit_arm_motion(const arm_motion_t *motion)
+{
+    arm_motion_requests.publish(*motion);
+}
+
+// Jogs of the positioning joints would fight the motion, they stop before it starts.
+static void submit_cartesian_motion(const arm_motion_t *motion)
+{
+    motor_direction_speed_t stop[SERVOS_COUNT] = {};
+    set_servos_motor_direction_speed(stop, ARM_CARTESIAN_JOINTS_MASK);
+    submit_arm_motion(motion);
+}
+
+void init_arm_kinematics()
+{
+    arm_motion.mode = ARM_MOTION_IDLE;
+    arm_current_pose_valid = false;
+}
+
+void arm_move_to(int16_t x_mm, int16_t y_mm, int16_t z_mm, uint8_t speed_mm_s)
+{
+    arm_motion_t motion = {};
+    motion.mode = ARM_MOTION_MOVE;
+    motion.goal_x_um = (int32_t)x_mm * 1000;
+    motion.goal_y_um = (int32_t)y_mm * 1000;
+    motion.goal_z_um = (int32_t)z_mm * 1000;
+    motion.speed_um_ms = (speed_mm_s == 0) ? ARM_DEFAULT_SPEED_MM_S : speed_mm_s;
+
+    submit_cartesian_motion(&motion);
+}
+
+void arm_jog(int8_t vx_mm_s, int8_t vy_mm_s, int8_t vz_mm_s, int8_t pitch_deg_s, uint16_t timeout_ms)
+{
+    arm_motion_t motion = {};
+    motion.mode = ARM_MOTION_VELOCITY;
+    motion.velocity_x_um_ms = vx_mm_s;
+    motion.velocity_y_um_ms = vy_mm_s;
+    motion.velocity_z_um_ms = vz_mm_s;
+    motion.pitch_rate_mdeg_ms = pitch_deg_s;
+    motion.timeout_ms = timeout_ms;
+
+    submit_cartesian_motion(&motion);
+}
+
+void arm_stop_cartesian()
+{
+    arm_motion_t motion = {};
+    motion.mode = ARM_MOTION_IDLE;
+    submit_arm_motion(&motion);
+}
+
+bool arm_cartesian_active()
+{
+    return arm_motion_requests.pending() || arm_motion.mode != ARM_MOTION_IDLE;
+}
+
+void __not_in_flash_func(process_arm_kinematics)(uint16_t elapsed_ms)
+{
+    arm_motion_requests.consume(arm_motion);
+
+    if (arm_motion.mode == ARM_MOTION_IDLE)
+    {
+        // The joints can be moved one by one while idle, read the pose again on the next motion.
+        arm_current_pose_valid = false;
+        return;
+    }
+
+    if (!arm_current_pose_valid)
+    {
+        read_current_arm_pose();
+    }
+
+    arm_pose_t next = arm_current_pose;
+
+    if (arm_motion.mode == ARM_MOTION_MOVE)
+    {
+        int32_t dx = arm_motion.goal_x_um - next.x_um;
+        int32_t dy = arm_motion.goal_y_um - next.y_um;
+        int32_t dz = arm_motion.goal_z_um - next.z_um;
+
+        int32_t horizontal, distance;
+        fx_atan2(dy, dx, &horizontal);
+        fx_atan2(dz, horizontal, &distance);
+
+        int32_t step = arm_motion.speed_um_ms * elapsed_ms;
+        if (distance <= step)
+        {
+            next.x_um = arm_motion.goal_x_um;
+            next.y_um = arm_motion.goal_y_um;
+            next.z_um = arm_motion.goal_z_um;
+            arm_motion.mode = ARM_MOTION_IDLE;
+        }
+        else
+        {
+            next.x_um += (int32_t)(((int64_t)dx * step) / distance);
+            next.y_um += (int32_t)(((int64_t)dy * step) / distance);
+            next.z_um += (int32_t)(((int64_t)dz * step) / distance);
+        }
+    }
+    else if (arm_motion.mode == ARM_MOTION_VELOCITY)
+    {
+        arm_motion.timeout_ms -= elapsed_ms;
+        if (arm_motion.timeout_ms <= 0)
+        {
+            arm_motion.mode = ARM_MOTION_IDLE;
+            return;
+        }
+
+        next.x_um += arm_motion.velocity_x_um_ms * elapsed_ms;
+        next.y_um += arm_motion.velocity_y_um_ms * elapsed_ms;
+        next.z_um += arm_motion.velocity_z_um_ms * elapsed_ms;
+        next.pitch_mdeg += arm_motion.pitch_rate_mdeg_ms * elapsed_ms;
+    }
+
+    if (!apply_arm_pose(&next))
+    {
+        // Out of reach or a joint limit. Stop at the last reachable pose.
+        arm_motion.mode = ARM_MOTION_IDLE;
+        return;
+    }
+
+    arm_current_pose = next;
+}
@@ -0,0 +1,69 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef ARM_KINEMATICS_HPP
+#define ARM_KINEMATICS_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// Speed of a Cartesian move when the command does not give one, in mm/s.
+#define ARM_DEFAULT_SPEED_MM_S  50
+
+// Pose of the gripper tip. Fixed-point: micrometers and millidegrees.
+// The origin is on the base plane under the base axis, x points forward at base center.
+typedef struct
+{
+    int32_t x_um;
+    int32_t y_um;
+    int32_t z_um;
+
+    // Angle of the gripper to the horizontal plane. Negative points down.
+    int32_t pitch_mdeg;
+} arm_pose_t;
+
+// Joint angles of the positioning joints in millidegrees.
+// Reference pose (all servos at center): base forward, upper link vertical,
+// forearm and gripper straight in line with it.
+typedef struct
+{
+    // Rotation around the vertical axis, 0 is forward.
+    int32_t base_mdeg;
+
+    // Elevation of the upper link from the horizontal plane.
+    int32_t shoulder_mdeg;
+
+    // Bend of the forearm relative to the upper link, 0 is straight.
+    int32_t elbow_mdeg;
+
+    // Bend of the gripper relative to the forearm, 0 is straight.
+    int32_t wrist_mdeg;
+} arm_joint_angles_t;
+
+void init_arm_kinematics();
+
+// The link lengths are the calibration of the positioning joints, see SERVO_CALIBRATION_LINK_UM.
+void arm_forward_kinematics(const arm_joint_angles_t *joints, arm_pose_t *pose);
+
+// Returns false if the pose is out of reach.
+bool arm_inverse_kinematics(const arm_pose_t *pose, arm_joint_angles_t *joints);
+
+// Moves the gripper tip on a straight line to the given point. The pitch is kept.
+// Speed in mm/s, 0 uses ARM_DEFAULT_SPEED_MM_S. A move or a jog stops the positioning joints
+// jogging on their own.
+void arm_move_to(int16_t x_mm, int16_t y_mm, int16_t z_mm, uint8_t speed_mm_s);
+
+// Moves the gripper tip with constant velocity until the timeout expires.
+// Velocity in mm/s, pitch rate in degrees/s, timeout in milliseconds.
+void arm_jog(int8_t vx_mm_s, int8_t vy_mm_s, int8_t vz_mm_s, int8_t pitch_deg_s, uint16_t timeout_ms);
+
+// Stops any Cartesian motion. The joints stay where they are.
+void arm_stop_cartesian();
+
+// True while the control tick follows a move or a jog, or one submitted is not taken over yet.
+// Main loop only, with the interrupts off for an answer the tick cannot change meanwhile.
+bool arm_cartesian_active();
+
+// Control tick. Called from the servo timer inside a PWM update group.
+void process_arm_kinematics(uint16_t elapsed_ms);
+
+#endif // ARM_KINEMATICS_HPP
@@ -0,0 +1,303 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/sync.h"
+#include "arm_kinematics.hpp"
+#include "benchmark.hpp"
+#include "commands_protocol.hpp"
+#include "cycle_counter.hpp"
+#include "dc_motors_control.hpp"
+#include "motion_recorder.hpp"
+#include "pico_native_pwm.hpp"
+#include "servo_control.hpp"
+#include "spi_frame_parser.hpp"
+#include "spi_transport.hpp"
+
+// Pulse width the PWM case stages on every channel before the levels are put back.
+#define BENCHMARK_PWM_PULSE_US 1500
+
+// The tick cases run on moving actuators, each run from the same state. The servos at full speed
+// move a degree every tick, the DC motors drive at half speed.
+#define BENCHMARK_SERVO_SPEED 100
+#define BENCHMARK_DC_MOTOR_SPEED 50
+#define BENCHMARK_MOVE_TIME_MS 1000
+
+static const char *benchmark_names[BENCHMARK_CASES_COUNT] = {
+    "frame decode",
+    "receive path",
+    "servo tick",
+    "dc motors tick",
+    "pwm update",
+    "command burst",
+};
+
+// A command with a sequence number and an execute time, most of what the parser takes apart.
+static const uint8_t benchmark_extended_frame[] = {
+    COMMAND_EXTENSION_FLAG | GET_POWER_STATUS_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    COMMAND_EXTENSION_SEQUENCE | COMMAND_EXTENSION_EXECUTE_AT,
+    0x12, 0x34, 0x00, 0x01, 0x02, 0x03,
+    0x00, 0x00, 0x10, 0x00,
+};
+
+// A plain command, queued by the receive path like any other.
+static const uint8_t benchmark_plain_frame[SPI_FRAME_COMMAND_SIZE] = { GET_POWER_STATUS_COMMAND };
+
+// Stop commands as one transfer. Direction, speed and timeout 0, they leave everything stopped.
+static const uint8_t benchmark_burst[BENCHMARK_BURST_COMMANDS * SPI_FRAME_COMMAND_SIZE] = {
+    LEFT_MOTOR_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    RIGHT_MOTOR_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    BASE_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    SHOULDER_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    ELBOW_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    ARM_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    WRIST_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+    GRIPPER_MOTOR_DIRECTION_COMMAND, 0, 0, 0, 0, 0, 0, 0,
+};
+
+bool benchmark_active = false;
+
+spi_frame_parser_t benchmark_parser;
+uint16_t benchmark_pwm_levels[PWMS_COUNT];
+
+// State of the control ticks before a run, put back after it.
+servo_tick_state_t benchmark_servo_state;
+dc_motors_tick_state_t benchmark_dc_motors_state;
+
+// Cycles of two back to back counter reads, taken off every run.
+uint32_t benchmark_overhead_cycles = 0;
+
+static void __not_in_flash_func(benchmark_case_body)(benchmark_case_t which)
+{
+    received_command_t received;
+
+    switch (which)
+    {
+    case BENCHMARK_FRAME_DECODE:
+        for (uint32_t i = 0; i < sizeof(benchmark_extended_frame); i++)
+        {
+            spi_frame_parser_feed(&benchmark_parser, benchmark_extended_frame[i], 0, &received);
+        }
+        break;
+
+    case BENCHMARK_RECEIVE_PATH:
+        spi_receive_bytes(benchmark_plain_frame, sizeof(benchmark_plain_frame));
+        break;
+
+    case BENCHMARK_SERVO_TICK:
+        process_servo_tick();
+        break;
+
+    case BENCHMARK_DC_MOTORS_TICK:
+        process_dc_motors_tick();
+        break;
+
+    case BENCHMARK_COMMAND_BURST:
+        spi_receive_bytes(benchmark_burst, sizeof(benchmark_burst));
+        for (int i = 0; i < BENCHMARK_BURST_COMMANDS; i++)
+        {
+            process_received_command();
+        }
+        break;
+
+    case BENCHMARK_PWM_UPDATE:
+        begin_pwm_update();
+        for (uint8_t i = 0; i < PWMS_COUNT; i++)
+        {
+            set_pwm_pulse_width_us(i, BENCHMARK_PWM_PULSE_US);
+        }
+        for (uint8_t i = 0; i < PWMS_COUNT; i++)
+        {
+            set_pwm_level(i, benchmark_pwm_levels[i]);
+        }
+        end_pwm_update();
+        break;
+
+    default:
+        break;
+    }
+}
+
+// The tick cases start from moving setpoints. Their outputs are only staged, the levels go back
+// before the update commits.
+static void __not_in_flash_func(benchmark_case_setup)(benchmark_case_t which)
+{
+    if (which == BENCHMARK_SERVO_TICK)
+    {
+        get_servo_tick_state(&benchmark_servo_state);
+        servo_tick_state_t moving = benchmark_servo_state;
+        for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+        {
+            moving.speeds[i].direction = (i % 2 == 0) ? 1 : -1;
+            moving.speeds[i].speed = BENCHMARK_SERVO_SPEED;
+            moving.speeds[i].elapsed_time = BENCHMARK_MOVE_TIME_MS;
+            moving.speeds[i].timeout = BENCHMARK_MOVE_TIME_MS;
+        }
+        set_servo_tick_state(&moving);
+        begin_pwm_update();
+    }
+
+    if (which == BENCHMARK_DC_MOTORS_TICK)
+    {
+        get_dc_motors_tick_state(&benchmark_dc_motors_state);
+        dc_motors_tick_state_t moving = benchmark_dc_motors_state;
+        moving.left = { .direction = 1, .speed = BENCHMARK_DC_MOTOR_SPEED, .elapsed_time = 0, .timeout = BENCHMARK_MOVE_TIME_MS };
+        moving.right = { .direction = -1, .speed = BENCHMARK_DC_MOTOR_SPEED, .elapsed_time = 0, .timeout = BENCHMARK_MOVE_TIME_MS };
+        set_dc_motors_tick_state(&moving);
+        begin_pwm_update();
+    }
+}
+
+static void __not_in_flash_func(benchmark_case_teardown)(benchmark_case_t which)
+{
+    if (which != BENCHMARK_SERVO_TICK && which != BENCHMARK_DC_MOTORS_TICK)
+    {
+        return;
+    }
+
+    for (uint8_t i = 0; i < PWMS_COUNT; i++)
+    {
+        set_pwm_level(i, benchmark_pwm_levels[i]);
+    }
+    end_pwm_update();
+
+    if (which == BENCHMARK_SERVO_TICK)
+    {
+        set_servo_tick_state(&benchmark_servo_state);
+    }
+    else
+    {
+        // The motors are held stopped, the direction pins the run set go back low. The PWM
+        // levels never left zero, so the bridges were not driven.
+        set_dc_motors_tick_state(&benchmark_dc_motors_state);
+        dc_motors_emergency_stop();
+    }
+}
+
+// Returns false without running if a command from the host waits in the queue the case goes through.
+static bool __not_in_flash_func(benchmark_once)(benchmark_case_t which, uint32_t *cycles)
+{
+    spi_frame_parser_reset(&benchmark_parser);
+    for (uint8_t i = 0; i < PWMS_COUNT; i++)
+    {
+        benchmark_pwm_levels[i] = get_pwm_level(i);
+    }
+
+    bool uses_queue = (which == BENCHMARK_RECEIVE_PATH || which == BENCHMARK_COMMAND_BURST);
+    uint32_t interrupts = save_and_disable_interrupts();
+    spi_transport_stats_t transport;
+    spi_get_transport_stats(&transport);
+    if (uses_queue && transport.queued != 0)
+    {
+        restore_interrupts(interrupts);
+        return false;
+    }
+
+    benchmark_case_setup(which);
+    uint32_t started = cycle_counter_read();
+    benchmark_case_body(which);
+    uint32_t elapsed = cycle_counter_read() - started;
+    benchmark_case_teardown(which);
+
+    // Taken out before the interrupts can queue anything behind it.
+    if (which == BENCHMARK_RECEIVE_PATH)
+    {
+        spi_get_received_command();
+    }
+    restore_interrupts(interrupts);
+
+    *cycles = (elapsed > benchmark_overhead_cycles) ? elapsed - benchmark_overhead_cycles : 0;
+    return true;
+}
+
+static void benchmark_hold_actuators()
+{
+    motor_direction_speed_t stop = {};
+    motor_direction_speed_t joints_stop[SERVOS_COUNT] = {};
+    set_dc_motors_speed(stop, stop);
+    set_servos_motor_direction_speed(joints_stop, (1u << SERVOS_COUNT) - 1);
+    arm_stop_cartesian();
+    motion_stop_playback();
+}
+
+static void benchmark_measure_overhead()
+{
+    benchmark_overhead_cycles = UINT32_MAX;
+    for (int i = 0; i < 16; i++)
+    {
+        uint32_t started = cycle_counter_read();
+        uint32_t cycles = cycle_counter_read() - started;
+        if (cycles < benchmark_overhead_cycles)
+        {
+            benchmark_overhead_cycles = cycles;
+        }
+    }
+}
+
+void benchmark_run(benchmark_case_t which, uint32_t iterations, benchmark_stats_t *stats)
+{
+    benchmark_active = true;
+    benchmark_hold_actuators();
+    motion_recorder_suspend(true);
+
+    cycle_counter_init();
+    benchmark_measure_overhead();
+
+    stats->iterations = 0;
+    stats->min_cycles = UINT32_MAX;
+    stats->max_cycles = 0;
+    stats->total_cycles = 0;
+    uint32_t started_us = time_us_32();
+    while (stats->iterations < iterations && time_us_32() - started_us < BENCHMARK_CASE_MAX_US)
+    {
+        uint32_t cycles;
+        if (!benchmark_once(which, &cycles))
+        {
+            break;
+        }
+
+        stats->iterations++;
+        stats->total_cycles += cycles;
+        if (cycles < stats->min_cycles)
+        {
+            stats->min_cycles = cycles;
+        }
+        if (cycles > stats->max_cycles)
+        {
+            stats->max_cycles = cycles;
+        }
+    }
+
+    if (stats->iterations == 0)
+    {
+        stats->min_cycles = 0;
+    }
+
+    motion_recorder_suspend(false);
+    benchmark_active = false;
+}
+
+bool benchmark_running()
+{
+    return benchmark_active;
+}
+
+void benchmark_report(uint32_t iterations)
+{
+    uint32_t clock_mhz = clock_get_hz(clk_sys) / 1000000;
+    printf("Benchmark on %s at %lu MHz, up to %lu runs each, cycles min/mean/max, runs\n",
+        CYCLE_COUNTER_CORE, (unsigned long)clock_mhz, (unsigned long)iterations);
+
+    for (int i = 0; i < BENCHMARK_CASES_COUNT; i++)
+    {
+        benchmark_stats_t stats;
+        benchmark_run((benchmark_case_t)i, iterations, &stats);
+
+        uint32_t mean_cycles = (stats.iterations != 0) ? (uint32_t)(stats.total_cycles / stats.iterations) : 0;
+        uint32_t mean_ns = (clock_mhz != 0) ? mean_cycles * 1000 / clock_mhz : 0;
+        printf("  %-16s %6lu %6lu %6lu  %lu ns  %lu\n", benchmark_names[i], (unsigned long)stats.min_cycles,
+            (unsigned long)mean_cycles, (unsigned long)stats.max_cycles, (unsigned long)mean_ns,
+            (unsigned long)stats.iterations);
+    }
+}
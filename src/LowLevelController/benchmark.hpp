@@ -0,0 +1,50 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+#include <stdint.h>
+#include "common_types.hpp"
+
+// 1 builds the benchmark image: the firmware times its hot paths once at boot, prints the numbers
+// on the stdio UART and then runs as usual. Build it for each core type to compare them, see build.ps1.
+#ifndef BENCHMARK_IMAGE
+#define BENCHMARK_IMAGE 0
+#endif
+
+// Timed runs of each case in the benchmark image and by default for BENCHMARK_COMMAND.
+// More runs than the maximum are cut.
+#define BENCHMARK_ITERATIONS 1000
+#define BENCHMARK_MAX_ITERATIONS 10000
+
+// A case stops after this long with runs left, so the main loop is not kept away for long.
+#define BENCHMARK_CASE_MAX_US 20000
+
+// Stop commands in each run of BENCHMARK_COMMAND_BURST, for both DC motors and the joints.
+#define BENCHMARK_BURST_COMMANDS 8
+
+// Core clock cycles of the runs of one case, without the cost of reading the counter.
+typedef struct
+{
+    uint32_t iterations;
+    uint32_t min_cycles;
+    uint32_t max_cycles;
+    uint64_t total_cycles;
+} benchmark_stats_t;
+
+// Runs one case, each run with interrupts disabled for one pass of the case only. The DC motors,
+// the joints, the cartesian motion and the playback are stopped first, the servos keep their
+// positions, and the motion recorder is suspended. The tick cases run each time from moving
+// setpoints, then the tick state and the PWM levels are put back before the update commits.
+// The command burst goes through the receive path, the commands queue and the main loop dispatcher,
+// one command at a time. It and the receive path take their commands back out, so they only run
+// with the queue empty and stop at a command from the host. stats->iterations tells the runs done.
+void benchmark_run(benchmark_case_t which, uint32_t iterations, benchmark_stats_t *stats);
+
+// True while benchmark_run() runs. The dispatcher then ignores BENCHMARK_COMMAND.
+bool benchmark_running();
+
+// Runs all cases and prints a line for each, with the core type and the clock.
+void benchmark_report(uint32_t iterations);
+
+#endif // BENCHMARK_HPP
@@ -0,0 +1,28 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "boot_profile.hpp"
+
+// The timer starts counting at reset, so the stamps include the bootrom and the bootloader.
+uint32_t boot_stage_times_us[BOOT_STAGES_COUNT];
+
+void boot_profile_mark(boot_stage_t stage)
+{
+    if (stage >= BOOT_STAGES_COUNT || boot_stage_times_us[stage] != 0)
+    {
+        return;
+    }
+
+    boot_stage_times_us[stage] = time_us_32();
+}
+
+uint32_t boot_profile_get(boot_stage_t stage)
+{
+    if (stage >= BOOT_STAGES_COUNT)
+    {
+        return 0;
+    }
+
+    return boot_stage_times_us[stage];
+}
@@ -0,0 +1,21 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef BOOT_PROFILE_HPP
+#define BOOT_PROFILE_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+
+// 1 brings the actuators to a safe state and the SPI transport up first, so commands are accepted
+// as soon as possible after a reset. stdio, the logger and the LED are initialized after that.
+// 0 keeps the original serial init order.
+#define BOOT_FAST_START 1
+
+// Records the time of a boot stage in microseconds since reset. Only the first mark of a stage is kept.
+void boot_profile_mark(boot_stage_t stage);
+
+// Time of the stage in microseconds since reset, 0 if the stage was not reached yet.
+uint32_t boot_profile_get(boot_stage_t stage);
+
+#endif // BOOT_PROFILE_HPP
@@ -1,7 +1,12 @@
 # Copyright © Svetoslav Paregov. All rights reserved.
 param(
     [switch]$SkipBuild,
-    [switch]$UploadToCar
+    [switch]$UploadToCar,
+    [int]$BoardAddress = 0,
+    [switch]$SharedChipSelect,
+    [switch]$PioSpi,
+    [switch]$RiscV,
+    [switch]$Benchmark
 )
 
 $currentFolder = Get-Location
@@ -17,7 +22,9 @@ try
 
         cd "build"
         Get-ChildItem | Remove-Item -Force -Recurse -ErrorAction Continue
-        cmake ..
+        # The Hazard3 RISC-V cores instead of the Cortex-M33 ones.
+        $platform = if ($RiscV) { "rp2350-riscv" } else { "rp2350-arm-s" }
+        cmake .. "-DBOARD_ADDRESS=$BoardAddress" "-DBOARD_SHARED_CHIP_SELECT=$([int]$SharedChipSelect.IsPresent)" "-DSPI_TRANSPORT_USE_PIO=$([int]$PioSpi.IsPresent)" "-DPICO_PLATFORM=$platform" "-DBENCHMARK_IMAGE=$([int]$Benchmark.IsPresent)"
         ninja
 
         if ($LASTEXITCODE -ne 0)
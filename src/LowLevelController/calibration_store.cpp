@@ -0,0 +1,191 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <string.h> // For memcpy, memset
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "calibration_store.hpp"
+#include "crc32.hpp"
+
+// 'CAL1'. Change it when the record layout changes, old records are then ignored.
+#define CALIBRATION_RECORD_MAGIC 0x314C4143
+
+#define CALIBRATION_STORE_SIZE (CALIBRATION_STORE_SECTORS * FLASH_SECTOR_SIZE)
+#define CALIBRATION_STORE_OFFSET (PICO_FLASH_SIZE_BYTES - CALIBRATION_STORE_SIZE)
+#define CALIBRATION_STORE_SLOTS (CALIBRATION_STORE_SIZE / CALIBRATION_STORE_SLOT_SIZE)
+#define CALIBRATION_SLOTS_PER_SECTOR (FLASH_SECTOR_SIZE / CALIBRATION_STORE_SLOT_SIZE)
+
+#define CALIBRATION_FLASH_TIMEOUT_MS 100
+
+// Layout of one slot in flash.
+typedef struct
+{
+    uint32_t magic;
+
+    // Increments with every save. The highest valid one is the current record.
+    uint32_t sequence;
+
+    // Size of the data in bytes.
+    uint32_t size;
+
+    // CRC32 over sequence, size and data.
+    uint32_t crc;
+
+    uint8_t data[CALIBRATION_STORE_MAX_DATA_SIZE];
+} calibration_record_t;
+
+static_assert(sizeof(calibration_record_t) == CALIBRATION_STORE_SLOT_SIZE, "Record must fill exactly one slot");
+static_assert(CALIBRATION_STORE_SLOT_SIZE % FLASH_PAGE_SIZE == 0, "Slot must be a whole number of pages");
+
+// Slot with the newest record, -1 if there is none.
+int32_t calibration_current_slot = -1;
+uint32_t calibration_current_sequence = 0;
+
+// Record prepared for programming. Flash is programmed from RAM.
+calibration_record_t calibration_write_record;
+uint32_t calibration_write_slot = 0;
+
+static uint32_t calibration_record_crc(const calibration_record_t *record)
+{
+    uint32_t crc = crc32_update(0, (const uint8_t *)&record->sequence, sizeof(record->sequence));
+    crc = crc32_update(crc, (const uint8_t *)&record->size, sizeof(record->size));
+    return crc32_update(crc, record->data, record->size);
+}
+
+static const calibration_record_t *calibration_slot(uint32_t slot)
+{
+    return (const calibration_record_t *)(XIP_BASE + CALIBRATION_STORE_OFFSET + slot * CALIBRATION_STORE_SLOT_SIZE);
+}
+
+static bool is_valid_record(const calibration_record_t *record)
+{
+    return record->magic == CALIBRATION_RECORD_MAGIC &&
+           record->size <= CALIBRATION_STORE_MAX_DATA_SIZE &&
+           record->crc == calibration_record_crc(record);
+}
+
+void init_calibration_store()
+{
+    calibration_current_slot = -1;
+    calibration_current_sequence = 0;
+
+    // Only the newest candidate gets the CRC check, so a full store does not slow down the boot.
+    // If it fails, the next newest one below it is tried.
+    uint32_t sequence_limit = 0xFFFFFFFF;
+    while (calibration_current_slot < 0)
+    {
+        int32_t candidate_slot = -1;
+        uint32_t candidate_sequence = 0;
+        for (uint32_t slot = 0; slot < CALIBRATION_STORE_SLOTS; slot++)
+        {
+            const calibration_record_t *record = calibration_slot(slot);
+            if (record->magic == CALIBRATION_RECORD_MAGIC &&
+                record->size <= CALIBRATION_STORE_MAX_DATA_SIZE &&
+                record->sequence < sequence_limit &&
+                (candidate_slot < 0 || record->sequence > candidate_sequence))
+            {
+                candidate_slot = slot;
+                candidate_sequence = record->sequence;
+            }
+        }
+
+        if (candidate_slot < 0)
+        {
+            break;
+        }
+
+        if (is_valid_record(calibration_slot(candidate_slot)))
+        {
+            calibration_current_slot = candidate_slot;
+            calibration_current_sequence = candidate_sequence;
+        }
+
+        sequence_limit = candidate_sequence;
+    }
+}
+
+bool calibration_store_load(void *data, uint32_t size)
+{
+    if (calibration_current_slot < 0)
+    {
+        return false;
+    }
+
+    const calibration_record_t *record = calibration_slot(calibration_current_slot);
+    if (record->size != size)
+    {
+        // Written by a firmware with a different layout.
+        return false;
+    }
+
+    memcpy(data, record->data, size);
+    return true;
+}
+
+// Runs with the other core and the interrupts held off by flash_safe_execute().
+static void calibration_flash_write(void *param)
+{
+    (void)param;
+    uint32_t offset = CALIBRATION_STORE_OFFSET + calibration_write_slot * CALIBRATION_STORE_SLOT_SIZE;
+
+    // Entering a sector, drop the oldest records it holds. The newest record is always in another sector.
+    if ((calibration_write_slot % CALIBRATION_SLOTS_PER_SECTOR) == 0)
+    {
+        flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    }
+
+    flash_range_program(offset, (const uint8_t *)&calibration_write_record, CALIBRATION_STORE_SLOT_SIZE);
+}
+
+bool calibration_store_save(const void *data, uint32_t size)
+{
+    if (size > CALIBRATION_STORE_MAX_DATA_SIZE)
+    {
+        return false;
+    }
+
+    memset(&calibration_write_record, 0xFF, sizeof(calibration_write_record));
+    calibration_write_record.magic = CALIBRATION_RECORD_MAGIC;
+    calibration_write_record.sequence = calibration_current_sequence + 1;
+    calibration_write_record.size = size;
+    memcpy(calibration_write_record.data, data, size);
+    calibration_write_record.crc = calibration_record_crc(&calibration_write_record);
+
+    calibration_write_slot = (calibration_current_slot < 0) ? 0 : (calibration_current_slot + 1) % CALIBRATION_STORE_SLOTS;
+
+    // A slot in the middle of a sector must still be erased. If it is not, the sector was left
+    // by an interrupted write, so start over with the next sector.
+    if ((calibration_write_slot % CALIBRATION_SLOTS_PER_SECTOR) != 0)
+    {
+        const uint32_t *words = (const uint32_t *)calibration_slot(calibration_write_slot);
+        for (uint32_t i = 0; i < CALIBRATION_STORE_SLOT_SIZE / sizeof(uint32_t); i++)
+        {
+            if (words[i] != 0xFFFFFFFF)
+            {
+                calibration_write_slot = (calibration_write_slot / CALIBRATION_SLOTS_PER_SECTOR + 1) * CALIBRATION_SLOTS_PER_SECTOR;
+                calibration_write_slot %= CALIBRATION_STORE_SLOTS;
+                break;
+            }
+        }
+    }
+
+    if (flash_safe_execute(calibration_flash_write, NULL, CALIBRATION_FLASH_TIMEOUT_MS) != PICO_OK)
+    {
+        return false;
+    }
+
+    if (!is_valid_record(calibration_slot(calibration_write_slot)))
+    {
+        return false;
+    }
+
+    calibration_current_slot = calibration_write_slot;
+    calibration_current_sequence = calibration_write_record.sequence;
+    return true;
+}
+
+uint32_t calibration_store_sequence()
+{
+    return calibration_current_sequence;
+}
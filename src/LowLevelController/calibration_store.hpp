@@ -0,0 +1,30 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef CALIBRATION_STORE_HPP
+#define CALIBRATION_STORE_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// The store uses the last sectors of the flash. They are kept out of the image by the linker script.
+#define CALIBRATION_STORE_SECTORS 4
+
+// Each record takes one slot. Records are written to the next free slot, so the sectors wear evenly.
+#define CALIBRATION_STORE_SLOT_SIZE 1024
+
+// Largest data that fits in a slot together with the record header.
+#define CALIBRATION_STORE_MAX_DATA_SIZE (CALIBRATION_STORE_SLOT_SIZE - 16)
+
+// Finds the newest valid record. Reads straight from the XIP mapped flash.
+void init_calibration_store();
+
+// Copies the newest record into data. Returns false if there is no valid record of this size.
+bool calibration_store_load(void *data, uint32_t size);
+
+// Writes a new record. Interrupts are held off while the flash is busy.
+bool calibration_store_save(const void *data, uint32_t size);
+
+// Sequence number of the newest record, 0 if there is none.
+uint32_t calibration_store_sequence();
+
+#endif // CALIBRATION_STORE_HPP
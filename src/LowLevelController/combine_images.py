@@ -0,0 +1,34 @@
+# Copyright © Svetoslav Paregov. All rights reserved.
+#
+# Joins the installer and the firmware into the image the bootloader's UART update writes.
+# The bootloader writes it from the end of its own region: the installer, padded with erased
+# bytes to its region (UPDATE_INSTALLER_SIZE), then the firmware for slot A.
+# Run by the build after linking, or by hand: python combine_images.py <installer.bin> <firmware.bin> <installer size> <out.bin>
+# The SPI update streams the firmware image alone, the installer is never rewritten by it.
+
+import sys
+
+
+def main():
+    if len(sys.argv) != 5:
+        print("Usage: combine_images.py <installer.bin> <firmware.bin> <installer size> <out.bin>")
+        return 2
+
+    installer_path, firmware_path, installer_size, out_path = sys.argv[1], sys.argv[2], int(sys.argv[3], 0), sys.argv[4]
+    with open(installer_path, "rb") as file:
+        installer = file.read()
+    with open(firmware_path, "rb") as file:
+        firmware = file.read()
+
+    if len(installer) > installer_size:
+        print(f"error: installer is {len(installer)} bytes, its region {installer_size}")
+        return 1
+
+    with open(out_path, "wb") as file:
+        file.write(installer + b"\xff" * (installer_size - len(installer)) + firmware)
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,86 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "command_scheduler.hpp"
+
+// Sorted by execution time, earliest first.
+received_command_t scheduled_commands[SCHEDULED_COMMANDS_SIZE];
+uint32_t scheduled_commands_count = 0;
+
+// Times wrap every 71 minutes. All scheduled times are within a minute of now, so the sign of the
+// difference orders them.
+static bool is_before(uint32_t a_us, uint32_t b_us)
+{
+    return (int32_t)(a_us - b_us) < 0;
+}
+
+bool schedule_command(const received_command_t &received, uint32_t now_us)
+{
+    if (scheduled_commands_count == SCHEDULED_COMMANDS_SIZE ||
+        (int32_t)(received.execute_at_us - now_us) > SCHEDULE_MAX_AHEAD_US)
+    {
+        return false;
+    }
+
+    // After all commands due at the same time or earlier.
+    uint32_t index = scheduled_commands_count;
+    while (index > 0 && is_before(received.execute_at_us, scheduled_commands[index - 1].execute_at_us))
+    {
+        scheduled_commands[index] = scheduled_commands[index - 1];
+        index--;
+    }
+
+    scheduled_commands[index] = received;
+    scheduled_commands_count++;
+    return true;
+}
+
+bool take_due_command(uint32_t now_us, received_command_t *received)
+{
+    if (scheduled_commands_count == 0 || is_before(now_us, scheduled_commands[0].execute_at_us))
+    {
+        return false;
+    }
+
+    *received = scheduled_commands[0];
+    scheduled_commands_count--;
+    for (uint32_t i = 0; i < scheduled_commands_count; i++)
+    {
+        scheduled_commands[i] = scheduled_commands[i + 1];
+    }
+
+    return true;
+}
+
+uint32_t count_scheduled_commands()
+{
+    return scheduled_commands_count;
+}
+
+bool next_scheduled_command_us(uint32_t *execute_at_us)
+{
+    if (scheduled_commands_count == 0)
+    {
+        return false;
+    }
+
+    *execute_at_us = scheduled_commands[0].execute_at_us;
+    return true;
+}
+
+uint32_t remove_scheduled_commands(bool (*predicate)(const received_command_t &received))
+{
+    uint32_t kept = 0;
+    for (uint32_t i = 0; i < scheduled_commands_count; i++)
+    {
+        if (!predicate(scheduled_commands[i]))
+        {
+            scheduled_commands[kept++] = scheduled_commands[i];
+        }
+    }
+
+    uint32_t removed = scheduled_commands_count - kept;
+    scheduled_commands_count = kept;
+    return removed;
+}
@@ -0,0 +1,35 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef COMMAND_SCHEDULER_HPP
+#define COMMAND_SCHEDULER_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+
+// Commands with COMMAND_EXTENSION_EXECUTE_AT, held in time order until they are due.
+// Owned by the main loop. Commands due at the same time keep the order they were received in,
+// so the main loop applies them in the same pass and the control ticks take them over within
+// one tick period.
+
+#define SCHEDULED_COMMANDS_SIZE 16
+
+// Times further ahead are taken as a host clock that is not in sync.
+#define SCHEDULE_MAX_AHEAD_US 60000000
+
+// Returns false if the queue is full or the time is too far ahead.
+bool schedule_command(const received_command_t &received, uint32_t now_us);
+
+// Takes the earliest command if it is due.
+bool take_due_command(uint32_t now_us, received_command_t *received);
+
+// Commands waiting now.
+uint32_t count_scheduled_commands();
+
+// Time of the earliest command, false if none is scheduled.
+bool next_scheduled_command_us(uint32_t *execute_at_us);
+
+// Removes the commands the predicate matches, returns how many.
+uint32_t remove_scheduled_commands(bool (*predicate)(const received_command_t &received));
+
+#endif // COMMAND_SCHEDULER_HPP
@@ -5,9 +5,23 @@
 #include "pico/stdlib.h"
 #include "uart_transport.hpp"
 #include "spi_transport.hpp"
+#include "arm_kinematics.hpp"
 #include "commands_protocol.hpp"
 #include "dc_motors_control.hpp"
+#include "motion_recorder.hpp"
 #include "servo_control.hpp"
+#include "boot_profile.hpp"
+#include "calibration_store.hpp"
+#include "link_training.hpp"
+#include "power_monitor.hpp"
+#include "emergency_stop.hpp"
+#include "command_scheduler.hpp"
+#include "update_agent.hpp"
+#include "irq_tiers.hpp"
+#include "register_map.hpp"
+#include "benchmark.hpp"
+#include "cycle_counter.hpp"
+#include "hardware/clocks.h"
 #include "common_types.hpp"
 
 void init_commands_protocol()
@@ -15,21 +29,413 @@ void init_commands_protocol()
 
 }
 
-void process_commands_protocol()
+static void write_int32_be(uint8_t *data, int32_t value)
+{
+    data[0] = (uint8_t)((uint32_t)value >> 24);
+    data[1] = (uint8_t)((uint32_t)value >> 16);
+    data[2] = (uint8_t)((uint32_t)value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static int32_t read_int32_be(const uint8_t *data)
+{
+    return (int32_t)((uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3]);
+}
+
+// Response data: servo, field, status (1 applied, 0 rejected), value (big-endian int32).
+static void send_servo_calibration_response(uint8_t servo, uint8_t field, bool status)
+{
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = SERVO_CALIBRATION_RESPONSE;
+    response.data[0] = servo;
+    response.data[1] = field;
+
+    int32_t value = 0;
+    response.data[2] = (status && get_servo_calibration_field(servo, (servo_calibration_field_t)field, &value)) ? 1 : 0;
+    write_int32_be(&response.data[3], value);
+
+    spi_send_response(response);
+}
+
+// Response data: servo, row, status, min percentage, max percentage, min time (big-endian uint16).
+static void send_servo_speed_profile_response(uint8_t servo, uint8_t row, bool status)
 {
-    uint32_t buffer_size = 512;
-    char buffer[buffer_size];
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = SERVO_SPEED_PROFILE_RESPONSE;
+    response.data[0] = servo;
+    response.data[1] = row;
 
-    command_8_bytes_t command = spi_get_received_command();
+    servo_speed_settings_t settings = {};
+    response.data[2] = (status && get_servo_speed_profile(servo, row, &settings)) ? 1 : 0;
+    response.data[3] = settings.min_percentage;
+    response.data[4] = settings.max_percentage;
+    response.data[5] = (uint8_t)(settings.min_time_ms >> 8);
+    response.data[6] = (uint8_t)settings.min_time_ms;
+
+    spi_send_response(response);
+}
+
+// One response per stage. Response data: stage, reached, time since reset in us (big-endian uint32).
+static void send_boot_profile_response(uint8_t stage)
+{
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = BOOT_PROFILE_RESPONSE;
+    response.data[0] = stage;
+
+    uint32_t time_us = boot_profile_get((boot_stage_t)stage);
+    response.data[1] = (time_us != 0) ? 1 : 0;
+    write_int32_be(&response.data[2], (int32_t)time_us);
+
+    spi_send_response(response);
+}
+
+// Next stage of a GET_BOOT_PROFILE_COMMAND to answer, BOOT_STAGES_COUNT when all went out.
+// Sent as room frees up in the responses queue, see send_pending_boot_profile_responses().
+uint8_t boot_profile_next_stage = BOOT_STAGES_COUNT;
+
+// Response data: mode, recording, length in bytes (big-endian uint16), length in ticks (big-endian uint24).
+static void send_motion_status_response()
+{
+    motion_status_t status;
+    get_motion_status(&status);
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = MOTION_STATUS_RESPONSE;
+    response.data[0] = (uint8_t)status.mode;
+    response.data[1] = status.recording_id;
+    response.data[2] = (uint8_t)(status.length >> 8);
+    response.data[3] = (uint8_t)status.length;
+    response.data[4] = (uint8_t)(status.ticks >> 16);
+    response.data[5] = (uint8_t)(status.ticks >> 8);
+    response.data[6] = (uint8_t)status.ticks;
+
+    spi_send_response(response);
+}
+
+// Response data: status, sequence of the newest stored record (big-endian uint32).
+static void send_calibration_saved_response(bool status)
+{
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = CALIBRATION_SAVED_RESPONSE;
+    response.data[0] = status ? 1 : 0;
+    write_int32_be(&response.data[1], (int32_t)calibration_store_sequence());
+
+    spi_send_response(response);
+}
+
+// Echoes the sequence and host timestamp, then reports when the command was applied.
+// Echo data: sequence (big-endian uint16), host timestamp (big-endian uint32), applied flag.
+// Applied data: sequence (big-endian uint16), apply time in us (big-endian uint32),
+// time in the receive queue in 100us units (saturated).
+static void send_command_sequence_responses(const received_command_t &received, uint32_t applied_us)
+{
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = COMMAND_ECHO_RESPONSE;
+    response.data[0] = (uint8_t)(received.sequence >> 8);
+    response.data[1] = (uint8_t)received.sequence;
+    write_int32_be(&response.data[2], (int32_t)received.host_timestamp);
+    response.data[6] = 1;
+    spi_send_response(response);
 
-    if (command.type == INVALID_COMMAND)
+    uint32_t queued_100us = (applied_us - received.received_us) / 100;
+    response.type = COMMAND_APPLIED_RESPONSE;
+    write_int32_be(&response.data[2], (int32_t)applied_us);
+    response.data[6] = (queued_100us > 0xFF) ? 0xFF : (uint8_t)queued_100us;
+    spi_send_response(response);
+}
+
+// Echo of a command that was not applied, a scheduled one with no room or too far ahead.
+static void send_command_rejected_response(const received_command_t &received)
+{
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = COMMAND_ECHO_RESPONSE;
+    response.data[0] = (uint8_t)(received.sequence >> 8);
+    response.data[1] = (uint8_t)received.sequence;
+    write_int32_be(&response.data[2], (int32_t)received.host_timestamp);
+    spi_send_response(response);
+}
+
+static uint16_t saturate_uint16(uint32_t value)
+{
+    return (value > 0xFFFF) ? 0xFFFF : (uint16_t)value;
+}
+
+// Response data: intact patterns, corrupted patterns (big-endian uint16, saturated),
+// committed clock in kHz (big-endian uint24).
+static void send_link_status_response()
+{
+    link_training_status_t status;
+    link_training_get_status(&status);
+
+    uint16_t good = saturate_uint16(status.good_frames);
+    uint16_t bad = saturate_uint16(status.bad_frames);
+    uint32_t clock_khz = status.committed_clock_hz / 1000;
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = LINK_STATUS_RESPONSE;
+    response.data[0] = (uint8_t)(good >> 8);
+    response.data[1] = (uint8_t)good;
+    response.data[2] = (uint8_t)(bad >> 8);
+    response.data[3] = (uint8_t)bad;
+    response.data[4] = (uint8_t)(clock_khz >> 16);
+    response.data[5] = (uint8_t)(clock_khz >> 8);
+    response.data[6] = (uint8_t)clock_khz;
+
+    spi_send_response(response);
+}
+
+// Cut-offs already reported in a power status.
+uint32_t reported_dc_motors_stalls = 0;
+uint32_t reported_servos_overcurrents = 0;
+
+// Response data: battery voltage in mV, average and peak load current in mA (big-endian uint16),
+// cut-offs since the last report (bit 0 DC motors stalled, bit 1 servos overcurrent).
+// The peak hold starts again after each report.
+static void send_power_status_response()
+{
+    power_readings_t readings;
+    power_get_readings(&readings);
+    power_reset_peak();
+
+    uint32_t dc_motors_stalls = dc_motors_stall_count();
+    uint32_t servos_overcurrents = servos_overcurrent_count();
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = POWER_STATUS_RESPONSE;
+    response.data[0] = (uint8_t)(readings.battery_mv >> 8);
+    response.data[1] = (uint8_t)readings.battery_mv;
+    response.data[2] = (uint8_t)(readings.load_current_ma >> 8);
+    response.data[3] = (uint8_t)readings.load_current_ma;
+    response.data[4] = (uint8_t)(readings.load_current_peak_ma >> 8);
+    response.data[5] = (uint8_t)readings.load_current_peak_ma;
+    response.data[6] = (dc_motors_stalls != reported_dc_motors_stalls ? 0x01 : 0) |
+        (servos_overcurrents != reported_servos_overcurrents ? 0x02 : 0);
+
+    reported_dc_motors_stalls = dc_motors_stalls;
+    reported_servos_overcurrents = servos_overcurrents;
+
+    spi_send_response(response);
+}
+
+// Emergency stops already reported, and motion commands dropped since the last report.
+uint32_t reported_emergency_stops = 0;
+uint32_t flushed_motion_commands = 0;
+
+// Response data: stops since boot (big-endian uint16), latency of the last stop and the highest one
+// in us (big-endian uint16, saturated), motion commands dropped since the last report (saturated).
+static void send_emergency_stop_response()
+{
+    emergency_stop_status_t status;
+    emergency_stop_get_status(&status);
+
+    uint16_t last_latency_us = saturate_uint16(status.last_latency_us);
+    uint16_t max_latency_us = saturate_uint16(status.max_latency_us);
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = EMERGENCY_STOP_RESPONSE;
+    response.data[0] = (uint8_t)(status.count >> 8);
+    response.data[1] = (uint8_t)status.count;
+    response.data[2] = (uint8_t)(last_latency_us >> 8);
+    response.data[3] = (uint8_t)last_latency_us;
+    response.data[4] = (uint8_t)(max_latency_us >> 8);
+    response.data[5] = (uint8_t)max_latency_us;
+    response.data[6] = (flushed_motion_commands > 0xFF) ? 0xFF : (uint8_t)flushed_motion_commands;
+
+    if (spi_send_response(response))
+    {
+        reported_emergency_stops = status.count;
+        flushed_motion_commands = 0;
+    }
+}
+
+// Commands that move an actuator. Queued before an emergency stop, they are dropped.
+static bool is_motion_command(uint8_t type)
+{
+    return (type >= BASE_MOTOR_DIRECTION_COMMAND && type <= RIGHT_REAR_MOTOR_COMMAND) ||
+        (type >= BASE_MOTOR_POSITION_COMMAND && type <= CARTESIAN_VELOCITY_COMMAND) ||
+        type == MOTION_PLAY_COMMAND || type == REGISTER_WRITE_COMMAND;
+}
+
+static bool is_flushed_by_emergency_stop(const received_command_t &received)
+{
+    return received.stop_count != (uint8_t)emergency_stop_count() && is_motion_command(received.command.type);
+}
+
+// Response data: sync id echoed, time the request was received in us (big-endian uint32),
+// time from receiving to answering in us (big-endian uint16, saturated).
+// The receive time is stamped in the SPI interrupt, at the end of the host's transfer.
+static void send_time_sync_response(const received_command_t &received)
+{
+    uint16_t answer_delay_us = saturate_uint16(time_us_32() - received.received_us);
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = TIME_SYNC_RESPONSE;
+    response.data[0] = received.command.data[0];
+    write_int32_be(&response.data[1], (int32_t)received.received_us);
+    response.data[5] = (uint8_t)(answer_delay_us >> 8);
+    response.data[6] = (uint8_t)answer_delay_us;
+
+    spi_send_response(response);
+}
+
+// Response data: state, result of the last operation, next chunk and chunks of the image
+// (big-endian uint16), data frames that did not fit the transfer buffer (saturated).
+static void send_firmware_update_response()
+{
+    update_agent_status_t status;
+    update_agent_get_status(&status);
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = FIRMWARE_UPDATE_RESPONSE;
+    response.data[0] = (uint8_t)status.state;
+    response.data[1] = (uint8_t)status.last_result;
+    response.data[2] = (uint8_t)(status.next_chunk >> 8);
+    response.data[3] = (uint8_t)status.next_chunk;
+    response.data[4] = (uint8_t)(status.chunks >> 8);
+    response.data[5] = (uint8_t)status.chunks;
+    response.data[6] = (status.overflows > 0xFF) ? 0xFF : (uint8_t)status.overflows;
+
+    spi_send_response(response);
+}
+
+// A response for each tier. Response data: tier, worst latency, worst duration in us and misses
+// (big-endian uint16, saturated). See irq_tier_stats_t for what the latency and misses count.
+static void send_irq_stats_responses(bool reset)
+{
+    for (uint8_t tier = 0; tier < IRQ_TIERS_COUNT; tier++)
+    {
+        irq_tier_stats_t stats;
+        irq_tier_get_stats((irq_tier_t)tier, &stats);
+        if (reset)
+        {
+            irq_tier_reset((irq_tier_t)tier);
+        }
+
+        uint16_t latency = saturate_uint16(stats.max_latency);
+        uint16_t duration_us = saturate_uint16(stats.max_duration_us);
+        uint16_t misses = saturate_uint16(stats.misses);
+
+        response_8_bytes_t response;
+        memset(&response, 0, sizeof(response));
+        response.type = IRQ_STATS_RESPONSE;
+        response.data[0] = tier;
+        response.data[1] = (uint8_t)(latency >> 8);
+        response.data[2] = (uint8_t)latency;
+        response.data[3] = (uint8_t)(duration_us >> 8);
+        response.data[4] = (uint8_t)duration_us;
+        response.data[5] = (uint8_t)(misses >> 8);
+        response.data[6] = (uint8_t)misses;
+
+        spi_send_response(response);
+    }
+}
+
+static void write_uint24_be_saturated(uint8_t *data, uint32_t value)
+{
+    if (value > 0xFFFFFF)
+    {
+        value = 0xFFFFFF;
+    }
+
+    data[0] = (uint8_t)(value >> 16);
+    data[1] = (uint8_t)(value >> 8);
+    data[2] = (uint8_t)value;
+}
+
+// Cases of a BENCHMARK_COMMAND still to run, a bit per case. The main loop runs one per pass.
+uint32_t benchmark_cases_pending = 0;
+uint32_t benchmark_iterations = 0;
+
+static void start_benchmark(const command_8_bytes_t &command)
+{
+    // The receive path and the burst go through the commands queue, they would take what waits there.
+    spi_transport_stats_t transport;
+    spi_get_transport_stats(&transport);
+    if (transport.queued != 0)
+    {
+        response_8_bytes_t response;
+        memset(&response, 0, sizeof(response));
+        response.type = BENCHMARK_RESPONSE;
+        response.data[0] = BENCHMARK_REFUSED;
+        response.data[1] = (uint8_t)transport.queued;
+        spi_send_response(response);
+        return;
+    }
+
+    uint32_t iterations = (uint32_t)command.data[1] << 8 | command.data[2];
+    if (iterations == 0)
+    {
+        iterations = BENCHMARK_ITERATIONS;
+    }
+    if (iterations > BENCHMARK_MAX_ITERATIONS)
+    {
+        iterations = BENCHMARK_MAX_ITERATIONS;
+    }
+
+    benchmark_iterations = iterations;
+    benchmark_cases_pending = (command.data[0] != 0) ? command.data[0] : (1u << BENCHMARK_CASES_COUNT) - 1;
+    benchmark_cases_pending &= (1u << BENCHMARK_CASES_COUNT) - 1;
+}
+
+// The next case of the pending ones and its response, or the summary after the last one.
+static void run_next_benchmark_case()
+{
+    uint8_t i = 0;
+    while ((benchmark_cases_pending & (1u << i)) == 0)
+    {
+        i++;
+    }
+    benchmark_cases_pending &= ~(1u << i);
+
+    benchmark_stats_t stats;
+    benchmark_run((benchmark_case_t)i, benchmark_iterations, &stats);
+
+    response_8_bytes_t response;
+    memset(&response, 0, sizeof(response));
+    response.type = BENCHMARK_RESPONSE;
+    response.data[0] = i;
+    write_uint24_be_saturated(&response.data[1], (stats.iterations != 0) ? (uint32_t)(stats.total_cycles / stats.iterations) : 0);
+    write_uint24_be_saturated(&response.data[4], stats.max_cycles);
+    spi_send_response(response);
+
+    if (benchmark_cases_pending != 0)
     {
         return;
     }
-    
+
+    uint32_t iterations = benchmark_iterations;
+    uint32_t clock_mhz = clock_get_hz(clk_sys) / 1000000;
+    response_8_bytes_t summary;
+    memset(&summary, 0, sizeof(summary));
+    summary.type = BENCHMARK_RESPONSE;
+    summary.data[0] = BENCHMARK_SUMMARY;
+    summary.data[1] = CYCLE_COUNTER_CORE_TYPE;
+    summary.data[2] = (uint8_t)(clock_mhz >> 8);
+    summary.data[3] = (uint8_t)clock_mhz;
+    summary.data[4] = (uint8_t)(iterations >> 8);
+    summary.data[5] = (uint8_t)iterations;
+    summary.data[6] = BENCHMARK_BURST_COMMANDS;
+    spi_send_response(summary);
+}
+
+static void apply_command(const command_8_bytes_t &command)
+{
     motor_direction_speed_t motor_direction_speed = {
         .direction = (int8_t)command.data[0], // Direction
         .speed = command.data[1], // Speed in percentage (0-100)
+        .elapsed_time = 0,
         .timeout = (int16_t)((uint16_t)command.data[2] << 8 | command.data[3]) // Timeout in milliseconds
     };
 
@@ -43,33 +449,325 @@ void process_commands_protocol()
         set_right_dc_motor_speed(motor_direction_speed);
     }
 
-    if (BASE_MOTOR_DIRECTION_COMMAND == command.type)
+    // Jogging a joint, dispatched through the table generated from the robot description.
+    uint8_t joint = (command.type < COMMAND_TYPES_COUNT) ? command_joint_table.joints[command.type] : NO_JOINT;
+    if (joint != NO_JOINT)
+    {
+        // Moving a positioning joint on its own takes it over from the Cartesian motion.
+        if (robot_joints[joint].is_cartesian)
+        {
+            arm_stop_cartesian();
+        }
+
+        // Any joint motion command takes the arm over from a playback. Recording continues.
+        motion_stop_playback();
+        set_servo_motor_direction_speed(joint, motor_direction_speed);
+    }
+
+    if (CARTESIAN_MOVE_COMMAND == command.type ||
+        CARTESIAN_VELOCITY_COMMAND == command.type)
+    {
+        motion_stop_playback();
+    }
+
+    if (CARTESIAN_MOVE_COMMAND == command.type)
+    {
+        // x, y, z in mm (big-endian int16), speed in mm/s.
+        arm_move_to(
+            (int16_t)((uint16_t)command.data[0] << 8 | command.data[1]),
+            (int16_t)((uint16_t)command.data[2] << 8 | command.data[3]),
+            (int16_t)((uint16_t)command.data[4] << 8 | command.data[5]),
+            command.data[6]);
+    }
+
+    if (CARTESIAN_VELOCITY_COMMAND == command.type)
+    {
+        // vx, vy, vz in mm/s, pitch rate in degrees/s, timeout in milliseconds (big-endian).
+        arm_jog(
+            (int8_t)command.data[0],
+            (int8_t)command.data[1],
+            (int8_t)command.data[2],
+            (int8_t)command.data[3],
+            (uint16_t)((uint16_t)command.data[4] << 8 | command.data[5]));
+    }
+
+    if (GET_SERVO_CALIBRATION_COMMAND == command.type)
+    {
+        // servo, field.
+        send_servo_calibration_response(command.data[0], command.data[1], true);
+    }
+
+    if (SET_SERVO_CALIBRATION_COMMAND == command.type)
+    {
+        // servo, field, value (big-endian int32). The response carries the value in use.
+        bool status = set_servo_calibration_field(
+            command.data[0],
+            (servo_calibration_field_t)command.data[1],
+            read_int32_be(&command.data[2]));
+        send_servo_calibration_response(command.data[0], command.data[1], status);
+    }
+
+    if (GET_SERVO_SPEED_PROFILE_COMMAND == command.type)
+    {
+        // servo, row.
+        send_servo_speed_profile_response(command.data[0], command.data[1], true);
+    }
+
+    if (SET_SERVO_SPEED_PROFILE_COMMAND == command.type)
     {
-        set_base_servo_speed(motor_direction_speed);
+        // servo, row, min percentage, max percentage, min time in milliseconds (big-endian).
+        servo_speed_settings_t settings = {
+            .min_percentage = command.data[2],
+            .max_percentage = command.data[3],
+            .min_time_ms = (uint16_t)((uint16_t)command.data[4] << 8 | command.data[5])
+        };
+        bool status = set_servo_speed_profile(command.data[0], command.data[1], settings);
+        send_servo_speed_profile_response(command.data[0], command.data[1], status);
     }
 
-    if (SHOULDER_MOTOR_DIRECTION_COMMAND == command.type)
+    if (SAVE_CALIBRATION_COMMAND == command.type)
     {
-        set_shoulder_servo_speed(motor_direction_speed);
+        send_calibration_saved_response(save_servo_calibration());
     }
 
-    if (ELBOW_MOTOR_DIRECTION_COMMAND == command.type)
+    if (LOAD_DEFAULT_CALIBRATION_COMMAND == command.type)
     {
-        set_elbow_servo_speed(motor_direction_speed);
+        // Only the values in use. Saving afterwards makes the defaults permanent again.
+        restore_default_servo_calibration();
+        send_calibration_saved_response(false);
     }
 
-    if (ARM_MOTOR_DIRECTION_COMMAND == command.type)
+    if (GET_BOOT_PROFILE_COMMAND == command.type)
     {
-        set_arm_servo_speed(motor_direction_speed);
+        // A request while the last one is going out starts it again.
+        boot_profile_next_stage = 0;
     }
 
-    if (WRIST_MOTOR_DIRECTION_COMMAND == command.type)
+    if (MOTION_RECORD_COMMAND == command.type)
     {
-        set_wrist_servo_speed(motor_direction_speed);
+        // recording.
+        motion_record_start(command.data[0]);
     }
 
-    if (GRIPPER_MOTOR_DIRECTION_COMMAND == command.type)
+    if (MOTION_PLAY_COMMAND == command.type)
     {
-        set_gripper_servo_speed(motor_direction_speed);
+        // recording, speed in percent, loop.
+        arm_stop_cartesian();
+        motion_play(command.data[0], command.data[1], command.data[2] != 0);
     }
+
+    if (MOTION_STOP_COMMAND == command.type)
+    {
+        motion_stop();
+    }
+
+    if (GET_MOTION_STATUS_COMMAND == command.type)
+    {
+        send_motion_status_response();
+    }
+
+    // Start and pattern frames are counted in the SPI interrupt and never get here.
+    if (LINK_TRAINING_COMMAND == command.type)
+    {
+        if (LINK_TRAINING_COMMIT == command.data[0])
+        {
+            link_training_commit((uint32_t)read_int32_be(&command.data[1]));
+        }
+
+        send_link_status_response();
+    }
+
+    if (GET_POWER_STATUS_COMMAND == command.type)
+    {
+        send_power_status_response();
+    }
+
+    // Data frames go into the transfer buffer in the SPI interrupt and never get here.
+    if (FIRMWARE_UPDATE_COMMAND == command.type)
+    {
+        update_agent_command(command);
+        send_firmware_update_response();
+    }
+
+    if (GET_IRQ_STATS_COMMAND == command.type)
+    {
+        send_irq_stats_responses(command.data[0] == 1);
+    }
+
+    // The payload was taken in the SPI interrupt. Reads never get here, register_map_refresh() builds them.
+    if (REGISTER_WRITE_COMMAND == command.type)
+    {
+        register_map_apply_write(command);
+    }
+
+    // The command burst runs the dispatcher again, a request among its commands is not run.
+    if (BENCHMARK_COMMAND == command.type && !benchmark_running())
+    {
+        start_benchmark(command);
+    }
+}
+
+// Set by SYNC_HOLD_COMMAND. Motion commands wait in the scheduled queue until the start,
+// which several boards take from the same broadcast frame.
+bool motion_held = false;
+
+static void run_command(const received_command_t &received)
+{
+    if (TIME_SYNC_COMMAND == received.command.type)
+    {
+        send_time_sync_response(received);
+    }
+
+    if (SYNC_HOLD_COMMAND == received.command.type)
+    {
+        // 1 holds, 0 starts.
+        motion_held = (received.command.data[0] != 0);
+    }
+
+    apply_command(received.command);
+
+    if (received.extension_flags & COMMAND_EXTENSION_SEQUENCE)
+    {
+        send_command_sequence_responses(received, time_us_32());
+    }
+}
+
+// The echo and the applied response of a sequenced command.
+#define COMMAND_SEQUENCE_RESPONSES 2
+
+// Most responses one command sends when it runs, GET_IRQ_STATS_COMMAND with a sequence.
+#define COMMAND_RESPONSES_MAX (IRQ_TIERS_COUNT + COMMAND_SEQUENCE_RESPONSES)
+
+static_assert(RESPONSES_BUFFER_SIZE - 1 >= SCHEDULED_COMMANDS_SIZE * COMMAND_SEQUENCE_RESPONSES + COMMAND_RESPONSES_MAX,
+    "The responses queue holds the answers of a full scheduler and of one more command");
+
+static uint32_t response_room_needed()
+{
+    return count_scheduled_commands() * COMMAND_SEQUENCE_RESPONSES + COMMAND_RESPONSES_MAX;
+}
+
+// A command is taken from the queue only with room for its responses, next to those the
+// scheduled commands send when they are due. Until the host reads the responses the commands
+// wait in the queue, and the queue credits tell it.
+static bool has_response_room()
+{
+    return spi_responses_free() >= response_room_needed();
+}
+
+// Only into the room past what has_response_room() keeps, the next command is not held back.
+static void send_pending_boot_profile_responses()
+{
+    while (boot_profile_next_stage < BOOT_STAGES_COUNT && spi_responses_free() > response_room_needed())
+    {
+        send_boot_profile_response(boot_profile_next_stage++);
+    }
+}
+
+static void receive_command(received_command_t &received)
+{
+    boot_profile_mark(BOOT_STAGE_FIRST_COMMAND);
+
+    bool is_scheduled = (received.extension_flags & COMMAND_EXTENSION_EXECUTE_AT) &&
+        (int32_t)(received.execute_at_us - time_us_32()) > 0;
+    bool is_held = motion_held && is_motion_command(received.command.type);
+
+    // A time already past runs now.
+    if (!is_scheduled && !is_held)
+    {
+        run_command(received);
+        return;
+    }
+
+    if (!is_scheduled)
+    {
+        received.execute_at_us = time_us_32();
+    }
+
+    if (!schedule_command(received, time_us_32()) &&
+        (received.extension_flags & COMMAND_EXTENSION_SEQUENCE))
+    {
+        send_command_rejected_response(received);
+    }
+}
+
+void process_received_command()
+{
+    received_command_t received = spi_get_received_command();
+    if (received.command.type != INVALID_COMMAND)
+    {
+        receive_command(received);
+    }
+}
+
+void process_commands_protocol()
+{
+    // The servos are held on an overcurrent or an emergency stop. Stop what would move them again.
+    if (servos_hold_pending())
+    {
+        arm_stop_cartesian();
+        motion_stop_playback();
+        release_servos_hold();
+    }
+
+    // A benchmark case per pass. The commands wait in the queue until the summary is out.
+    if (benchmark_cases_pending != 0)
+    {
+        run_next_benchmark_case();
+        register_map_refresh(motion_held);
+        return;
+    }
+
+    // All the motion commands queued before a stop go at once, not one per loop.
+    received_command_t received = {};
+    received.command.type = INVALID_COMMAND;
+    if (has_response_room())
+    {
+        received = spi_get_received_command();
+    }
+    while (is_flushed_by_emergency_stop(received))
+    {
+        flushed_motion_commands++;
+        received = spi_get_received_command();
+    }
+
+    if (emergency_stop_count() != reported_emergency_stops)
+    {
+        flushed_motion_commands += remove_scheduled_commands(is_flushed_by_emergency_stop);
+        send_emergency_stop_response();
+    }
+
+    // All the commands due by now, so the ones scheduled for the same time, or held until
+    // the same start, take effect within one tick period. They go before the command just
+    // taken, which they were due ahead of.
+    received_command_t scheduled;
+    while (!motion_held && take_due_command(time_us_32(), &scheduled))
+    {
+        run_command(scheduled);
+    }
+
+    if (received.command.type != INVALID_COMMAND)
+    {
+        receive_command(received);
+    }
+
+    send_pending_boot_profile_responses();
+    register_map_refresh(motion_held);
+}
+
+uint32_t commands_protocol_sleep_us(uint32_t max_sleep_us)
+{
+    // Nothing is due before the start.
+    uint32_t execute_at_us;
+    if (motion_held || !next_scheduled_command_us(&execute_at_us))
+    {
+        return max_sleep_us;
+    }
+
+    int32_t until_us = (int32_t)(execute_at_us - time_us_32());
+    if (until_us <= 0)
+    {
+        return 0;
+    }
+
+    return ((uint32_t)until_us < max_sleep_us) ? (uint32_t)until_us : max_sleep_us;
 }
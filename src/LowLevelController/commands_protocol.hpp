@@ -3,6 +3,7 @@
 #ifndef COMMANDS_PROTOCOL_HPP
 #define COMMANDS_PROTOCOL_HPP
 
+#include <stdint.h>
 
 // Represents a single joystick object from the JSON array
 typedef struct {
@@ -20,4 +21,11 @@ typedef struct {
 void init_commands_protocol();
 void process_commands_protocol();
 
+// Takes one command from the commands queue and runs it as the main loop would, without
+// the scheduled commands and the register map refresh. For the command burst benchmark.
+void process_received_command();
+
+// How long the main loop can sleep, up to max_sleep_us, and still apply the next scheduled command on time.
+uint32_t commands_protocol_sleep_us(uint32_t max_sleep_us);
+
 #endif // COMMANDS_PROTOCOL_HPP
@@ -1,6 +1,8 @@
 #ifndef COMMON_TYPES_HPP
 #define COMMON_TYPES_HPP
 
+#include <stdint.h>
+
 typedef enum {
     INVALID_COMMAND = 0,
     BASE_MOTOR_DIRECTION_COMMAND = 1,
@@ -21,8 +23,196 @@ typedef enum {
     ARM_MOTOR_POSITION_COMMAND = 16,
     WRIST_MOTOR_POSITION_COMMAND = 17,
     GRIPPER_MOTOR_POSITION_COMMAND = 18,
+    CARTESIAN_MOVE_COMMAND = 19,
+    CARTESIAN_VELOCITY_COMMAND = 20,
+    GET_SERVO_CALIBRATION_COMMAND = 21,
+    SET_SERVO_CALIBRATION_COMMAND = 22,
+    GET_SERVO_SPEED_PROFILE_COMMAND = 23,
+    SET_SERVO_SPEED_PROFILE_COMMAND = 24,
+    SAVE_CALIBRATION_COMMAND = 25,
+    LOAD_DEFAULT_CALIBRATION_COMMAND = 26,
+    GET_BOOT_PROFILE_COMMAND = 27,
+    MOTION_RECORD_COMMAND = 28,
+    MOTION_PLAY_COMMAND = 29,
+    MOTION_STOP_COMMAND = 30,
+    GET_MOTION_STATUS_COMMAND = 31,
+    LINK_TRAINING_COMMAND = 32,
+    GET_POWER_STATUS_COMMAND = 33,
+    TIME_SYNC_COMMAND = 34,
+    SYNC_HOLD_COMMAND = 35,
+    BOARD_SELECT_COMMAND = 36,
+    FIRMWARE_UPDATE_COMMAND = 37,
+    GET_IRQ_STATS_COMMAND = 38,
+    REGISTER_WRITE_COMMAND = 39,
+    REGISTER_READ_COMMAND = 40,
+    GET_QUEUE_CREDITS_COMMAND = 41,
+    BENCHMARK_COMMAND = 42,
+
+    // Keep last. Frames starting with a higher type are not commands.
+    COMMAND_TYPES_COUNT
 } command_type_t;
 
+// Types of the responses sent back to the main controller.
+typedef enum {
+    INVALID_RESPONSE = 0,
+    SERVO_CALIBRATION_RESPONSE = 1,
+    SERVO_SPEED_PROFILE_RESPONSE = 2,
+    CALIBRATION_SAVED_RESPONSE = 3,
+    BOOT_PROFILE_RESPONSE = 4,
+    MOTION_STATUS_RESPONSE = 5,
+    COMMAND_ECHO_RESPONSE = 6,
+    COMMAND_APPLIED_RESPONSE = 7,
+    LINK_STATUS_RESPONSE = 8,
+    POWER_STATUS_RESPONSE = 9,
+    EMERGENCY_STOP_RESPONSE = 10,
+    TIME_SYNC_RESPONSE = 11,
+    FIRMWARE_UPDATE_RESPONSE = 12,
+    IRQ_STATS_RESPONSE = 13,
+    REGISTER_BURST_RESPONSE = 14, // Longer than the others, see register_map.hpp.
+    QUEUE_CREDITS_RESPONSE = 15,
+    BENCHMARK_RESPONSE = 16,
+} response_type_t;
+
+// Boot stages stamped by the boot profile, in the order of the fast start.
+typedef enum {
+    BOOT_STAGE_MAIN = 0,            // Entered main(), after the SDK runtime init.
+    BOOT_STAGE_PWMS = 1,            // PWM outputs running, all low.
+    BOOT_STAGE_DC_MOTORS = 2,       // DC motors stopped.
+    BOOT_STAGE_SERVOS = 3,          // Servos at their start positions.
+    BOOT_STAGE_SPI = 4,             // Transport accepting frames.
+    BOOT_STAGE_STDIO = 5,
+    BOOT_STAGE_LOGGER = 6,
+    BOOT_STAGE_COMPLETE = 7,        // Entering the main loop.
+    BOOT_STAGE_FIRST_COMMAND = 8,   // First valid command processed.
+    BOOT_STAGES_COUNT
+} boot_stage_t;
+
+// Servo calibration values that can be read and changed at runtime.
+// Pulse widths are transferred in nanoseconds, so they fit an integer.
+typedef enum {
+    SERVO_CALIBRATION_DEGREES = 0,
+    SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT = 1,
+    SERVO_CALIBRATION_TOP_DEGREES_LIMIT = 2,
+    SERVO_CALIBRATION_LEFT_NS = 3,
+    SERVO_CALIBRATION_CENTER_NS = 4,
+    SERVO_CALIBRATION_RIGHT_NS = 5,
+    SERVO_CALIBRATION_PWM_NUMBER = 6,
+    SERVO_CALIBRATION_INVERTED = 7,
+    SERVO_CALIBRATION_CURRENT_DEGREES = 8, // Read only.
+    SERVO_CALIBRATION_LINK_UM = 9,         // Link of the Cartesian motion, see joint_description_t.
+} servo_calibration_field_t;
+
+// Operations of LINK_TRAINING_COMMAND, in data[0].
+// The host sends a start, a burst of patterns and a report request at each clock rate it tries.
+typedef enum {
+    LINK_TRAINING_START = 0,    // Clears the pattern counters.
+    LINK_TRAINING_PATTERN = 1,  // data[1] is the pattern index, data[2..6] the pattern.
+    LINK_TRAINING_REPORT = 2,   // Answered with LINK_STATUS_RESPONSE.
+    LINK_TRAINING_COMMIT = 3,   // data[1..4] is the clock the host settled on, big-endian Hz.
+} link_training_op_t;
+
+#define LINK_TRAINING_PATTERN_SIZE 5
+
+// Byte of a training pattern. Alternating bits, all ones and zeros, nibbles and a walking one,
+// shifted with the index so each byte of the frame carries every value.
+static inline uint8_t link_training_pattern_byte(uint8_t index, uint8_t position)
+{
+    static const uint8_t patterns[8] = { 0x55, 0xAA, 0xFF, 0x00, 0x33, 0xCC, 0x0F, 0xF0 };
+    if (position == LINK_TRAINING_PATTERN_SIZE - 1)
+    {
+        return (uint8_t)(1u << (index & 7));
+    }
+
+    return patterns[(index + position) & 7];
+}
+
+// Operations of FIRMWARE_UPDATE_COMMAND, in data[0].
+// The image goes in chunks of one flash sector. The data frames of a chunk fill the transfer
+// buffer, the chunk frame then checks and writes it. Every operation but the data frames is
+// answered with FIRMWARE_UPDATE_RESPONSE.
+typedef enum {
+    FIRMWARE_UPDATE_DATA = 0,       // data[1..6] appended to the transfer buffer.
+    FIRMWARE_UPDATE_BEGIN = 1,      // data[1..4] image size, big-endian. The buffer holds the SHA-256 of the image.
+    FIRMWARE_UPDATE_CHUNK = 2,      // data[1..2] chunk index, data[3..6] CRC32 of the buffer, big-endian.
+    FIRMWARE_UPDATE_FINISH = 3,     // Checks the SHA-256 of the whole image.
+    FIRMWARE_UPDATE_ACTIVATE = 4,   // Reboots and installs the checked image.
+    FIRMWARE_UPDATE_REPORT = 5,
+} firmware_update_op_t;
+
+#define FIRMWARE_UPDATE_DATA_SIZE 6
+#define FIRMWARE_UPDATE_HASH_SIZE 32
+
+// A chunk in the transfer buffer: encoding, payload length (big-endian uint16), payload.
+// The payload unpacks to one flash sector, less for the last chunk of the image.
+typedef enum {
+    FIRMWARE_CHUNK_RAW = 0,
+    FIRMWARE_CHUNK_LZSS = 1,
+} firmware_chunk_encoding_t;
+
+#define FIRMWARE_CHUNK_HEADER_SIZE 3
+
+typedef enum {
+    FIRMWARE_UPDATE_IDLE = 0,
+    FIRMWARE_UPDATE_RECEIVING = 1,  // Waiting for the next chunk.
+    FIRMWARE_UPDATE_VERIFIED = 2,   // All chunks written and the hash matches.
+    FIRMWARE_UPDATE_ACTIVATING = 3, // Rebooting into the new image.
+} firmware_update_state_t;
+
+// Result of the last operation, in the update response.
+typedef enum {
+    FIRMWARE_UPDATE_OK = 0,
+    FIRMWARE_UPDATE_ERROR_STATE = 1,      // Not expected in this state, e.g. a chunk before the begin.
+    FIRMWARE_UPDATE_ERROR_SIZE = 2,       // Image larger than the staging slot, or a wrong buffer length.
+    FIRMWARE_UPDATE_ERROR_CRC = 3,        // Chunk damaged on the way, send it again.
+    FIRMWARE_UPDATE_ERROR_ORDER = 4,      // Chunk ahead of the next one expected.
+    FIRMWARE_UPDATE_ERROR_DECODE = 5,     // Payload does not unpack to the chunk size.
+    FIRMWARE_UPDATE_ERROR_FLASH = 6,      // Written sector reads back different.
+    FIRMWARE_UPDATE_ERROR_HASH = 7,       // Image in the staging slot does not match the SHA-256.
+    FIRMWARE_UPDATE_ERROR_MOVING = 8,     // Actuators running, a flash write would stall their control. Stop them first.
+} firmware_update_result_t;
+
+// GET_QUEUE_CREDITS_COMMAND is answered from the SPI interrupt, ahead of the queued responses,
+// with a QUEUE_CREDITS_RESPONSE: free commands queue entries when the request was received (uint8),
+// queue capacity (uint8) and commands dropped on a full queue since boot (uint32, big-endian).
+// Frames sent after the request may take entries counted as free, the host subtracts them.
+
+// Interrupt priority tiers, most urgent first. See irq_tiers.hpp.
+// GET_IRQ_STATS_COMMAND answers with an IRQ_STATS_RESPONSE for each, data[0] 1 also clears them.
+typedef enum {
+    IRQ_TIER_TRANSPORT = 0,     // SPI and UART receive.
+    IRQ_TIER_OUTPUT = 1,        // PWM wrap and servo DMA.
+    IRQ_TIER_CONTROL = 2,       // Control ticks.
+    IRQ_TIERS_COUNT
+} irq_tier_t;
+
+// Hot paths timed by the benchmark, see benchmark.hpp.
+typedef enum {
+    BENCHMARK_FRAME_DECODE = 0,     // Parsing one extended command frame.
+    BENCHMARK_RECEIVE_PATH = 1,     // The SPI receive interrupt work for one frame, queueing included.
+    BENCHMARK_SERVO_TICK = 2,       // One servo control tick.
+    BENCHMARK_DC_MOTORS_TICK = 3,   // One DC motors control tick.
+    BENCHMARK_PWM_UPDATE = 4,       // All hardware PWM channels set and committed in one update.
+    BENCHMARK_COMMAND_BURST = 5,    // A burst of stop commands, from the first byte received to the last one run.
+    BENCHMARK_CASES_COUNT
+} benchmark_case_t;
+
+// BENCHMARK_COMMAND: data[0] the cases to run, a bit per benchmark_case_t, 0 for all,
+// data[1] runs of each case (big-endian uint16), 0 for BENCHMARK_ITERATIONS.
+// The actuators are stopped first and stay stopped. The main loop runs a case per pass and takes
+// no commands meanwhile, the host sends nothing until the summary.
+// A BENCHMARK_RESPONSE per case: case, mean and max core cycles of a run (big-endian uint24, saturated).
+// Then the summary: BENCHMARK_SUMMARY, core type, clock in MHz (big-endian uint16),
+// runs of each case asked (big-endian uint16), commands in a burst.
+// With other commands waiting in the queue only BENCHMARK_REFUSED and the number waiting.
+#define BENCHMARK_SUMMARY 0xFF
+#define BENCHMARK_REFUSED 0xFE
+
+typedef enum {
+    BENCHMARK_CORE_HOST = 0,        // The host simulator.
+    BENCHMARK_CORE_CORTEX_M33 = 1,
+    BENCHMARK_CORE_HAZARD3 = 2,
+} benchmark_core_t;
+
 // Represents the type of control for the servo motors.
 // Each servo can be controlled by only one type at a time.
 typedef enum {
@@ -42,6 +232,63 @@ typedef struct
     uint8_t data[7];
 } command_8_bytes_t;
 
+// Set in the type byte of a command when an extension follows the 8 bytes of the command.
+// The extension starts with a flags byte, the fields follow in the order of the flag bits.
+#define COMMAND_EXTENSION_FLAG 0x80
+
+// Sequence number (uint16) and host timestamp (uint32), both big-endian.
+// The command is answered with COMMAND_ECHO_RESPONSE and COMMAND_APPLIED_RESPONSE.
+#define COMMAND_EXTENSION_SEQUENCE 0x01
+#define COMMAND_EXTENSION_SEQUENCE_SIZE 6
+
+// Firmware time to apply the command at (uint32 us, big-endian), see TIME_SYNC_COMMAND.
+// The command waits in the scheduled queue until then, one already due is applied at once.
+#define COMMAND_EXTENSION_EXECUTE_AT 0x02
+#define COMMAND_EXTENSION_EXECUTE_AT_SIZE 4
+
+// Address of the board the command is for (uint8), see BOARD_ADDRESS.
+// Commands without it are for every board, as are the ones to BOARD_BROADCAST_ADDRESS.
+#define COMMAND_EXTENSION_ADDRESS 0x04
+#define COMMAND_EXTENSION_ADDRESS_SIZE 1
+
+#define BOARD_BROADCAST_ADDRESS 0xFF
+
+// Flags this firmware knows. A frame with other flags set is dropped, its length is unknown.
+#define COMMAND_EXTENSION_KNOWN_FLAGS (COMMAND_EXTENSION_SEQUENCE | COMMAND_EXTENSION_EXECUTE_AT | COMMAND_EXTENSION_ADDRESS)
+
+// A command as taken from the transport, with its extension.
+typedef struct
+{
+    command_8_bytes_t command;
+
+    // COMMAND_EXTENSION_* flags of the fields present, 0 for a plain command.
+    uint8_t extension_flags;
+
+    // Low bits of the emergency stop count when the command was received.
+    uint8_t stop_count;
+
+    // BOARD_BROADCAST_ADDRESS if the frame has no address.
+    uint8_t address;
+
+    uint16_t sequence;
+    uint32_t host_timestamp;
+    uint32_t execute_at_us;
+
+    // Firmware time when the last byte of the frame was received.
+    uint32_t received_us;
+} received_command_t;
+
+// Represents a single response sent to the main controller.
+typedef struct
+{
+    // Type of the response, e.g., SERVO_CALIBRATION_RESPONSE.
+    response_type_t type;
+
+    // Data associated with the response.
+    // The size of the data is determined by the response type.
+    uint8_t data[7];
+} response_8_bytes_t;
+
 // Internal type used for direction and speed settings.
 typedef struct
 {
@@ -0,0 +1,24 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef CRC32_HPP
+#define CRC32_HPP
+
+#include <stdint.h>
+
+// CRC-32 as in zlib. Start with 0, pass the result on to continue over more data.
+static inline uint32_t crc32_update(uint32_t crc, const uint8_t *data, uint32_t length)
+{
+    crc = ~crc;
+    for (uint32_t i = 0; i < length; i++)
+    {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+
+    return ~crc;
+}
+
+#endif // CRC32_HPP
@@ -0,0 +1,56 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef CYCLE_COUNTER_HPP
+#define CYCLE_COUNTER_HPP
+
+#include <stdint.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+
+// Core clock cycles, on either core type of the RP2350, for timing short code paths.
+// Cortex-M33: the DWT cycle counter. Hazard3: the mcycle counter. 32 bits, it wraps in about
+// 28 s at 150 MHz, so only differences of close reads count.
+// Elsewhere, as in the host simulator, the microsecond timer scaled to the system clock.
+#if defined(__riscv)
+#include "hardware/riscv.h"
+#elif defined(__ARM_ARCH_8M_MAIN__)
+#include "hardware/structs/m33.h"
+#else
+#include "hardware/clocks.h"
+#endif
+
+// Core type the firmware is built for, name and benchmark_core_t.
+#if defined(__riscv)
+#define CYCLE_COUNTER_CORE "hazard3"
+#define CYCLE_COUNTER_CORE_TYPE BENCHMARK_CORE_HAZARD3
+#elif defined(__ARM_ARCH_8M_MAIN__)
+#define CYCLE_COUNTER_CORE "cortex-m33"
+#define CYCLE_COUNTER_CORE_TYPE BENCHMARK_CORE_CORTEX_M33
+#else
+#define CYCLE_COUNTER_CORE "host"
+#define CYCLE_COUNTER_CORE_TYPE BENCHMARK_CORE_HOST
+#endif
+
+// Starts the counter. Both counters are stopped after reset.
+static inline void cycle_counter_init()
+{
+#if defined(__riscv)
+    riscv_clear_csr(mcountinhibit, 1u);
+#elif defined(__ARM_ARCH_8M_MAIN__)
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+#endif
+}
+
+static inline uint32_t cycle_counter_read()
+{
+#if defined(__riscv)
+    return riscv_read_csr(mcycle);
+#elif defined(__ARM_ARCH_8M_MAIN__)
+    return m33_hw->dwt_cyccnt;
+#else
+    return time_us_32() * (clock_get_hz(clk_sys) / 1000000);
+#endif
+}
+
+#endif // CYCLE_COUNTER_HPP
@@ -15,10 +15,16 @@ public:
     }
 
     // Pushes an item into the buffer (thread-safe for single producer)
-    void push(const T& item) {
+    // Returns false and drops the item if the buffer is full, the queued items are kept.
+    bool push(const T& item) {
         const auto current_head = _head.load(std::memory_order_relaxed);
+        const auto next_head = (current_head + 1) & (Size - 1);
+        if (next_head == _tail.load(std::memory_order_acquire)) {
+            return false; // Buffer is full
+        }
         _buffer[current_head] = item;
-        _head.store((current_head + 1) & (Size - 1), std::memory_order_release);
+        _head.store(next_head, std::memory_order_release);
+        return true;
     }
 
     // Pops an item from the buffer (thread-safe for single consumer)
@@ -36,6 +42,16 @@ public:
         return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
     }
 
+    // Number of items in the buffer
+    size_t size() const {
+        return (_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire)) & (Size - 1);
+    }
+
+    // Most items the buffer holds, one slot stays free to tell full from empty
+    static constexpr size_t capacity() {
+        return Size - 1;
+    }
+
     bool is_full() const {
         return ((_head.load(std::memory_order_acquire) + 1) & (Size - 1)) == _tail.load(std::memory_order_acquire);
     }
@@ -6,10 +6,20 @@
 #include "hardware/pwm.h"
 #include "dc_motors_control.hpp"
 #include "pico_native_pwm.hpp"
+#include "publish_buffer.hpp"
+#include "power_monitor.hpp"
+#include "emergency_stop.hpp"
+#include "irq_tiers.hpp"
 
 #define TIMER_INTERVAL_US 10000
 #define LEFT_MOTOR_INDEX 0
 #define RIGHT_MOTOR_INDEX 1
+#define DC_MOTORS_COUNT 2
+
+// A driven motor that keeps the load current above this is stalled. Both motors are stopped.
+// The motors are the biggest load on the supply, so they are cut before the servos.
+#define DC_MOTORS_STALL_CURRENT_MA 2500
+#define DC_MOTORS_STALL_TICKS 30
 
 // Define the GPIO pins for the motors
 const uint LEFT_MOTOR_FORWARD_PIN = 27;     // IN2
@@ -17,14 +27,53 @@ const uint LEFT_MOTOR_BACKWARD_PIN = 26;    // IN1
 const uint RIGHT_MOTOR_FORWARD_PIN = 14;    // IN4
 const uint RIGHT_MOTOR_BACKWARD_PIN = 15;   // IN3
 
-motor_direction_speed_t dc_motors_speeds[2] = {
-    { .direction = 0, .speed = 0, .timeout = 0 }, // Left motor
-    { .direction = 0, .speed = 0, .timeout = 0 }  // Right motor
+// Working state of the motors. Owned by the control tick.
+motor_direction_speed_t dc_motors_speeds[DC_MOTORS_COUNT] = {
+    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 }, // Left motor
+    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 }  // Right motor
 };
 
+// Speeds set by the command processing, taken over by the control tick.
+PublishedSetpoints<motor_direction_speed_t, DC_MOTORS_COUNT> dc_motors_setpoints;
+
 struct repeating_timer dc_motors_control_timer;
+irq_tick_t dc_motors_tick;
+
+// Emergency stops already applied to the working state.
+uint32_t dc_motors_stop_count = 0;
+
+// Ticks in a row over the stall current, and stalls detected since boot.
+uint16_t dc_motors_stall_ticks = 0;
+volatile uint32_t dc_motors_stall_cutoffs = 0;
+
+static bool __not_in_flash_func(is_dc_motor_driven)(const motor_direction_speed_t *motor)
+{
+    return motor->direction != 0 && motor->speed > 0 && motor->timeout > 0;
+}
+
+// Stops both motors until the next command for them.
+static void __not_in_flash_func(check_dc_motors_stall)()
+{
+    if (!dc_motors_running() || power_load_current_ma() < DC_MOTORS_STALL_CURRENT_MA)
+    {
+        dc_motors_stall_ticks = 0;
+        return;
+    }
+
+    if (++dc_motors_stall_ticks < DC_MOTORS_STALL_TICKS)
+    {
+        return;
+    }
+
+    dc_motors_stall_ticks = 0;
+    dc_motors_stall_cutoffs++;
+    for (int i = 0; i < DC_MOTORS_COUNT; i++)
+    {
+        dc_motors_speeds[i].timeout = 0;
+    }
+}
 
-void process_dc_motor_speed(
+void __not_in_flash_func(process_dc_motor_speed)(
     motor_direction_speed_t *motor,
     uint gpio_forward,
     uint gpio_backward,
@@ -68,17 +117,26 @@ void process_dc_motor_speed(
     set_pwm_duty_cycle_in_percent(pwm_index, motor->speed);
 }
 
-/*
- * @brief Callback function for the repeating timer.
- * * This function is the Interrupt Service Routine (ISR). It will be called automatically
- * by the hardware timer every 10ms.
- * * IMPORTANT: Keep ISRs short and fast. Avoid long delays, complex calculations,
- * or calling functions that are not interrupt-safe (like many stdio functions).
- * * @param t Pointer to the repeating_timer structure.
- * @return bool Must return true to continue the timer. Returning false would stop it.
- */
-bool dc_motors_timer_callback(struct repeating_timer *t)
+// One control tick: setpoints, emergency stop and stall checks, then the motor outputs.
+void __not_in_flash_func(process_dc_motors_tick)()
 {
+    dc_motors_setpoints.take(dc_motors_speeds);
+
+    // The outputs were cut in the receive path, stop the motors here as well.
+    uint32_t stop_count = emergency_stop_count();
+    if (stop_count != dc_motors_stop_count)
+    {
+        dc_motors_stop_count = stop_count;
+        for (int i = 0; i < DC_MOTORS_COUNT; i++)
+        {
+            dc_motors_speeds[i].timeout = 0;
+        }
+    }
+
+    check_dc_motors_stall();
+
+    begin_pwm_update();
+
     process_dc_motor_speed(
         &dc_motors_speeds[LEFT_MOTOR_INDEX],
         LEFT_MOTOR_FORWARD_PIN,
@@ -90,6 +148,30 @@ bool dc_motors_timer_callback(struct repeating_timer *t)
         RIGHT_MOTOR_BACKWARD_PIN,
         PWM_NUMBER_DC_MOTOR_RIGHT);
 
+    end_pwm_update();
+
+    // A stop that interrupted this tick must not be undone by it.
+    if (emergency_stop_count() != stop_count)
+    {
+        dc_motors_emergency_stop();
+    }
+}
+
+/*
+ * @brief Callback function for the repeating timer.
+ * * This function is the Interrupt Service Routine (ISR). It will be called automatically
+ * by the hardware timer every 10ms.
+ * * IMPORTANT: Keep ISRs short and fast. Avoid long delays, complex calculations,
+ * or calling functions that are not interrupt-safe (like many stdio functions).
+ * * @param t Pointer to the repeating_timer structure.
+ * @return bool Must return true to continue the timer. Returning false would stop it.
+ */
+bool __not_in_flash_func(dc_motors_timer_callback)(struct repeating_timer *t)
+{
+    (void)t;
+    uint32_t entered_us = irq_tick_begin(&dc_motors_tick);
+    process_dc_motors_tick();
+    irq_tick_end(&dc_motors_tick, entered_us);
     return true; // Keep the timer repeating
 }
 
@@ -112,8 +194,8 @@ void init_dc_motors()
     gpio_put(RIGHT_MOTOR_BACKWARD_PIN, 0);
 
     set_dc_motors_speed(
-        (motor_direction_speed_t){ .direction = 0, .speed = 0, .timeout = 0 }, // Left motor
-        (motor_direction_speed_t){ .direction = 0, .speed = 0, .timeout = 0 }  // Right motor
+        (motor_direction_speed_t){ .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 }, // Left motor
+        (motor_direction_speed_t){ .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 }  // Right motor
     );
     
     // Create a repeating timer that calls dc_motors_timer_callback.
@@ -121,25 +203,80 @@ void init_dc_motors()
     // A negative value means the timer will be fired relative to the previous scheduled fire time,
     // which is better for periodic tasks to avoid drift.
     // The last argument is a pointer where the SDK will store timer information.
+    irq_tick_start(&dc_motors_tick, TIMER_INTERVAL_US);
     add_repeating_timer_us(-TIMER_INTERVAL_US, dc_motors_timer_callback, NULL, &dc_motors_control_timer);
 }
 
 void set_dc_motors_speed(motor_direction_speed_t left, motor_direction_speed_t right)
 {
-    uint32_t saved = save_and_disable_interrupts();
-    
-    dc_motors_speeds[LEFT_MOTOR_INDEX] = left;
-    dc_motors_speeds[RIGHT_MOTOR_INDEX] = right;
-
-    restore_interrupts(saved);
+    // Both motors are taken over in the same tick.
+    dc_motors_setpoints.set(LEFT_MOTOR_INDEX, left);
+    dc_motors_setpoints.set(RIGHT_MOTOR_INDEX, right);
+    dc_motors_setpoints.publish();
 }
 
 void set_left_dc_motor_speed(motor_direction_speed_t speed)
 {
-    dc_motors_speeds[LEFT_MOTOR_INDEX] = speed;
+    dc_motors_setpoints.set(LEFT_MOTOR_INDEX, speed);
+    dc_motors_setpoints.publish();
 }
 
 void set_right_dc_motor_speed(motor_direction_speed_t speed)
 {
-    dc_motors_speeds[RIGHT_MOTOR_INDEX] = speed;
+    dc_motors_setpoints.set(RIGHT_MOTOR_INDEX, speed);
+    dc_motors_setpoints.publish();
+}
+
+void __not_in_flash_func(get_dc_motors_tick_state)(dc_motors_tick_state_t *state)
+{
+    dc_motors_setpoints.take(dc_motors_speeds);
+    state->left = dc_motors_speeds[LEFT_MOTOR_INDEX];
+    state->right = dc_motors_speeds[RIGHT_MOTOR_INDEX];
+    state->stall_ticks = dc_motors_stall_ticks;
+    state->stop_count = dc_motors_stop_count;
+}
+
+void __not_in_flash_func(set_dc_motors_tick_state)(const dc_motors_tick_state_t *state)
+{
+    dc_motors_speeds[LEFT_MOTOR_INDEX] = state->left;
+    dc_motors_speeds[RIGHT_MOTOR_INDEX] = state->right;
+    dc_motors_stall_ticks = state->stall_ticks;
+    dc_motors_stop_count = state->stop_count;
+}
+
+void get_dc_motors_speed(motor_direction_speed_t *left, motor_direction_speed_t *right)
+{
+    *left = dc_motors_speeds[LEFT_MOTOR_INDEX];
+    *right = dc_motors_speeds[RIGHT_MOTOR_INDEX];
+}
+
+bool __not_in_flash_func(dc_motors_running)()
+{
+    return is_dc_motor_driven(&dc_motors_speeds[LEFT_MOTOR_INDEX]) ||
+        is_dc_motor_driven(&dc_motors_speeds[RIGHT_MOTOR_INDEX]);
+}
+
+bool dc_motors_moving()
+{
+    // With the interrupts off the tick cannot run meanwhile. The speeds published but not taken
+    // over yet are taken here, as the next tick would.
+    uint32_t interrupts = save_and_disable_interrupts();
+    dc_motors_setpoints.take(dc_motors_speeds);
+    bool moving = dc_motors_running();
+    restore_interrupts(interrupts);
+    return moving;
+}
+
+uint32_t dc_motors_stall_count()
+{
+    return dc_motors_stall_cutoffs;
+}
+
+void __not_in_flash_func(dc_motors_emergency_stop)()
+{
+    // Both H-bridge inputs low stops the motor whatever the PWM output does.
+    gpio_put(LEFT_MOTOR_FORWARD_PIN, 0);
+    gpio_put(LEFT_MOTOR_BACKWARD_PIN, 0);
+    gpio_put(RIGHT_MOTOR_FORWARD_PIN, 0);
+    gpio_put(RIGHT_MOTOR_BACKWARD_PIN, 0);
 }
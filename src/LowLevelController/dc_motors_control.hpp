@@ -6,8 +6,41 @@
 #include "common_types.hpp"
 
 void init_dc_motors();
+
+// The work of one control tick, without the timer bookkeeping. The benchmarks run it with
+// interrupts disabled, so it cannot race the timer.
+void process_dc_motors_tick();
+// Working state of the control tick, saved and put back by the benchmark around each run.
+typedef struct
+{
+    motor_direction_speed_t left;
+    motor_direction_speed_t right;
+    uint16_t stall_ticks;
+    uint32_t stop_count;
+} dc_motors_tick_state_t;
+
+// Call with the interrupts disabled. Getting it takes the pending setpoints over first, as the tick would.
+void get_dc_motors_tick_state(dc_motors_tick_state_t *state);
+void set_dc_motors_tick_state(const dc_motors_tick_state_t *state);
+
 void set_dc_motors_speed(motor_direction_speed_t left, motor_direction_speed_t right);
 void set_left_dc_motor_speed(motor_direction_speed_t speed);
 void set_right_dc_motor_speed(motor_direction_speed_t speed);
 
+// Working state of the motors, as the control tick last left it.
+void get_dc_motors_speed(motor_direction_speed_t *left, motor_direction_speed_t *right);
+
+// Cuts the motor outputs at once. Safe to call from interrupts.
+// The control tick stops the motors on its next run, see emergency_stop.hpp.
+void dc_motors_emergency_stop();
+
+// True while the control tick drives either motor.
+bool dc_motors_running();
+
+// As dc_motors_running(), counting the speeds the control tick did not take over yet. Main loop only.
+bool dc_motors_moving();
+
+// Stalls detected since boot. Each stops both motors.
+uint32_t dc_motors_stall_count();
+
 #endif // DC_MOTORS_CONTROL_HPP
@@ -0,0 +1,46 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "dc_motors_control.hpp"
+#include "emergency_stop.hpp"
+
+// Updated by the SPI interrupt, read by the control ticks and the main loop.
+volatile uint32_t emergency_stops = 0;
+volatile uint32_t emergency_stop_last_latency_us = 0;
+volatile uint32_t emergency_stop_max_latency_us = 0;
+
+bool __not_in_flash_func(emergency_stop_receive)(const received_command_t &received)
+{
+    if (received.command.type != STOP_ALL_MOTORS_COMMAND)
+    {
+        return false;
+    }
+
+    dc_motors_emergency_stop();
+
+    uint32_t latency_us = time_us_32() - received.received_us;
+    emergency_stop_last_latency_us = latency_us;
+    if (latency_us > emergency_stop_max_latency_us)
+    {
+        emergency_stop_max_latency_us = latency_us;
+    }
+
+    // Last, the control ticks and the main loop act on the new count.
+    // The servo tick holds the servos, the DC tick keeps the motors stopped.
+    emergency_stops++;
+
+    return true;
+}
+
+uint32_t __not_in_flash_func(emergency_stop_count)()
+{
+    return emergency_stops;
+}
+
+void emergency_stop_get_status(emergency_stop_status_t *status)
+{
+    status->count = emergency_stops;
+    status->last_latency_us = emergency_stop_last_latency_us;
+    status->max_latency_us = emergency_stop_max_latency_us;
+}
@@ -0,0 +1,35 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef EMERGENCY_STOP_HPP
+#define EMERGENCY_STOP_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+
+// Priority commands are acted on in the SPI interrupt, as soon as their last byte is in,
+// instead of waiting behind the commands queue.
+//
+// STOP_ALL_MOTORS_COMMAND cuts the DC motor outputs right in the interrupt and holds the servos
+// from the next control tick. Every command queued before it counts as received before the stop,
+// the motion ones among them are dropped instead of being applied.
+
+typedef struct
+{
+    // Emergency stops since boot.
+    uint32_t count;
+
+    // From the last byte of the stop frame until the DC motor outputs were cut, in us.
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+} emergency_stop_status_t;
+
+// Called in the receive path for each frame. Returns true if the command was taken.
+bool emergency_stop_receive(const received_command_t &received);
+
+// Number of stops so far. A command received with an older count is from before a stop.
+uint32_t emergency_stop_count();
+
+void emergency_stop_get_status(emergency_stop_status_t *status);
+
+#endif // EMERGENCY_STOP_HPP
@@ -0,0 +1,180 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Cartesian motion of the arm in simulated time.
+//   1. Poses across the workspace solve, and the forward kinematics of the solution gives them back.
+//   2. Points out of reach, too far or too close to the shoulder, do not solve.
+//   3. The link lengths are the calibration of the positioning joints.
+//   4. A move past a joint limit stops at the last reachable pose, the joint at its limit.
+//   5. A Cartesian move stops the positioning joints jogging on their own.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "arm_kinematics.hpp"
+#include "common_types.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in servo_control.cpp, one entry per joint.
+extern motor_direction_speed_t servo_motor_speeds_array[];
+
+// A solution read back through the fixed-point forward kinematics lands this close.
+#define ROUND_TRIP_TOLERANCE_UM 200
+#define ROUND_TRIP_TOLERANCE_MDEG 200
+
+// The servos move in whole degrees, the tip lands this close to a goal.
+#define SERVO_STEP_TOLERANCE_UM 5000
+
+static void send_cartesian_move(int16_t x_mm, int16_t y_mm, int16_t z_mm, uint8_t speed_mm_s)
+{
+    uint8_t data[7] = {
+        (uint8_t)((uint16_t)x_mm >> 8), (uint8_t)x_mm,
+        (uint8_t)((uint16_t)y_mm >> 8), (uint8_t)y_mm,
+        (uint8_t)((uint16_t)z_mm >> 8), (uint8_t)z_mm,
+        speed_mm_s
+    };
+    sim_send_command(CARTESIAN_MOVE_COMMAND, data);
+}
+
+static void send_joint_jog(uint8_t type, int8_t direction, uint8_t speed, uint16_t timeout_ms)
+{
+    uint8_t data[7] = { (uint8_t)direction, speed, (uint8_t)(timeout_ms >> 8), (uint8_t)timeout_ms, 0, 0, 0 };
+    sim_send_command(type, data);
+}
+
+// Solves the pose and reads it back. False if it does not solve or lands off the pose.
+static bool round_trip(const arm_pose_t *pose)
+{
+    arm_joint_angles_t joints;
+    if (!arm_inverse_kinematics(pose, &joints))
+    {
+        return false;
+    }
+
+    arm_pose_t solved;
+    arm_forward_kinematics(&joints, &solved);
+    return abs(solved.x_um - pose->x_um) <= ROUND_TRIP_TOLERANCE_UM &&
+        abs(solved.y_um - pose->y_um) <= ROUND_TRIP_TOLERANCE_UM &&
+        abs(solved.z_um - pose->z_um) <= ROUND_TRIP_TOLERANCE_UM &&
+        abs(solved.pitch_mdeg - pose->pitch_mdeg) <= ROUND_TRIP_TOLERANCE_MDEG;
+}
+
+// Pose of the gripper tip now, from the servo positions.
+static void read_arm_pose(arm_pose_t *pose)
+{
+    arm_joint_angles_t joints = {};
+    const uint8_t servos[4] = { BASE_MOTOR_INDEX, SHOULDER_MOTOR_INDEX, ELBOW_MOTOR_INDEX, ARM_MOTOR_INDEX };
+    int32_t *angles[4] = { &joints.base_mdeg, &joints.shoulder_mdeg, &joints.elbow_mdeg, &joints.wrist_mdeg };
+    for (int i = 0; i < 4; i++)
+    {
+        const servo_info_t *info = get_servo_info(servos[i]);
+        int32_t offset = (int32_t)info->current_degrees * 1000 - (int32_t)info->degrees * 500;
+        *angles[i] = info->is_inverted ? -offset : offset;
+    }
+    joints.shoulder_mdeg += 90000;
+
+    arm_forward_kinematics(&joints, pose);
+}
+
+// The control tick takes the motion over first.
+static bool wait_for_cartesian_idle(uint32_t timeout_ms)
+{
+    sim_run_for_ms(50);
+    for (uint32_t elapsed = 0; elapsed < timeout_ms; elapsed += 10)
+    {
+        sim_run_for_ms(10);
+        if (!arm_cartesian_active())
+        {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Round trip\n");
+    // Poses of the arm leaning forward with the elbow up, the solution the inverse kinematics picks.
+    int solved = 0;
+    int poses = 0;
+    for (int32_t base = -60000; base <= 60000; base += 30000)
+    {
+        for (int32_t shoulder = 30000; shoulder <= 90000; shoulder += 15000)
+        {
+            for (int32_t elbow = -120000; elbow <= -30000; elbow += 30000)
+            {
+                for (int32_t wrist = -60000; wrist <= 0; wrist += 30000)
+                {
+                    arm_joint_angles_t angles = { .base_mdeg = base, .shoulder_mdeg = shoulder, .elbow_mdeg = elbow, .wrist_mdeg = wrist };
+                    arm_pose_t pose;
+                    arm_forward_kinematics(&angles, &pose);
+                    poses++;
+                    solved += round_trip(&pose) ? 1 : 0;
+                }
+            }
+        }
+    }
+    printf("    %d of %d poses\n", solved, poses);
+    sim_check(solved == poses, "every pose solves and reads back");
+    arm_joint_angles_t stretched = { .base_mdeg = 0, .shoulder_mdeg = 90000, .elbow_mdeg = 0, .wrist_mdeg = 0 };
+    arm_pose_t boot_pose;
+    arm_forward_kinematics(&stretched, &boot_pose);
+    sim_check(round_trip(&boot_pose), "arm stretched straight up, as it boots");
+
+    printf("Out of reach\n");
+    arm_joint_angles_t joints;
+    arm_pose_t too_far = { .x_um = 600000, .y_um = 0, .z_um = 70000, .pitch_mdeg = 0 };
+    sim_check(!arm_inverse_kinematics(&too_far, &joints), "past the stretched arm");
+    arm_pose_t too_close = { .x_um = 150000, .y_um = 0, .z_um = 70000, .pitch_mdeg = 0 };
+    sim_check(!arm_inverse_kinematics(&too_close, &joints), "wrist at the shoulder axis");
+
+    printf("Calibrated geometry\n");
+    arm_pose_t pose;
+    sim_check(set_servo_calibration_field(ELBOW_MOTOR_INDEX, SERVO_CALIBRATION_LINK_UM, 120000), "forearm link set");
+    arm_forward_kinematics(&stretched, &pose);
+    sim_check(abs(pose.z_um - (ARM_BASE_HEIGHT_UM + ARM_UPPER_LINK_UM + 120000 + ARM_GRIPPER_LINK_UM)) <= ROUND_TRIP_TOLERANCE_UM,
+        "stretched arm as long as the calibrated links");
+    arm_pose_t far = { .x_um = 0, .y_um = 360000, .z_um = 70000, .pitch_mdeg = 0 };
+    sim_check(round_trip(&far), "a point only the longer forearm reaches solves");
+    sim_check(!set_servo_calibration_field(ELBOW_MOTOR_INDEX, SERVO_CALIBRATION_LINK_UM, -1), "negative link refused");
+    restore_default_servo_calibration();
+    sim_check(!arm_inverse_kinematics(&far, &joints), "out of reach again with the defaults");
+
+    printf("Joint limits\n");
+    send_cartesian_move(150, 0, 250, 100);
+    sim_check(wait_for_cartesian_idle(5000), "move to the start point done");
+    read_arm_pose(&pose);
+    sim_check(abs(pose.x_um - 150000) <= SERVO_STEP_TOLERANCE_UM && abs(pose.z_um - 250000) <= SERVO_STEP_TOLERANCE_UM, "tip at the start point");
+
+    // With the gripper pointing up, a move down turns the wrist angle joint up. It may not go far.
+    int32_t wrist_degrees = get_servo_info(ARM_MOTOR_INDEX)->current_degrees;
+    sim_check(set_servo_calibration_field(ARM_MOTOR_INDEX, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, wrist_degrees + 5), "wrist limit set");
+    send_cartesian_move(150, 0, 50, 100);
+    sim_check(wait_for_cartesian_idle(5000), "move stops");
+    wrist_degrees = get_servo_info(ARM_MOTOR_INDEX)->current_degrees;
+    int32_t wrist_limit = get_servo_info(ARM_MOTOR_INDEX)->top_degrees_limit;
+    sim_check(wrist_degrees <= wrist_limit && wrist_degrees >= wrist_limit - 1, "wrist stopped at its limit");
+    read_arm_pose(&pose);
+    sim_check(pose.z_um < 250000 && pose.z_um > 50000 + SERVO_STEP_TOLERANCE_UM, "stopped on the way");
+    restore_default_servo_calibration();
+
+    printf("Jogging joints\n");
+    send_joint_jog(BASE_MOTOR_DIRECTION_COMMAND, 1, 100, 30000);
+    sim_run_for_ms(100);
+    sim_check(servo_motor_speeds_array[robot_joint_entry(BASE_MOTOR_INDEX)].speed != 0, "base jogging");
+    send_cartesian_move(150, 50, 250, 100);
+    sim_run_for_ms(50);
+    sim_check(servo_motor_speeds_array[robot_joint_entry(BASE_MOTOR_INDEX)].speed == 0, "jog stopped by the move");
+    sim_check(wait_for_cartesian_idle(5000), "move done");
+    read_arm_pose(&pose);
+    sim_check(abs(pose.x_um - 150000) <= SERVO_STEP_TOLERANCE_UM && abs(pose.y_um - 50000) <= SERVO_STEP_TOLERANCE_UM && abs(pose.z_um - 250000) <= SERVO_STEP_TOLERANCE_UM,
+        "tip at the goal");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
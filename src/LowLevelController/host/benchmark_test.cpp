@@ -0,0 +1,196 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// The benchmark on the simulated firmware. The simulated time does not move while code runs,
+// so the cycles are not checked, only that the runs leave the firmware as they found it.
+//   1. Every case runs the requested number of times.
+//   2. The PWM outputs are the same after the runs.
+//   3. The receive path case leaves the commands queue empty, nothing is dropped.
+//   4. BENCHMARK_COMMAND answers for each case asked and with the summary, and stops the motors.
+//   5. The main loop takes commands again after it.
+//   6. With a command queued behind it the request is refused, the command is run as sent.
+//   7. The servo tick runs leave the joints where they were and add nothing to a recording.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "benchmark.hpp"
+#include "pico_native_pwm.hpp"
+#include "dc_motors_control.hpp"
+#include "motion_recorder.hpp"
+#include "servo_control.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+#define RUNS 50
+
+// GPIOs of the first servo and of the left DC motor PWM.
+#define SERVO_GPIO 2
+#define DC_MOTOR_GPIO 21
+
+// Polls for the case responses up to the summary or the refusal, all of them, several can come
+// in one poll. Returns the number of cases answered, -1 without the summary.
+static int read_benchmark_responses(uint8_t cases[BENCHMARK_CASES_COUNT], uint8_t summary[7])
+{
+    int count = 0;
+    uint8_t frame[10];
+    size_t received = 0;
+    for (int poll = 0; poll < 500; poll++)
+    {
+        sim_run_for_ms(1);
+
+        uint8_t idle[32] = { 0 };
+        uint8_t miso[32];
+        sim_spi_transfer(idle, miso, sizeof(miso));
+        for (size_t i = 0; i < sizeof(miso); i++)
+        {
+            if (received == 0 && miso[i] != 0xA5)
+            {
+                continue;
+            }
+
+            frame[received++] = miso[i];
+            if (received < sizeof(frame))
+            {
+                continue;
+            }
+            received = 0;
+
+            uint8_t checksum = 0;
+            for (size_t j = 1; j < sizeof(frame) - 1; j++)
+            {
+                checksum ^= frame[j];
+            }
+            if (checksum != frame[sizeof(frame) - 1] || frame[1] != BENCHMARK_RESPONSE)
+            {
+                continue;
+            }
+
+            if (frame[2] == BENCHMARK_SUMMARY || frame[2] == BENCHMARK_REFUSED)
+            {
+                memcpy(summary, &frame[2], 7);
+                return count;
+            }
+
+            if (count < BENCHMARK_CASES_COUNT)
+            {
+                cases[count] = frame[2];
+            }
+            count++;
+        }
+    }
+
+    return -1;
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    uint16_t levels[PWMS_COUNT];
+    for (uint8_t i = 0; i < PWMS_COUNT; i++)
+    {
+        levels[i] = get_pwm_level(i);
+    }
+    uint16_t servo_output = sim_pwm_gpio_level(SERVO_GPIO);
+    uint16_t dc_motor_output = sim_pwm_gpio_level(DC_MOTOR_GPIO);
+    spi_transport_stats_t before;
+    spi_get_transport_stats(&before);
+
+    printf("Runs\n");
+    bool all_ran = true;
+    for (int i = 0; i < BENCHMARK_CASES_COUNT; i++)
+    {
+        benchmark_stats_t stats;
+        benchmark_run((benchmark_case_t)i, RUNS, &stats);
+        all_ran = all_ran && stats.iterations == RUNS && stats.min_cycles <= stats.max_cycles;
+    }
+    sim_check(all_ran, "every case run");
+
+    printf("Servo tick\n");
+    motion_record_start(0);
+    sim_run_for_ms(100);
+    motion_status_t recording;
+    get_motion_status(&recording);
+    int16_t degrees[SERVOS_COUNT];
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        degrees[i] = get_servo_info(i)->current_degrees;
+    }
+    benchmark_stats_t servo_stats;
+    benchmark_run(BENCHMARK_SERVO_TICK, RUNS, &servo_stats);
+    bool joints_kept = true;
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        joints_kept = joints_kept && get_servo_info(i)->current_degrees == degrees[i];
+    }
+    motion_status_t after_runs;
+    get_motion_status(&after_runs);
+    sim_check(servo_stats.iterations == RUNS && joints_kept, "joints where they were");
+    sim_check(recording.mode == MOTION_MODE_RECORDING && after_runs.mode == MOTION_MODE_RECORDING &&
+        after_runs.ticks == recording.ticks && after_runs.length == recording.length,
+        "recording kept its place");
+    motion_stop();
+    sim_run_for_ms(100);
+    benchmark_report(RUNS);
+    sim_run_for_ms(100);
+
+    printf("Outputs\n");
+    bool levels_kept = true;
+    for (uint8_t i = 0; i < PWMS_COUNT; i++)
+    {
+        levels_kept = levels_kept && get_pwm_level(i) == levels[i];
+    }
+    sim_check(levels_kept, "staged PWM levels kept");
+    sim_check(sim_pwm_gpio_level(SERVO_GPIO) == servo_output && sim_pwm_gpio_level(DC_MOTOR_GPIO) == dc_motor_output,
+        "PWM outputs kept");
+
+    printf("Commands queue\n");
+    spi_transport_stats_t after;
+    spi_get_transport_stats(&after);
+    sim_check(after.queued == 0 && after.queue_overflows == before.queue_overflows, "queue empty, nothing dropped");
+    sim_check(after.frames - before.frames == RUNS * (1 + BENCHMARK_BURST_COMMANDS) * 2,
+        "one frame per receive path run, a burst per burst run");
+
+    printf("Command\n");
+    uint8_t drive[7] = { 1, 40, 0x75, 0x30, 0, 0, 0 };
+    sim_send_command(LEFT_MOTOR_COMMAND, drive);
+    sim_run_for_ms(100);
+    bool was_running = dc_motors_running();
+
+    uint8_t cases[BENCHMARK_CASES_COUNT] = {};
+    uint8_t summary[7] = {};
+    uint8_t all_cases[7] = { 0, 0, RUNS, 0, 0, 0, 0 };
+    sim_send_command(BENCHMARK_COMMAND, all_cases);
+    sim_check(read_benchmark_responses(cases, summary) == BENCHMARK_CASES_COUNT, "a response per case");
+    sim_check(summary[1] == BENCHMARK_CORE_HOST && (summary[4] << 8 | summary[5]) == RUNS &&
+        summary[6] == BENCHMARK_BURST_COMMANDS, "summary with the core, runs and burst");
+    sim_run_for_ms(100);
+    sim_check(was_running && !dc_motors_running() && sim_pwm_gpio_level(DC_MOTOR_GPIO) == 0, "DC motors stopped");
+
+    uint8_t burst_only[7] = { 1u << BENCHMARK_COMMAND_BURST, 0, 0, 0, 0, 0, 0 };
+    sim_send_command(BENCHMARK_COMMAND, burst_only);
+    sim_check(read_benchmark_responses(cases, summary) == 1 && cases[0] == BENCHMARK_COMMAND_BURST &&
+        (summary[4] << 8 | summary[5]) == BENCHMARK_ITERATIONS, "only the cases asked, default runs");
+
+    sim_send_command(LEFT_MOTOR_COMMAND, drive);
+    sim_run_for_ms(100);
+    sim_check(dc_motors_running(), "commands taken again");
+
+    printf("Queued behind\n");
+    uint8_t both[2 * 8] = { BENCHMARK_COMMAND, 1u << BENCHMARK_COMMAND_BURST, 0, RUNS, 0, 0, 0, 0,
+                            RIGHT_MOTOR_COMMAND, 1, 30, 0x75, 0x30, 0, 0, 0 };
+    sim_spi_transfer(both, NULL, sizeof(both));
+    sim_check(read_benchmark_responses(cases, summary) == 0 && summary[0] == BENCHMARK_REFUSED && summary[1] == 1,
+        "refused with the command waiting");
+    sim_run_for_ms(100);
+    motor_direction_speed_t left;
+    motor_direction_speed_t right;
+    get_dc_motors_speed(&left, &right);
+    sim_check(right.speed == 30 && left.speed == 40, "queued command run, motors left as they were");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,90 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Several boards on one bus, in simulated time, from the side of board 0.
+//   1. A frame addressed to another board is dropped, one to this board or to all is applied.
+//   2. Motion commands sent while held wait for the start and are taken over together.
+//   3. While another board is selected, MISO stays quiet and the responses wait.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "servo_control.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define OTHER_BOARD_ADDRESS 3
+
+int main()
+{
+    uint8_t response[7];
+    uint8_t wheel[7] = { 1, 60, 0x75, 0x30, 0, 0, 0 };
+    uint8_t arm[7] = { 1, 50, 0x75, 0x30, 0, 0, 0 };
+    uint8_t stop[7] = { 0, 0, 0, 0, 0, 0, 0 };
+
+    sim_record_motion_starts();
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Addressed frames\n");
+    spi_transport_stats_t stats;
+    sim_send_command_to(LEFT_MOTOR_COMMAND, wheel, OTHER_BOARD_ADDRESS);
+    sim_run_for_ms(50);
+    spi_get_transport_stats(&stats);
+    sim_check(dc_motors_speeds[0].speed == 0, "frame for another board not applied");
+    sim_check(stats.other_board_frames == 1, "frame for another board counted");
+    sim_send_command_to(LEFT_MOTOR_COMMAND, wheel, BOARD_ADDRESS);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 60, "frame for this board applied");
+    sim_send_command(LEFT_MOTOR_COMMAND, stop);
+    sim_run_for_ms(50);
+    sim_send_command_to(LEFT_MOTOR_COMMAND, wheel, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 60, "broadcast frame applied");
+    sim_send_command(LEFT_MOTOR_COMMAND, stop);
+    sim_run_for_ms(50);
+
+    printf("Hold and start\n");
+    sim_record_motion_starts();
+    uint8_t hold[7] = { 1, 0, 0, 0, 0, 0, 0 };
+    uint8_t start[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    sim_send_command_to(SYNC_HOLD_COMMAND, hold, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(20);
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+    sim_send_command(BASE_MOTOR_DIRECTION_COMMAND, arm);
+    sim_run_for_ms(100);
+    sim_check(sim_wheel_started_us() == 0 && sim_arm_started_us() == 0, "held until the start");
+    uint64_t start_us = sim_time_us();
+    sim_send_command_to(SYNC_HOLD_COMMAND, start, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(100);
+    uint64_t wheel_started_us = sim_wheel_started_us();
+    uint64_t arm_started_us = sim_arm_started_us();
+    printf("    start at %llu us, wheel at %llu us, arm at %llu us\n", (unsigned long long)start_us,
+        (unsigned long long)wheel_started_us, (unsigned long long)arm_started_us);
+    sim_check(wheel_started_us != 0 && wheel_started_us - start_us <= 2 * SIM_CONTROL_TICK_US, "wheel taken over at the start");
+    sim_check(arm_started_us != 0 && arm_started_us - start_us <= 2 * SIM_CONTROL_TICK_US, "arm taken over at the start");
+    uint64_t apart_us = (wheel_started_us > arm_started_us) ? wheel_started_us - arm_started_us : arm_started_us - wheel_started_us;
+    sim_check(apart_us <= SIM_CONTROL_TICK_US, "taken over within one control tick");
+    sim_send_command(LEFT_MOTOR_COMMAND, stop);
+    sim_run_for_ms(50);
+
+    printf("Board select\n");
+    uint8_t select_other[7] = { OTHER_BOARD_ADDRESS, 0, 0, 0, 0, 0, 0 };
+    uint8_t select_this[7] = { BOARD_ADDRESS, 0, 0, 0, 0, 0, 0 };
+    uint8_t sync[7] = { 0x5A, 0, 0, 0, 0, 0, 0 };
+    sim_send_command_to(BOARD_SELECT_COMMAND, select_other, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(20);
+    sim_send_command(TIME_SYNC_COMMAND, sync);
+    sim_check(!sim_read_response(TIME_SYNC_RESPONSE, response, 100), "no response while another board is selected");
+    sim_send_command_to(BOARD_SELECT_COMMAND, select_this, BOARD_BROADCAST_ADDRESS);
+    sim_check(sim_read_response(TIME_SYNC_RESPONSE, response, 100), "response sent once selected again");
+    sim_check(response[0] == 0x5A, "the waiting response came out");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
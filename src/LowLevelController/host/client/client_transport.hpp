@@ -0,0 +1,32 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef CLIENT_TRANSPORT_HPP
+#define CLIENT_TRANSPORT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The link to the controller, as seen by the client: one full duplex transfer at a time.
+typedef struct
+{
+    // Clocks the bytes out and as many in. miso can be NULL. Returns false if the link failed.
+    bool (*transfer)(void *context, const uint8_t *mosi, uint8_t *miso, size_t length);
+
+    // Releases the link, can be NULL.
+    void (*close)(void *context);
+
+    void *context;
+} client_transport_t;
+
+// A spidev device, e.g. "/dev/spidev0.0", in SPI mode 0 with 8 bit words.
+// Each transfer is one chip select burst.
+bool client_transport_open_spidev(const char *device, uint32_t speed_hz, client_transport_t *transport);
+
+// A serial port, e.g. "/dev/ttyAMA0", raw 8N1 at one of the standard baud rates.
+// Each transfer goes out in the AA BB CC ... DD EE FF framing of uart_frame_parser.hpp. The bytes the
+// controller sent meanwhile come back as the MISO bytes, zeros when fewer arrived.
+bool client_transport_open_termios(const char *device, uint32_t baud, client_transport_t *transport);
+
+void client_transport_close(client_transport_t *transport);
+
+#endif // CLIENT_TRANSPORT_HPP
@@ -0,0 +1,127 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <string.h>
+#include "common_types.hpp"
+#include "response_decoder.hpp"
+
+// Size of the response starting at frame, 0 while too few bytes are there to tell.
+// SIZE_MAX for a burst header with a length out of range.
+static size_t response_size(const uint8_t *frame, size_t available)
+{
+    if (available < 2)
+    {
+        return 0;
+    }
+
+    if (frame[1] != REGISTER_BURST_RESPONSE)
+    {
+        return CLIENT_RESPONSE_FRAME_SIZE;
+    }
+
+    if (available < CLIENT_BURST_HEADER_SIZE)
+    {
+        return 0;
+    }
+
+    size_t length = (size_t)(frame[4] << 8 | frame[5]);
+    if (length > CLIENT_MAX_BURST_LENGTH)
+    {
+        return SIZE_MAX;
+    }
+
+    return CLIENT_BURST_HEADER_SIZE + length + 1;
+}
+
+static void deliver(response_decoder_t *decoder, const uint8_t *frame, size_t size,
+    response_handler_t handler, void *context)
+{
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < size - 1; i++)
+    {
+        checksum ^= frame[i];
+    }
+
+    if (checksum != frame[size - 1])
+    {
+        decoder->checksum_errors++;
+        return;
+    }
+
+    response_view_t response;
+    response.type = frame[1];
+    if (frame[1] == REGISTER_BURST_RESPONSE)
+    {
+        response.address = (uint16_t)(frame[2] << 8 | frame[3]);
+        response.length = (uint16_t)(size - CLIENT_BURST_HEADER_SIZE - 1);
+        response.data = &frame[CLIENT_BURST_HEADER_SIZE];
+    }
+    else
+    {
+        response.address = 0;
+        response.length = 7;
+        response.data = &frame[2];
+    }
+
+    decoder->responses++;
+    handler(context, response);
+}
+
+void response_decoder_reset(response_decoder_t *decoder)
+{
+    decoder->carried = 0;
+    decoder->responses = 0;
+    decoder->checksum_errors = 0;
+}
+
+void response_decoder_feed(response_decoder_t *decoder, const uint8_t *bytes, size_t length,
+    response_handler_t handler, void *context)
+{
+    size_t i = 0;
+
+    // The rest of a response cut at the end of the previous bytes, the only one copied.
+    while (decoder->carried > 0 && i < length)
+    {
+        size_t size = response_size(decoder->carry, decoder->carried);
+        if (size == SIZE_MAX)
+        {
+            decoder->checksum_errors++;
+            decoder->carried = 0;
+            break;
+        }
+
+        decoder->carry[decoder->carried++] = bytes[i++];
+        size = response_size(decoder->carry, decoder->carried);
+        if (size != 0 && size != SIZE_MAX && decoder->carried == size)
+        {
+            deliver(decoder, decoder->carry, size, handler, context);
+            decoder->carried = 0;
+        }
+    }
+
+    while (i < length)
+    {
+        if (bytes[i] != CLIENT_RESPONSE_SYNC_BYTE)
+        {
+            i++;
+            continue;
+        }
+
+        size_t size = response_size(&bytes[i], length - i);
+        if (size == SIZE_MAX)
+        {
+            decoder->checksum_errors++;
+            i++;
+            continue;
+        }
+
+        if (size == 0 || size > length - i)
+        {
+            memcpy(decoder->carry, &bytes[i], length - i);
+            decoder->carried = (uint32_t)(length - i);
+            return;
+        }
+
+        deliver(decoder, &bytes[i], size, handler, context);
+        i += size;
+    }
+}
@@ -0,0 +1,50 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef RESPONSE_DECODER_HPP
+#define RESPONSE_DECODER_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The responses on MISO, as spi_transport.cpp frames them: sync byte, type, 7 data bytes and the XOR
+// of type and data. A register burst, see register_map.hpp, has the address and length (big-endian)
+// after the type, then the payload and the XOR of everything from the type.
+// Everything between responses is idle filler and is skipped.
+#define CLIENT_RESPONSE_SYNC_BYTE 0xA5
+#define CLIENT_RESPONSE_FRAME_SIZE 10
+#define CLIENT_BURST_HEADER_SIZE 6
+
+// The whole register map is smaller. A longer length is a damaged header.
+#define CLIENT_MAX_BURST_LENGTH 1024
+#define CLIENT_MAX_RESPONSE_SIZE (CLIENT_BURST_HEADER_SIZE + CLIENT_MAX_BURST_LENGTH + 1)
+
+// A decoded response. The data is not copied: it points into the bytes given to the decoder, or into
+// the decoder for a response cut at the end of the previous bytes. Valid until the handler returns.
+typedef struct
+{
+    uint8_t type;           // response_type_t
+    const uint8_t *data;    // 7 bytes, or the burst payload.
+    uint16_t length;
+    uint16_t address;       // Register bursts only.
+} response_view_t;
+
+typedef void (*response_handler_t)(void *context, const response_view_t &response);
+
+typedef struct
+{
+    // Start of a response cut at the end of the previous bytes.
+    uint8_t carry[CLIENT_MAX_RESPONSE_SIZE];
+    uint32_t carried;
+
+    // Statistics.
+    uint32_t responses;
+    uint32_t checksum_errors;
+} response_decoder_t;
+
+void response_decoder_reset(response_decoder_t *decoder);
+
+// Decodes the bytes of one transfer, calling the handler for each response completed, in order.
+void response_decoder_feed(response_decoder_t *decoder, const uint8_t *bytes, size_t length,
+    response_handler_t handler, void *context);
+
+#endif // RESPONSE_DECODER_HPP
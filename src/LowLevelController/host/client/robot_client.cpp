@@ -0,0 +1,403 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <string.h>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "robot_client.hpp"
+
+#define CLIENT_FRAME_SIZE 8
+
+// More transfers in one flush only while the credits let frames out.
+#define CLIENT_MAX_TRANSFERS_PER_FLUSH 4
+
+// A credits answer not back after this many transfers was lost, e.g. behind a gap. Asked again.
+#define CLIENT_CREDITS_ANSWER_TRANSFERS 8
+
+// Everything queued gets the next sequence number, the transfers keep that order across the
+// commands and the setpoints. A setpoint set again moves to its new place.
+typedef struct
+{
+    bool pending;
+    uint64_t sequence;
+    uint8_t data[7];
+} setpoint_slot_t;
+
+typedef struct
+{
+    uint64_t sequence;
+    std::vector<uint8_t> frame;
+} queued_command_t;
+
+struct robot_client
+{
+    client_transport_t transport;
+    robot_client_config_t config;
+    response_handler_t handler;
+    void *context;
+
+    // Guards what the callers queue and the statistics.
+    std::mutex mutex;
+    std::deque<queued_command_t> commands;
+    setpoint_slot_t setpoints[COMMAND_TYPES_COUNT];
+    uint64_t next_sequence;
+    robot_client_stats_t stats;
+
+    // One flush at a time. The rest is only used while flushing.
+    std::mutex flush_mutex;
+    response_decoder_t decoder;
+    std::vector<uint8_t> mosi;
+    std::vector<uint8_t> miso;
+    bool credits_known;
+    uint32_t credits;
+    bool credits_asked;
+    uint32_t frames_since_ask;
+    uint32_t transfers_since_ask;
+
+    std::thread sender;
+    std::condition_variable wake;
+    bool running;
+    bool work_queued;
+};
+
+static void encode_frame(std::vector<uint8_t> &out, uint8_t type, const uint8_t data[7],
+    uint8_t address, bool execute_at, uint32_t execute_at_us)
+{
+    uint8_t flags = 0;
+    if (execute_at)
+    {
+        flags |= COMMAND_EXTENSION_EXECUTE_AT;
+    }
+    if (address != BOARD_BROADCAST_ADDRESS)
+    {
+        flags |= COMMAND_EXTENSION_ADDRESS;
+    }
+
+    out.push_back(flags != 0 ? (uint8_t)(type | COMMAND_EXTENSION_FLAG) : type);
+    out.insert(out.end(), data, data + 7);
+    if (flags == 0)
+    {
+        return;
+    }
+
+    // The fields in the order of the flag bits.
+    out.push_back(flags);
+    if (execute_at)
+    {
+        out.push_back((uint8_t)(execute_at_us >> 24));
+        out.push_back((uint8_t)(execute_at_us >> 16));
+        out.push_back((uint8_t)(execute_at_us >> 8));
+        out.push_back((uint8_t)execute_at_us);
+    }
+    if (address != BOARD_BROADCAST_ADDRESS)
+    {
+        out.push_back(address);
+    }
+}
+
+// Takes the credits answers, passes every response on.
+static void on_response(void *context, const response_view_t &response)
+{
+    robot_client_t *client = (robot_client_t *)context;
+    if (response.type == QUEUE_CREDITS_RESPONSE && client->credits_asked)
+    {
+        // The frames sent after the request may have taken some of the free entries.
+        uint32_t free_entries = response.data[0];
+        client->credits = (free_entries > client->frames_since_ask) ? free_entries - client->frames_since_ask : 0;
+        client->credits_known = true;
+        client->credits_asked = false;
+
+        std::lock_guard<std::mutex> lock(client->mutex);
+        client->stats.queue_overflows = (uint32_t)response.data[2] << 24 | (uint32_t)response.data[3] << 16 |
+            (uint32_t)response.data[4] << 8 | response.data[5];
+    }
+
+    if (client->handler != NULL)
+    {
+        client->handler(client->context, response);
+    }
+}
+
+void robot_client_default_config(robot_client_config_t *config)
+{
+    config->board_address = BOARD_BROADCAST_ADDRESS;
+    config->use_credits = true;
+    config->poll_bytes = 16;
+    config->max_transfer_bytes = 4096;
+}
+
+robot_client_t *robot_client_create(const client_transport_t &transport, const robot_client_config_t &config,
+    response_handler_t handler, void *context)
+{
+    robot_client_t *client = new robot_client_t();
+    client->transport = transport;
+    client->config = config;
+    client->handler = handler;
+    client->context = context;
+    memset(client->setpoints, 0, sizeof(client->setpoints));
+    client->next_sequence = 0;
+    memset(&client->stats, 0, sizeof(client->stats));
+    response_decoder_reset(&client->decoder);
+    client->credits_known = false;
+    client->credits = 0;
+    client->credits_asked = false;
+    client->frames_since_ask = 0;
+    client->transfers_since_ask = 0;
+    client->running = false;
+    client->work_queued = false;
+    return client;
+}
+
+void robot_client_destroy(robot_client_t *client)
+{
+    robot_client_stop(client);
+    client_transport_close(&client->transport);
+    delete client;
+}
+
+void robot_client_set_setpoint(robot_client_t *client, command_type_t type, const uint8_t data[7])
+{
+    if (type >= COMMAND_TYPES_COUNT)
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        setpoint_slot_t *slot = &client->setpoints[type];
+        if (slot->pending)
+        {
+            client->stats.setpoints_coalesced++;
+        }
+
+        memcpy(slot->data, data, 7);
+        slot->pending = true;
+        slot->sequence = client->next_sequence++;
+        client->work_queued = true;
+    }
+
+    client->wake.notify_one();
+}
+
+static void queue_command(robot_client_t *client, command_type_t type, const uint8_t data[7],
+    bool execute_at, uint32_t execute_at_us)
+{
+    queued_command_t command;
+    encode_frame(command.frame, (uint8_t)type, data, client->config.board_address, execute_at, execute_at_us);
+
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        command.sequence = client->next_sequence++;
+        client->commands.push_back(std::move(command));
+        client->work_queued = true;
+    }
+
+    client->wake.notify_one();
+}
+
+void robot_client_send(robot_client_t *client, command_type_t type, const uint8_t data[7])
+{
+    queue_command(client, type, data, false, 0);
+}
+
+void robot_client_send_at(robot_client_t *client, command_type_t type, const uint8_t data[7], uint32_t execute_at_us)
+{
+    queue_command(client, type, data, true, execute_at_us);
+}
+
+// Fills client->mosi with what fits the credits and the transfer. Returns the frames taken and
+// whether some were left behind.
+static uint32_t build_transfer(robot_client_t *client, bool *left_behind)
+{
+    uint32_t budget = client->config.use_credits ? (client->credits_known ? client->credits : 0) : UINT32_MAX;
+
+    // Room for the credits request and the poll.
+    size_t limit = client->config.max_transfer_bytes - CLIENT_FRAME_SIZE - client->config.poll_bytes;
+
+    std::lock_guard<std::mutex> lock(client->mutex);
+    client->mosi.clear();
+    uint32_t taken = 0;
+    while (taken < budget)
+    {
+        // The oldest of the next command and the pending setpoints.
+        int setpoint = -1;
+        for (int type = 0; type < COMMAND_TYPES_COUNT; type++)
+        {
+            const setpoint_slot_t *slot = &client->setpoints[type];
+            if (slot->pending && (setpoint < 0 || slot->sequence < client->setpoints[setpoint].sequence))
+            {
+                setpoint = type;
+            }
+        }
+
+        bool command = !client->commands.empty() &&
+            (setpoint < 0 || client->commands.front().sequence < client->setpoints[setpoint].sequence);
+        if (command)
+        {
+            const std::vector<uint8_t> &frame = client->commands.front().frame;
+            if (client->mosi.size() + frame.size() > limit)
+            {
+                break;
+            }
+
+            client->mosi.insert(client->mosi.end(), frame.begin(), frame.end());
+            client->commands.pop_front();
+        }
+        else if (setpoint >= 0)
+        {
+            if (client->mosi.size() + CLIENT_FRAME_SIZE + 1 + COMMAND_EXTENSION_ADDRESS_SIZE > limit)
+            {
+                break;
+            }
+
+            setpoint_slot_t *slot = &client->setpoints[setpoint];
+            encode_frame(client->mosi, (uint8_t)setpoint, slot->data, client->config.board_address, false, 0);
+            slot->pending = false;
+        }
+        else
+        {
+            break;
+        }
+
+        taken++;
+    }
+
+    *left_behind = !client->commands.empty();
+    for (int type = 0; type < COMMAND_TYPES_COUNT && !*left_behind; type++)
+    {
+        *left_behind = client->setpoints[type].pending;
+    }
+
+    // What is left waits for the credits, the sender asks again at its period.
+    client->work_queued = false;
+    client->stats.frames_sent += taken;
+    return taken;
+}
+
+bool robot_client_flush(robot_client_t *client)
+{
+    std::lock_guard<std::mutex> flush_lock(client->flush_mutex);
+
+    for (int transfer = 0; transfer < CLIENT_MAX_TRANSFERS_PER_FLUSH; transfer++)
+    {
+        bool left_behind = false;
+        uint32_t taken = build_transfer(client, &left_behind);
+
+        if (client->config.use_credits)
+        {
+            client->credits = (client->credits > taken) ? client->credits - taken : 0;
+            client->frames_since_ask += taken;
+
+            // One request out at a time, at the end so the answer counts every frame before it.
+            if (!client->credits_asked || client->transfers_since_ask >= CLIENT_CREDITS_ANSWER_TRANSFERS)
+            {
+                static const uint8_t no_data[7] = { 0 };
+                encode_frame(client->mosi, GET_QUEUE_CREDITS_COMMAND, no_data, client->config.board_address, false, 0);
+                client->credits_asked = true;
+                client->frames_since_ask = 0;
+                client->transfers_since_ask = 0;
+            }
+        }
+
+        client->mosi.insert(client->mosi.end(), client->config.poll_bytes, 0);
+        client->miso.resize(client->mosi.size());
+        if (!client->transport.transfer(client->transport.context, client->mosi.data(), client->miso.data(), client->mosi.size()))
+        {
+            return false;
+        }
+
+        client->transfers_since_ask++;
+        response_decoder_feed(&client->decoder, client->miso.data(), client->miso.size(), on_response, client);
+
+        {
+            std::lock_guard<std::mutex> lock(client->mutex);
+            client->stats.transfers++;
+            client->stats.responses = client->decoder.responses;
+            client->stats.checksum_errors = client->decoder.checksum_errors;
+            if (left_behind && client->config.use_credits && client->credits == 0)
+            {
+                client->stats.credit_stalls++;
+            }
+        }
+
+        if (!left_behind || (client->config.use_credits && client->credits == 0))
+        {
+            break;
+        }
+    }
+
+    return true;
+}
+
+static void sender_main(robot_client_t *client, uint32_t period_us)
+{
+    std::unique_lock<std::mutex> lock(client->mutex);
+    while (client->running)
+    {
+        client->wake.wait_for(lock, std::chrono::microseconds(period_us),
+            [client] { return client->work_queued || !client->running; });
+        if (!client->running)
+        {
+            break;
+        }
+
+        lock.unlock();
+        bool flushed = robot_client_flush(client);
+        lock.lock();
+
+        // A link that failed is tried again at the next period, not at once.
+        if (!flushed)
+        {
+            client->wake.wait_for(lock, std::chrono::microseconds(period_us), [client] { return !client->running; });
+        }
+    }
+}
+
+bool robot_client_start(robot_client_t *client, uint32_t period_us)
+{
+    std::lock_guard<std::mutex> lock(client->mutex);
+    if (client->running)
+    {
+        return false;
+    }
+
+    client->running = true;
+    client->sender = std::thread(sender_main, client, period_us);
+    return true;
+}
+
+void robot_client_stop(robot_client_t *client)
+{
+    {
+        std::lock_guard<std::mutex> lock(client->mutex);
+        if (!client->running)
+        {
+            return;
+        }
+        client->running = false;
+    }
+
+    client->wake.notify_one();
+    client->sender.join();
+}
+
+void robot_client_get_stats(robot_client_t *client, robot_client_stats_t *stats)
+{
+    std::lock_guard<std::mutex> lock(client->mutex);
+    *stats = client->stats;
+}
+
+void client_transport_close(client_transport_t *transport)
+{
+    if (transport->close != NULL)
+    {
+        transport->close(transport->context);
+    }
+
+    transport->transfer = NULL;
+    transport->close = NULL;
+    transport->context = NULL;
+}
@@ -0,0 +1,86 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef ROBOT_CLIENT_HPP
+#define ROBOT_CLIENT_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+#include "common_types.hpp"
+#include "client_transport.hpp"
+#include "response_decoder.hpp"
+
+// Host side of the LowLevelController protocol, with the command and response types of the
+// firmware's common_types.hpp.
+//
+// Commands are queued and go out in batches, many frames in one transfer. Setpoints are kept per
+// actuator, one per command type, and only the last one set goes out, so a fast caller does not
+// fill the controller's queue with values already replaced. With queue credits, see
+// GET_QUEUE_CREDITS_COMMAND, a batch is never larger than the room in the controller's queue.
+//
+// The responses come back on the same transfers and are decoded in place, see response_decoder.hpp.
+// The handler runs on the thread that flushes.
+
+typedef struct robot_client robot_client_t;
+
+typedef struct
+{
+    // Address of the board the commands are for, BOARD_BROADCAST_ADDRESS for every board.
+    uint8_t board_address;
+
+    // Pace the batches by the free entries the controller reports.
+    bool use_credits;
+
+    // Idle bytes after the commands of each transfer, to clock the responses out.
+    uint32_t poll_bytes;
+
+    // Longest transfer. spidev takes 4096 bytes by default.
+    uint32_t max_transfer_bytes;
+} robot_client_config_t;
+
+typedef struct
+{
+    uint32_t transfers;
+    uint32_t frames_sent;
+
+    // Setpoints replaced before they went out.
+    uint32_t setpoints_coalesced;
+
+    // Flushes that left commands waiting for credits.
+    uint32_t credit_stalls;
+
+    uint32_t responses;
+    uint32_t checksum_errors;
+
+    // Commands the controller dropped on a full queue, as it last reported.
+    uint32_t queue_overflows;
+} robot_client_stats_t;
+
+void robot_client_default_config(robot_client_config_t *config);
+
+// The client takes the transport over and closes it when destroyed.
+robot_client_t *robot_client_create(const client_transport_t &transport, const robot_client_config_t &config,
+    response_handler_t handler, void *context);
+void robot_client_destroy(robot_client_t *client);
+
+// Latest value for the actuator driven by the command type, e.g. LEFT_MOTOR_COMMAND.
+// Replaces the one not sent yet, and goes out after everything queued before this call.
+void robot_client_set_setpoint(robot_client_t *client, command_type_t type, const uint8_t data[7]);
+
+// Queues a command. Commands and setpoints go out in the order of the calls, commands are never coalesced.
+void robot_client_send(robot_client_t *client, command_type_t type, const uint8_t data[7]);
+
+// Queues a command to run at the given firmware time, see TIME_SYNC_COMMAND.
+void robot_client_send_at(robot_client_t *client, command_type_t type, const uint8_t data[7], uint32_t execute_at_us);
+
+// Sends what is pending on the caller's thread, in as few transfers as the credits allow.
+// Returns false if the transport failed.
+bool robot_client_flush(robot_client_t *client);
+
+// Flushes on a thread of its own, at once when something is queued and every period_us otherwise,
+// which also reads the responses.
+bool robot_client_start(robot_client_t *client, uint32_t period_us);
+void robot_client_stop(robot_client_t *client);
+
+void robot_client_get_stats(robot_client_t *client, robot_client_stats_t *stats);
+
+#endif // ROBOT_CLIENT_HPP
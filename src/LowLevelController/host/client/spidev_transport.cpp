@@ -0,0 +1,67 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/spi/spidev.h>
+#include "client_transport.hpp"
+
+typedef struct
+{
+    int fd;
+    uint32_t speed_hz;
+} spidev_link_t;
+
+static bool spidev_transfer(void *context, const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+    spidev_link_t *link = (spidev_link_t *)context;
+
+    struct spi_ioc_transfer transfer;
+    memset(&transfer, 0, sizeof(transfer));
+    transfer.tx_buf = (uintptr_t)mosi;
+    transfer.rx_buf = (uintptr_t)miso;
+    transfer.len = (uint32_t)length;
+    transfer.speed_hz = link->speed_hz;
+    transfer.bits_per_word = 8;
+
+    return ioctl(link->fd, SPI_IOC_MESSAGE(1), &transfer) >= 0;
+}
+
+static void spidev_close(void *context)
+{
+    spidev_link_t *link = (spidev_link_t *)context;
+    close(link->fd);
+    delete link;
+}
+
+bool client_transport_open_spidev(const char *device, uint32_t speed_hz, client_transport_t *transport)
+{
+    int fd = open(device, O_RDWR);
+    if (fd < 0)
+    {
+        perror(device);
+        return false;
+    }
+
+    uint8_t mode = SPI_MODE_0;
+    uint8_t bits = 8;
+    if (ioctl(fd, SPI_IOC_WR_MODE, &mode) < 0 ||
+        ioctl(fd, SPI_IOC_WR_BITS_PER_WORD, &bits) < 0 ||
+        ioctl(fd, SPI_IOC_WR_MAX_SPEED_HZ, &speed_hz) < 0)
+    {
+        perror(device);
+        close(fd);
+        return false;
+    }
+
+    spidev_link_t *link = new spidev_link_t;
+    link->fd = fd;
+    link->speed_hz = speed_hz;
+
+    transport->transfer = spidev_transfer;
+    transport->close = spidev_close;
+    transport->context = link;
+    return true;
+}
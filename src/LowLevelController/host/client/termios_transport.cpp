@@ -0,0 +1,143 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <vector>
+#include "uart_frame_parser.hpp"
+#include "client_transport.hpp"
+
+static const uint8_t start_marker[UART_FRAME_MARKER_LEN] = { 0xAA, 0xBB, 0xCC };
+static const uint8_t end_marker[UART_FRAME_MARKER_LEN] = { 0xDD, 0xEE, 0xFF };
+
+// How long a transfer waits for the bytes coming back, in tenths of a second as termios counts.
+#define TERMIOS_READ_TIMEOUT_DS 1
+
+typedef struct
+{
+    int fd;
+    std::vector<uint8_t> frame;
+} termios_link_t;
+
+static bool termios_transfer(void *context, const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+    termios_link_t *link = (termios_link_t *)context;
+
+    // Payload and end marker must fit the firmware parser.
+    if (length + UART_FRAME_MARKER_LEN > UART_FRAME_BUFFER_SIZE)
+    {
+        return false;
+    }
+
+    link->frame.assign(start_marker, start_marker + UART_FRAME_MARKER_LEN);
+    link->frame.insert(link->frame.end(), mosi, mosi + length);
+    link->frame.insert(link->frame.end(), end_marker, end_marker + UART_FRAME_MARKER_LEN);
+
+    size_t written = 0;
+    while (written < link->frame.size())
+    {
+        ssize_t count = write(link->fd, &link->frame[written], link->frame.size() - written);
+        if (count < 0)
+        {
+            return false;
+        }
+        written += (size_t)count;
+    }
+
+    if (miso == NULL)
+    {
+        return true;
+    }
+
+    // Whatever came back within the timeout.
+    size_t received = 0;
+    while (received < length)
+    {
+        ssize_t count = read(link->fd, &miso[received], length - received);
+        if (count < 0)
+        {
+            return false;
+        }
+        if (count == 0)
+        {
+            break;
+        }
+        received += (size_t)count;
+    }
+
+    memset(&miso[received], 0, length - received);
+    return true;
+}
+
+static void termios_close(void *context)
+{
+    termios_link_t *link = (termios_link_t *)context;
+    close(link->fd);
+    delete link;
+}
+
+static speed_t termios_speed(uint32_t baud)
+{
+    switch (baud)
+    {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 230400: return B230400;
+    case 460800: return B460800;
+    case 921600: return B921600;
+    default: return B0;
+    }
+}
+
+bool client_transport_open_termios(const char *device, uint32_t baud, client_transport_t *transport)
+{
+    speed_t speed = termios_speed(baud);
+    if (speed == B0)
+    {
+        fprintf(stderr, "%s: %u baud is not a standard rate\n", device, baud);
+        return false;
+    }
+
+    int fd = open(device, O_RDWR | O_NOCTTY);
+    if (fd < 0)
+    {
+        perror(device);
+        return false;
+    }
+
+    struct termios settings;
+    if (tcgetattr(fd, &settings) < 0)
+    {
+        perror(device);
+        close(fd);
+        return false;
+    }
+
+    cfmakeraw(&settings);
+    cfsetispeed(&settings, speed);
+    cfsetospeed(&settings, speed);
+    settings.c_cflag |= CLOCAL | CREAD;
+    settings.c_cc[VMIN] = 0;
+    settings.c_cc[VTIME] = TERMIOS_READ_TIMEOUT_DS;
+    if (tcsetattr(fd, TCSANOW, &settings) < 0)
+    {
+        perror(device);
+        close(fd);
+        return false;
+    }
+
+    tcflush(fd, TCIOFLUSH);
+
+    termios_link_t *link = new termios_link_t;
+    link->fd = fd;
+
+    transport->transfer = termios_transfer;
+    transport->close = termios_close;
+    transport->context = link;
+    return true;
+}
@@ -0,0 +1,70 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Emergency stop in simulated time, sent behind a full commands queue.
+//   1. The DC motor outputs are cut in the transfer that carries the stop.
+//   2. The motion commands queued before the stop are dropped, the ones after it run.
+//   3. A jogging servo holds.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define LEFT_MOTOR_FORWARD_GPIO 27
+#define QUEUED_COMMANDS 40
+
+int main()
+{
+    uint8_t response[7];
+
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("DC motors\n");
+    sim_send_motion_command(LEFT_MOTOR_COMMAND, 1, 80, 30000);
+    sim_run_for_ms(100);
+    sim_check(sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "left motor driven");
+
+    for (int i = 0; i < QUEUED_COMMANDS; i++)
+    {
+        sim_send_motion_command(LEFT_MOTOR_COMMAND, 1, (uint8_t)(10 + i), 30000);
+    }
+    sim_send_motion_command(STOP_ALL_MOTORS_COMMAND, 0, 0, 0);
+    sim_check(!sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "outputs cut in the stop transfer");
+
+    sim_run_for_ms(1000);
+    sim_check(!sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO) && dc_motors_speeds[0].speed == 0, "queued commands not applied");
+    sim_check(sim_read_response(EMERGENCY_STOP_RESPONSE, response, 400), "stop response received");
+    printf("    stops %u, latency %u us, max %u us, flushed %u\n",
+        sim_read_uint16(&response[0]), sim_read_uint16(&response[2]), sim_read_uint16(&response[4]), response[6]);
+    sim_check(sim_read_uint16(&response[0]) == 1, "one stop");
+    sim_check(response[6] == QUEUED_COMMANDS, "queued motion commands flushed");
+
+    sim_send_motion_command(LEFT_MOTOR_COMMAND, 1, 50, 30000);
+    sim_run_for_ms(100);
+    sim_check(sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "commands after the stop run");
+
+    printf("Servos\n");
+    sim_send_motion_command(BASE_MOTOR_DIRECTION_COMMAND, 1, 50, 30000);
+    sim_run_for_ms(300);
+    int16_t moving_from = get_servo_info(BASE_MOTOR_INDEX)->current_degrees;
+    sim_run_for_ms(300);
+    sim_check(get_servo_info(BASE_MOTOR_INDEX)->current_degrees != moving_from, "base servo moving");
+
+    sim_send_motion_command(STOP_ALL_MOTORS_COMMAND, 0, 0, 0);
+    sim_run_for_ms(20);
+    int16_t held_at = get_servo_info(BASE_MOTOR_INDEX)->current_degrees;
+    sim_run_for_ms(500);
+    sim_check(get_servo_info(BASE_MOTOR_INDEX)->current_degrees == held_at, "base servo holds");
+    sim_check(!sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "left motor stopped again");
+    sim_check(sim_read_response(EMERGENCY_STOP_RESPONSE, response, 400) && sim_read_uint16(&response[0]) == 2, "second stop reported");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,338 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Firmware update over SPI in simulated time, while the controller keeps running.
+//   1. Chunks packed with LZSS and raw ones are written to slot B, the motors still take commands.
+//      A chunk that needs a flash write is refused while a motor runs or a joint moves, also right
+//      after the command, before the control tick took it over.
+//   2. Damaged, repeated and out of order chunks are answered without breaking the transfer.
+//   3. A wrong SHA-256 is caught, the image then goes again under the right one.
+//   4. Activating marks the staged image and reboots.
+//   5. The installer copies slot B over slot A. After a power loss in the middle, the next boot goes on
+//      from the first sector not done, then slot A starts.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "pico/sha256.h"
+#include "common_types.hpp"
+#include "crc32.hpp"
+#include "update_agent.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+// main() of update_installer.cpp, as the bootloader starts it.
+int installer_main();
+
+#define IMAGE_SIZE (3 * FLASH_SECTOR_SIZE + 1000)
+
+static uint32_t random_state = 0x2545F491;
+
+typedef struct
+{
+    uint8_t state;
+    uint8_t result;
+    uint16_t next_chunk;
+    uint16_t chunks;
+} update_status_t;
+
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// Greedy LZSS in the format of update_agent.hpp, as the host packs the chunks.
+static std::vector<uint8_t> lzss_encode(const uint8_t *data, uint32_t size)
+{
+    std::vector<uint8_t> output;
+    uint32_t position = 0;
+    while (position < size)
+    {
+        size_t flags_index = output.size();
+        output.push_back(0);
+        for (int bit = 0; bit < 8 && position < size; bit++)
+        {
+            uint32_t best_length = 0;
+            uint32_t best_distance = 0;
+            for (uint32_t distance = 1; distance <= 4096 && distance <= position; distance++)
+            {
+                uint32_t length = 0;
+                while (length < 18 && position + length < size && data[position + length] == data[position + length - distance])
+                {
+                    length++;
+                }
+                if (length > best_length)
+                {
+                    best_length = length;
+                    best_distance = distance;
+                }
+            }
+
+            if (best_length < 3)
+            {
+                output[flags_index] |= (uint8_t)(1u << bit);
+                output.push_back(data[position++]);
+                continue;
+            }
+
+            output.push_back((uint8_t)((best_distance - 1) >> 4));
+            output.push_back((uint8_t)((best_distance - 1) << 4 | (best_length - 3)));
+            position += best_length;
+        }
+    }
+
+    return output;
+}
+
+// Runs at execute_at_us if given, otherwise right away.
+static void send_op(uint8_t op, const uint8_t *args, size_t length, uint32_t execute_at_us = 0)
+{
+    uint8_t data[7] = { op, 0, 0, 0, 0, 0, 0 };
+    memcpy(&data[1], args, length);
+    if (execute_at_us != 0)
+    {
+        sim_send_command_at(FIRMWARE_UPDATE_COMMAND, data, execute_at_us);
+        return;
+    }
+
+    sim_send_command(FIRMWARE_UPDATE_COMMAND, data);
+}
+
+// The transfer buffer in data frames, padded to whole frames. Returns the bytes sent.
+static std::vector<uint8_t> send_buffer(const std::vector<uint8_t> &bytes)
+{
+    std::vector<uint8_t> padded = bytes;
+    padded.resize((bytes.size() + FIRMWARE_UPDATE_DATA_SIZE - 1) / FIRMWARE_UPDATE_DATA_SIZE * FIRMWARE_UPDATE_DATA_SIZE, 0);
+    for (size_t i = 0; i < padded.size(); i += FIRMWARE_UPDATE_DATA_SIZE)
+    {
+        send_op(FIRMWARE_UPDATE_DATA, &padded[i], FIRMWARE_UPDATE_DATA_SIZE);
+    }
+
+    return padded;
+}
+
+static bool read_status(update_status_t *status)
+{
+    uint8_t response[7];
+    if (!sim_read_response(FIRMWARE_UPDATE_RESPONSE, response, 500))
+    {
+        return false;
+    }
+
+    status->state = response[0];
+    status->result = response[1];
+    status->next_chunk = (uint16_t)(response[2] << 8 | response[3]);
+    status->chunks = (uint16_t)(response[4] << 8 | response[5]);
+    return true;
+}
+
+static update_status_t begin(const uint8_t *sha256)
+{
+    send_buffer(std::vector<uint8_t>(sha256, sha256 + FIRMWARE_UPDATE_HASH_SIZE));
+    uint8_t args[4] = { (uint8_t)(IMAGE_SIZE >> 24), (uint8_t)(IMAGE_SIZE >> 16), (uint8_t)(IMAGE_SIZE >> 8), (uint8_t)IMAGE_SIZE };
+    send_op(FIRMWARE_UPDATE_BEGIN, args, sizeof(args));
+
+    update_status_t status = {};
+    read_status(&status);
+    return status;
+}
+
+static update_status_t send_chunk(const std::vector<uint8_t> &image, uint16_t index, bool packed, bool damage, uint32_t execute_at_us = 0)
+{
+    uint32_t offset = (uint32_t)index * FLASH_SECTOR_SIZE;
+    uint32_t size = (IMAGE_SIZE - offset < FLASH_SECTOR_SIZE) ? IMAGE_SIZE - offset : FLASH_SECTOR_SIZE;
+    std::vector<uint8_t> payload(&image[offset], &image[offset] + size);
+    if (packed)
+    {
+        // Random bytes grow when packed, those go raw as the host would send them.
+        std::vector<uint8_t> encoded = lzss_encode(&image[offset], size);
+        packed = encoded.size() < payload.size();
+        if (packed)
+        {
+            payload = encoded;
+        }
+    }
+
+    std::vector<uint8_t> chunk;
+    chunk.push_back(packed ? FIRMWARE_CHUNK_LZSS : FIRMWARE_CHUNK_RAW);
+    chunk.push_back((uint8_t)(payload.size() >> 8));
+    chunk.push_back((uint8_t)payload.size());
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+
+    // The CRC goes over the padded buffer, as the controller received it.
+    std::vector<uint8_t> padded = chunk;
+    padded.resize((chunk.size() + FIRMWARE_UPDATE_DATA_SIZE - 1) / FIRMWARE_UPDATE_DATA_SIZE * FIRMWARE_UPDATE_DATA_SIZE, 0);
+    uint32_t crc = crc32_update(0, padded.data(), (uint32_t)padded.size());
+    if (damage)
+    {
+        chunk[chunk.size() / 2] ^= 0x10;
+    }
+    send_buffer(chunk);
+
+    uint8_t args[6] = { (uint8_t)(index >> 8), (uint8_t)index, (uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc };
+    send_op(FIRMWARE_UPDATE_CHUNK, args, sizeof(args), execute_at_us);
+
+    update_status_t status = {};
+    read_status(&status);
+    return status;
+}
+
+static update_status_t send_simple_op(uint8_t op)
+{
+    send_op(op, NULL, 0);
+    update_status_t status = {};
+    read_status(&status);
+    return status;
+}
+
+int main()
+{
+    // Repeating text packs well, random bytes do not.
+    std::vector<uint8_t> image(IMAGE_SIZE);
+    const char *text = "LowLevelController servo and DC motor control loop. ";
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++)
+    {
+        image[i] = (i < 2 * FLASH_SECTOR_SIZE) ? (uint8_t)text[i % strlen(text)] : (uint8_t)next_random();
+    }
+
+    pico_sha256_state_t sha_state;
+    sha256_result_t sha256;
+    pico_sha256_start_blocking(&sha_state, SHA256_BIG_ENDIAN, false);
+    pico_sha256_update_blocking(&sha_state, image.data(), image.size());
+    pico_sha256_finish(&sha_state, &sha256);
+
+    uint8_t wrong_sha256[FIRMWARE_UPDATE_HASH_SIZE];
+    memcpy(wrong_sha256, sha256.bytes, sizeof(wrong_sha256));
+    wrong_sha256[0] ^= 0xFF;
+
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    // The running image and the installer, neither of them the new image.
+    for (uint32_t i = 0; i < UPDATE_SLOT_SIZE; i++)
+    {
+        sim_flash[UPDATE_SLOT_A_OFFSET + i] = (uint8_t)(i * 7);
+    }
+    std::vector<uint8_t> installer(UPDATE_INSTALLER_SIZE);
+    for (uint32_t i = 0; i < UPDATE_INSTALLER_SIZE; i++)
+    {
+        installer[i] = (uint8_t)(i * 13);
+    }
+    memcpy(&sim_flash[UPDATE_INSTALLER_OFFSET], installer.data(), installer.size());
+
+    printf("Transfer\n");
+    update_status_t status = begin(wrong_sha256);
+    sim_check(status.state == FIRMWARE_UPDATE_RECEIVING && status.result == FIRMWARE_UPDATE_OK, "begin accepted");
+    sim_check(status.chunks == 4 && status.next_chunk == 0, "four chunks expected");
+
+    status = send_chunk(image, 0, true, false);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 1, "packed chunk written");
+
+    uint8_t wheel[7] = { 1, 60, 0x75, 0x30, 0, 0, 0 };
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 60, "motor command applied during the update");
+    status = send_chunk(image, 1, true, false);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_MOVING && status.next_chunk == 1, "chunk refused while the motor runs");
+
+    wheel[1] = 0;
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+
+    // Scheduled for the same time, the chunk runs right behind the command in the same pass of the
+    // main loop, before the control tick took the command over.
+    wheel[1] = 60;
+    uint32_t execute_at_us = (uint32_t)sim_time_us() + 100000;
+    sim_send_command_at(LEFT_MOTOR_COMMAND, wheel, execute_at_us);
+    status = send_chunk(image, 1, true, false, execute_at_us);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_MOVING, "chunk refused right after a motor command");
+    wheel[1] = 0;
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+
+    uint8_t jog[7] = { 1, 100, 0x75, 0x30, 0, 0, 0 };
+    execute_at_us = (uint32_t)sim_time_us() + 100000;
+    sim_send_command_at(BASE_MOTOR_DIRECTION_COMMAND, jog, execute_at_us);
+    status = send_chunk(image, 1, true, false, execute_at_us);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_MOVING, "chunk refused right after a joint command");
+    jog[1] = 0;
+    sim_send_command(BASE_MOTOR_DIRECTION_COMMAND, jog);
+    sim_run_for_ms(50);
+
+    status = send_chunk(image, 1, true, false);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 2, "second packed chunk written");
+    status = send_chunk(image, 1, true, false);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 2, "repeated chunk taken again");
+    status = send_chunk(image, 3, false, false);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_ORDER && status.next_chunk == 2, "chunk ahead refused");
+    status = send_chunk(image, 2, false, true);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_CRC && status.next_chunk == 2, "damaged chunk refused");
+    status = send_chunk(image, 2, false, false);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 3, "raw chunk written");
+
+    status = begin(wrong_sha256);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 3, "begin again goes on where it stopped");
+    status = send_chunk(image, 3, true, false);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 4, "last chunk written");
+    sim_check(memcmp(&sim_flash[UPDATE_SLOT_B_OFFSET], image.data(), IMAGE_SIZE) == 0, "slot B holds the image");
+
+    printf("Verify\n");
+    status = send_simple_op(FIRMWARE_UPDATE_FINISH);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_HASH && status.state != FIRMWARE_UPDATE_VERIFIED, "wrong hash caught");
+    status = send_simple_op(FIRMWARE_UPDATE_ACTIVATE);
+    sim_check(status.result == FIRMWARE_UPDATE_ERROR_STATE && !sim_reboot_requested(), "unverified image not activated");
+
+    status = begin(sha256.bytes);
+    sim_check(status.state == FIRMWARE_UPDATE_RECEIVING && status.next_chunk == 0, "new hash starts over");
+    for (uint16_t index = 0; index < 4; index++)
+    {
+        status = send_chunk(image, index, true, false);
+    }
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.next_chunk == 4, "chunks sent again");
+    status = send_simple_op(FIRMWARE_UPDATE_FINISH);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.state == FIRMWARE_UPDATE_VERIFIED, "image verified");
+
+    printf("Activate\n");
+    status = send_simple_op(FIRMWARE_UPDATE_ACTIVATE);
+    sim_check(status.result == FIRMWARE_UPDATE_OK && status.state == FIRMWARE_UPDATE_ACTIVATING, "image activated");
+    sim_check(sim_reboot_requested(), "reboot requested");
+    const uint8_t activate[4] = { 'S', 'W', 'A', 'P' };
+    uint32_t record_offset = UPDATE_SLOT_B_OFFSET + UPDATE_MAX_IMAGE_SIZE;
+    sim_check(memcmp(&sim_flash[record_offset + 44], activate, sizeof(activate)) == 0, "record marked for the install");
+
+    printf("Install\n");
+    // Each sector takes an erase, a program and its progress mark. The power goes off right after
+    // the third sector is erased.
+    sim_flash_lose_power_after(2 * 3 + 1);
+    installer_main();
+    sim_flash_restore_power();
+    const uint8_t *progress = &sim_flash[UPDATE_PROGRESS_OFFSET];
+    sim_check(progress[0] == UPDATE_PROGRESS_DONE && progress[1] == UPDATE_PROGRESS_DONE && progress[2] != UPDATE_PROGRESS_DONE,
+        "two sectors installed before the power loss");
+    sim_check(memcmp(&sim_flash[UPDATE_SLOT_A_OFFSET], image.data(), 2 * FLASH_SECTOR_SIZE) == 0 &&
+        memcmp(&sim_flash[UPDATE_SLOT_A_OFFSET], image.data(), IMAGE_SIZE) != 0, "slot A half written");
+    sim_check(memcmp(&sim_flash[record_offset + 44], activate, sizeof(activate)) == 0, "record still marked");
+
+    // Only the two sectors left and the record erase, a sector written again would run out.
+    sim_flash_lose_power_after(2 * 3 + 1);
+    installer_main();
+    sim_flash_restore_power();
+    sim_check(memcmp(&sim_flash[UPDATE_SLOT_A_OFFSET], image.data(), IMAGE_SIZE) == 0, "next boot finishes the install");
+    sim_check(sim_flash[record_offset] == 0xFF && sim_flash[UPDATE_PROGRESS_OFFSET] == 0xFF, "record and progress erased");
+    sim_check(sim_chained_image() == XIP_BASE + UPDATE_SLOT_A_OFFSET, "slot A started");
+    sim_check(memcmp(&sim_flash[UPDATE_INSTALLER_OFFSET], installer.data(), installer.size()) == 0, "installer never written");
+
+    sim_flash_lose_power_after(0);
+    installer_main();
+    sim_flash_restore_power();
+    sim_check(memcmp(&sim_flash[UPDATE_SLOT_A_OFFSET], image.data(), IMAGE_SIZE) == 0, "nothing installed on the boot after");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,145 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Interrupt tiers in simulated time.
+//   1. Transport receive is the most urgent, then the outputs, then the control ticks.
+//   2. Undisturbed, no tick is late by a whole interval and the receive FIFO never fills.
+//   3. Interrupts held off, as by a flash erase, show up as late ticks, a late PWM wrap and a
+//      receive overrun. The frames that fit in the FIFO are still taken.
+//   4. Reading with reset clears the worst cases.
+
+#include <stdio.h>
+#include <string.h>
+#include "hardware/irq.h"
+#include "common_types.hpp"
+#include "irq_tiers.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define RESPONSE_SYNC_BYTE 0xA5
+#define RESPONSE_SIZE 10
+#define POLL_SIZE 32
+#define POLL_INTERVAL_US 20000
+
+typedef struct
+{
+    uint16_t latency;
+    uint16_t duration_us;
+    uint16_t misses;
+} tier_stats_t;
+
+static uint64_t last_frame_us = 0;
+
+static void on_pwm_frame(uint64_t time_us)
+{
+    last_frame_us = time_us;
+}
+
+// The tiers answer back to back, often within one poll, so all of them are taken from the stream.
+static bool read_stats(bool reset, tier_stats_t stats[IRQ_TIERS_COUNT])
+{
+    uint8_t data[7] = { (uint8_t)(reset ? 1 : 0), 0, 0, 0, 0, 0, 0 };
+    sim_send_command(GET_IRQ_STATS_COMMAND, data);
+
+    uint8_t frame[RESPONSE_SIZE];
+    size_t received = 0;
+    int tiers = 0;
+    for (int poll = 0; poll < 25 && tiers < IRQ_TIERS_COUNT; poll++)
+    {
+        sim_run_until(sim_time_us() + POLL_INTERVAL_US);
+
+        uint8_t idle[POLL_SIZE] = { 0 };
+        uint8_t miso[POLL_SIZE];
+        sim_spi_transfer(idle, miso, sizeof(miso));
+
+        for (size_t i = 0; i < sizeof(miso); i++)
+        {
+            if (received == 0 && miso[i] != RESPONSE_SYNC_BYTE)
+            {
+                continue;
+            }
+
+            frame[received++] = miso[i];
+            if (received < sizeof(frame))
+            {
+                continue;
+            }
+            received = 0;
+
+            uint8_t checksum = 0;
+            for (size_t j = 1; j < sizeof(frame) - 1; j++)
+            {
+                checksum ^= frame[j];
+            }
+
+            if (checksum != frame[sizeof(frame) - 1] || frame[1] != IRQ_STATS_RESPONSE || frame[2] >= IRQ_TIERS_COUNT)
+            {
+                continue;
+            }
+
+            tier_stats_t *tier = &stats[frame[2]];
+            tier->latency = (uint16_t)(frame[3] << 8 | frame[4]);
+            tier->duration_us = (uint16_t)(frame[5] << 8 | frame[6]);
+            tier->misses = (uint16_t)(frame[7] << 8 | frame[8]);
+            tiers++;
+        }
+    }
+
+    return tiers == IRQ_TIERS_COUNT;
+}
+
+int main()
+{
+    sim_set_pwm_frame_hook(on_pwm_frame);
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Priorities\n");
+    sim_check(sim_irq_priority(SPI0_IRQ) == IRQ_PRIORITY_TRANSPORT, "SPI receive on the transport tier");
+    sim_check(sim_irq_priority(PWM_IRQ_WRAP) == IRQ_PRIORITY_OUTPUT, "PWM wrap on the output tier");
+    sim_check(sim_irq_priority(DMA_IRQ_0) == IRQ_PRIORITY_OUTPUT, "servo DMA on the output tier");
+    sim_check(sim_irq_priority(TIMER0_IRQ_3) == IRQ_PRIORITY_CONTROL, "timer alarm on the control tier");
+    sim_check(IRQ_PRIORITY_TRANSPORT < IRQ_PRIORITY_OUTPUT && IRQ_PRIORITY_OUTPUT < IRQ_PRIORITY_CONTROL, "transport before output before control");
+
+    printf("Undisturbed\n");
+    tier_stats_t stats[IRQ_TIERS_COUNT];
+    sim_check(read_stats(true, stats), "stats of all tiers read and reset");
+    sim_run_for_ms(200);
+    memset(stats, 0, sizeof(stats));
+    sim_check(read_stats(false, stats), "stats of all tiers read");
+    sim_check(stats[IRQ_TIER_TRANSPORT].latency < 8 && stats[IRQ_TIER_TRANSPORT].misses == 0, "receive FIFO never full");
+    sim_check(stats[IRQ_TIER_OUTPUT].latency == 0, "PWM wrap handled at the frame boundary");
+    sim_check(stats[IRQ_TIER_CONTROL].latency < 10000 && stats[IRQ_TIER_CONTROL].misses == 0, "no control tick missed");
+
+    printf("Held off\n");
+    sim_check(read_stats(true, stats), "stats reset");
+
+    // Held from 1 ms after a frame boundary for 30 ms, the next wrap is handled 11 ms late.
+    sim_run_until(last_frame_us + 21000);
+    sim_hold_interrupts(30000);
+    uint8_t wheel[7] = { 1, 60, 0x75, 0x30, 0, 0, 0 };
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+
+    memset(stats, 0, sizeof(stats));
+    sim_check(read_stats(false, stats), "stats of all tiers read");
+    sim_check(stats[IRQ_TIER_TRANSPORT].latency == 8 && stats[IRQ_TIER_TRANSPORT].misses == 1, "full FIFO drained once, overrun counted");
+    sim_check(stats[IRQ_TIER_OUTPUT].latency >= 10900 && stats[IRQ_TIER_OUTPUT].latency <= 11000, "late PWM wrap measured");
+    sim_check(stats[IRQ_TIER_CONTROL].latency >= 20000 && stats[IRQ_TIER_CONTROL].misses >= 1, "late control ticks counted");
+    sim_check(dc_motors_speeds[0].speed == 60, "frame that fit in the FIFO applied");
+
+    printf("Reset\n");
+    sim_check(read_stats(true, stats), "stats read and reset");
+    sim_run_for_ms(200);
+    memset(stats, 0, sizeof(stats));
+    sim_check(read_stats(false, stats), "stats read again");
+    sim_check(stats[IRQ_TIER_TRANSPORT].misses == 0 && stats[IRQ_TIER_CONTROL].misses == 0, "misses cleared");
+    sim_check(stats[IRQ_TIER_OUTPUT].latency == 0 && stats[IRQ_TIER_CONTROL].latency < 10000, "worst latencies cleared");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,78 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Motion playback in simulated time.
+//   1. Playback moves the joints to the start pose of the recording at a limited rate, it does
+//      not jump there.
+//   2. Before each loop the joints go back to the start pose at the same rate.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "motion_recorder.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Joint moved in the recording, and how far.
+#define PLAYBACK_JOINT 0
+#define PLAYBACK_DEGREES 40
+
+// Largest change of the joint within one control tick, as seen by a sample every 10ms.
+static int32_t largest_step_for_ms(uint32_t ms)
+{
+    int32_t largest = 0;
+    int16_t degrees = get_servo_info(PLAYBACK_JOINT)->current_degrees;
+    for (uint32_t i = 0; i < ms / 10; i++)
+    {
+        sim_run_for_ms(10);
+        int32_t step = abs(get_servo_info(PLAYBACK_JOINT)->current_degrees - degrees);
+        largest = (step > largest) ? step : largest;
+        degrees = get_servo_info(PLAYBACK_JOINT)->current_degrees;
+    }
+
+    return largest;
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Record\n");
+    int16_t start = get_servo_info(PLAYBACK_JOINT)->current_degrees;
+    motion_record_start(0);
+    sim_run_for_ms(50);
+    for (int i = 1; i <= PLAYBACK_DEGREES; i++)
+    {
+        set_servo_position_in_degrees(PLAYBACK_JOINT, start + i);
+        sim_run_for_ms(10);
+    }
+    sim_run_for_ms(50);
+    motion_stop();
+    sim_run_for_ms(50);
+
+    motion_status_t status;
+    get_motion_status(&status);
+    sim_check(status.mode == MOTION_MODE_IDLE && status.ticks > PLAYBACK_DEGREES, "recorded");
+
+    printf("Start pose\n");
+    set_servo_position_in_degrees(PLAYBACK_JOINT, start - PLAYBACK_DEGREES);
+    motion_play(0, 100, false);
+    sim_check(largest_step_for_ms(200) <= 2 * MOTION_APPROACH_DEGREES_PER_TICK, "joint approaches the start pose");
+    sim_check(get_servo_info(PLAYBACK_JOINT)->current_degrees != start, "start pose not reached at once");
+    sim_run_for_ms(2000);
+    get_motion_status(&status);
+    sim_check(status.mode == MOTION_MODE_IDLE && get_servo_info(PLAYBACK_JOINT)->current_degrees == start + PLAYBACK_DEGREES,
+        "recording played to its end");
+
+    printf("Loop\n");
+    motion_play(0, 100, true);
+    sim_check(largest_step_for_ms(3000) <= 2 * MOTION_APPROACH_DEGREES_PER_TICK, "no jump back to the start pose");
+    get_motion_status(&status);
+    sim_check(status.mode == MOTION_MODE_PLAYING, "still looping");
+    motion_stop();
+    sim_run_for_ms(50);
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,637 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Replays recorded byte streams and fuzzed variants of them through the SPI and UART frame parsers.
+// Checks that the parsers never write outside their buffers, never get stuck and get back in step
+// within a bounded number of bytes. Reports the parse throughput.
+//
+// Usage:
+//   parser_fuzz [seed] [iterations]
+//   parser_fuzz --replay spi|uart <capture file>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include "spi_frame_parser.hpp"
+#include "uart_frame_parser.hpp"
+
+#define GUARD_SIZE 64
+#define GUARD_BYTE 0x5A
+
+// Time between bytes of one frame and between frames, in microseconds.
+#define BYTE_INTERVAL_US 16
+#define FRAME_INTERVAL_US 5000
+
+// Parsers wrapped in guard bytes. Any write outside the parser shows up in the guards.
+typedef struct
+{
+    uint8_t before[GUARD_SIZE];
+    spi_frame_parser_t parser;
+    uint8_t after[GUARD_SIZE];
+} guarded_spi_parser_t;
+
+typedef struct
+{
+    uint8_t before[GUARD_SIZE];
+    uart_frame_parser_t parser;
+    uint8_t after[GUARD_SIZE];
+} guarded_uart_parser_t;
+
+typedef struct
+{
+    uint8_t byte;
+    uint32_t time_us;
+} timed_byte_t;
+
+static uint32_t failures = 0;
+
+#define CHECK(condition, ...) \
+    do \
+    { \
+        if (!(condition)) \
+        { \
+            failures++; \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+// xorshift32, so a seed always gives the same streams.
+static uint32_t random_state = 1;
+
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+static uint32_t random_below(uint32_t limit)
+{
+    return next_random() % limit;
+}
+
+static bool guards_intact(const uint8_t *before, const uint8_t *after)
+{
+    for (int i = 0; i < GUARD_SIZE; i++)
+    {
+        if (before[i] != GUARD_BYTE || after[i] != GUARD_BYTE)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// --- SPI ---
+
+static void append_spi_frame(std::vector<uint8_t> &stream, const received_command_t &command)
+{
+    uint8_t type = (uint8_t)command.command.type;
+    if (command.extension_flags != 0)
+    {
+        type |= COMMAND_EXTENSION_FLAG;
+    }
+
+    stream.push_back(type);
+    stream.insert(stream.end(), command.command.data, command.command.data + 7);
+    if (command.extension_flags != 0)
+    {
+        stream.push_back(command.extension_flags);
+    }
+    if (command.extension_flags & COMMAND_EXTENSION_SEQUENCE)
+    {
+        stream.push_back((uint8_t)(command.sequence >> 8));
+        stream.push_back((uint8_t)command.sequence);
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            stream.push_back((uint8_t)(command.host_timestamp >> shift));
+        }
+    }
+    if (command.extension_flags & COMMAND_EXTENSION_EXECUTE_AT)
+    {
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            stream.push_back((uint8_t)(command.execute_at_us >> shift));
+        }
+    }
+    if (command.extension_flags & COMMAND_EXTENSION_ADDRESS)
+    {
+        stream.push_back(command.address);
+    }
+}
+
+static received_command_t random_spi_command()
+{
+    received_command_t command = {};
+    command.command.type = (command_type_t)(1 + random_below(COMMAND_TYPES_COUNT - 1));
+    for (int i = 0; i < 7; i++)
+    {
+        command.command.data[i] = (uint8_t)next_random();
+    }
+
+    // Any combination of the extension fields, or none.
+    command.address = BOARD_BROADCAST_ADDRESS;
+    command.extension_flags = (uint8_t)random_below(COMMAND_EXTENSION_KNOWN_FLAGS + 1);
+    if (command.extension_flags & COMMAND_EXTENSION_SEQUENCE)
+    {
+        command.sequence = (uint16_t)next_random();
+        command.host_timestamp = next_random();
+    }
+    if (command.extension_flags & COMMAND_EXTENSION_EXECUTE_AT)
+    {
+        command.execute_at_us = next_random();
+    }
+    if (command.extension_flags & COMMAND_EXTENSION_ADDRESS)
+    {
+        command.address = (uint8_t)next_random();
+    }
+
+    return command;
+}
+
+static bool same_command(const received_command_t &a, const received_command_t &b)
+{
+    return a.command.type == b.command.type &&
+           memcmp(a.command.data, b.command.data, 7) == 0 &&
+           a.extension_flags == b.extension_flags &&
+           a.sequence == b.sequence &&
+           a.host_timestamp == b.host_timestamp &&
+           a.execute_at_us == b.execute_at_us &&
+           a.address == b.address;
+}
+
+// Recorded session: commands, each in its own transfer, with all zero poll frames in between.
+static void record_spi_session(uint32_t frames, std::vector<timed_byte_t> &stream, std::vector<received_command_t> &commands)
+{
+    uint32_t now_us = 0;
+    for (uint32_t i = 0; i < frames; i++)
+    {
+        received_command_t command = {};
+        command.address = BOARD_BROADCAST_ADDRESS;
+        if (random_below(4) != 0)
+        {
+            command = random_spi_command();
+        }
+
+        std::vector<uint8_t> bytes;
+        append_spi_frame(bytes, command);
+        for (uint8_t byte : bytes)
+        {
+            stream.push_back({byte, now_us});
+            now_us += BYTE_INTERVAL_US;
+        }
+
+        commands.push_back(command);
+        now_us += FRAME_INTERVAL_US;
+    }
+}
+
+static uint32_t feed_spi(guarded_spi_parser_t &guarded, const std::vector<timed_byte_t> &stream, std::vector<received_command_t> *decoded)
+{
+    uint32_t frames = 0;
+    for (const timed_byte_t &timed : stream)
+    {
+        received_command_t received;
+        if (spi_frame_parser_feed(&guarded.parser, timed.byte, timed.time_us, &received))
+        {
+            frames++;
+            CHECK((received.command.type & COMMAND_EXTENSION_FLAG) == 0, "decoded type 0x%02X has the extension flag", received.command.type);
+            if (decoded != NULL)
+            {
+                decoded->push_back(received);
+            }
+        }
+
+        CHECK(guarded.parser.received_count < SPI_FRAME_MAX_SIZE, "received_count %u", guarded.parser.received_count);
+        CHECK(guarded.parser.message_length <= SPI_FRAME_MAX_SIZE, "message_length %u", guarded.parser.message_length);
+    }
+
+    return frames;
+}
+
+static void init_guarded_spi(guarded_spi_parser_t &guarded)
+{
+    memset(&guarded, GUARD_BYTE, sizeof(guarded));
+    spi_frame_parser_reset(&guarded.parser);
+}
+
+static void test_spi_replay()
+{
+    std::vector<timed_byte_t> stream;
+    std::vector<received_command_t> commands;
+    record_spi_session(1000, stream, commands);
+
+    guarded_spi_parser_t guarded;
+    init_guarded_spi(guarded);
+
+    std::vector<received_command_t> decoded;
+    feed_spi(guarded, stream, &decoded);
+
+    CHECK(decoded.size() == commands.size(), "spi replay decoded %zu of %zu frames", decoded.size(), commands.size());
+    for (size_t i = 0; i < decoded.size() && i < commands.size(); i++)
+    {
+        CHECK(same_command(decoded[i], commands[i]), "spi replay frame %zu differs", i);
+    }
+
+    CHECK(guarded.parser.dropped_bytes == 0 && guarded.parser.dropped_frames == 0, "spi replay dropped data");
+    CHECK(guards_intact(guarded.before, guarded.after), "spi replay wrote outside the parser");
+}
+
+// Frame cut short, the rest must not be taken as the start of the next frame.
+static void test_spi_truncated_frame()
+{
+    guarded_spi_parser_t guarded;
+    init_guarded_spi(guarded);
+
+    received_command_t command = random_spi_command();
+    std::vector<uint8_t> bytes;
+    append_spi_frame(bytes, command);
+
+    std::vector<timed_byte_t> stream;
+    uint32_t now_us = 0;
+    for (size_t i = 0; i < bytes.size() / 2; i++)
+    {
+        stream.push_back({bytes[i], now_us});
+        now_us += BYTE_INTERVAL_US;
+    }
+
+    now_us += FRAME_INTERVAL_US;
+    for (uint8_t byte : bytes)
+    {
+        stream.push_back({byte, now_us});
+        now_us += BYTE_INTERVAL_US;
+    }
+
+    std::vector<received_command_t> decoded;
+    feed_spi(guarded, stream, &decoded);
+    CHECK(decoded.size() == 1 && same_command(decoded[0], command), "spi truncated frame not recovered");
+    CHECK(guarded.parser.dropped_frames == 1, "spi truncated frame not counted");
+}
+
+// Applies a random mutation to a copy of the recorded stream.
+static std::vector<timed_byte_t> mutate_spi_stream(const std::vector<timed_byte_t> &stream)
+{
+    std::vector<timed_byte_t> mutated = stream;
+    uint32_t mutations = 1 + random_below(16);
+    for (uint32_t m = 0; m < mutations && !mutated.empty(); m++)
+    {
+        size_t at = random_below((uint32_t)mutated.size());
+        switch (random_below(5))
+        {
+            case 0: // Bit flip
+                mutated[at].byte ^= (uint8_t)(1 << random_below(8));
+                break;
+
+            case 1: // Lost byte
+                mutated.erase(mutated.begin() + at);
+                break;
+
+            case 2: // Extra byte with the same time stamp
+                mutated.insert(mutated.begin() + at, {(uint8_t)next_random(), mutated[at].time_us});
+                break;
+
+            case 3: // Garbage burst, takes the time of the bytes it replaces
+                for (uint32_t i = random_below(32); i > 0 && at < mutated.size(); i--, at++)
+                {
+                    mutated[at].byte = (uint8_t)next_random();
+                }
+                break;
+
+            case 4: // Stream cut off
+                mutated.resize(at);
+                break;
+        }
+    }
+
+    return mutated;
+}
+
+static void test_spi_fuzz(uint32_t iterations)
+{
+    uint32_t failures_before = failures;
+    for (uint32_t iteration = 0; iteration < iterations && failures == failures_before; iteration++)
+    {
+        std::vector<timed_byte_t> stream;
+        std::vector<received_command_t> commands;
+        record_spi_session(1 + random_below(64), stream, commands);
+        stream = mutate_spi_stream(stream);
+
+        guarded_spi_parser_t guarded;
+        init_guarded_spi(guarded);
+        feed_spi(guarded, stream, NULL);
+
+        // Resync bound: after the inter-frame gap the very next frame must decode exactly.
+        uint32_t now_us = (stream.empty() ? 0 : stream.back().time_us) + FRAME_INTERVAL_US;
+        received_command_t command = random_spi_command();
+        std::vector<uint8_t> bytes;
+        append_spi_frame(bytes, command);
+
+        std::vector<timed_byte_t> tail;
+        for (uint8_t byte : bytes)
+        {
+            tail.push_back({byte, now_us});
+            now_us += BYTE_INTERVAL_US;
+        }
+
+        std::vector<received_command_t> decoded;
+        feed_spi(guarded, tail, &decoded);
+        CHECK(decoded.size() == 1 && same_command(decoded[0], command), "spi fuzz iteration %u did not resync", iteration);
+        CHECK(guarded.parser.received_count == 0, "spi fuzz iteration %u left a partial frame", iteration);
+        CHECK(guards_intact(guarded.before, guarded.after), "spi fuzz iteration %u wrote outside the parser", iteration);
+    }
+}
+
+// --- UART ---
+
+static const uint8_t UART_START[] = {0xAA, 0xBB, 0xCC};
+static const uint8_t UART_END[] = {0xDD, 0xEE, 0xFF};
+
+static std::vector<uint8_t> random_uart_payload(uint32_t max_length)
+{
+    std::vector<uint8_t> payload(1 + random_below(max_length));
+    for (uint8_t &byte : payload)
+    {
+        // Payloads may contain marker bytes, just not the full end marker.
+        byte = (uint8_t)(0xA0 + random_below(0x60));
+    }
+
+    for (size_t i = 2; i < payload.size(); i++)
+    {
+        if (payload[i - 2] == 0xDD && payload[i - 1] == 0xEE && payload[i] == 0xFF)
+        {
+            payload[i] = 0x00;
+        }
+    }
+
+    return payload;
+}
+
+static void append_uart_message(std::vector<uint8_t> &stream, const std::vector<uint8_t> &payload)
+{
+    stream.insert(stream.end(), UART_START, UART_START + sizeof(UART_START));
+    stream.insert(stream.end(), payload.begin(), payload.end());
+    stream.insert(stream.end(), UART_END, UART_END + sizeof(UART_END));
+}
+
+static void init_guarded_uart(guarded_uart_parser_t &guarded)
+{
+    memset(&guarded, GUARD_BYTE, sizeof(guarded));
+    uart_frame_parser_reset(&guarded.parser);
+}
+
+static uint32_t feed_uart(guarded_uart_parser_t &guarded, const std::vector<uint8_t> &stream, std::vector<std::vector<uint8_t>> *decoded)
+{
+    uint32_t messages = 0;
+    for (uint8_t byte : stream)
+    {
+        uint32_t length = 0;
+        if (uart_frame_parser_feed(&guarded.parser, byte, &length))
+        {
+            messages++;
+            CHECK(length <= UART_FRAME_BUFFER_SIZE - UART_FRAME_MARKER_LEN, "uart message length %u", length);
+            if (decoded != NULL)
+            {
+                decoded->emplace_back(guarded.parser.buffer, guarded.parser.buffer + length);
+            }
+        }
+
+        CHECK(guarded.parser.buffer_idx <= UART_FRAME_BUFFER_SIZE, "uart buffer_idx %u", guarded.parser.buffer_idx);
+        CHECK(guarded.parser.marker_match_idx < UART_FRAME_MARKER_LEN, "uart marker_match_idx %u", guarded.parser.marker_match_idx);
+    }
+
+    return messages;
+}
+
+static void test_uart_replay()
+{
+    std::vector<uint8_t> stream;
+    std::vector<std::vector<uint8_t>> payloads;
+    for (int i = 0; i < 500; i++)
+    {
+        // Line noise and repeated marker bytes between the messages.
+        static const uint8_t noise[] = {0x00, 0xAA, 0xAA, 0xBB, 0xDD};
+        stream.insert(stream.end(), noise, noise + random_below(sizeof(noise) + 1));
+
+        payloads.push_back(random_uart_payload(64));
+        append_uart_message(stream, payloads.back());
+    }
+
+    guarded_uart_parser_t guarded;
+    init_guarded_uart(guarded);
+
+    std::vector<std::vector<uint8_t>> decoded;
+    feed_uart(guarded, stream, &decoded);
+    CHECK(decoded == payloads, "uart replay decoded %zu of %zu messages", decoded.size(), payloads.size());
+    CHECK(guards_intact(guarded.before, guarded.after), "uart replay wrote outside the parser");
+}
+
+// A message longer than the buffer is dropped and the one after it still decodes.
+static void test_uart_overflow()
+{
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> too_long(UART_FRAME_BUFFER_SIZE * 2, 0x11);
+    append_uart_message(stream, too_long);
+
+    std::vector<uint8_t> payload = random_uart_payload(32);
+    append_uart_message(stream, payload);
+
+    guarded_uart_parser_t guarded;
+    init_guarded_uart(guarded);
+
+    std::vector<std::vector<uint8_t>> decoded;
+    feed_uart(guarded, stream, &decoded);
+    CHECK(decoded.size() == 1 && decoded[0] == payload, "uart message after overflow not decoded");
+    CHECK(guarded.parser.overflows == 1, "uart overflow not counted");
+    CHECK(guards_intact(guarded.before, guarded.after), "uart overflow wrote outside the parser");
+}
+
+static void test_uart_fuzz(uint32_t iterations)
+{
+    uint32_t failures_before = failures;
+    for (uint32_t iteration = 0; iteration < iterations && failures == failures_before; iteration++)
+    {
+        std::vector<uint8_t> stream;
+        for (uint32_t i = random_below(8); i > 0; i--)
+        {
+            append_uart_message(stream, random_uart_payload(UART_FRAME_BUFFER_SIZE));
+        }
+
+        for (uint32_t m = 1 + random_below(16); m > 0 && !stream.empty(); m--)
+        {
+            size_t at = random_below((uint32_t)stream.size());
+            switch (random_below(4))
+            {
+                case 0:
+                    stream[at] ^= (uint8_t)(1 << random_below(8));
+                    break;
+
+                case 1:
+                    stream.erase(stream.begin() + at);
+                    break;
+
+                case 2:
+                    stream.insert(stream.begin() + at, (uint8_t)next_random());
+                    break;
+
+                case 3:
+                    stream.resize(at);
+                    break;
+            }
+        }
+
+        guarded_uart_parser_t guarded;
+        init_guarded_uart(guarded);
+        feed_uart(guarded, stream, NULL);
+
+        // Resync bound: an end marker closes whatever was started, then the next message decodes exactly.
+        std::vector<uint8_t> tail(UART_END, UART_END + sizeof(UART_END));
+        std::vector<uint8_t> payload = random_uart_payload(64);
+        append_uart_message(tail, payload);
+
+        std::vector<std::vector<uint8_t>> decoded;
+        feed_uart(guarded, tail, &decoded);
+        CHECK(!decoded.empty() && decoded.back() == payload, "uart fuzz iteration %u did not resync", iteration);
+        CHECK(guarded.parser.state == UART_FRAME_WAITING_FOR_START, "uart fuzz iteration %u stuck in a message", iteration);
+        CHECK(guards_intact(guarded.before, guarded.after), "uart fuzz iteration %u wrote outside the parser", iteration);
+    }
+}
+
+// --- Throughput ---
+
+static void report_throughput()
+{
+    std::vector<timed_byte_t> spi_stream;
+    std::vector<received_command_t> commands;
+    record_spi_session(100000, spi_stream, commands);
+
+    guarded_spi_parser_t spi;
+    init_guarded_spi(spi);
+
+    auto start = std::chrono::steady_clock::now();
+    uint32_t frames = 0;
+    for (const timed_byte_t &timed : spi_stream)
+    {
+        received_command_t received;
+        frames += spi_frame_parser_feed(&spi.parser, timed.byte, timed.time_us, &received);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("spi parser: %zu bytes, %u frames, %.1f MB/s\n", spi_stream.size(), frames, spi_stream.size() / seconds / 1e6);
+
+    std::vector<uint8_t> uart_stream;
+    for (int i = 0; i < 20000; i++)
+    {
+        append_uart_message(uart_stream, random_uart_payload(64));
+    }
+
+    guarded_uart_parser_t uart;
+    init_guarded_uart(uart);
+
+    start = std::chrono::steady_clock::now();
+    uint32_t messages = 0;
+    for (uint8_t byte : uart_stream)
+    {
+        uint32_t length;
+        messages += uart_frame_parser_feed(&uart.parser, byte, &length);
+    }
+    seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("uart parser: %zu bytes, %u messages, %.1f MB/s\n", uart_stream.size(), messages, uart_stream.size() / seconds / 1e6);
+}
+
+// Replays a raw capture, e.g. a logic analyzer export. An SPI capture has no timing, it is replayed as one transfer.
+static int replay_capture(const char *kind, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        printf("Cannot open %s\n", path);
+        return 2;
+    }
+
+    std::vector<uint8_t> bytes;
+    int ch;
+    while ((ch = fgetc(file)) != EOF)
+    {
+        bytes.push_back((uint8_t)ch);
+    }
+    fclose(file);
+
+    if (strcmp(kind, "spi") == 0)
+    {
+        std::vector<timed_byte_t> stream;
+        uint32_t now_us = 0;
+        for (uint8_t byte : bytes)
+        {
+            stream.push_back({byte, now_us});
+            now_us += BYTE_INTERVAL_US;
+        }
+
+        guarded_spi_parser_t guarded;
+        init_guarded_spi(guarded);
+        std::vector<received_command_t> decoded;
+        feed_spi(guarded, stream, &decoded);
+        for (const received_command_t &received : decoded)
+        {
+            printf("type %2d flags 0x%02X seq %5u data", received.command.type, received.extension_flags, received.sequence);
+            for (int i = 0; i < 7; i++)
+            {
+                printf(" %02X", received.command.data[i]);
+            }
+            printf("\n");
+        }
+        printf("%zu frames, %u dropped bytes, %u dropped frames\n", decoded.size(), guarded.parser.dropped_bytes, guarded.parser.dropped_frames);
+    }
+    else
+    {
+        guarded_uart_parser_t guarded;
+        init_guarded_uart(guarded);
+        std::vector<std::vector<uint8_t>> decoded;
+        feed_uart(guarded, bytes, &decoded);
+        for (const std::vector<uint8_t> &message : decoded)
+        {
+            printf("%zu bytes:", message.size());
+            for (uint8_t byte : message)
+            {
+                printf(" %02X", byte);
+            }
+            printf("\n");
+        }
+        printf("%zu messages, %u overflows\n", decoded.size(), guarded.parser.overflows);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 4 && strcmp(argv[1], "--replay") == 0)
+    {
+        return replay_capture(argv[2], argv[3]);
+    }
+
+    uint32_t seed = (argc > 1) ? (uint32_t)strtoul(argv[1], NULL, 0) : 0x12345678;
+    uint32_t iterations = (argc > 2) ? (uint32_t)strtoul(argv[2], NULL, 0) : 20000;
+    random_state = (seed != 0) ? seed : 1;
+    printf("seed 0x%08X, %u iterations\n", seed, iterations);
+
+    test_spi_replay();
+    test_spi_truncated_frame();
+    test_spi_fuzz(iterations);
+    test_uart_replay();
+    test_uart_overflow();
+    test_uart_fuzz(iterations);
+    report_throughput();
+
+    if (failures != 0)
+    {
+        printf("%u checks failed\n", failures);
+        return 1;
+    }
+
+    printf("All checks passed\n");
+    return 0;
+}
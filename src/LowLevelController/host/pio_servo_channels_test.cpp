@@ -0,0 +1,99 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// PIO servo engine built for 16 outputs, in simulated time.
+//   1. Distinct widths: one segment per output, each pin high for its own width.
+//   2. Equal widths share a segment, the frame is as short as the distinct widths allow.
+//   3. An output set to 0 stays low, the others keep their pulses.
+//   4. A joint can be remapped to the last output, not past it.
+
+#include <stdio.h>
+#include "common_types.hpp"
+#include "pico_native_pwm.hpp"
+#include "pio_servo_pwm.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+static const uint8_t servo_gpios[PIO_SERVOS_COUNT] = { PIO_SERVOS_GPIOS };
+
+static_assert(PIO_SERVOS_COUNT >= 16, "Built with fewer outputs than the test drives");
+
+static bool pulses_match(const uint16_t widths_us[PIO_SERVOS_COUNT])
+{
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        if (sim_pio_servo_pulse_ticks(servo_gpios[i]) != (uint32_t)widths_us[i] * PIO_SERVO_TICKS_PER_US)
+        {
+            printf("  output %u: %u ticks, expected %u\n", i, sim_pio_servo_pulse_ticks(servo_gpios[i]),
+                widths_us[i] * PIO_SERVO_TICKS_PER_US);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void set_widths(const uint16_t widths_us[PIO_SERVOS_COUNT])
+{
+    begin_pwm_update();
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        set_pwm_pulse_width_us(PIO_PWM_NUMBER_FIRST + i, widths_us[i]);
+    }
+    end_pwm_update();
+
+    // Taken over at the next frame, streamed from the one after.
+    sim_run_for_ms(2 * PWM_PERIOD / 1000);
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    uint16_t widths_us[PIO_SERVOS_COUNT];
+
+    printf("Distinct widths\n");
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        widths_us[i] = 500 + 100 * i;
+    }
+    set_widths(widths_us);
+    sim_check(sim_pio_servo_segments() == PIO_SERVOS_COUNT + 1, "one segment per output and the low one");
+    sim_check(pulses_match(widths_us), "every output its own width");
+
+    printf("Equal widths\n");
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        widths_us[i] = 1500;
+    }
+    set_widths(widths_us);
+    sim_check(sim_pio_servo_segments() == 2, "all outputs in one segment");
+    sim_check(pulses_match(widths_us), "same width on every output");
+
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        widths_us[i] = (i % 2 == 0) ? 1000 : 2000;
+    }
+    set_widths(widths_us);
+    sim_check(sim_pio_servo_segments() == 3, "one segment per distinct width");
+    sim_check(pulses_match(widths_us), "each group its width");
+
+    printf("Idle output\n");
+    widths_us[PIO_SERVOS_COUNT - 1] = 0;
+    set_widths(widths_us);
+    sim_check(sim_pio_servo_pulse_ticks(servo_gpios[PIO_SERVOS_COUNT - 1]) == 0, "output held low");
+    sim_check(pulses_match(widths_us), "other outputs kept");
+
+    printf("Remap\n");
+    sim_check(!set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_PWM_NUMBER, PIO_PWM_NUMBER_FIRST + PIO_SERVOS_COUNT),
+        "output past the last refused");
+    sim_check(set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_PWM_NUMBER, PIO_PWM_NUMBER_FIRST + PIO_SERVOS_COUNT - 1),
+        "remapped to the last output");
+    sim_run_for_ms(50);
+    sim_check(sim_pio_servo_pulse_ticks(servo_gpios[PIO_SERVOS_COUNT - 1]) != 0, "last output driven by the joint");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
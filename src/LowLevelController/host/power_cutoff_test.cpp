@@ -0,0 +1,86 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Power monitor and cut-offs in simulated time. The ADC inputs are driven with known voltages,
+// the readings come back in POWER_STATUS_RESPONSE over SPI.
+//   1. Battery and load current readings.
+//   2. A stalled DC motor is stopped.
+//   3. A servo pushing against something with the DC motors stopped makes all servos hold.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+#define LOAD_CURRENT_ADC_INPUT 2
+#define BATTERY_ADC_INPUT 3
+#define LEFT_MOTOR_FORWARD_GPIO 27
+
+// 500mV per ampere on the current sense, VSYS divided by 3.
+#define CURRENT_SENSE_MV(ma) ((ma) / 2)
+#define BATTERY_SENSE_MV(mv) ((mv) / 3)
+
+static bool read_power_status(uint8_t data[7])
+{
+    uint8_t request[7] = { 0 };
+    sim_send_command(GET_POWER_STATUS_COMMAND, request);
+    return sim_read_response(POWER_STATUS_RESPONSE, data, 400);
+}
+
+static bool near(uint16_t value, uint16_t expected, uint16_t tolerance)
+{
+    return value + tolerance >= expected && value <= expected + tolerance;
+}
+
+int main()
+{
+    uint8_t status[7];
+
+    sim_adc_set_millivolts(BATTERY_ADC_INPUT, BATTERY_SENSE_MV(4800));
+    sim_adc_set_millivolts(LOAD_CURRENT_ADC_INPUT, CURRENT_SENSE_MV(400));
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Readings\n");
+    sim_check(read_power_status(status), "power status received");
+    printf("    battery %u mV, load %u mA, peak %u mA, flags 0x%02X\n",
+        sim_read_uint16(&status[0]), sim_read_uint16(&status[2]), sim_read_uint16(&status[4]), status[6]);
+    sim_check(near(sim_read_uint16(&status[0]), 4800, 10), "battery voltage");
+    sim_check(near(sim_read_uint16(&status[2]), 400, 5), "load current");
+    sim_check(status[6] == 0, "no cut-offs");
+
+    printf("DC motor stall\n");
+    sim_send_motion_command(LEFT_MOTOR_COMMAND, 1, 80, 30000);
+    sim_run_for_ms(200);
+    sim_check(sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "left motor driven");
+    sim_adc_set_millivolts(LOAD_CURRENT_ADC_INPUT, CURRENT_SENSE_MV(3000));
+    sim_run_for_ms(250);
+    sim_check(sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "still driven before the stall time");
+    sim_run_for_ms(250);
+    sim_check(!sim_gpio_level(LEFT_MOTOR_FORWARD_GPIO), "left motor stopped");
+    sim_check(read_power_status(status), "power status received");
+    sim_check(status[6] == 0x01, "DC motors cut-off reported");
+    sim_check(near(sim_read_uint16(&status[4]), 3000, 5), "peak current held");
+    sim_check(read_power_status(status) && status[6] == 0 && near(sim_read_uint16(&status[4]), 3000, 5),
+        "reported once, peak restarted at the current level");
+
+    printf("Servo overcurrent\n");
+    sim_adc_set_millivolts(LOAD_CURRENT_ADC_INPUT, CURRENT_SENSE_MV(400));
+    sim_send_motion_command(BASE_MOTOR_DIRECTION_COMMAND, 1, 50, 30000);
+    sim_run_for_ms(300);
+    int16_t moving_from = get_servo_info(BASE_MOTOR_INDEX)->current_degrees;
+    sim_run_for_ms(300);
+    sim_check(get_servo_info(BASE_MOTOR_INDEX)->current_degrees != moving_from, "base servo moving");
+    sim_adc_set_millivolts(LOAD_CURRENT_ADC_INPUT, CURRENT_SENSE_MV(2500));
+    sim_run_for_ms(700);
+    int16_t held_at = get_servo_info(BASE_MOTOR_INDEX)->current_degrees;
+    sim_run_for_ms(500);
+    sim_check(get_servo_info(BASE_MOTOR_INDEX)->current_degrees == held_at, "base servo holds");
+    sim_check(read_power_status(status), "power status received");
+    sim_check(status[6] == 0x02, "servos cut-off reported");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,273 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Commands queue credits in simulated time.
+//   1. An idle board reports the whole queue free.
+//   2. The free entries are counted when the request arrives, the frames in front of it taken.
+//   3. A sender ignoring the credits overruns the queue, the drops are reported.
+//   4. A sender spending only the credits it was given sends as fast as the main loop takes
+//      the commands, in batches as large as the free entries, and nothing is dropped.
+//   5. Sequenced commands sent while the host reads no responses wait in the queue once the
+//      responses queue is short of room for their echoes, none of these is dropped. The boot
+//      profile asked for behind them, taken when there is room for a few of its responses
+//      only, comes whole as room frees up.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "common_types.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define PACED_COMMANDS 1000
+#define SEQUENCED_COMMANDS 40
+
+typedef struct
+{
+    uint8_t free_entries;
+    uint8_t capacity;
+    uint32_t overflows;
+} credits_t;
+
+static void put_wheel_command(std::vector<uint8_t> &transfer, uint8_t speed)
+{
+    uint8_t frame[8] = { LEFT_MOTOR_COMMAND, 1, speed, 0x75, 0x30, 0, 0, 0 };
+    transfer.insert(transfer.end(), frame, frame + sizeof(frame));
+}
+
+static void put_credits_request(std::vector<uint8_t> &transfer)
+{
+    uint8_t frame[8] = { GET_QUEUE_CREDITS_COMMAND, 0, 0, 0, 0, 0, 0, 0 };
+    transfer.insert(transfer.end(), frame, frame + sizeof(frame));
+}
+
+// Waits for the answer to a request already sent.
+static bool read_credits(credits_t *credits)
+{
+    uint8_t data[7];
+    if (!sim_read_response(QUEUE_CREDITS_RESPONSE, data, 100))
+    {
+        return false;
+    }
+
+    credits->free_entries = data[0];
+    credits->capacity = data[1];
+    credits->overflows = sim_read_uint32(&data[2]);
+    return true;
+}
+
+static void put_sequenced_wheel_command(std::vector<uint8_t> &transfer, uint8_t speed, uint16_t sequence)
+{
+    uint8_t frame[8 + 1 + COMMAND_EXTENSION_SEQUENCE_SIZE] = {
+        LEFT_MOTOR_COMMAND | COMMAND_EXTENSION_FLAG, 1, speed, 0x75, 0x30, 0, 0, 0,
+        COMMAND_EXTENSION_SEQUENCE, (uint8_t)(sequence >> 8), (uint8_t)sequence, 0, 0, 0, 0
+    };
+    transfer.insert(transfer.end(), frame, frame + sizeof(frame));
+}
+
+typedef struct
+{
+    int echoes;
+    int applied;
+    int boot_stages;
+
+    // Frame read so far, frames may be split over polls.
+    uint8_t frame[10];
+    size_t received;
+} response_reader_t;
+
+// Clocks out the given number of bytes and counts the responses in them.
+static void read_responses(response_reader_t *reader, size_t bytes)
+{
+    uint8_t idle[64] = { 0 };
+    uint8_t miso[64];
+    sim_spi_transfer(idle, miso, bytes);
+    for (size_t i = 0; i < bytes; i++)
+    {
+        if (reader->received == 0 && miso[i] != 0xA5)
+        {
+            continue;
+        }
+
+        reader->frame[reader->received++] = miso[i];
+        if (reader->received < sizeof(reader->frame))
+        {
+            continue;
+        }
+        reader->received = 0;
+
+        uint8_t checksum = 0;
+        for (size_t j = 1; j < sizeof(reader->frame) - 1; j++)
+        {
+            checksum ^= reader->frame[j];
+        }
+        if (checksum != reader->frame[sizeof(reader->frame) - 1])
+        {
+            continue;
+        }
+
+        reader->echoes += (reader->frame[1] == COMMAND_ECHO_RESPONSE);
+        reader->applied += (reader->frame[1] == COMMAND_APPLIED_RESPONSE);
+        reader->boot_stages += (reader->frame[1] == BOOT_PROFILE_RESPONSE);
+    }
+}
+
+// Polls until the echoes and applied responses of the given number of commands and the whole
+// boot profile came, several in each poll.
+static bool read_sequence_responses(int expected, response_reader_t *reader)
+{
+    for (int poll = 0; poll < 1000 &&
+        (reader->echoes < expected || reader->applied < expected || reader->boot_stages < BOOT_STAGES_COUNT); poll++)
+    {
+        sim_run_for_ms(1);
+        read_responses(reader, 64);
+    }
+
+    return reader->echoes == expected && reader->applied == expected && reader->boot_stages == BOOT_STAGES_COUNT;
+}
+
+static bool wait_for_empty_queue(credits_t *credits)
+{
+    for (int i = 0; i < 100; i++)
+    {
+        std::vector<uint8_t> transfer;
+        put_credits_request(transfer);
+        sim_spi_transfer(transfer.data(), NULL, transfer.size());
+        if (!read_credits(credits))
+        {
+            return false;
+        }
+
+        if (credits->free_entries == credits->capacity)
+        {
+            return true;
+        }
+
+        sim_run_for_ms(10);
+    }
+
+    return false;
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Idle\n");
+    std::vector<uint8_t> transfer;
+    put_credits_request(transfer);
+    sim_spi_transfer(transfer.data(), NULL, transfer.size());
+    credits_t credits = {};
+    sim_check(read_credits(&credits), "credits answered");
+    sim_check(credits.capacity > 0 && credits.free_entries == credits.capacity, "whole queue free");
+    sim_check(credits.overflows == 0, "nothing dropped");
+    uint8_t capacity = credits.capacity;
+
+    printf("Counted at the request\n");
+    transfer.clear();
+    for (int i = 0; i < 10; i++)
+    {
+        put_wheel_command(transfer, 10);
+    }
+    put_credits_request(transfer);
+    sim_spi_transfer(transfer.data(), NULL, transfer.size());
+    sim_check(read_credits(&credits) && credits.free_entries == capacity - 10, "frames in front of the request taken");
+
+    printf("Unpaced sender\n");
+    sim_check(wait_for_empty_queue(&credits), "queue taken by the main loop");
+    uint32_t overflows = credits.overflows;
+    transfer.clear();
+    for (int i = 0; i < capacity + 17; i++)
+    {
+        put_wheel_command(transfer, 20);
+    }
+    put_credits_request(transfer);
+    sim_spi_transfer(transfer.data(), NULL, transfer.size());
+    sim_check(read_credits(&credits) && credits.free_entries == 0, "queue full");
+    sim_check(credits.overflows == overflows + 17, "commands past the capacity dropped and counted");
+    overflows = credits.overflows;
+
+    printf("Paced sender\n");
+    sim_check(wait_for_empty_queue(&credits), "queue taken by the main loop");
+    spi_transport_stats_t before;
+    spi_get_transport_stats(&before);
+    int sent = 0;
+    int batches = 0;
+    int largest_batch = 0;
+    bool answered = true;
+    while (sent < PACED_COMMANDS && answered)
+    {
+        // Each batch spends the credits and asks for the next ones in the same transfer.
+        int batch = credits.free_entries;
+        if (batch > PACED_COMMANDS - sent)
+        {
+            batch = PACED_COMMANDS - sent;
+        }
+
+        transfer.clear();
+        for (int i = 0; i < batch; i++)
+        {
+            put_wheel_command(transfer, (uint8_t)((sent + i) % 50));
+        }
+        put_credits_request(transfer);
+        sim_spi_transfer(transfer.data(), NULL, transfer.size());
+
+        sent += batch;
+        batches++;
+        if (batch > largest_batch)
+        {
+            largest_batch = batch;
+        }
+        answered = read_credits(&credits);
+    }
+    bool drained = wait_for_empty_queue(&credits);
+
+    spi_transport_stats_t after;
+    spi_get_transport_stats(&after);
+    sim_check(answered && sent == PACED_COMMANDS, "every batch answered with credits");
+    sim_check(credits.overflows == overflows && after.queue_overflows == before.queue_overflows, "nothing dropped");
+    sim_check(largest_batch > 1 && batches < PACED_COMMANDS, "batches as large as the credits");
+    sim_check(drained && dc_motors_speeds[0].speed == (PACED_COMMANDS - 1) % 50, "last command applied");
+    printf("  %d commands in %d batches, up to %d each\n", sent, batches, largest_batch);
+
+    printf("Responses not read\n");
+    sim_check(wait_for_empty_queue(&credits), "queue taken by the main loop");
+    std::vector<uint8_t> sequenced;
+    for (int i = 0; i < SEQUENCED_COMMANDS; i++)
+    {
+        put_sequenced_wheel_command(sequenced, (uint8_t)i, (uint16_t)i);
+    }
+    uint8_t boot_profile[8] = { GET_BOOT_PROFILE_COMMAND, 0, 0, 0, 0, 0, 0, 0 };
+    sequenced.insert(sequenced.end(), boot_profile, boot_profile + sizeof(boot_profile));
+    spi_get_transport_stats(&before);
+    sim_spi_transfer(sequenced.data(), NULL, sequenced.size());
+    sim_run_for_ms(1000);
+    spi_transport_stats_t waiting;
+    spi_get_transport_stats(&waiting);
+    sim_check(waiting.queued > 0 && waiting.queued <= SEQUENCED_COMMANDS, "commands wait for room for their responses");
+
+    // One response at a time, so the boot profile request is taken with room for a few only.
+    response_reader_t reader = {};
+    for (int i = 0; i < 1000 && waiting.queued != 0; i++)
+    {
+        read_responses(&reader, 10);
+        sim_run_for_ms(10);
+        spi_get_transport_stats(&waiting);
+    }
+    sim_run_for_ms(100);
+
+    bool all_answered = read_sequence_responses(SEQUENCED_COMMANDS, &reader);
+    sim_run_for_ms(50);
+    spi_get_transport_stats(&after);
+    sim_check(all_answered, "every echo, applied response and boot stage came");
+    sim_check(after.response_drops == before.response_drops && after.queue_overflows == before.queue_overflows, "nothing dropped");
+    sim_check(dc_motors_speeds[0].speed == SEQUENCED_COMMANDS - 1, "last command applied");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,238 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Register map bursts in simulated time.
+//   1. One read returns the identity, the status and the counters.
+//   2. One write sets both wheels and every joint, the motors take them over.
+//   3. A read of the whole map reflects the state and reads the setpoints back.
+//   4. Limits and speed profiles written through the map are in use.
+//   5. Writes with a wrong checksum, to the read only part or for another board are not applied,
+//      and the frames after them still parse.
+//   6. A scheduled write applies its own payload, not the one of a write received after it.
+//      Past REGISTER_WRITE_SLOTS waiting writes the oldest is refused and counted.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "common_types.hpp"
+#include "register_map.hpp"
+#include "servo_control.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define RESPONSE_SYNC_BYTE 0xA5
+#define RESPONSE_SIZE 10
+
+static void put_setpoint(uint8_t *data, int8_t direction, uint8_t speed, uint16_t timeout_ms)
+{
+    data[0] = (uint8_t)direction;
+    data[1] = speed;
+    data[2] = (uint8_t)(timeout_ms >> 8);
+    data[3] = (uint8_t)timeout_ms;
+}
+
+// Frame and payload in one transfer, as the host sends them. Address BOARD_BROADCAST_ADDRESS sends no extension.
+static void write_registers(uint16_t address, const std::vector<uint8_t> &payload, uint8_t checksum_flip, uint8_t board)
+{
+    uint8_t checksum = 0;
+    for (uint8_t b : payload)
+    {
+        checksum ^= b;
+    }
+
+    std::vector<uint8_t> transfer = {
+        REGISTER_WRITE_COMMAND, (uint8_t)(address >> 8), (uint8_t)address,
+        (uint8_t)(payload.size() >> 8), (uint8_t)payload.size(), (uint8_t)(checksum ^ checksum_flip), 0, 0
+    };
+    if (board != BOARD_BROADCAST_ADDRESS)
+    {
+        transfer[0] |= COMMAND_EXTENSION_FLAG;
+        transfer.push_back(COMMAND_EXTENSION_ADDRESS);
+        transfer.push_back(board);
+    }
+
+    transfer.insert(transfer.end(), payload.begin(), payload.end());
+    sim_spi_transfer(transfer.data(), NULL, transfer.size());
+}
+
+// As write_registers(), to run at the given firmware time.
+static void write_registers_at(uint16_t address, const std::vector<uint8_t> &payload, uint32_t execute_at_us)
+{
+    uint8_t checksum = 0;
+    for (uint8_t b : payload)
+    {
+        checksum ^= b;
+    }
+
+    std::vector<uint8_t> transfer = {
+        REGISTER_WRITE_COMMAND | COMMAND_EXTENSION_FLAG, (uint8_t)(address >> 8), (uint8_t)address,
+        (uint8_t)(payload.size() >> 8), (uint8_t)payload.size(), checksum, 0, 0,
+        COMMAND_EXTENSION_EXECUTE_AT, (uint8_t)(execute_at_us >> 24), (uint8_t)(execute_at_us >> 16),
+        (uint8_t)(execute_at_us >> 8), (uint8_t)execute_at_us
+    };
+    transfer.insert(transfer.end(), payload.begin(), payload.end());
+    sim_spi_transfer(transfer.data(), NULL, transfer.size());
+}
+
+// Sends the read, lets the main loop build the burst and clocks it out. The 8-byte responses
+// in front of it are skipped.
+static bool read_registers(uint16_t address, uint16_t length, uint8_t *data)
+{
+    uint8_t read[8] = {
+        REGISTER_READ_COMMAND, (uint8_t)(address >> 8), (uint8_t)address, (uint8_t)(length >> 8), (uint8_t)length, 0, 0, 0
+    };
+    sim_spi_transfer(read, NULL, sizeof(read));
+    sim_run_for_ms(20);
+
+    // Room for a response going out already, the burst and the lag of the TX FIFO, in whole idle frames.
+    size_t size = (RESPONSE_SIZE + REGISTER_BURST_HEADER_SIZE + length + 1 + 8 + 7) / 8 * 8;
+    std::vector<uint8_t> transfer(size, 0);
+    std::vector<uint8_t> miso(size);
+    sim_spi_transfer(transfer.data(), miso.data(), size);
+
+    size_t i = 0;
+    while (i < size)
+    {
+        if (miso[i] != RESPONSE_SYNC_BYTE || i + 1 >= size)
+        {
+            i++;
+            continue;
+        }
+
+        if (miso[i + 1] != REGISTER_BURST_RESPONSE)
+        {
+            i += RESPONSE_SIZE;
+            continue;
+        }
+
+        size_t end = i + REGISTER_BURST_HEADER_SIZE + length;
+        if (end >= size || sim_read_uint16(&miso[i + 2]) != address || sim_read_uint16(&miso[i + 4]) != length)
+        {
+            return false;
+        }
+
+        uint8_t checksum = 0;
+        for (size_t j = i + 1; j < end; j++)
+        {
+            checksum ^= miso[j];
+        }
+
+        memcpy(data, &miso[i + REGISTER_BURST_HEADER_SIZE], length);
+        return checksum == miso[end];
+    }
+
+    return false;
+}
+
+static uint32_t register_errors()
+{
+    uint8_t data[4] = { 0 };
+    read_registers(REG_REGISTER_ERRORS, sizeof(data), data);
+    return sim_read_uint32(data);
+}
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Status\n");
+    uint8_t status[REG_REGISTER_ERRORS + 4];
+    sim_check(read_registers(0, sizeof(status), status), "identity, status and counters in one read");
+    sim_check(sim_read_uint16(&status[REG_MAGIC]) == REGISTER_MAP_MAGIC && status[REG_VERSION] == REGISTER_MAP_VERSION, "magic and layout version");
+    sim_check(status[REG_SERVO_SLOTS] == SERVOS_COUNT, "servo slots");
+    sim_check(sim_read_uint32(&status[REG_UPTIME_US]) >= 950000, "uptime from the last main loop");
+    sim_check(sim_read_uint32(&status[REG_REGISTER_ERRORS]) == 0, "no register errors");
+
+    printf("Setpoints\n");
+    int16_t base_start = get_servo_info(BASE_MOTOR_INDEX)->current_degrees;
+    int16_t elbow_start = get_servo_info(ELBOW_MOTOR_INDEX)->current_degrees;
+    std::vector<uint8_t> setpoints(REG_JOINT_SETPOINTS + SERVOS_COUNT * REGISTER_SETPOINT_SIZE - REG_WHEEL_SETPOINTS, 0);
+    put_setpoint(&setpoints[0], 1, 60, 30000);
+    put_setpoint(&setpoints[REGISTER_SETPOINT_SIZE], -1, 40, 30000);
+    put_setpoint(&setpoints[REG_JOINT_SETPOINTS - REG_WHEEL_SETPOINTS + BASE_MOTOR_INDEX * REGISTER_SETPOINT_SIZE], 1, 100, 2000);
+    put_setpoint(&setpoints[REG_JOINT_SETPOINTS - REG_WHEEL_SETPOINTS + ELBOW_MOTOR_INDEX * REGISTER_SETPOINT_SIZE], -1, 100, 2000);
+    write_registers(REG_WHEEL_SETPOINTS, setpoints, 0, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(500);
+    sim_check(dc_motors_speeds[0].direction == 1 && dc_motors_speeds[0].speed == 60, "left wheel set");
+    sim_check(dc_motors_speeds[1].direction == -1 && dc_motors_speeds[1].speed == 40, "right wheel set");
+    sim_check(get_servo_info(BASE_MOTOR_INDEX)->current_degrees > base_start, "base joint moving up");
+    sim_check(get_servo_info(ELBOW_MOTOR_INDEX)->current_degrees < elbow_start, "elbow joint moving down");
+
+    std::vector<uint8_t> map(REGISTER_MAP_SIZE);
+    sim_run_for_ms(20);
+    sim_check(read_registers(0, REGISTER_MAP_SIZE, map.data()), "whole map in one read");
+    sim_check(map[REG_WHEELS] == 1 && map[REG_WHEELS + 1] == 60 && (int8_t)map[REG_WHEELS + 2] == -1, "wheels state");
+    sim_check(memcmp(&map[REG_WHEEL_SETPOINTS], setpoints.data(), setpoints.size()) == 0, "setpoints read back");
+    sim_check((map[REG_STATUS_FLAGS] & REGISTER_STATUS_DC_MOTORS_RUNNING) != 0, "motors running flag");
+    sim_check((int16_t)sim_read_uint16(&map[REG_SERVO_DEGREES + BASE_MOTOR_INDEX * 2]) > base_start, "base position");
+    sim_check(sim_read_uint32(&map[REG_SPI_FRAMES]) >= 3, "frames counted");
+
+    printf("Limits and profiles\n");
+    uint16_t limits_address = REG_JOINT_LIMITS + ELBOW_MOTOR_INDEX * REGISTER_LIMITS_SIZE;
+    write_registers(limits_address, { 0, 20, 0, 200 }, 0, BOARD_BROADCAST_ADDRESS);
+    uint16_t profile_address = REG_SPEED_PROFILES + (ELBOW_MOTOR_INDEX * SERVO_SPEED_TABLE_SIZE + 1) * REGISTER_PROFILE_ROW_SIZE;
+    write_registers(profile_address, { 15, 25, 0, 120 }, 0, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(50);
+
+    int32_t bottom = 0;
+    int32_t top = 0;
+    get_servo_calibration_field(ELBOW_MOTOR_INDEX, SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT, &bottom);
+    get_servo_calibration_field(ELBOW_MOTOR_INDEX, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, &top);
+    sim_check(bottom == 20 && top == 200, "limits in use");
+    servo_speed_settings_t settings = {};
+    get_servo_speed_profile(ELBOW_MOTOR_INDEX, 1, &settings);
+    sim_check(settings.min_percentage == 15 && settings.max_percentage == 25 && settings.min_time_ms == 120, "profile row in use");
+
+    uint8_t profile[REGISTER_PROFILE_ROW_SIZE];
+    sim_check(read_registers(profile_address, sizeof(profile), profile) && profile[0] == 15 && sim_read_uint16(&profile[2]) == 120, "profile row read back");
+
+    printf("Refused writes\n");
+    uint32_t errors = register_errors();
+    uint8_t wheel[7] = { 1, 30, 0x75, 0x30, 0, 0, 0 };
+    write_registers(REG_WHEEL_SETPOINTS, { 1, 90, 0x75, 0x30 }, 0x01, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 60, "wrong checksum not applied");
+    sim_check(register_errors() == errors + 1, "wrong checksum counted");
+
+    write_registers(REG_UPTIME_US, { 1, 2, 3, 4 }, 0, BOARD_BROADCAST_ADDRESS);
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+    sim_check(register_errors() == errors + 2, "write to the read only part refused");
+    sim_check(dc_motors_speeds[0].speed == 30, "command after it applied");
+
+    write_registers(REG_WHEEL_SETPOINTS, { 1, 90, 0x75, 0x30, LEFT_MOTOR_COMMAND, 90, 0x75, 0x30 }, 0, BOARD_ADDRESS + 1);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 30, "write for another board skipped");
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    wheel[1] = 35;
+    sim_send_command(LEFT_MOTOR_COMMAND, wheel);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 35, "frames after it in step");
+
+    printf("Scheduled writes\n");
+    uint32_t execute_at_us = (uint32_t)sim_time_us() + 100000;
+    write_registers_at(REG_WHEEL_SETPOINTS, { 1, 50, 0x75, 0x30 }, execute_at_us);
+    write_registers(REG_WHEEL_SETPOINTS, { 1, 20, 0x75, 0x30 }, 0, BOARD_BROADCAST_ADDRESS);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 20, "write received after it applied first");
+    sim_run_for_ms(100);
+    sim_check(dc_motors_speeds[0].speed == 50, "scheduled write applies its own payload");
+
+    errors = register_errors();
+    execute_at_us = (uint32_t)sim_time_us() + 100000;
+    for (int i = 0; i <= REGISTER_WRITE_SLOTS; i++)
+    {
+        write_registers_at(REG_WHEEL_SETPOINTS, { 1, (uint8_t)(60 + i), 0x75, 0x30 }, execute_at_us + i * 1000);
+    }
+    sim_run_for_ms(200);
+    sim_check(dc_motors_speeds[0].speed == 60 + REGISTER_WRITE_SLOTS, "last scheduled write applied");
+    sim_check(register_errors() == errors + 1, "oldest, its slot taken again, refused and counted");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,223 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// The host client library against the simulated firmware, through the loopback transport.
+//   1. The decoder takes responses cut over transfers and skips damaged ones.
+//   2. Setpoints set faster than they go out are coalesced, the last one is applied.
+//      A stop sent after a setpoint goes out after it, and a setpoint set after the stop after the stop.
+//   3. Responses and register bursts reach the handler.
+//   4. A long stream of commands is paced by the credits, nothing is dropped.
+//   5. The sender thread flushes on its own.
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <thread>
+#include "common_types.hpp"
+#include "register_map.hpp"
+#include "spi_transport.hpp"
+#include "client/robot_client.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_loopback_transport.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define LINK_CLOCK_HZ 4000000
+#define STREAM_COMMANDS 500
+
+typedef struct
+{
+    uint32_t responses;
+    int time_sync_id;
+    uint16_t burst_address;
+    uint16_t burst_magic;
+} received_t;
+
+static void on_response(void *context, const response_view_t &response)
+{
+    received_t *received = (received_t *)context;
+    received->responses++;
+    if (response.type == TIME_SYNC_RESPONSE)
+    {
+        received->time_sync_id = response.data[0];
+    }
+    if (response.type == REGISTER_BURST_RESPONSE && response.length == 2)
+    {
+        received->burst_address = response.address;
+        received->burst_magic = (uint16_t)(response.data[0] << 8 | response.data[1]);
+    }
+}
+
+static void count_response(void *context, const response_view_t &response)
+{
+    (void)response;
+    (*(int *)context)++;
+}
+
+static void put_frame(uint8_t *out, uint8_t type, const uint8_t data[7])
+{
+    uint8_t checksum = type;
+    out[0] = CLIENT_RESPONSE_SYNC_BYTE;
+    out[1] = type;
+    for (int i = 0; i < 7; i++)
+    {
+        out[2 + i] = data[i];
+        checksum ^= data[i];
+    }
+    out[9] = checksum;
+}
+
+static void wheel_data(uint8_t speed, uint8_t data[7])
+{
+    uint8_t wheel[7] = { 1, speed, 0x75, 0x30, 0, 0, 0 };
+    memcpy(data, wheel, 7);
+}
+
+// Flushes, letting the firmware run between the flushes, until the condition holds.
+static bool flush_until(robot_client_t *client, bool (*done)(void *), void *context, uint32_t timeout_ms)
+{
+    for (uint32_t ms = 0; ms < timeout_ms; ms += 5)
+    {
+        robot_client_flush(client);
+        if (done(context))
+        {
+            return true;
+        }
+        sim_run_for_ms(5);
+    }
+
+    return false;
+}
+
+static bool time_sync_answered(void *context)
+{
+    return ((received_t *)context)->time_sync_id == 7;
+}
+
+static bool burst_answered(void *context)
+{
+    return ((received_t *)context)->burst_magic == REGISTER_MAP_MAGIC;
+}
+
+static uint32_t stream_end = 0;
+
+static bool stream_sent(void *context)
+{
+    robot_client_stats_t stats;
+    robot_client_get_stats((robot_client_t *)context, &stats);
+    return stats.frames_sent >= stream_end;
+}
+
+int main()
+{
+    printf("Decoder\n");
+    uint8_t data[7] = { 1, 2, 3, 4, 5, 6, 7 };
+    uint8_t stream[40] = { 0 };
+    put_frame(&stream[3], TIME_SYNC_RESPONSE, data);
+    put_frame(&stream[15], POWER_STATUS_RESPONSE, data);
+    stream[24] ^= 0x01;
+    put_frame(&stream[27], TIME_SYNC_RESPONSE, data);
+    response_decoder_t decoder;
+    response_decoder_reset(&decoder);
+    int decoded = 0;
+    response_decoder_feed(&decoder, stream, 7, count_response, &decoded);
+    response_decoder_feed(&decoder, &stream[7], 24, count_response, &decoded);
+    response_decoder_feed(&decoder, &stream[31], sizeof(stream) - 31, count_response, &decoded);
+    sim_check(decoded == 2 && decoder.responses == 2, "responses cut over three transfers");
+    sim_check(decoder.checksum_errors == 1, "damaged response skipped");
+
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    client_transport_t transport;
+    sim_loopback_transport(LINK_CLOCK_HZ, &transport);
+    robot_client_config_t config;
+    robot_client_default_config(&config);
+    received_t received = {};
+    received.time_sync_id = -1;
+    robot_client_t *client = robot_client_create(transport, config, on_response, &received);
+
+    printf("Setpoints\n");
+    uint8_t wheel[7];
+    for (uint8_t speed = 10; speed <= 50; speed += 10)
+    {
+        wheel_data(speed, wheel);
+        robot_client_set_setpoint(client, LEFT_MOTOR_COMMAND, wheel);
+    }
+    wheel_data(25, wheel);
+    robot_client_set_setpoint(client, RIGHT_MOTOR_COMMAND, wheel);
+    robot_client_flush(client);
+    robot_client_flush(client);
+    sim_run_for_ms(50);
+
+    robot_client_stats_t stats;
+    robot_client_get_stats(client, &stats);
+    sim_check(stats.frames_sent == 2 && stats.setpoints_coalesced == 4, "one frame per actuator");
+    sim_check(dc_motors_speeds[0].speed == 50 && dc_motors_speeds[1].speed == 25, "last setpoints applied");
+
+    uint8_t no_data[7] = { 0 };
+    wheel_data(40, wheel);
+    robot_client_set_setpoint(client, LEFT_MOTOR_COMMAND, wheel);
+    robot_client_send(client, STOP_ALL_MOTORS_COMMAND, no_data);
+    robot_client_flush(client);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 0 && dc_motors_speeds[1].speed == 0, "stop after the setpoint wins");
+
+    robot_client_send(client, STOP_ALL_MOTORS_COMMAND, no_data);
+    wheel_data(30, wheel);
+    robot_client_set_setpoint(client, LEFT_MOTOR_COMMAND, wheel);
+    robot_client_flush(client);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 30, "setpoint after the stop applied");
+
+    printf("Responses\n");
+    uint8_t sync[7] = { 7, 0, 0, 0, 0, 0, 0 };
+    robot_client_send(client, TIME_SYNC_COMMAND, sync);
+    sim_check(flush_until(client, time_sync_answered, &received, 200), "response to a command");
+
+    uint8_t read[7] = { 0, REG_MAGIC, 0, 2, 0, 0, 0 };
+    robot_client_send(client, REGISTER_READ_COMMAND, read);
+    sim_check(flush_until(client, burst_answered, &received, 200) && received.burst_address == REG_MAGIC, "register burst in place");
+
+    printf("Command stream\n");
+    spi_transport_stats_t before;
+    spi_get_transport_stats(&before);
+    robot_client_get_stats(client, &stats);
+    stream_end = stats.frames_sent + STREAM_COMMANDS;
+    for (int i = 0; i < STREAM_COMMANDS; i++)
+    {
+        wheel_data((uint8_t)(i % 50), wheel);
+        robot_client_send(client, LEFT_MOTOR_COMMAND, wheel);
+    }
+    bool sent = flush_until(client, stream_sent, client, 20000);
+    sim_run_for_ms(1000);
+
+    spi_transport_stats_t after;
+    spi_get_transport_stats(&after);
+    robot_client_get_stats(client, &stats);
+    sim_check(sent, "every command sent");
+    sim_check(after.queue_overflows == before.queue_overflows && stats.queue_overflows == 0, "nothing dropped");
+    sim_check(stats.credit_stalls > 0, "held back by the credits");
+    sim_check(dc_motors_speeds[0].speed == (STREAM_COMMANDS - 1) % 50, "last command applied");
+    sim_check(stats.checksum_errors == 0, "no damaged responses");
+
+    printf("Sender thread\n");
+    uint32_t frames = stats.frames_sent;
+    robot_client_start(client, 1000);
+    wheel_data(33, wheel);
+    robot_client_set_setpoint(client, RIGHT_MOTOR_COMMAND, wheel);
+    for (int i = 0; i < 1000 && stats.frames_sent == frames; i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        robot_client_get_stats(client, &stats);
+    }
+    robot_client_stop(client);
+    sim_run_for_ms(50);
+    sim_check(stats.frames_sent > frames && dc_motors_speeds[1].speed == 33, "setpoint sent by the thread");
+
+    robot_client_destroy(client);
+    sim_shutdown();
+
+    return sim_checks_result();
+}
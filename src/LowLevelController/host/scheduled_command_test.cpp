@@ -0,0 +1,78 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Time sync and scheduled commands in simulated time.
+//   1. The time sync response carries the firmware receive time.
+//   2. A wheel and an arm command scheduled for the same time are taken over by their control
+//      ticks together, not before the time.
+//   3. A time too far ahead is rejected.
+//   4. A scheduled command due in the pass that takes a plain command runs first.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define SCHEDULE_AHEAD_MS 200
+
+int main()
+{
+    uint8_t response[7];
+
+    sim_record_motion_starts();
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Time sync\n");
+    uint8_t sync[7] = { 0x5A, 0, 0, 0, 0, 0, 0 };
+    uint64_t sent_us = sim_time_us();
+    sim_send_command(TIME_SYNC_COMMAND, sync);
+    sim_check(sim_read_response(TIME_SYNC_RESPONSE, response, 100), "time sync response received");
+    sim_check(response[0] == 0x5A, "sync id echoed");
+    sim_check(sim_read_uint32(&response[1]) == (uint32_t)sent_us, "receive time is the transfer time");
+    sim_check((uint16_t)(response[5] << 8 | response[6]) <= SIM_CONTROL_TICK_US, "answered within a main loop pass");
+
+    printf("Scheduled commands\n");
+    uint32_t execute_at_us = (uint32_t)sim_time_us() + SCHEDULE_AHEAD_MS * 1000;
+    uint8_t wheel[7] = { 1, 60, 0x75, 0x30, 0, 0, 0 };
+    uint8_t arm[7] = { 1, 50, 0x75, 0x30, 0, 0, 0 };
+    sim_send_command_at(LEFT_MOTOR_COMMAND, wheel, execute_at_us);
+    sim_run_for_ms(50);
+    sim_send_command_at(BASE_MOTOR_DIRECTION_COMMAND, arm, execute_at_us);
+
+    sim_run_for_ms(SCHEDULE_AHEAD_MS);
+    uint64_t wheel_started_us = sim_wheel_started_us();
+    uint64_t arm_started_us = sim_arm_started_us();
+    printf("    due at %u us, wheel at %llu us, arm at %llu us\n", execute_at_us,
+        (unsigned long long)wheel_started_us, (unsigned long long)arm_started_us);
+    sim_check(wheel_started_us >= execute_at_us && arm_started_us >= execute_at_us, "not taken over early");
+    sim_check(wheel_started_us != 0 && wheel_started_us - execute_at_us <= 2 * SIM_CONTROL_TICK_US, "wheel taken over on time");
+    sim_check(arm_started_us != 0 && arm_started_us - execute_at_us <= 2 * SIM_CONTROL_TICK_US, "arm taken over on time");
+    uint64_t apart_us = (wheel_started_us > arm_started_us) ? wheel_started_us - arm_started_us : arm_started_us - wheel_started_us;
+    sim_check(apart_us <= SIM_CONTROL_TICK_US, "taken over within one control tick");
+
+    printf("Rejected\n");
+    uint8_t stop[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    sim_send_command(LEFT_MOTOR_COMMAND, stop);
+    sim_run_for_ms(50);
+    sim_send_command_at(LEFT_MOTOR_COMMAND, wheel, (uint32_t)sim_time_us() + 120000000);
+    sim_run_for_ms(500);
+    sim_check(dc_motors_speeds[0].speed == 0, "time two minutes ahead not scheduled");
+
+    printf("Order\n");
+    uint8_t later[7] = { 1, 20, 0x75, 0x30, 0, 0, 0 };
+    execute_at_us = (uint32_t)sim_time_us() + SCHEDULE_AHEAD_MS * 1000;
+    sim_send_command_at(LEFT_MOTOR_COMMAND, wheel, execute_at_us);
+    sim_run_until(sim_time_us() + SCHEDULE_AHEAD_MS * 1000 - 100);
+    sim_send_command(LEFT_MOTOR_COMMAND, later);
+    sim_run_for_ms(50);
+    sim_check(dc_motors_speeds[0].speed == 20, "due command before the one received after it");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
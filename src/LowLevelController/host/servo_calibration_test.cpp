@@ -0,0 +1,73 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Runtime servo calibration in simulated time.
+//   1. Values out of the joint's range are refused, none wraps into the int16_t of the record.
+//   2. A remapped joint drives its new output, the old one goes idle.
+//   3. Restoring the defaults drives the default output again and idles the remapped one,
+//      the joint stays where it was.
+//   4. A free slot has no calibration and never moves.
+
+#include <stdio.h>
+#include "common_types.hpp"
+#include "pico_native_pwm.hpp"
+#include "servo_control.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Staged widths in pio_servo_pwm.cpp.
+extern uint32_t pio_servo_widths[];
+
+// A PIO output no joint uses by default.
+#define REMAP_PIO_SERVO 1
+
+int main()
+{
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Range\n");
+    const servo_info_t *gripper = get_servo_info(GRIPPER_MOTOR_INDEX);
+    int16_t top_limit = gripper->top_degrees_limit;
+    sim_check(!set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, 65536 + 90),
+        "limit past int16_t refused");
+    sim_check(gripper->top_degrees_limit == top_limit, "limit kept");
+    sim_check(!set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_DEGREES, 270), "range past the servo refused");
+    sim_check(!set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT, -1), "negative limit refused");
+    sim_check(!set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_RIGHT_NS, 0x7FFFFFFF), "pulse past the frame refused");
+    sim_check(set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, 150), "limit in range set");
+    sim_check(gripper->top_degrees_limit == 150, "limit taken");
+
+    printf("Remap\n");
+    uint8_t default_pwm = gripper->pwm_number;
+    int16_t degrees = gripper->current_degrees;
+    sim_check(get_pwm_level(default_pwm) != 0, "default output driven");
+    sim_check(set_servo_calibration_field(GRIPPER_MOTOR_INDEX, SERVO_CALIBRATION_PWM_NUMBER, PIO_PWM_NUMBER_FIRST + REMAP_PIO_SERVO),
+        "remapped to a PIO output");
+    sim_run_for_ms(50);
+    sim_check(get_pwm_level(default_pwm) == 0 && pio_servo_widths[REMAP_PIO_SERVO] != 0, "new output driven, old one idle");
+
+    printf("Restore\n");
+    restore_default_servo_calibration();
+    sim_run_for_ms(50);
+    sim_check(gripper->pwm_number == default_pwm && gripper->top_degrees_limit == gripper->degrees, "defaults restored");
+    sim_check(get_pwm_level(default_pwm) != 0, "default output driven again");
+    sim_check(pio_servo_widths[REMAP_PIO_SERVO] == 0, "remapped output idle");
+    sim_check(gripper->current_degrees == degrees, "joint stays where it was");
+
+    printf("Free slot\n");
+    uint8_t free_slot = 0;
+    while (free_slot < SERVOS_COUNT && robot_joints[free_slot].type != JOINT_NONE)
+    {
+        free_slot++;
+    }
+    int32_t value = 0;
+    sim_check(free_slot < SERVOS_COUNT && JOINTS_COUNT < SERVOS_COUNT, "robot has a free slot");
+    sim_check(!get_servo_calibration_field(free_slot, SERVO_CALIBRATION_DEGREES, &value), "no calibration to read");
+    sim_check(!set_servo_calibration_field(free_slot, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, 90), "no calibration to change");
+    set_servo_position_in_degrees(free_slot, 90);
+    sim_check(get_servo_info(free_slot)->current_degrees == 0, "free slot does not move");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,12 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_ADDRESS_MAPPED_H
+#define SIM_HARDWARE_ADDRESS_MAPPED_H
+
+#include "pico/stdlib.h"
+
+// Plain read-modify-write. The simulated registers have no atomic set and clear aliases.
+void hw_set_bits(volatile uint32_t *address, uint32_t mask);
+void hw_clear_bits(volatile uint32_t *address, uint32_t mask);
+
+#endif // SIM_HARDWARE_ADDRESS_MAPPED_H
@@ -0,0 +1,15 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_CLOCKS_H
+#define SIM_HARDWARE_CLOCKS_H
+
+#include "pico/stdlib.h"
+
+typedef enum
+{
+    clk_sys
+} clock_handle_t;
+
+uint32_t clock_get_hz(clock_handle_t clock);
+
+#endif // SIM_HARDWARE_CLOCKS_H
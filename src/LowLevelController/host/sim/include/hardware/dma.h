@@ -0,0 +1,65 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_DMA_H
+#define SIM_HARDWARE_DMA_H
+
+#include "pico/stdlib.h"
+
+// No data is moved, except for channels paced by the ADC and by the PIO SPI slave. A channel with
+// its IRQ 0 enabled reports completion at every PWM frame, which is when the PIO servo frame ends
+// on the hardware.
+typedef struct
+{
+    uint32_t ctrl;
+    uint dreq;
+    bool ring_write;
+    uint ring_size_bits;
+    uint chain_to;
+} dma_channel_config;
+
+typedef struct
+{
+    volatile uint32_t read_addr;
+    volatile uint32_t write_addr;
+    volatile uint32_t transfer_count;
+    volatile uint32_t ctrl_trig;
+} dma_channel_hw_t;
+
+#define DREQ_ADC 48
+
+typedef enum
+{
+    DMA_SIZE_8,
+    DMA_SIZE_16,
+    DMA_SIZE_32
+} dma_channel_transfer_size;
+
+int dma_claim_unused_channel(bool required);
+dma_channel_config dma_channel_get_default_config(uint channel);
+void channel_config_set_transfer_data_size(dma_channel_config *config, dma_channel_transfer_size size);
+void channel_config_set_read_increment(dma_channel_config *config, bool incr);
+void channel_config_set_write_increment(dma_channel_config *config, bool incr);
+void channel_config_set_dreq(dma_channel_config *config, uint dreq);
+void channel_config_set_ring(dma_channel_config *config, bool write, uint size_bits);
+void channel_config_set_chain_to(dma_channel_config *config, uint chain_to);
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger);
+void dma_channel_set_irq0_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq0_status(uint channel);
+void dma_channel_acknowledge_irq0(uint channel);
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger);
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger);
+void dma_channel_set_irq1_enabled(uint channel, bool enabled);
+bool dma_channel_get_irq1_status(uint channel);
+void dma_channel_acknowledge_irq1(uint channel);
+bool dma_channel_is_busy(uint channel);
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count);
+
+// Only the write address of the ADC channel follows the transfers, the lower 32 bits of it.
+dma_channel_hw_t *dma_channel_hw_addr(uint channel);
+
+static inline uint32_t dma_encode_endless_transfer_count()
+{
+    return 0xF0000000u;
+}
+
+#endif // SIM_HARDWARE_DMA_H
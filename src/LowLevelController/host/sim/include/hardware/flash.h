@@ -0,0 +1,15 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_FLASH_H
+#define SIM_HARDWARE_FLASH_H
+
+#include "pico/stdlib.h"
+
+#define FLASH_SECTOR_SIZE (1u << 12)
+#define FLASH_PAGE_SIZE (1u << 8)
+
+// Work on sim_flash with the same rules as the real flash: erase sets bits, programming clears them.
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count);
+
+#endif // SIM_HARDWARE_FLASH_H
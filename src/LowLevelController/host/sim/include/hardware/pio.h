@@ -0,0 +1,73 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_PIO_H
+#define SIM_HARDWARE_PIO_H
+
+#include "pico/stdlib.h"
+
+// The state machines are not simulated, only the programs the firmware runs are modelled:
+// the SPI slave byte by byte, see sim_pio_spi_slave_attach(), and the servo pulse engine's
+// output edges, see sim_pio_servo_attach(). As on the hardware, an OUT to pins drives every pin
+// in the range of the state machine that is given to its block with pio_gpio_init().
+typedef struct
+{
+    volatile uint32_t txf[4];
+    volatile uint32_t rxf[4];
+} pio_hw_t;
+
+typedef pio_hw_t *PIO;
+extern pio_hw_t sim_pio0_hw;
+extern pio_hw_t sim_pio1_hw;
+#define pio0 (&sim_pio0_hw)
+#define pio1 (&sim_pio1_hw)
+
+typedef struct
+{
+    const uint16_t *instructions;
+    uint8_t length;
+    int8_t origin;
+} pio_program_t;
+
+typedef struct
+{
+    float clkdiv;
+    uint out_base;
+    uint out_count;
+} pio_sm_config;
+
+static inline void sm_config_set_out_pins(pio_sm_config *c, uint out_base, uint out_count)
+{
+    c->out_base = out_base;
+    c->out_count = out_count;
+}
+
+static inline void sm_config_set_clkdiv(pio_sm_config *c, float div)
+{
+    c->clkdiv = div;
+}
+
+void pio_gpio_init(PIO pio, uint pin);
+int pio_claim_unused_sm(PIO pio, bool required);
+uint pio_add_program(PIO pio, const pio_program_t *program);
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask);
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask);
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config);
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled);
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx);
+uint8_t pio_sm_get_pc(PIO pio, uint sm);
+void pio_sm_restart(PIO pio, uint sm);
+void pio_sm_exec(PIO pio, uint sm, uint instr);
+
+static inline uint pio_encode_jmp(uint addr)
+{
+    return addr;
+}
+
+// The SPI slave program from spi_pio_slave.pio runs on this state machine, idle at idle_pc.
+void sim_pio_spi_slave_attach(PIO pio, uint sm, uint pin_mosi, uint pin_miso, uint idle_pc);
+
+// The servo pulse program from pio_servo_pwm.pio runs on this state machine. It plays the table
+// of segments its DMA channel reads, one table per PWM frame.
+void sim_pio_servo_attach(PIO pio, uint sm);
+
+#endif // SIM_HARDWARE_PIO_H
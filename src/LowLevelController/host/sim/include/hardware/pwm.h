@@ -0,0 +1,27 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_PWM_H
+#define SIM_HARDWARE_PWM_H
+
+#include "pico/stdlib.h"
+
+typedef struct
+{
+    float clkdiv;
+    uint16_t wrap;
+} pwm_config;
+
+pwm_config pwm_get_default_config();
+void pwm_config_set_clkdiv(pwm_config *config, float divider);
+void pwm_config_set_wrap(pwm_config *config, uint16_t wrap);
+void pwm_init(uint slice_num, pwm_config *config, bool start);
+uint pwm_gpio_to_slice_num(uint gpio);
+void pwm_set_gpio_level(uint gpio, uint16_t level);
+void pwm_set_mask_enabled(uint32_t mask);
+void pwm_clear_irq(uint slice_num);
+void pwm_set_irq_enabled(uint slice_num, bool enabled);
+
+// Counter of the frame, all slices run in phase.
+uint16_t pwm_get_counter(uint slice_num);
+
+#endif // SIM_HARDWARE_PWM_H
@@ -0,0 +1,48 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_SPI_H
+#define SIM_HARDWARE_SPI_H
+
+#include "pico/stdlib.h"
+#include "hardware/address_mapped.h"
+
+// Data register of the simulated SPI. Reading pops the RX FIFO, writing pushes to the TX FIFO.
+struct sim_spi_data_register_t
+{
+    operator uint32_t();
+    sim_spi_data_register_t &operator=(uint32_t value);
+};
+
+typedef struct
+{
+    volatile uint32_t cr0;
+    volatile uint32_t cr1;
+    sim_spi_data_register_t dr;
+    volatile uint32_t sr;
+    volatile uint32_t cpsr;
+    volatile uint32_t imsc;
+    volatile uint32_t ris;
+    volatile uint32_t mis;
+    volatile uint32_t icr;
+} spi_hw_t;
+
+typedef struct sim_spi_inst spi_inst_t;
+extern spi_inst_t *sim_spi0;
+#define spi0 sim_spi0
+
+// Slave-mode output disable. MISO is not driven while it is set.
+#define SPI_SSPCR1_SOD_BITS 0x00000008
+
+#define SPI_SSPIMSC_RXIM_LSB 2
+#define SPI_SSPIMSC_RXIM_BITS 0x00000004
+
+// Receive overrun, a byte came in with the RX FIFO full. Cleared by writing the bit to icr.
+#define SPI_SSPRIS_RORRIS_BITS 0x00000001
+#define SPI_SSPICR_RORIC_BITS 0x00000001
+
+uint spi_init(spi_inst_t *spi, uint baudrate);
+void spi_set_slave(spi_inst_t *spi, bool slave);
+spi_hw_t *spi_get_hw(spi_inst_t *spi);
+bool spi_is_readable(spi_inst_t *spi);
+
+#endif // SIM_HARDWARE_SPI_H
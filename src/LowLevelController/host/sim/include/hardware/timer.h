@@ -0,0 +1,10 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_TIMER_H
+#define SIM_HARDWARE_TIMER_H
+
+#include "pico/stdlib.h"
+
+uint hardware_alarm_get_irq_num(uint alarm_num);
+
+#endif // SIM_HARDWARE_TIMER_H
@@ -0,0 +1,32 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_UART_H
+#define SIM_HARDWARE_UART_H
+
+#include "pico/stdlib.h"
+
+// The UARTs are not simulated, nothing is ever received.
+typedef struct sim_uart_inst uart_inst_t;
+extern uart_inst_t *sim_uart0;
+extern uart_inst_t *sim_uart1;
+#define uart0 sim_uart0
+#define uart1 sim_uart1
+
+typedef enum
+{
+    UART_PARITY_NONE
+} uart_parity_t;
+
+uint uart_init(uart_inst_t *uart, uint baudrate);
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate);
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts);
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity);
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled);
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data);
+bool uart_is_readable(uart_inst_t *uart);
+char uart_getc(uart_inst_t *uart);
+void uart_puts(uart_inst_t *uart, const char *s);
+
+void on_uart_rx();
+
+#endif // SIM_HARDWARE_UART_H
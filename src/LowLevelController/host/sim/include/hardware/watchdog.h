@@ -0,0 +1,21 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HARDWARE_WATCHDOG_H
+#define SIM_HARDWARE_WATCHDOG_H
+
+#include "pico/stdlib.h"
+#include "hardware/address_mapped.h"
+
+#define WATCHDOG_CTRL_TRIGGER_BITS 0x80000000u
+
+typedef struct
+{
+    volatile uint32_t ctrl;
+} watchdog_hw_t;
+
+extern watchdog_hw_t *const watchdog_hw;
+
+// Only records the request, see sim_reboot_requested(). The simulation cannot reboot.
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms);
+
+#endif // SIM_HARDWARE_WATCHDOG_H
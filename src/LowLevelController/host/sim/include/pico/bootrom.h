@@ -0,0 +1,12 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_PICO_BOOTROM_H
+#define SIM_PICO_BOOTROM_H
+
+#include "pico/stdlib.h"
+
+// Records the region for sim_chained_image() and returns, there is no image to start.
+// The region is a host address here, the flash is sim_flash.
+int rom_chain_image(uint8_t *workarea_base, uint32_t workarea_size, uintptr_t region_base, uint32_t region_size);
+
+#endif // SIM_PICO_BOOTROM_H
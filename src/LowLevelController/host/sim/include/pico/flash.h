@@ -0,0 +1,11 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_PICO_FLASH_H
+#define SIM_PICO_FLASH_H
+
+#include "pico/stdlib.h"
+
+// Runs func right away. There is no other core to hold off in the simulation.
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms);
+
+#endif // SIM_PICO_FLASH_H
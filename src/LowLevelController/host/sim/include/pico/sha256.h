@@ -0,0 +1,37 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_PICO_SHA256_H
+#define SIM_PICO_SHA256_H
+
+#include "pico/stdlib.h"
+
+// SHA-256 in software, with the API of the hardware accelerator.
+
+enum sha256_endianness
+{
+    SHA256_LITTLE_ENDIAN,
+    SHA256_BIG_ENDIAN,
+};
+
+typedef struct
+{
+    union
+    {
+        uint32_t words[8];
+        uint8_t bytes[32];
+    };
+} sha256_result_t;
+
+typedef struct
+{
+    uint32_t state[8];
+    uint8_t block[64];
+    uint32_t block_length;
+    uint64_t total_length;
+} pico_sha256_state_t;
+
+int pico_sha256_start_blocking(pico_sha256_state_t *state, enum sha256_endianness endianness, bool use_dma);
+void pico_sha256_update_blocking(pico_sha256_state_t *state, const uint8_t *data, size_t data_size_bytes);
+void pico_sha256_finish(pico_sha256_state_t *state, sha256_result_t *out);
+
+#endif // SIM_PICO_SHA256_H
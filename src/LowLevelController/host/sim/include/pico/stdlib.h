@@ -0,0 +1,84 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Simulation of the parts of the Pico SDK the firmware uses. Implemented in sim_hal.cpp.
+
+#ifndef SIM_PICO_STDLIB_H
+#define SIM_PICO_STDLIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+typedef unsigned int uint;
+
+#define __unused __attribute__((unused))
+#define __not_in_flash_func(func_name) func_name
+#define __no_inline_not_in_flash_func(func_name) func_name
+#define __time_critical_func(func_name) func_name
+#define __not_in_flash(group)
+#define __scratch_x(group)
+#define __scratch_y(group)
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+
+#define PICO_DEFAULT_LED_PIN 25
+
+// The flash is a plain array, so the XIP reads of the calibration store work unchanged.
+#define PICO_FLASH_SIZE_BYTES (256 * 1024)
+extern uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+#define XIP_BASE ((uintptr_t)sim_flash)
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+typedef enum
+{
+    GPIO_FUNC_SPI,
+    GPIO_FUNC_UART,
+    GPIO_FUNC_PWM,
+    GPIO_FUNC_SIO,
+    GPIO_FUNC_PIO0,
+    GPIO_FUNC_NULL
+} gpio_function_t;
+
+void stdio_init_all();
+
+void gpio_init(uint gpio);
+void gpio_set_dir(uint gpio, bool out);
+void gpio_put(uint gpio, bool value);
+bool gpio_get(uint gpio);
+void gpio_set_function(uint gpio, gpio_function_t function);
+
+// Sleeping hands the simulated core back to the simulation, which runs the timers meanwhile.
+void sleep_ms(uint32_t ms);
+void sleep_us(uint64_t us);
+void tight_loop_contents();
+
+uint32_t time_us_32();
+uint64_t time_us_64();
+
+struct repeating_timer
+{
+    int64_t delay_us;
+    void *user_data;
+};
+
+typedef bool (*repeating_timer_callback_t)(struct repeating_timer *timer);
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out);
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out);
+bool cancel_repeating_timer(struct repeating_timer *timer);
+
+// The repeating timers all run from the default pool, on alarm 3 as on the RP2350.
+typedef struct sim_alarm_pool alarm_pool_t;
+alarm_pool_t *alarm_pool_get_default();
+uint alarm_pool_timer_alarm_num(alarm_pool_t *pool);
+
+uint32_t save_and_disable_interrupts();
+void restore_interrupts(uint32_t status);
+
+#include "hardware/irq.h"
+
+#endif // SIM_PICO_STDLIB_H
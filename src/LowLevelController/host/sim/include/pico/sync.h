@@ -0,0 +1,8 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_PICO_SYNC_H
+#define SIM_PICO_SYNC_H
+
+#include "pico/stdlib.h"
+
+#endif // SIM_PICO_SYNC_H
@@ -0,0 +1,21 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Stands in for the header pioasm generates from pio_servo_pwm.pio.
+
+#ifndef SIM_PIO_SERVO_PWM_PIO_H
+#define SIM_PIO_SERVO_PWM_PIO_H
+
+#include "hardware/pio.h"
+
+static const pio_program_t servo_pulse_program = { NULL, 0, -1 };
+
+static inline void servo_pulse_program_init(PIO pio, uint sm, uint offset, float clock_divider)
+{
+    pio_sm_config config = {};
+    sm_config_set_out_pins(&config, 0, 32);
+    sm_config_set_clkdiv(&config, clock_divider);
+    pio_sm_init(pio, sm, offset, &config);
+    sim_pio_servo_attach(pio, sm);
+}
+
+#endif // SIM_PIO_SERVO_PWM_PIO_H
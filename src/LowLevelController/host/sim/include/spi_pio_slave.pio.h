@@ -0,0 +1,23 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Stands in for the header pioasm generates from spi_pio_slave.pio.
+
+#ifndef SIM_SPI_PIO_SLAVE_PIO_H
+#define SIM_SPI_PIO_SLAVE_PIO_H
+
+#include "hardware/pio.h"
+
+#define spi_slave_wrap_target 1
+#define spi_slave_wrap 8
+
+static const pio_program_t spi_slave_program = { NULL, 0, -1 };
+
+static inline void spi_slave_program_init(PIO pio, uint sm, uint offset, uint pin_mosi, uint pin_miso)
+{
+    pio_sm_config config = {};
+    sm_config_set_out_pins(&config, pin_miso, 1);
+    pio_sm_init(pio, sm, offset, &config);
+    sim_pio_spi_slave_attach(pio, sm, pin_mosi, pin_miso, offset + spi_slave_wrap_target);
+}
+
+#endif // SIM_SPI_PIO_SLAVE_PIO_H
@@ -0,0 +1,1593 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <string.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "pico/sha256.h"
+#include "hardware/adc.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/flash.h"
+#include "hardware/gpio.h"
+#include "hardware/pio.h"
+#include "hardware/pwm.h"
+#include "hardware/spi.h"
+#include "hardware/uart.h"
+#include "hardware/watchdog.h"
+#include "sim_hal.hpp"
+
+// The firmware main(), renamed when LowLevelController.cpp is built for the simulation.
+int firmware_main();
+
+#define SIM_GPIO_COUNT 48
+#define SIM_DMA_CHANNELS 16
+#define SIM_SPI_FIFO_DEPTH 8
+#define SIM_PIO_FIFO_DEPTH 4
+#define SIM_PIO_BLOCKS 2
+#define SIM_PIO_STATE_MACHINES 4
+#define SIM_DREQ_PIO0_TX0 0
+#define SIM_DREQ_PIO0_RX0 4
+#define SIM_DREQ_PIO_BLOCK_STRIDE 8
+
+// Bit clock of a transfer through the PIO SPI slave.
+#define SIM_PIO_SPI_CLOCK_HZ 4000000
+
+// Cycles of the servo pulse program on top of each segment length, see pio_servo_pwm.pio.
+#define SIM_PIO_SERVO_SEGMENT_OVERHEAD 3
+#define SIM_CLOCK_HZ 150000000
+#define SIM_ADC_CLOCK_HZ 48000000
+#define SIM_ADC_INPUTS 5
+
+// The PWM slices and the PIO servo frames all run at 50Hz.
+#define SIM_PWM_FRAME_US 20000
+
+typedef struct
+{
+    struct repeating_timer *timer;
+    repeating_timer_callback_t callback;
+    int64_t delay_us;
+    uint64_t next_us;
+    bool active;
+} sim_timer_t;
+
+// Thrown out of sleep_us() to end the firmware thread.
+struct sim_stopped
+{
+};
+
+uint8_t sim_flash[PICO_FLASH_SIZE_BYTES];
+
+static uint64_t now_us = 0;
+
+static std::vector<sim_timer_t> timers;
+
+static irq_handler_t irq_handlers[SIM_IRQ_COUNT];
+static std::vector<irq_handler_t> dma_irq0_handlers;
+static bool irq_enabled[SIM_IRQ_COUNT];
+static uint8_t irq_priorities[SIM_IRQ_COUNT];
+static bool irq_priorities_set[SIM_IRQ_COUNT];
+
+// Interrupts held off until then, see sim_hold_interrupts().
+static uint64_t irq_hold_until_us = 0;
+
+static bool gpio_levels[SIM_GPIO_COUNT];
+static uint16_t pwm_levels[SIM_GPIO_COUNT];
+static bool pwm_running = false;
+static uint64_t pwm_next_frame_us = 0;
+static uint16_t pwm_wrap = 0xFFFF;
+
+typedef struct
+{
+    dma_channel_config config;
+    volatile uint8_t *write_base;
+    bool started;
+    dma_channel_hw_t hw;
+
+    // Only followed for the channels of the PIO SPI slave.
+    const volatile uint8_t *read_next;
+    uint32_t write_offset;
+    uint32_t remaining;
+    uint32_t reload;
+} sim_dma_channel_t;
+
+static sim_dma_channel_t dma_channels[SIM_DMA_CHANNELS];
+static uint32_t dma_irq0_enabled_mask = 0;
+static uint32_t dma_irq0_status = 0;
+static uint32_t dma_irq1_enabled_mask = 0;
+static uint32_t dma_irq1_status = 0;
+static int dma_next_channel = 0;
+
+adc_hw_t sim_adc_hw;
+static uint16_t adc_input_mv[SIM_ADC_INPUTS];
+static uint adc_selected_input = 0;
+static uint adc_round_robin_mask = 0;
+static float adc_clkdiv = 0;
+static bool adc_running = false;
+static uint64_t adc_start_us = 0;
+static uint64_t adc_samples_done = 0;
+
+static spi_hw_t spi0_hw;
+static std::deque<uint8_t> spi_rx_fifo;
+static std::deque<uint8_t> spi_tx_fifo;
+static bool spi_irq_pending = false;
+
+// The SPI slave program on a PIO state machine. Bytes go through its FIFOs and the DMA channels
+// paced by them. Its interrupts run at once, holding them off is not modelled.
+static bool pio_spi_attached = false;
+static bool pio_spi_enabled = false;
+static uint pio_spi_sm = 0;
+static uint pio_spi_pin_cs = 0;
+static uint pio_spi_pin_miso = 0;
+static uint pio_spi_idle_pc = 0;
+static std::deque<uint8_t> pio_spi_rx_fifo;
+static std::deque<uint8_t> pio_spi_tx_fifo;
+static uint pio_spi_block = 0;
+
+// The state machines by block, and the block each pin is given to, plus one. 0 for none.
+typedef struct
+{
+    bool enabled;
+    pio_sm_config config;
+} sim_pio_sm_t;
+
+static sim_pio_sm_t pio_sms[SIM_PIO_BLOCKS][SIM_PIO_STATE_MACHINES];
+static int pio_next_sm[SIM_PIO_BLOCKS];
+static uint gpio_pio_blocks[SIM_GPIO_COUNT];
+
+static bool pio_servo_attached = false;
+static uint pio_servo_block = 0;
+static uint pio_servo_sm = 0;
+
+static gpio_irq_callback_t gpio_callback = NULL;
+static uint32_t gpio_irq_events[SIM_GPIO_COUNT];
+static uint gpio_oe_overrides[SIM_GPIO_COUNT];
+
+static sim_hook_t pwm_frame_hook = NULL;
+static sim_hook_t main_loop_hook = NULL;
+
+// Lock step between the caller and the firmware thread.
+static std::mutex sim_mutex;
+static std::condition_variable sim_condition;
+static std::thread firmware_thread;
+static bool firmware_running = false;
+static bool firmware_stopping = false;
+static uint64_t firmware_wake_us = 0;
+
+struct sim_spi_inst
+{
+};
+struct sim_uart_inst
+{
+};
+
+struct sim_alarm_pool
+{
+};
+
+static sim_spi_inst spi0_instance;
+static sim_uart_inst uart0_instance;
+static sim_uart_inst uart1_instance;
+static alarm_pool_t default_alarm_pool;
+spi_inst_t *sim_spi0 = &spi0_instance;
+uart_inst_t *sim_uart0 = &uart0_instance;
+uart_inst_t *sim_uart1 = &uart1_instance;
+pio_hw_t sim_pio0_hw;
+pio_hw_t sim_pio1_hw;
+
+// --- Time and timers ---
+
+uint32_t time_us_32()
+{
+    return (uint32_t)now_us;
+}
+
+uint64_t time_us_64()
+{
+    return now_us;
+}
+
+uint64_t sim_time_us()
+{
+    return now_us;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out)
+{
+    out->delay_us = delay_us;
+    out->user_data = user_data;
+
+    sim_timer_t timer;
+    timer.timer = out;
+    timer.callback = callback;
+    timer.delay_us = delay_us;
+    timer.next_us = now_us + (delay_us < 0 ? -delay_us : delay_us);
+    timer.active = true;
+    timers.push_back(timer);
+    return true;
+}
+
+bool add_repeating_timer_ms(int32_t delay_ms, repeating_timer_callback_t callback, void *user_data, struct repeating_timer *out)
+{
+    return add_repeating_timer_us((int64_t)delay_ms * 1000, callback, user_data, out);
+}
+
+bool cancel_repeating_timer(struct repeating_timer *timer)
+{
+    for (sim_timer_t &entry : timers)
+    {
+        if (entry.timer == timer && entry.active)
+        {
+            entry.active = false;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+alarm_pool_t *alarm_pool_get_default()
+{
+    return &default_alarm_pool;
+}
+
+uint alarm_pool_timer_alarm_num(alarm_pool_t *pool)
+{
+    (void)pool;
+    return 3;
+}
+
+uint hardware_alarm_get_irq_num(uint alarm_num)
+{
+    return TIMER0_IRQ_0 + alarm_num;
+}
+
+uint32_t save_and_disable_interrupts()
+{
+    return 0;
+}
+
+void restore_interrupts(uint32_t status)
+{
+    (void)status;
+}
+
+// --- Firmware thread ---
+
+void sleep_us(uint64_t us)
+{
+    std::unique_lock<std::mutex> lock(sim_mutex);
+    firmware_wake_us = now_us + us;
+    firmware_running = false;
+    sim_condition.notify_all();
+    sim_condition.wait(lock, [] { return firmware_running || firmware_stopping; });
+
+    if (firmware_stopping)
+    {
+        throw sim_stopped();
+    }
+}
+
+void sleep_ms(uint32_t ms)
+{
+    sleep_us((uint64_t)ms * 1000);
+}
+
+void tight_loop_contents()
+{
+}
+
+// Runs the firmware until it sleeps again.
+static void resume_firmware()
+{
+    std::unique_lock<std::mutex> lock(sim_mutex);
+    firmware_running = true;
+    sim_condition.notify_all();
+    sim_condition.wait(lock, [] { return !firmware_running; });
+}
+
+static void firmware_thread_main()
+{
+    try
+    {
+        firmware_main();
+    }
+    catch (const sim_stopped &)
+    {
+    }
+
+    std::lock_guard<std::mutex> lock(sim_mutex);
+    firmware_running = false;
+    sim_condition.notify_all();
+}
+
+void sim_boot()
+{
+    memset(sim_flash, 0xFF, sizeof(sim_flash));
+
+    std::unique_lock<std::mutex> lock(sim_mutex);
+    firmware_running = true;
+    firmware_thread = std::thread(firmware_thread_main);
+    sim_condition.wait(lock, [] { return !firmware_running; });
+}
+
+void sim_shutdown()
+{
+    {
+        std::lock_guard<std::mutex> lock(sim_mutex);
+        firmware_stopping = true;
+        sim_condition.notify_all();
+    }
+
+    if (firmware_thread.joinable())
+    {
+        firmware_thread.join();
+    }
+}
+
+static void run_pwm_frame()
+{
+    if (irq_enabled[PWM_IRQ_WRAP] && irq_handlers[PWM_IRQ_WRAP] != NULL)
+    {
+        irq_handlers[PWM_IRQ_WRAP]();
+    }
+
+    // The PIO servo frame ends at the same time. Its DMA channel is then restarted.
+    if (irq_enabled[DMA_IRQ_0] && dma_irq0_enabled_mask != 0)
+    {
+        dma_irq0_status |= dma_irq0_enabled_mask;
+        for (irq_handler_t handler : dma_irq0_handlers)
+        {
+            handler();
+        }
+    }
+
+    if (pwm_frame_hook != NULL)
+    {
+        pwm_frame_hook(now_us);
+    }
+}
+
+static void run_spi_irq()
+{
+    if (irq_enabled[SPI0_IRQ] && (spi0_hw.imsc & SPI_SSPIMSC_RXIM_BITS) && irq_handlers[SPI0_IRQ] != NULL)
+    {
+        irq_handlers[SPI0_IRQ]();
+    }
+
+    if (spi0_hw.icr & SPI_SSPICR_RORIC_BITS)
+    {
+        spi0_hw.ris &= ~SPI_SSPRIS_RORRIS_BITS;
+        spi0_hw.icr = 0;
+    }
+}
+
+// When an interrupt due at the given time runs, later while they are held off.
+static uint64_t irq_time_us(uint64_t due_us)
+{
+    return (due_us < irq_hold_until_us) ? irq_hold_until_us : due_us;
+}
+
+void sim_run_until(uint64_t time_us)
+{
+    while (true)
+    {
+        // Earliest pending event. Ties go to the timers, then the PWM frame, then the main loop.
+        uint64_t next_us = time_us;
+        for (const sim_timer_t &timer : timers)
+        {
+            if (timer.active && irq_time_us(timer.next_us) < next_us)
+            {
+                next_us = irq_time_us(timer.next_us);
+            }
+        }
+
+        if (pwm_running && irq_time_us(pwm_next_frame_us) < next_us)
+        {
+            next_us = irq_time_us(pwm_next_frame_us);
+        }
+
+        if (spi_irq_pending && irq_hold_until_us < next_us)
+        {
+            next_us = irq_hold_until_us;
+        }
+
+        if (!firmware_stopping && firmware_wake_us < next_us)
+        {
+            next_us = firmware_wake_us;
+        }
+
+        now_us = next_us;
+
+        bool fired = false;
+        if (spi_irq_pending && irq_hold_until_us <= now_us)
+        {
+            fired = true;
+            spi_irq_pending = false;
+            run_spi_irq();
+        }
+
+        for (size_t i = 0; i < timers.size(); i++)
+        {
+            if (timers[i].active && irq_time_us(timers[i].next_us) <= now_us)
+            {
+                fired = true;
+                bool repeat = timers[i].callback(timers[i].timer);
+
+                // The callback may have added timers, so index again.
+                sim_timer_t &timer = timers[i];
+                if (!repeat)
+                {
+                    timer.active = false;
+                }
+                else if (timer.delay_us < 0)
+                {
+                    timer.next_us += -timer.delay_us;
+                }
+                else
+                {
+                    timer.next_us = now_us + timer.delay_us;
+                }
+            }
+        }
+
+        if (pwm_running && irq_time_us(pwm_next_frame_us) <= now_us)
+        {
+            fired = true;
+            run_pwm_frame();
+
+            // A late wrap interrupt is pending only once, the frames missed meanwhile are gone.
+            while (pwm_next_frame_us <= now_us)
+            {
+                pwm_next_frame_us += SIM_PWM_FRAME_US;
+            }
+        }
+
+        if (!firmware_stopping && firmware_wake_us <= now_us)
+        {
+            fired = true;
+            resume_firmware();
+            if (main_loop_hook != NULL)
+            {
+                main_loop_hook(now_us);
+            }
+        }
+
+        if (!fired && now_us >= time_us)
+        {
+            return;
+        }
+    }
+}
+
+void sim_hold_interrupts(uint32_t duration_us)
+{
+    irq_hold_until_us = now_us + duration_us;
+}
+
+void sim_set_pwm_frame_hook(sim_hook_t hook)
+{
+    pwm_frame_hook = hook;
+}
+
+void sim_set_main_loop_hook(sim_hook_t hook)
+{
+    main_loop_hook = hook;
+}
+
+// --- Interrupts ---
+
+void irq_set_exclusive_handler(uint num, irq_handler_t handler)
+{
+    irq_handlers[num] = handler;
+}
+
+void irq_add_shared_handler(uint num, irq_handler_t handler, uint8_t order_priority)
+{
+    (void)order_priority;
+    if (num == DMA_IRQ_0)
+    {
+        dma_irq0_handlers.push_back(handler);
+    }
+    else
+    {
+        irq_handlers[num] = handler;
+    }
+}
+
+void irq_set_enabled(uint num, bool enabled)
+{
+    irq_enabled[num] = enabled;
+}
+
+void irq_set_priority(uint num, uint8_t hardware_priority)
+{
+    irq_priorities[num] = hardware_priority;
+    irq_priorities_set[num] = true;
+}
+
+uint8_t sim_irq_priority(unsigned int num)
+{
+    return irq_priorities_set[num] ? irq_priorities[num] : PICO_DEFAULT_IRQ_PRIORITY;
+}
+
+// --- GPIO and PWM ---
+
+void stdio_init_all()
+{
+}
+
+void gpio_init(uint gpio)
+{
+    gpio_levels[gpio] = false;
+}
+
+void gpio_set_dir(uint gpio, bool out)
+{
+    (void)gpio;
+    (void)out;
+}
+
+void gpio_put(uint gpio, bool value)
+{
+    gpio_levels[gpio] = value;
+}
+
+bool gpio_get(uint gpio)
+{
+    return gpio_levels[gpio];
+}
+
+void gpio_set_function(uint gpio, gpio_function_t function)
+{
+    (void)gpio;
+    (void)function;
+}
+
+bool sim_gpio_level(unsigned int gpio)
+{
+    return gpio < SIM_GPIO_COUNT && gpio_levels[gpio];
+}
+
+pwm_config pwm_get_default_config()
+{
+    pwm_config config = { 1.0f, 0xFFFF };
+    return config;
+}
+
+void pwm_config_set_clkdiv(pwm_config *config, float divider)
+{
+    config->clkdiv = divider;
+}
+
+void pwm_config_set_wrap(pwm_config *config, uint16_t wrap)
+{
+    config->wrap = wrap;
+}
+
+void pwm_init(uint slice_num, pwm_config *config, bool start)
+{
+    (void)slice_num;
+    (void)start;
+    pwm_wrap = config->wrap;
+}
+
+uint pwm_gpio_to_slice_num(uint gpio)
+{
+    return (gpio >> 1) & 0x0F;
+}
+
+void pwm_set_gpio_level(uint gpio, uint16_t level)
+{
+    pwm_levels[gpio] = level;
+}
+
+void pwm_set_mask_enabled(uint32_t mask)
+{
+    if (mask != 0 && !pwm_running)
+    {
+        pwm_running = true;
+        pwm_next_frame_us = now_us + SIM_PWM_FRAME_US;
+    }
+}
+
+void pwm_clear_irq(uint slice_num)
+{
+    (void)slice_num;
+}
+
+void pwm_set_irq_enabled(uint slice_num, bool enabled)
+{
+    (void)slice_num;
+    (void)enabled;
+}
+
+uint16_t pwm_get_counter(uint slice_num)
+{
+    (void)slice_num;
+    if (!pwm_running)
+    {
+        return 0;
+    }
+
+    // Time since the last frame boundary, the next one may still be held back.
+    uint64_t elapsed_us = (now_us >= pwm_next_frame_us)
+        ? (now_us - pwm_next_frame_us) % SIM_PWM_FRAME_US
+        : (SIM_PWM_FRAME_US - (pwm_next_frame_us - now_us) % SIM_PWM_FRAME_US) % SIM_PWM_FRAME_US;
+    return (uint16_t)(elapsed_us * ((uint32_t)pwm_wrap + 1) / SIM_PWM_FRAME_US);
+}
+
+uint16_t sim_pwm_gpio_level(unsigned int gpio)
+{
+    return (gpio < SIM_GPIO_COUNT) ? pwm_levels[gpio] : 0;
+}
+
+uint32_t clock_get_hz(clock_handle_t clock)
+{
+    (void)clock;
+    return SIM_CLOCK_HZ;
+}
+
+// --- SPI ---
+
+sim_spi_data_register_t::operator uint32_t()
+{
+    if (spi_rx_fifo.empty())
+    {
+        return 0;
+    }
+
+    uint8_t value = spi_rx_fifo.front();
+    spi_rx_fifo.pop_front();
+    return value;
+}
+
+sim_spi_data_register_t &sim_spi_data_register_t::operator=(uint32_t value)
+{
+    // A full FIFO ignores the write, as the hardware does.
+    if (spi_tx_fifo.size() < SIM_SPI_FIFO_DEPTH)
+    {
+        spi_tx_fifo.push_back((uint8_t)value);
+    }
+
+    return *this;
+}
+
+uint spi_init(spi_inst_t *spi, uint baudrate)
+{
+    (void)spi;
+    spi_rx_fifo.clear();
+    spi_tx_fifo.clear();
+    return baudrate;
+}
+
+void spi_set_slave(spi_inst_t *spi, bool slave)
+{
+    (void)spi;
+    (void)slave;
+}
+
+spi_hw_t *spi_get_hw(spi_inst_t *spi)
+{
+    (void)spi;
+    return &spi0_hw;
+}
+
+bool spi_is_readable(spi_inst_t *spi)
+{
+    (void)spi;
+    return !spi_rx_fifo.empty();
+}
+
+void hw_set_bits(volatile uint32_t *address, uint32_t mask)
+{
+    *address |= mask;
+}
+
+void hw_clear_bits(volatile uint32_t *address, uint32_t mask)
+{
+    *address &= ~mask;
+}
+
+static void pio_spi_transfer(const uint8_t *mosi, uint8_t *miso, size_t length);
+
+void sim_spi_transfer(const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+    if (pio_spi_attached && pio_spi_enabled)
+    {
+        pio_spi_transfer(mosi, miso, length);
+        return;
+    }
+
+    for (size_t i = 0; i < length; i++)
+    {
+        // The slave shifts out what it queued before the byte started. An empty FIFO sends zeros.
+        uint8_t out = 0;
+        if (!spi_tx_fifo.empty())
+        {
+            out = spi_tx_fifo.front();
+            spi_tx_fifo.pop_front();
+        }
+
+        // With the output disabled the FIFO still shifts, but the line stays low.
+        if (miso != NULL)
+        {
+            miso[i] = (spi0_hw.cr1 & SPI_SSPCR1_SOD_BITS) ? 0 : out;
+        }
+
+        // A byte coming into a full FIFO is lost and flags the overrun.
+        if (spi_rx_fifo.size() < SIM_SPI_FIFO_DEPTH)
+        {
+            spi_rx_fifo.push_back(mosi[i]);
+        }
+        else
+        {
+            spi0_hw.ris |= SPI_SSPRIS_RORRIS_BITS;
+        }
+
+        if (now_us < irq_hold_until_us)
+        {
+            spi_irq_pending = true;
+        }
+        else
+        {
+            run_spi_irq();
+        }
+    }
+}
+
+// --- UART ---
+
+uint uart_init(uart_inst_t *uart, uint baudrate)
+{
+    (void)uart;
+    return baudrate;
+}
+
+uint uart_set_baudrate(uart_inst_t *uart, uint baudrate)
+{
+    (void)uart;
+    return baudrate;
+}
+
+void uart_set_hw_flow(uart_inst_t *uart, bool cts, bool rts)
+{
+    (void)uart;
+    (void)cts;
+    (void)rts;
+}
+
+void uart_set_format(uart_inst_t *uart, uint data_bits, uint stop_bits, uart_parity_t parity)
+{
+    (void)uart;
+    (void)data_bits;
+    (void)stop_bits;
+    (void)parity;
+}
+
+void uart_set_fifo_enabled(uart_inst_t *uart, bool enabled)
+{
+    (void)uart;
+    (void)enabled;
+}
+
+void uart_set_irq_enables(uart_inst_t *uart, bool rx_has_data, bool tx_needs_data)
+{
+    (void)uart;
+    (void)rx_has_data;
+    (void)tx_needs_data;
+}
+
+bool uart_is_readable(uart_inst_t *uart)
+{
+    (void)uart;
+    return false;
+}
+
+char uart_getc(uart_inst_t *uart)
+{
+    (void)uart;
+    return 0;
+}
+
+void uart_puts(uart_inst_t *uart, const char *s)
+{
+    (void)uart;
+    (void)s;
+}
+
+// --- Flash ---
+
+int flash_safe_execute(void (*func)(void *), void *param, uint32_t enter_exit_timeout_ms)
+{
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+static bool flash_power_lost = false;
+static uint32_t flash_operations_left = 0;
+
+void sim_flash_lose_power_after(uint32_t operations)
+{
+    flash_power_lost = true;
+    flash_operations_left = operations;
+}
+
+void sim_flash_restore_power()
+{
+    flash_power_lost = false;
+}
+
+static bool flash_powered()
+{
+    if (!flash_power_lost)
+    {
+        return true;
+    }
+
+    if (flash_operations_left == 0)
+    {
+        return false;
+    }
+
+    flash_operations_left--;
+    return true;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+    if (!flash_powered())
+    {
+        return;
+    }
+
+    memset(&sim_flash[flash_offs], 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t *data, size_t count)
+{
+    if (!flash_powered())
+    {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        sim_flash[flash_offs + i] &= data[i];
+    }
+}
+
+// --- Bootrom ---
+
+static uintptr_t chained_image = 0;
+
+int rom_chain_image(uint8_t *workarea_base, uint32_t workarea_size, uintptr_t region_base, uint32_t region_size)
+{
+    (void)workarea_base;
+    (void)workarea_size;
+    (void)region_size;
+    chained_image = region_base;
+    return 0;
+}
+
+uintptr_t sim_chained_image()
+{
+    return chained_image;
+}
+
+// --- SHA-256 ---
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t rotate_right(uint32_t value, int bits)
+{
+    return (value >> bits) | (value << (32 - bits));
+}
+
+static void sha256_block(pico_sha256_state_t *state)
+{
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+    {
+        w[i] = (uint32_t)state->block[i * 4] << 24 | (uint32_t)state->block[i * 4 + 1] << 16 |
+            (uint32_t)state->block[i * 4 + 2] << 8 | state->block[i * 4 + 3];
+    }
+    for (int i = 16; i < 64; i++)
+    {
+        uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t v[8];
+    memcpy(v, state->state, sizeof(v));
+    for (int i = 0; i < 64; i++)
+    {
+        uint32_t s1 = rotate_right(v[4], 6) ^ rotate_right(v[4], 11) ^ rotate_right(v[4], 25);
+        uint32_t choice = (v[4] & v[5]) ^ (~v[4] & v[6]);
+        uint32_t t1 = v[7] + s1 + choice + sha256_k[i] + w[i];
+        uint32_t s0 = rotate_right(v[0], 2) ^ rotate_right(v[0], 13) ^ rotate_right(v[0], 22);
+        uint32_t majority = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+        memmove(&v[1], &v[0], 7 * sizeof(uint32_t));
+        v[4] += t1;
+        v[0] = t1 + s0 + majority;
+    }
+
+    for (int i = 0; i < 8; i++)
+    {
+        state->state[i] += v[i];
+    }
+}
+
+int pico_sha256_start_blocking(pico_sha256_state_t *state, enum sha256_endianness endianness, bool use_dma)
+{
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+    };
+
+    (void)endianness;
+    (void)use_dma;
+    memcpy(state->state, initial, sizeof(initial));
+    state->block_length = 0;
+    state->total_length = 0;
+    return PICO_OK;
+}
+
+void pico_sha256_update_blocking(pico_sha256_state_t *state, const uint8_t *data, size_t data_size_bytes)
+{
+    for (size_t i = 0; i < data_size_bytes; i++)
+    {
+        state->block[state->block_length++] = data[i];
+        if (state->block_length == sizeof(state->block))
+        {
+            sha256_block(state);
+            state->block_length = 0;
+        }
+    }
+    state->total_length += data_size_bytes;
+}
+
+void pico_sha256_finish(pico_sha256_state_t *state, sha256_result_t *out)
+{
+    uint64_t total_bits = state->total_length * 8;
+    uint8_t padding[72] = { 0x80 };
+    size_t padding_length = ((state->block_length < 56) ? 56 : 120) - state->block_length;
+    for (int i = 0; i < 8; i++)
+    {
+        padding[padding_length + i] = (uint8_t)(total_bits >> (56 - i * 8));
+    }
+    pico_sha256_update_blocking(state, padding, padding_length + 8);
+
+    for (int i = 0; i < 8; i++)
+    {
+        out->bytes[i * 4] = (uint8_t)(state->state[i] >> 24);
+        out->bytes[i * 4 + 1] = (uint8_t)(state->state[i] >> 16);
+        out->bytes[i * 4 + 2] = (uint8_t)(state->state[i] >> 8);
+        out->bytes[i * 4 + 3] = (uint8_t)state->state[i];
+    }
+}
+
+// --- Watchdog ---
+
+static watchdog_hw_t sim_watchdog_hw;
+watchdog_hw_t *const watchdog_hw = &sim_watchdog_hw;
+static bool reboot_requested = false;
+
+void watchdog_reboot(uint32_t pc, uint32_t sp, uint32_t delay_ms)
+{
+    (void)pc;
+    (void)sp;
+    (void)delay_ms;
+    reboot_requested = true;
+}
+
+bool sim_reboot_requested()
+{
+    return reboot_requested;
+}
+
+// --- DMA and PIO ---
+
+int dma_claim_unused_channel(bool required)
+{
+    (void)required;
+    return (dma_next_channel < SIM_DMA_CHANNELS) ? dma_next_channel++ : -1;
+}
+
+dma_channel_config dma_channel_get_default_config(uint channel)
+{
+    // Chained to itself means not chained, as on the hardware.
+    dma_channel_config config = {};
+    config.chain_to = channel;
+    return config;
+}
+
+void channel_config_set_transfer_data_size(dma_channel_config *config, dma_channel_transfer_size size)
+{
+    (void)config;
+    (void)size;
+}
+
+void channel_config_set_read_increment(dma_channel_config *config, bool incr)
+{
+    (void)config;
+    (void)incr;
+}
+
+void channel_config_set_write_increment(dma_channel_config *config, bool incr)
+{
+    (void)config;
+    (void)incr;
+}
+
+void channel_config_set_dreq(dma_channel_config *config, uint dreq)
+{
+    config->dreq = dreq;
+}
+
+void channel_config_set_ring(dma_channel_config *config, bool write, uint size_bits)
+{
+    config->ring_write = write;
+    config->ring_size_bits = size_bits;
+}
+
+void channel_config_set_chain_to(dma_channel_config *config, uint chain_to)
+{
+    config->chain_to = chain_to;
+}
+
+void dma_channel_configure(uint channel, const dma_channel_config *config, volatile void *write_addr, const volatile void *read_addr, uint transfer_count, bool trigger)
+{
+    sim_dma_channel_t &dma = dma_channels[channel];
+    dma.config = *config;
+    dma.write_base = (volatile uint8_t *)write_addr;
+    dma.started = trigger;
+    dma.hw.write_addr = (uint32_t)(uintptr_t)write_addr;
+    dma.read_next = (const volatile uint8_t *)read_addr;
+    dma.write_offset = 0;
+    dma.reload = transfer_count;
+    dma.remaining = trigger ? transfer_count : 0;
+}
+
+void dma_channel_set_irq0_enabled(uint channel, bool enabled)
+{
+    if (enabled)
+    {
+        dma_irq0_enabled_mask |= (1u << channel);
+    }
+    else
+    {
+        dma_irq0_enabled_mask &= ~(1u << channel);
+    }
+}
+
+bool dma_channel_get_irq0_status(uint channel)
+{
+    return (dma_irq0_status & (1u << channel)) != 0;
+}
+
+void dma_channel_acknowledge_irq0(uint channel)
+{
+    dma_irq0_status &= ~(1u << channel);
+}
+
+void dma_channel_set_irq1_enabled(uint channel, bool enabled)
+{
+    if (enabled)
+    {
+        dma_irq1_enabled_mask |= (1u << channel);
+    }
+    else
+    {
+        dma_irq1_enabled_mask &= ~(1u << channel);
+    }
+}
+
+bool dma_channel_get_irq1_status(uint channel)
+{
+    return (dma_irq1_status & (1u << channel)) != 0;
+}
+
+void dma_channel_acknowledge_irq1(uint channel)
+{
+    dma_irq1_status &= ~(1u << channel);
+}
+
+bool dma_channel_is_busy(uint channel)
+{
+    return dma_channels[channel].started && dma_channels[channel].remaining > 0;
+}
+
+static void run_pio_spi_dma();
+
+void dma_channel_transfer_from_buffer_now(uint channel, const volatile void *read_addr, uint32_t transfer_count)
+{
+    sim_dma_channel_t &dma = dma_channels[channel];
+    dma.read_next = (const volatile uint8_t *)read_addr;
+    dma.reload = transfer_count;
+    dma.remaining = transfer_count;
+    dma.started = (transfer_count > 0);
+    run_pio_spi_dma();
+}
+
+// Only the servo frames use these. Their channel is not run, the table is read where it is.
+void dma_channel_set_read_addr(uint channel, const volatile void *read_addr, bool trigger)
+{
+    (void)trigger;
+    dma_channels[channel].read_next = (const volatile uint8_t *)read_addr;
+}
+
+void dma_channel_set_trans_count(uint channel, uint32_t trans_count, bool trigger)
+{
+    (void)trigger;
+    dma_channels[channel].reload = trans_count;
+}
+
+// Writes the conversions due by now to the DMA channel paced by the ADC, round robin over the inputs.
+static void run_adc_dma()
+{
+    if (!adc_running)
+    {
+        return;
+    }
+
+    sim_dma_channel_t *dma = NULL;
+    for (sim_dma_channel_t &channel : dma_channels)
+    {
+        if (channel.started && channel.config.dreq == DREQ_ADC)
+        {
+            dma = &channel;
+        }
+    }
+
+    if (dma == NULL || !dma->config.ring_write)
+    {
+        return;
+    }
+
+    uint inputs[SIM_ADC_INPUTS];
+    uint inputs_count = 0;
+    for (uint i = 0; i < SIM_ADC_INPUTS; i++)
+    {
+        uint input = (adc_selected_input + i) % SIM_ADC_INPUTS;
+        if (adc_round_robin_mask & (1u << input))
+        {
+            inputs[inputs_count++] = input;
+        }
+    }
+    if (inputs_count == 0)
+    {
+        inputs[inputs_count++] = adc_selected_input;
+    }
+
+    double samples_per_us = SIM_ADC_CLOCK_HZ / (1.0 + adc_clkdiv) / 1000000.0;
+    uint64_t samples_due = (uint64_t)((now_us - adc_start_us) * samples_per_us);
+    uint32_t ring_samples = (1u << dma->config.ring_size_bits) / sizeof(uint16_t);
+
+    // Only the last ring of samples is ever seen.
+    if (samples_due - adc_samples_done > ring_samples)
+    {
+        adc_samples_done = samples_due - ring_samples;
+    }
+
+    for (; adc_samples_done < samples_due; adc_samples_done++)
+    {
+        uint input = inputs[adc_samples_done % inputs_count];
+        uint32_t counts = (uint32_t)adc_input_mv[input] * 4096 / 3300;
+        uint32_t offset = (uint32_t)(adc_samples_done % ring_samples) * sizeof(uint16_t);
+        *(volatile uint16_t *)(dma->write_base + offset) = (uint16_t)(counts > 4095 ? 4095 : counts);
+    }
+
+    uint32_t next_offset = (uint32_t)(adc_samples_done % ring_samples) * sizeof(uint16_t);
+    dma->hw.write_addr = (uint32_t)(uintptr_t)(dma->write_base + next_offset);
+}
+
+dma_channel_hw_t *dma_channel_hw_addr(uint channel)
+{
+    run_adc_dma();
+    return &dma_channels[channel].hw;
+}
+
+// --- ADC ---
+
+void adc_init()
+{
+    adc_running = false;
+}
+
+void adc_gpio_init(uint gpio)
+{
+    (void)gpio;
+}
+
+void adc_select_input(uint input)
+{
+    adc_selected_input = input;
+}
+
+void adc_set_round_robin(uint input_mask)
+{
+    adc_round_robin_mask = input_mask;
+}
+
+void adc_fifo_setup(bool en, bool dreq_en, uint16_t dreq_thresh, bool err_in_fifo, bool byte_shift)
+{
+    (void)en;
+    (void)dreq_en;
+    (void)dreq_thresh;
+    (void)err_in_fifo;
+    (void)byte_shift;
+}
+
+void adc_set_clkdiv(float clkdiv)
+{
+    adc_clkdiv = clkdiv;
+}
+
+void adc_run(bool run)
+{
+    adc_running = run;
+    adc_start_us = now_us;
+    adc_samples_done = 0;
+}
+
+void sim_adc_set_millivolts(unsigned int input, uint16_t millivolts)
+{
+    // Conversions up to now saw the old voltage.
+    run_adc_dma();
+    adc_input_mv[input] = millivolts;
+}
+
+static uint pio_block(PIO pio)
+{
+    return (pio == pio1) ? 1 : 0;
+}
+
+static uint pio_dreq(uint block, uint sm, bool is_tx)
+{
+    return block * SIM_DREQ_PIO_BLOCK_STRIDE + (is_tx ? SIM_DREQ_PIO0_TX0 : SIM_DREQ_PIO0_RX0) + sm;
+}
+
+void pio_gpio_init(PIO pio, uint pin)
+{
+    gpio_pio_blocks[pin] = pio_block(pio) + 1;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+    (void)required;
+    int &next = pio_next_sm[pio_block(pio)];
+    return (next < SIM_PIO_STATE_MACHINES) ? next++ : -1;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t *program)
+{
+    (void)pio;
+    (void)program;
+    return 0;
+}
+
+void pio_sm_set_pins_with_mask(PIO pio, uint sm, uint32_t pin_values, uint32_t pin_mask)
+{
+    (void)pio;
+    (void)sm;
+    (void)pin_values;
+    (void)pin_mask;
+}
+
+void pio_sm_set_pindirs_with_mask(PIO pio, uint sm, uint32_t pin_dirs, uint32_t pin_mask)
+{
+    (void)pio;
+    (void)sm;
+    (void)pin_dirs;
+    (void)pin_mask;
+}
+
+void pio_sm_init(PIO pio, uint sm, uint initial_pc, const pio_sm_config *config)
+{
+    (void)initial_pc;
+    pio_sms[pio_block(pio)][sm].config = *config;
+}
+
+void pio_sm_set_enabled(PIO pio, uint sm, bool enabled)
+{
+    pio_sms[pio_block(pio)][sm].enabled = enabled;
+    if (pio_spi_attached && pio_block(pio) == pio_spi_block && sm == pio_spi_sm)
+    {
+        pio_spi_enabled = enabled;
+    }
+}
+
+uint pio_get_dreq(PIO pio, uint sm, bool is_tx)
+{
+    return pio_dreq(pio_block(pio), sm, is_tx);
+}
+
+uint8_t pio_sm_get_pc(PIO pio, uint sm)
+{
+    (void)pio;
+    (void)sm;
+
+    // Transfers are whole bytes, between them the program waits for chip select.
+    return (uint8_t)pio_spi_idle_pc;
+}
+
+void pio_sm_restart(PIO pio, uint sm)
+{
+    (void)pio;
+    (void)sm;
+}
+
+void pio_sm_exec(PIO pio, uint sm, uint instr)
+{
+    (void)pio;
+    (void)sm;
+    (void)instr;
+}
+
+void sim_pio_spi_slave_attach(PIO pio, uint sm, uint pin_mosi, uint pin_miso, uint idle_pc)
+{
+    pio_spi_attached = true;
+    pio_spi_block = pio_block(pio);
+    pio_spi_sm = sm;
+    pio_spi_pin_cs = pin_mosi + 1;
+    pio_spi_pin_miso = pin_miso;
+    pio_spi_idle_pc = idle_pc;
+    pio_spi_rx_fifo.clear();
+    pio_spi_tx_fifo.clear();
+
+    // Chip select idles high.
+    gpio_levels[pio_spi_pin_cs] = true;
+}
+
+void sim_pio_servo_attach(PIO pio, uint sm)
+{
+    pio_servo_attached = true;
+    pio_servo_block = pio_block(pio);
+    pio_servo_sm = sm;
+}
+
+// --- GPIO interrupts ---
+
+void gpio_set_irq_enabled_with_callback(uint gpio, uint32_t event_mask, bool enabled, gpio_irq_callback_t callback)
+{
+    gpio_callback = callback;
+    if (enabled)
+    {
+        gpio_irq_events[gpio] |= event_mask;
+    }
+    else
+    {
+        gpio_irq_events[gpio] &= ~event_mask;
+    }
+    irq_enabled[IO_IRQ_BANK0] = true;
+}
+
+void gpio_set_oeover(uint gpio, uint value)
+{
+    gpio_oe_overrides[gpio] = value;
+}
+
+static void set_gpio_input(uint gpio, bool level)
+{
+    if (gpio_levels[gpio] == level)
+    {
+        return;
+    }
+
+    gpio_levels[gpio] = level;
+    uint32_t event = level ? GPIO_IRQ_EDGE_RISE : GPIO_IRQ_EDGE_FALL;
+    if ((gpio_irq_events[gpio] & event) && irq_enabled[IO_IRQ_BANK0] && gpio_callback != NULL)
+    {
+        gpio_callback(gpio, event);
+    }
+}
+
+// --- PIO SPI slave ---
+
+static void complete_dma_channel(uint channel)
+{
+    sim_dma_channel_t &dma = dma_channels[channel];
+    dma.started = false;
+    if (dma_irq1_enabled_mask & (1u << channel))
+    {
+        dma_irq1_status |= (1u << channel);
+    }
+
+    // The chained channel starts over with its count. Its write address went on, or wrapped in its ring.
+    if (dma.config.chain_to != channel)
+    {
+        sim_dma_channel_t &next = dma_channels[dma.config.chain_to];
+        next.started = true;
+        next.remaining = next.reload;
+    }
+}
+
+static int find_dma_channel(uint dreq)
+{
+    for (int i = 0; i < dma_next_channel; i++)
+    {
+        if (dma_channels[i].started && dma_channels[i].remaining > 0 && dma_channels[i].config.dreq == dreq)
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// Moves the bytes the DMA channels paced by the state machine would move by now.
+static void run_pio_spi_dma()
+{
+    int tx = find_dma_channel(pio_dreq(pio_spi_block, pio_spi_sm, true));
+    while (tx >= 0 && pio_spi_tx_fifo.size() < SIM_PIO_FIFO_DEPTH)
+    {
+        sim_dma_channel_t &dma = dma_channels[tx];
+        pio_spi_tx_fifo.push_back((uint8_t)*dma.read_next++);
+        if (--dma.remaining == 0)
+        {
+            complete_dma_channel(tx);
+            tx = find_dma_channel(pio_dreq(pio_spi_block, pio_spi_sm, true));
+        }
+    }
+
+    while (!pio_spi_rx_fifo.empty())
+    {
+        int rx = find_dma_channel(pio_dreq(pio_spi_block, pio_spi_sm, false));
+        if (rx < 0)
+        {
+            break;
+        }
+
+        sim_dma_channel_t &dma = dma_channels[rx];
+        uint32_t ring_mask = dma.config.ring_write ? (1u << dma.config.ring_size_bits) - 1 : 0xFFFFFFFFu;
+        dma.write_base[dma.write_offset & ring_mask] = pio_spi_rx_fifo.front();
+        pio_spi_rx_fifo.pop_front();
+        dma.write_offset++;
+        dma.hw.write_addr = (uint32_t)(uintptr_t)(dma.write_base + (dma.write_offset & ring_mask));
+        if (--dma.remaining == 0)
+        {
+            complete_dma_channel(rx);
+        }
+    }
+
+    if (dma_irq1_status != 0 && irq_enabled[DMA_IRQ_1] && irq_handlers[DMA_IRQ_1] != NULL)
+    {
+        irq_handlers[DMA_IRQ_1]();
+    }
+}
+
+// DMA channel streaming the servo frame table, -1 before the firmware set it up.
+static int find_pio_servo_dma_channel()
+{
+    int channel = -1;
+    for (int i = 0; i < dma_next_channel; i++)
+    {
+        if (dma_channels[i].config.dreq == pio_dreq(pio_servo_block, pio_servo_sm, true))
+        {
+            channel = i;
+        }
+    }
+    return channel;
+}
+
+// The servo pulse program drives all pins in its OUT range at the start of every segment.
+// A pin given to its block is then driven from the segment mask, MISO included, until the
+// SPI slave program shifts out its next bit. The bits of the transfer sampled then are the servo's.
+static void drive_miso_from_servo_edges(uint8_t *miso, size_t length)
+{
+    uint pin = pio_spi_pin_miso;
+    const sim_pio_sm_t &servo = pio_sms[pio_servo_block][pio_servo_sm];
+    if (!pio_servo_attached || !servo.enabled || !pwm_running ||
+        gpio_pio_blocks[pin] != pio_servo_block + 1 ||
+        pin < servo.config.out_base || pin >= servo.config.out_base + servo.config.out_count)
+    {
+        return;
+    }
+
+    int channel = find_pio_servo_dma_channel();
+    if (channel < 0)
+    {
+        return;
+    }
+
+    const volatile uint32_t *table = (const volatile uint32_t *)dma_channels[channel].read_next;
+    uint32_t words = dma_channels[channel].reload;
+    double ticks_per_us = clock_get_hz(clk_sys) / (double)servo.config.clkdiv / 1000000.0;
+    double bit_us = 1000000.0 / SIM_PIO_SPI_CLOCK_HZ;
+    double end_us = now_us + length * 8 * bit_us;
+
+    // From the frame playing now, the same table every frame.
+    for (uint64_t frame_us = pwm_next_frame_us - SIM_PWM_FRAME_US; frame_us < end_us; frame_us += SIM_PWM_FRAME_US)
+    {
+        double edge_us = (double)frame_us;
+        for (uint32_t w = 0; w + 1 < words; w += 2)
+        {
+            if (edge_us >= now_us && edge_us < end_us)
+            {
+                size_t bit = (size_t)((edge_us - now_us) / bit_us);
+                uint8_t bit_mask = (uint8_t)(0x80 >> (bit % 8));
+                bool level = (table[w] >> pin) & 1;
+                miso[bit / 8] = level ? (miso[bit / 8] | bit_mask) : (miso[bit / 8] & ~bit_mask);
+            }
+
+            edge_us += (table[w + 1] + SIM_PIO_SERVO_SEGMENT_OVERHEAD) / ticks_per_us;
+        }
+    }
+}
+
+uint32_t sim_pio_servo_segments()
+{
+    int channel = find_pio_servo_dma_channel();
+    return (pio_servo_attached && channel >= 0) ? dma_channels[channel].reload / 2 : 0;
+}
+
+uint32_t sim_pio_servo_pulse_ticks(unsigned int gpio)
+{
+    int channel = find_pio_servo_dma_channel();
+    if (!pio_servo_attached || channel < 0 || gpio >= 32)
+    {
+        return 0;
+    }
+
+    // The pin goes high at the frame start and stays high up to the first segment without it.
+    const volatile uint32_t *table = (const volatile uint32_t *)dma_channels[channel].read_next;
+    uint32_t words = dma_channels[channel].reload;
+    uint32_t ticks = 0;
+    for (uint32_t w = 0; w + 1 < words && ((table[w] >> gpio) & 1); w += 2)
+    {
+        ticks += table[w + 1] + SIM_PIO_SERVO_SEGMENT_OVERHEAD;
+    }
+    return ticks;
+}
+
+// Chip select low for the whole transfer, as a master sending one burst.
+static void pio_spi_transfer(const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+    set_gpio_input(pio_spi_pin_cs, false);
+
+    for (size_t i = 0; i < length; i++)
+    {
+        // Pulled at the start of the byte. With the FIFO empty the program sends its idle byte.
+        uint8_t out = 0;
+        if (!pio_spi_tx_fifo.empty())
+        {
+            out = pio_spi_tx_fifo.front();
+            pio_spi_tx_fifo.pop_front();
+        }
+
+        if (miso != NULL)
+        {
+            miso[i] = (gpio_oe_overrides[pio_spi_pin_miso] == GPIO_OVERRIDE_LOW) ? 0 : out;
+        }
+
+        // Pushed without blocking, a byte for a full FIFO is lost.
+        if (pio_spi_rx_fifo.size() < SIM_PIO_FIFO_DEPTH)
+        {
+            pio_spi_rx_fifo.push_back(mosi[i]);
+        }
+
+        run_pio_spi_dma();
+    }
+
+    if (miso != NULL && gpio_oe_overrides[pio_spi_pin_miso] != GPIO_OVERRIDE_LOW)
+    {
+        drive_miso_from_servo_edges(miso, length);
+    }
+
+    set_gpio_input(pio_spi_pin_cs, true);
+}
@@ -0,0 +1,73 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_HAL_HPP
+#define SIM_HAL_HPP
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Runs the unmodified firmware on the development machine in simulated time.
+//
+// The firmware main() runs on its own thread, in lock step with the caller: only one of them
+// runs at a time. The firmware runs until it sleeps, then the simulation fires the timers,
+// the PWM frame interrupts and the SPI interrupt at their simulated times, as the hardware would.
+// Interrupts run to completion at their event, there is no preemption.
+
+// Simulated time since reset, in microseconds.
+uint64_t sim_time_us();
+
+// Starts the firmware and runs it until the main loop first sleeps.
+void sim_boot();
+
+// Runs the simulation up to the given time.
+void sim_run_until(uint64_t time_us);
+
+// Stops the firmware thread. The simulation cannot be booted again in the same process.
+void sim_shutdown();
+
+// Clocks one transfer through the SPI slave at the current time.
+// miso gets what the slave sent back, it can be NULL.
+// The simulated time does not move. With the PIO SPI slave the bits are still placed
+// SIM_PIO_SPI_CLOCK_HZ apart from now, for the outputs other state machines change meanwhile.
+void sim_spi_transfer(const uint8_t *mosi, uint8_t *miso, size_t length);
+
+// Voltage on an ADC input, 0 to 3300mV. Inputs 0 to 3 are GP26 to GP29.
+void sim_adc_set_millivolts(unsigned int input, uint16_t millivolts);
+
+// Current level of a PWM output, as the hardware would output it.
+uint16_t sim_pwm_gpio_level(unsigned int gpio);
+
+// Current level of a GPIO output.
+bool sim_gpio_level(unsigned int gpio);
+
+// The servo frame the PIO DMA channel streams: its length in segments, and the pulse width
+// on a pin in PIO ticks, 0 for a pin held low.
+uint32_t sim_pio_servo_segments();
+uint32_t sim_pio_servo_pulse_ticks(unsigned int gpio);
+
+// Holds the interrupts off from now for the given time, as a flash erase does. The timers,
+// PWM frames and SPI bytes due meanwhile are handled late. SPI bytes beyond the receive FIFO are lost.
+void sim_hold_interrupts(uint32_t duration_us);
+
+// Priority the firmware gave an interrupt, PICO_DEFAULT_IRQ_PRIORITY if it did not.
+uint8_t sim_irq_priority(unsigned int num);
+
+// Whether the firmware asked the watchdog for a reboot.
+bool sim_reboot_requested();
+
+// After the given count of further flash erases and programs, the rest are lost, as if the power
+// went off in the middle. Until sim_flash_restore_power(), the code goes on as if they were done.
+void sim_flash_lose_power_after(uint32_t operations);
+void sim_flash_restore_power();
+
+// Address of the region the bootrom was last asked to start an image from, 0 if none.
+uintptr_t sim_chained_image();
+
+// Called after each PWM frame boundary, when the committed levels are on the outputs.
+typedef void (*sim_hook_t)(uint64_t time_us);
+void sim_set_pwm_frame_hook(sim_hook_t hook);
+
+// Called each time the firmware main loop goes to sleep.
+void sim_set_main_loop_hook(sim_hook_t hook);
+
+#endif // SIM_HAL_HPP
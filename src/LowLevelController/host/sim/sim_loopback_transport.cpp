@@ -0,0 +1,22 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include "sim_hal.hpp"
+#include "sim_loopback_transport.hpp"
+
+static uint32_t loopback_clock_hz;
+
+static bool loopback_transfer(void *context, const uint8_t *mosi, uint8_t *miso, size_t length)
+{
+    (void)context;
+    sim_spi_transfer(mosi, miso, length);
+    sim_run_until(sim_time_us() + (uint64_t)length * 8 * 1000000 / loopback_clock_hz);
+    return true;
+}
+
+void sim_loopback_transport(uint32_t clock_hz, client_transport_t *transport)
+{
+    loopback_clock_hz = clock_hz;
+    transport->transfer = loopback_transfer;
+    transport->close = NULL;
+    transport->context = NULL;
+}
@@ -0,0 +1,14 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_LOOPBACK_TRANSPORT_HPP
+#define SIM_LOOPBACK_TRANSPORT_HPP
+
+#include <stdint.h>
+#include "client/client_transport.hpp"
+
+// A client transport into the simulated firmware: each transfer goes through sim_spi_transfer(),
+// then the simulation runs for as long as the bytes take at the given clock.
+// Only one thread may drive the simulation at a time, the one flushing the client.
+void sim_loopback_transport(uint32_t clock_hz, client_transport_t *transport);
+
+#endif // SIM_LOOPBACK_TRANSPORT_HPP
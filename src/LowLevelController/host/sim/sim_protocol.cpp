@@ -0,0 +1,170 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <string.h>
+#include "common_types.hpp"
+#include "robot_description.hpp"
+#include "sim_hal.hpp"
+#include "sim_protocol.hpp"
+
+#define SIM_RESPONSE_SYNC_BYTE 0xA5
+#define SIM_RESPONSE_SIZE 10
+
+// Whole idle frames, so the slave stays in step.
+#define SIM_POLL_SIZE 32
+#define SIM_POLL_INTERVAL_US 20000
+
+// Working state in dc_motors_control.cpp and servo_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+extern motor_direction_speed_t servo_motor_speeds_array[];
+
+static int sim_check_failures = 0;
+
+static uint64_t wheel_started_us = 0;
+static uint64_t arm_started_us = 0;
+
+void sim_send_command(uint8_t type, const uint8_t data[7])
+{
+    uint8_t frame[8];
+    frame[0] = type;
+    memcpy(&frame[1], data, 7);
+    sim_spi_transfer(frame, NULL, sizeof(frame));
+}
+
+void sim_send_motion_command(uint8_t type, int8_t direction, uint8_t speed, uint16_t timeout_ms)
+{
+    uint8_t data[7] = { (uint8_t)direction, speed, (uint8_t)(timeout_ms >> 8), (uint8_t)timeout_ms, 0, 0, 0 };
+    sim_send_command(type, data);
+}
+
+void sim_send_command_at(uint8_t type, const uint8_t data[7], uint32_t execute_at_us)
+{
+    uint8_t frame[8 + 1 + COMMAND_EXTENSION_EXECUTE_AT_SIZE];
+    frame[0] = type | COMMAND_EXTENSION_FLAG;
+    memcpy(&frame[1], data, 7);
+    frame[8] = COMMAND_EXTENSION_EXECUTE_AT;
+    frame[9] = (uint8_t)(execute_at_us >> 24);
+    frame[10] = (uint8_t)(execute_at_us >> 16);
+    frame[11] = (uint8_t)(execute_at_us >> 8);
+    frame[12] = (uint8_t)execute_at_us;
+    sim_spi_transfer(frame, NULL, sizeof(frame));
+}
+
+void sim_send_command_to(uint8_t type, const uint8_t data[7], uint8_t address)
+{
+    uint8_t frame[8 + 1 + COMMAND_EXTENSION_ADDRESS_SIZE];
+    frame[0] = type | COMMAND_EXTENSION_FLAG;
+    memcpy(&frame[1], data, 7);
+    frame[8] = COMMAND_EXTENSION_ADDRESS;
+    frame[9] = address;
+    sim_spi_transfer(frame, NULL, sizeof(frame));
+}
+
+bool sim_read_response(uint8_t type, uint8_t data[7], uint32_t timeout_ms)
+{
+    uint8_t frame[SIM_RESPONSE_SIZE];
+    size_t received = 0;
+    uint64_t end_us = sim_time_us() + (uint64_t)timeout_ms * 1000;
+
+    while (sim_time_us() < end_us)
+    {
+        sim_run_until(sim_time_us() + SIM_POLL_INTERVAL_US);
+
+        uint8_t idle[SIM_POLL_SIZE] = { 0 };
+        uint8_t miso[SIM_POLL_SIZE];
+        sim_spi_transfer(idle, miso, sizeof(miso));
+
+        for (size_t i = 0; i < sizeof(miso); i++)
+        {
+            if (received == 0 && miso[i] != SIM_RESPONSE_SYNC_BYTE)
+            {
+                continue;
+            }
+
+            frame[received++] = miso[i];
+            if (received < sizeof(frame))
+            {
+                continue;
+            }
+            received = 0;
+
+            uint8_t checksum = 0;
+            for (size_t j = 1; j < sizeof(frame) - 1; j++)
+            {
+                checksum ^= frame[j];
+            }
+
+            if (checksum == frame[sizeof(frame) - 1] && frame[1] == type)
+            {
+                memcpy(data, &frame[2], 7);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+uint16_t sim_read_uint16(const uint8_t *data)
+{
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+uint32_t sim_read_uint32(const uint8_t *data)
+{
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+void sim_run_for_ms(uint32_t ms)
+{
+    sim_run_until(sim_time_us() + (uint64_t)ms * 1000);
+}
+
+static void record_motion_starts(uint64_t time_us)
+{
+    if (wheel_started_us == 0 && dc_motors_speeds[0].speed != 0)
+    {
+        wheel_started_us = time_us;
+    }
+    if (arm_started_us == 0 && servo_motor_speeds_array[robot_joint_entry(BASE_MOTOR_INDEX)].speed != 0)
+    {
+        arm_started_us = time_us;
+    }
+}
+
+void sim_record_motion_starts()
+{
+    wheel_started_us = 0;
+    arm_started_us = 0;
+    sim_set_pwm_frame_hook(record_motion_starts);
+}
+
+uint64_t sim_wheel_started_us()
+{
+    return wheel_started_us;
+}
+
+uint64_t sim_arm_started_us()
+{
+    return arm_started_us;
+}
+
+void sim_check(bool condition, const char *what)
+{
+    printf("  %-56s %s\n", what, condition ? "ok" : "FAILED");
+    if (!condition)
+    {
+        sim_check_failures++;
+    }
+}
+
+int sim_checks_result()
+{
+    if (sim_check_failures != 0)
+    {
+        printf("%d checks failed\n", sim_check_failures);
+        return 1;
+    }
+
+    return 0;
+}
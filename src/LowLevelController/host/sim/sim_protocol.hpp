@@ -0,0 +1,50 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SIM_PROTOCOL_HPP
+#define SIM_PROTOCOL_HPP
+
+#include <stdint.h>
+
+// The main controller side of the SPI protocol, for the scenarios run against the simulation.
+
+// Sends a plain 8-byte command at the current simulated time.
+void sim_send_command(uint8_t type, const uint8_t data[7]);
+
+// Sends a motor or joint direction command: direction, speed in percent and timeout in ms.
+void sim_send_motion_command(uint8_t type, int8_t direction, uint8_t speed, uint16_t timeout_ms);
+
+// Sends a command to run at the given firmware time, with the execute at extension.
+void sim_send_command_at(uint8_t type, const uint8_t data[7], uint32_t execute_at_us);
+
+// Sends a command to one board, or to all with BOARD_BROADCAST_ADDRESS, with the address extension.
+void sim_send_command_to(uint8_t type, const uint8_t data[7], uint8_t address);
+
+// Polls with idle frames, letting the simulation run between polls, until a response of the
+// given type arrives. Other responses are skipped. Returns false after timeout_ms.
+bool sim_read_response(uint8_t type, uint8_t data[7], uint32_t timeout_ms);
+
+// Big-endian fields of the responses and the register map.
+uint16_t sim_read_uint16(const uint8_t *data);
+uint32_t sim_read_uint32(const uint8_t *data);
+
+// Lets the simulation run for the given time.
+void sim_run_for_ms(uint32_t ms);
+
+// Control tick period, how far apart two ticks can take commands sent together over.
+#define SIM_CONTROL_TICK_US 10000
+
+// Records the first PWM frame in which the left wheel and the base joint have a speed.
+// Takes the PWM frame hook, calling it again starts a new recording.
+void sim_record_motion_starts();
+
+// Time of that frame, 0 until then.
+uint64_t sim_wheel_started_us();
+uint64_t sim_arm_started_us();
+
+// A check of the scenario, printed on its own line and counted when it fails.
+void sim_check(bool condition, const char *what);
+
+// Exit code of the scenario, 0 if every check passed. Prints the count of the failed ones.
+int sim_checks_result();
+
+#endif // SIM_PROTOCOL_HPP
@@ -0,0 +1,345 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Soak benchmark of the firmware command path in simulated time: SPI bytes in, through
+// the commands queue and process_commands_protocol(), to the DC motor state and the PWM level.
+// The firmware side counterpart of Run-RestLoadTest.ps1.
+//
+// Sends left motor commands at a given rate and burst pattern. Each command carries a new speed,
+// so the PWM frame that first outputs that speed tells when the command took effect.
+// Reports the sustained throughput, drops, queue occupancy and input to PWM latency percentiles.
+//
+// Usage:
+//   soak_benchmark [--rate <commands/s>] [--burst <frames>] [--duration <s>] [--jitter <us>]
+//                  [--spi-hz <Hz>] [--extended] [--seed <n>]
+//   soak_benchmark --sweep [--burst <frames>] [--duration <s>]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include "common_types.hpp"
+#include "spi_frame_parser.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+
+// Working state of the DC motors in dc_motors_control.cpp, what the control tick last applied.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+// Long enough that the motor does not time out between commands.
+#define SOAK_MOTOR_TIMEOUT_MS 30000
+
+// Time to let the queue drain after the load stops.
+#define SOAK_DRAIN_US 2000000
+
+typedef struct
+{
+    double rate;
+    uint32_t burst;
+    double duration_s;
+    uint32_t jitter_us;
+    uint32_t spi_hz;
+    bool extended;
+} soak_config_t;
+
+typedef struct
+{
+    uint8_t speed;
+    uint64_t sent_us;
+} in_flight_command_t;
+
+typedef struct
+{
+    uint32_t offered;
+    uint32_t frames;
+    uint32_t overflows;
+    uint32_t applied;
+    uint32_t applied_under_load;
+    uint32_t reached_pwm;
+    double duration_s;
+    double occupancy_mean;
+    uint32_t occupancy_p99;
+    uint32_t occupancy_max;
+    std::vector<uint64_t> latencies_us;
+} soak_result_t;
+
+static std::deque<in_flight_command_t> in_flight;
+static std::vector<uint64_t> latencies_us;
+static std::vector<uint32_t> occupancy_samples;
+static uint8_t last_applied_speed = 0;
+static uint32_t matching_errors = 0;
+
+static uint32_t random_state = 0x2545F491;
+
+static uint32_t next_random()
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+// A new speed reached the outputs in this frame. The commands before the one that carried it
+// were replaced in the same tick or dropped.
+static void on_pwm_frame(uint64_t time_us)
+{
+    uint8_t speed = dc_motors_speeds[0].speed;
+    if (speed == last_applied_speed)
+    {
+        return;
+    }
+    last_applied_speed = speed;
+
+    while (!in_flight.empty() && in_flight.front().speed != speed)
+    {
+        in_flight.pop_front();
+    }
+
+    if (in_flight.empty())
+    {
+        matching_errors++;
+        return;
+    }
+
+    latencies_us.push_back(time_us - in_flight.front().sent_us);
+    in_flight.pop_front();
+}
+
+static void on_main_loop(uint64_t time_us)
+{
+    (void)time_us;
+    spi_transport_stats_t stats;
+    spi_get_transport_stats(&stats);
+    occupancy_samples.push_back(stats.queued);
+}
+
+static void send_motor_command(const soak_config_t &config, uint8_t speed, uint16_t sequence)
+{
+    uint8_t frame[SPI_FRAME_MAX_SIZE];
+    size_t length = 0;
+
+    frame[length++] = (uint8_t)LEFT_MOTOR_COMMAND | (config.extended ? COMMAND_EXTENSION_FLAG : 0);
+    frame[length++] = 1; // Forward
+    frame[length++] = speed;
+    frame[length++] = (uint8_t)(SOAK_MOTOR_TIMEOUT_MS >> 8);
+    frame[length++] = (uint8_t)SOAK_MOTOR_TIMEOUT_MS;
+    while (length < 8)
+    {
+        frame[length++] = 0;
+    }
+
+    if (config.extended)
+    {
+        uint32_t host_timestamp = (uint32_t)sim_time_us();
+        frame[length++] = COMMAND_EXTENSION_SEQUENCE;
+        frame[length++] = (uint8_t)(sequence >> 8);
+        frame[length++] = (uint8_t)sequence;
+        for (int shift = 24; shift >= 0; shift -= 8)
+        {
+            frame[length++] = (uint8_t)(host_timestamp >> shift);
+        }
+    }
+
+    in_flight.push_back({ speed, sim_time_us() });
+    sim_spi_transfer(frame, NULL, length);
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p)
+{
+    if (sorted.empty())
+    {
+        return 0;
+    }
+
+    return sorted[(size_t)(p * (sorted.size() - 1))];
+}
+
+static soak_result_t run_soak(const soak_config_t &config)
+{
+    in_flight.clear();
+    latencies_us.clear();
+    occupancy_samples.clear();
+
+    spi_transport_stats_t start_stats;
+    spi_get_transport_stats(&start_stats);
+
+    soak_result_t result = {};
+    uint64_t start_us = sim_time_us();
+    uint64_t end_us = start_us + (uint64_t)(config.duration_s * 1000000.0);
+    uint64_t burst_interval_us = (uint64_t)(config.burst * 1000000.0 / config.rate);
+    uint64_t frame_us = (uint64_t)(config.extended ? 15 : 8) * 8 * 1000000 / config.spi_hz + 1;
+
+    uint8_t speed = last_applied_speed;
+    uint16_t sequence = 0;
+    for (uint64_t burst_us = start_us; burst_us < end_us; burst_us += burst_interval_us)
+    {
+        uint64_t send_us = burst_us + (config.jitter_us ? next_random() % config.jitter_us : 0);
+        for (uint32_t i = 0; i < config.burst; i++)
+        {
+            sim_run_until(send_us);
+
+            // 1 to 100, never the same twice in a row.
+            speed = (uint8_t)(speed % 100 + 1);
+            send_motor_command(config, speed, sequence++);
+            result.offered++;
+            send_us += frame_us;
+        }
+    }
+
+    sim_run_until(end_us);
+    result.duration_s = (sim_time_us() - start_us) / 1000000.0;
+
+    // Occupancy and throughput under load only, not while draining.
+    std::vector<uint32_t> occupancy = occupancy_samples;
+    spi_transport_stats_t stats;
+    spi_get_transport_stats(&stats);
+    result.applied_under_load = (stats.frames - start_stats.frames) - (stats.queue_overflows - start_stats.queue_overflows) - stats.queued;
+
+    sim_run_until(end_us + SOAK_DRAIN_US);
+    spi_get_transport_stats(&stats);
+    result.frames = stats.frames - start_stats.frames;
+    result.overflows = stats.queue_overflows - start_stats.queue_overflows;
+    result.applied = result.frames - result.overflows - stats.queued;
+    result.reached_pwm = (uint32_t)latencies_us.size();
+
+    if (!occupancy.empty())
+    {
+        uint64_t sum = 0;
+        for (uint32_t sample : occupancy)
+        {
+            sum += sample;
+        }
+        std::sort(occupancy.begin(), occupancy.end());
+        result.occupancy_mean = (double)sum / occupancy.size();
+        result.occupancy_p99 = occupancy[(size_t)(0.99 * (occupancy.size() - 1))];
+        result.occupancy_max = occupancy.back();
+    }
+
+    result.latencies_us = latencies_us;
+    std::sort(result.latencies_us.begin(), result.latencies_us.end());
+    return result;
+}
+
+static void print_result(const soak_config_t &config, const soak_result_t &result)
+{
+    const std::vector<uint64_t> &latency = result.latencies_us;
+    printf("rate %.0f/s, burst %u, %.1f s%s\n", config.rate, config.burst, result.duration_s, config.extended ? ", extended frames" : "");
+    printf("  offered      %8u (%.1f/s)\n", result.offered, result.offered / result.duration_s);
+    printf("  received     %8u\n", result.frames);
+    printf("  dropped      %8u (%.2f%%, queue full)\n", result.overflows, result.offered ? 100.0 * result.overflows / result.offered : 0.0);
+    printf("  applied      %8u (%.1f/s sustained)\n", result.applied, result.applied_under_load / result.duration_s);
+    printf("  reached PWM  %8u (the rest was replaced within a tick)\n", result.reached_pwm);
+    printf("  queue        mean %.1f, p99 %u, max %u\n", result.occupancy_mean, result.occupancy_p99, result.occupancy_max);
+    printf("  latency us   p50 %llu, p90 %llu, p99 %llu, p99.9 %llu, max %llu\n",
+        (unsigned long long)percentile(latency, 0.50),
+        (unsigned long long)percentile(latency, 0.90),
+        (unsigned long long)percentile(latency, 0.99),
+        (unsigned long long)percentile(latency, 0.999),
+        (unsigned long long)(latency.empty() ? 0 : latency.back()));
+}
+
+static void print_sweep_row(const soak_config_t &config, const soak_result_t &result)
+{
+    const std::vector<uint64_t> &latency = result.latencies_us;
+    printf("%8.0f %8u %10.1f %8.2f%% %6.1f %6u %10llu %10llu %10llu\n",
+        config.rate,
+        config.burst,
+        result.applied_under_load / result.duration_s,
+        result.offered ? 100.0 * result.overflows / result.offered : 0.0,
+        result.occupancy_mean,
+        result.occupancy_max,
+        (unsigned long long)percentile(latency, 0.50),
+        (unsigned long long)percentile(latency, 0.99),
+        (unsigned long long)(latency.empty() ? 0 : latency.back()));
+}
+
+int main(int argc, char **argv)
+{
+    // The default jitter of one control tick keeps the sends from lining up with the ticks.
+    soak_config_t config = { 50.0, 1, 60.0, 10000, 500000, false };
+    bool sweep = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        bool has_value = (i + 1 < argc);
+        if (strcmp(argv[i], "--rate") == 0 && has_value)
+        {
+            config.rate = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--burst") == 0 && has_value)
+        {
+            config.burst = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--duration") == 0 && has_value)
+        {
+            config.duration_s = atof(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--jitter") == 0 && has_value)
+        {
+            config.jitter_us = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--spi-hz") == 0 && has_value)
+        {
+            config.spi_hz = (uint32_t)atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--seed") == 0 && has_value)
+        {
+            random_state = (uint32_t)strtoul(argv[++i], NULL, 0) | 1;
+        }
+        else if (strcmp(argv[i], "--extended") == 0)
+        {
+            config.extended = true;
+        }
+        else if (strcmp(argv[i], "--sweep") == 0)
+        {
+            sweep = true;
+        }
+        else
+        {
+            printf("Unknown argument %s\n", argv[i]);
+            return 2;
+        }
+    }
+
+    if (config.rate <= 0 || config.burst == 0 || config.duration_s <= 0 || config.spi_hz == 0)
+    {
+        printf("Rate, burst, duration and SPI clock must be positive\n");
+        return 2;
+    }
+
+    sim_set_pwm_frame_hook(on_pwm_frame);
+    sim_set_main_loop_hook(on_main_loop);
+    sim_boot();
+
+    // Let the boot and the servo start positions settle.
+    sim_run_until(sim_time_us() + 1000000);
+
+    int status = 0;
+    if (sweep)
+    {
+        static const double rates[] = { 10, 25, 50, 75, 100, 150, 200, 400, 800 };
+        printf("%8s %8s %10s %9s %6s %6s %10s %10s %10s\n",
+            "rate/s", "burst", "applied/s", "dropped", "q mean", "q max", "p50 us", "p99 us", "max us");
+        for (double rate : rates)
+        {
+            config.rate = rate;
+            soak_result_t result = run_soak(config);
+            print_sweep_row(config, result);
+        }
+    }
+    else
+    {
+        soak_result_t result = run_soak(config);
+        print_result(config, result);
+    }
+
+    if (matching_errors != 0)
+    {
+        printf("%u PWM changes did not match a sent command\n", matching_errors);
+        status = 1;
+    }
+
+    sim_shutdown();
+    return status;
+}
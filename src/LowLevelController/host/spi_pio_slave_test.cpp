@@ -0,0 +1,149 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// The transport on the PIO SPI slave, in simulated time.
+//   1. One chip select burst longer than the receive ring, with commands spread over it,
+//      is taken whole and in order, without an interrupt per byte.
+//   2. A register write with frames right after it in the same burst.
+//   3. A register read comes out whole at the start of the next burst after a main loop pass.
+//   4. While another board is selected MISO stays low, the responses wait.
+//   5. A register read streamed while the PIO servos switch, from the frame start over the
+//      falling edges, comes out whole: the servo engine does not drive MISO.
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "common_types.hpp"
+#include "irq_tiers.hpp"
+#include "pico_native_pwm.hpp"
+#include "pio_servo_pwm.hpp"
+#include "register_map.hpp"
+#include "spi_transport.hpp"
+#include "sim/sim_hal.hpp"
+#include "sim/sim_protocol.hpp"
+
+// Working state in dc_motors_control.cpp.
+extern motor_direction_speed_t dc_motors_speeds[];
+
+#define RESPONSE_SYNC_BYTE 0xA5
+#define OTHER_BOARD_ADDRESS 3
+
+// Longer than the 512 byte receive ring.
+#define BURST_FRAMES 100
+
+static uint64_t last_frame_us = 0;
+
+static void record_frame(uint64_t time_us)
+{
+    last_frame_us = time_us;
+}
+
+static void put_frame(std::vector<uint8_t> &burst, size_t frame, uint8_t type, const uint8_t data[7])
+{
+    burst[frame * 8] = type;
+    memcpy(&burst[frame * 8 + 1], data, 7);
+}
+
+int main()
+{
+    static_assert(SPI_TRANSPORT_USE_PIO, "Built against the firmware with the PIO SPI slave");
+
+    sim_boot();
+    sim_run_for_ms(1000);
+
+    printf("Long burst\n");
+    spi_transport_stats_t before;
+    spi_get_transport_stats(&before);
+    irq_tier_reset(IRQ_TIER_TRANSPORT);
+
+    uint8_t left[7] = { 1, 40, 0x75, 0x30, 0, 0, 0 };
+    uint8_t right[7] = { 0xFF, 50, 0x75, 0x30, 0, 0, 0 };
+    std::vector<uint8_t> burst(BURST_FRAMES * 8, 0);
+    put_frame(burst, 0, LEFT_MOTOR_COMMAND, left);
+    put_frame(burst, BURST_FRAMES * 3 / 4, RIGHT_MOTOR_COMMAND, right);
+    left[1] = 70;
+    put_frame(burst, BURST_FRAMES - 1, LEFT_MOTOR_COMMAND, left);
+    sim_spi_transfer(burst.data(), NULL, burst.size());
+    sim_run_for_ms(100);
+
+    spi_transport_stats_t after;
+    spi_get_transport_stats(&after);
+    irq_tier_stats_t transport;
+    irq_tier_get_stats(IRQ_TIER_TRANSPORT, &transport);
+    sim_check(after.frames - before.frames == BURST_FRAMES, "every frame of the burst parsed");
+    sim_check(dc_motors_speeds[0].direction == 1 && dc_motors_speeds[0].speed == 70, "left wheel from the last frame");
+    sim_check(dc_motors_speeds[1].direction == -1 && dc_motors_speeds[1].speed == 50, "right wheel from past the ring wrap");
+    sim_check(transport.entries <= 8 && transport.misses == 0, "a few interrupts for the burst, none late");
+
+    printf("Register write in a burst\n");
+    // Payload 1, 20, 0x75, 0x30, 1, 25, 0x75, 0x30 with XOR 20 ^ 25, then a frame stopping the right wheel.
+    std::vector<uint8_t> write = {
+        REGISTER_WRITE_COMMAND, (uint8_t)(REG_WHEEL_SETPOINTS >> 8), (uint8_t)REG_WHEEL_SETPOINTS, 0, 8, 20 ^ 25, 0, 0,
+        1, 20, 0x75, 0x30, 1, 25, 0x75, 0x30,
+        RIGHT_MOTOR_COMMAND, 0, 0, 0, 0, 0, 0, 0
+    };
+    sim_spi_transfer(write.data(), NULL, write.size());
+    sim_run_for_ms(100);
+    sim_check(dc_motors_speeds[0].speed == 20, "written setpoint applied");
+    sim_check(dc_motors_speeds[1].speed == 0, "frame after the payload applied");
+
+    printf("Register read\n");
+    uint8_t read[8] = { REGISTER_READ_COMMAND, 0, REG_MAGIC, 0, 4, 0, 0, 0 };
+    sim_spi_transfer(read, NULL, sizeof(read));
+    sim_run_for_ms(20);
+    uint8_t idle[32] = { 0 };
+    uint8_t miso[32];
+    sim_spi_transfer(idle, miso, sizeof(miso));
+    uint8_t checksum = 0;
+    for (size_t i = 1; i < REGISTER_BURST_HEADER_SIZE + 4; i++)
+    {
+        checksum ^= miso[i];
+    }
+    sim_check(miso[0] == RESPONSE_SYNC_BYTE && miso[1] == REGISTER_BURST_RESPONSE, "burst first in the next transfer after a pass");
+    sim_check((miso[6] << 8 | miso[7]) == REGISTER_MAP_MAGIC && checksum == miso[REGISTER_BURST_HEADER_SIZE + 4], "burst whole and checked");
+    sim_check(miso[REGISTER_BURST_HEADER_SIZE + 5] == 0, "idle bytes after it");
+
+    printf("Responder select\n");
+    uint8_t response[7];
+    uint8_t select[7] = { OTHER_BOARD_ADDRESS, 0, 0, 0, 0, 0, 0 };
+    uint8_t sync[7] = { 0, 0, 0, 0, 0, 0, 0 };
+    sim_send_command(BOARD_SELECT_COMMAND, select);
+    sim_send_command(TIME_SYNC_COMMAND, sync);
+    sim_check(!sim_read_response(TIME_SYNC_RESPONSE, response, 100), "no response while another board is selected");
+    select[0] = BOARD_ADDRESS;
+    sim_send_command(BOARD_SELECT_COMMAND, select);
+    sim_check(sim_read_response(TIME_SYNC_RESPONSE, response, 100), "response sent once selected again");
+
+    printf("Servo edges during a burst\n");
+    // Pulses ending 500 to 900 us into the frame, all inside a read of the whole map.
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        set_pwm_pulse_width_us(PIO_PWM_NUMBER_FIRST + i, 500 + 100 * i);
+    }
+    sim_set_pwm_frame_hook(record_frame);
+    sim_run_for_ms(50);
+
+    uint8_t read_map[8] = { REGISTER_READ_COMMAND, 0, 0, (uint8_t)(REGISTER_MAP_SIZE >> 8), (uint8_t)REGISTER_MAP_SIZE, 0, 0, 0 };
+    sim_spi_transfer(read_map, NULL, sizeof(read_map));
+    sim_run_for_ms(1);
+
+    // Starts on the frame start, where every servo output switches high.
+    uint64_t frame_start_us = last_frame_us + PWM_PERIOD;
+    sim_run_until(frame_start_us);
+    std::vector<uint8_t> idle_map(REGISTER_BURST_HEADER_SIZE + REGISTER_MAP_SIZE + 1, 0);
+    std::vector<uint8_t> miso_map(idle_map.size());
+    sim_spi_transfer(idle_map.data(), miso_map.data(), idle_map.size());
+    sim_set_pwm_frame_hook(NULL);
+
+    checksum = 0;
+    for (size_t i = 1; i < miso_map.size() - 1; i++)
+    {
+        checksum ^= miso_map[i];
+    }
+    sim_check(last_frame_us == frame_start_us && sim_time_us() == frame_start_us, "burst from the frame start");
+    sim_check(miso_map[0] == RESPONSE_SYNC_BYTE && miso_map[1] == REGISTER_BURST_RESPONSE, "burst header intact");
+    sim_check((miso_map[6] << 8 | miso_map[7]) == REGISTER_MAP_MAGIC && checksum == miso_map.back(), "burst whole over the servo edges");
+
+    sim_shutdown();
+
+    return sim_checks_result();
+}
@@ -0,0 +1,86 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "pico/time.h"
+#include "hardware/irq.h"
+#include "hardware/timer.h"
+#include "irq_tiers.hpp"
+
+// Each tier is only written by its own handlers, which do not preempt each other.
+irq_tier_stats_t irq_tier_stats[IRQ_TIERS_COUNT];
+volatile bool irq_tier_reset_requested[IRQ_TIERS_COUNT];
+
+void init_irq_tiers()
+{
+    // The repeating timers of the control ticks all run from the default alarm pool.
+    alarm_pool_t *pool = alarm_pool_get_default();
+    irq_set_priority(hardware_alarm_get_irq_num(alarm_pool_timer_alarm_num(pool)), IRQ_PRIORITY_CONTROL);
+}
+
+void __not_in_flash_func(irq_tier_record)(irq_tier_t tier, uint32_t latency, uint32_t entered_us)
+{
+    irq_tier_stats_t *stats = &irq_tier_stats[tier];
+    if (irq_tier_reset_requested[tier])
+    {
+        irq_tier_reset_requested[tier] = false;
+        stats->entries = 0;
+        stats->max_latency = 0;
+        stats->max_duration_us = 0;
+        stats->misses = 0;
+    }
+
+    uint32_t duration_us = time_us_32() - entered_us;
+    stats->entries++;
+    if (latency > stats->max_latency)
+    {
+        stats->max_latency = latency;
+    }
+    if (duration_us > stats->max_duration_us)
+    {
+        stats->max_duration_us = duration_us;
+    }
+}
+
+void __not_in_flash_func(irq_tier_miss)(irq_tier_t tier)
+{
+    irq_tier_stats[tier].misses++;
+}
+
+void irq_tick_start(irq_tick_t *tick, uint32_t interval_us)
+{
+    tick->interval_us = interval_us;
+    tick->due_us = time_us_32() + interval_us;
+    tick->late_us = 0;
+}
+
+uint32_t __not_in_flash_func(irq_tick_begin)(irq_tick_t *tick)
+{
+    uint32_t entered_us = time_us_32();
+    tick->late_us = entered_us - tick->due_us;
+
+    // With a negative interval the timer is due at fixed steps, however late this tick is.
+    tick->due_us += tick->interval_us;
+    return entered_us;
+}
+
+void __not_in_flash_func(irq_tick_end)(irq_tick_t *tick, uint32_t entered_us)
+{
+    // Started early is not late. Can only be off by the few us between irq_tick_start() and the timer.
+    uint32_t late_us = ((int32_t)tick->late_us < 0) ? 0 : tick->late_us;
+    irq_tier_record(IRQ_TIER_CONTROL, late_us, entered_us);
+    if (late_us >= tick->interval_us)
+    {
+        irq_tier_miss(IRQ_TIER_CONTROL);
+    }
+}
+
+void irq_tier_get_stats(irq_tier_t tier, irq_tier_stats_t *stats)
+{
+    *stats = irq_tier_stats[tier];
+}
+
+void irq_tier_reset(irq_tier_t tier)
+{
+    irq_tier_reset_requested[tier] = true;
+}
@@ -0,0 +1,67 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef IRQ_TIERS_HPP
+#define IRQ_TIERS_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/irq.h"
+#include "common_types.hpp"
+
+// Interrupt priorities of the firmware, lower is more urgent. Only the top 4 bits count.
+//
+// Transport receive preempts everything, so a long control tick cannot overrun the receive FIFO.
+// Its handlers only drain the FIFO into the queue and act on the priority commands.
+// The output interrupts latch the levels of the last tick at the frame boundary and must not
+// wait for the next tick. The control ticks run on the timer alarm below them.
+// Everything else, commands included, runs in thread mode from the main loop.
+#define IRQ_PRIORITY_TRANSPORT PICO_HIGHEST_IRQ_PRIORITY
+#define IRQ_PRIORITY_OUTPUT (PICO_DEFAULT_IRQ_PRIORITY - 0x40)
+#define IRQ_PRIORITY_CONTROL PICO_DEFAULT_IRQ_PRIORITY
+
+// Worst cases of one tier since boot or since the last reset.
+typedef struct
+{
+    uint32_t entries;
+
+    // How late the handlers started. For the transport tier, the most bytes taken in one entry,
+    // as the receive FIFO has no level to read. At 8 the FIFO was full. With the PIO slave the
+    // bytes come from the DMA ring, up to half of it in one entry is normal.
+    // For the other tiers, microseconds after the frame boundary or the due time of the tick.
+    uint32_t max_latency;
+
+    uint32_t max_duration_us;
+
+    // Receive overruns for the transport tier, ticks later than a whole interval for the control tier.
+    uint32_t misses;
+} irq_tier_stats_t;
+
+// A control tick on a repeating timer with a negative interval, due at fixed steps.
+typedef struct
+{
+    uint32_t due_us;
+    uint32_t interval_us;
+    uint32_t late_us;
+} irq_tick_t;
+
+// Sets the priority of the timer alarm that runs the control ticks.
+void init_irq_tiers();
+
+// Records one entry of a handler. Call at its end with the time it started.
+void irq_tier_record(irq_tier_t tier, uint32_t latency, uint32_t entered_us);
+
+void irq_tier_miss(irq_tier_t tier);
+
+// Call right before add_repeating_timer_us(), the first tick is due one interval later.
+void irq_tick_start(irq_tick_t *tick, uint32_t interval_us);
+
+// Call first thing in the tick. Returns the time it started, for irq_tick_end().
+uint32_t irq_tick_begin(irq_tick_t *tick);
+void irq_tick_end(irq_tick_t *tick, uint32_t entered_us);
+
+void irq_tier_get_stats(irq_tier_t tier, irq_tier_stats_t *stats);
+
+// Clears the worst cases. They are cleared at the next entry, by the handlers themselves.
+void irq_tier_reset(irq_tier_t tier);
+
+#endif // IRQ_TIERS_HPP
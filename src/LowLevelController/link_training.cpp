@@ -0,0 +1,68 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "link_training.hpp"
+
+// Updated by the SPI interrupt, read by the main loop.
+volatile uint32_t link_training_good_frames = 0;
+volatile uint32_t link_training_bad_frames = 0;
+
+uint32_t link_training_committed_clock_hz = 0;
+
+static bool __not_in_flash_func(is_pattern_intact)(const command_8_bytes_t &command)
+{
+    uint8_t index = command.data[1];
+    for (uint8_t i = 0; i < LINK_TRAINING_PATTERN_SIZE; i++)
+    {
+        if (command.data[2 + i] != link_training_pattern_byte(index, i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool __not_in_flash_func(link_training_receive)(const command_8_bytes_t &command)
+{
+    if (command.type != LINK_TRAINING_COMMAND)
+    {
+        return false;
+    }
+
+    if (command.data[0] == LINK_TRAINING_START)
+    {
+        link_training_good_frames = 0;
+        link_training_bad_frames = 0;
+        return true;
+    }
+
+    if (command.data[0] == LINK_TRAINING_PATTERN)
+    {
+        if (is_pattern_intact(command))
+        {
+            link_training_good_frames++;
+        }
+        else
+        {
+            link_training_bad_frames++;
+        }
+        return true;
+    }
+
+    // Anything else goes through the queue.
+    return false;
+}
+
+void link_training_get_status(link_training_status_t *status)
+{
+    status->good_frames = link_training_good_frames;
+    status->bad_frames = link_training_bad_frames;
+    status->committed_clock_hz = link_training_committed_clock_hz;
+}
+
+void link_training_commit(uint32_t clock_hz)
+{
+    link_training_committed_clock_hz = clock_hz;
+}
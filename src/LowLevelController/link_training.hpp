@@ -0,0 +1,33 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef LINK_TRAINING_HPP
+#define LINK_TRAINING_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+
+// The SPI slave samples with clk_peri, which must be at least 12 times the bus clock.
+// The host never needs to try faster than this.
+#define LINK_TRAINING_MAX_CLOCK_HZ (150000000 / 12)
+
+typedef struct
+{
+    // Pattern frames since the last start, received intact and with wrong bytes.
+    // Frames lost completely are the ones the host sent but are in neither count.
+    uint32_t good_frames;
+    uint32_t bad_frames;
+
+    // Clock the host settled on, 0 before the first commit.
+    uint32_t committed_clock_hz;
+} link_training_status_t;
+
+// Start and pattern frames are counted straight in the SPI interrupt, so a burst of patterns
+// does not wait in the commands queue. Returns true if the command was taken.
+bool link_training_receive(const command_8_bytes_t &command);
+
+void link_training_get_status(link_training_status_t *status);
+
+void link_training_commit(uint32_t clock_hz);
+
+#endif // LINK_TRAINING_HPP
@@ -4,6 +4,7 @@
 #include "hardware/uart.h"
 #include "hardware/irq.h"
 #include "logger.hpp"
+#include "irq_tiers.hpp"
 
 #define UART_ID uart1 
 #define BAUD_RATE 115200
@@ -16,8 +17,6 @@
 #define UART_TX_PIN 0
 #define UART_RX_PIN 1
 
-static int chars_rxed = 0;
-
 void init_logger()
 {
 #if LOGGER_ENABLED
@@ -50,6 +49,7 @@ void init_logger()
 
     // And set up and enable the interrupt handlers
     irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
+    irq_set_priority(UART_IRQ, IRQ_PRIORITY_TRANSPORT);
     irq_set_enabled(UART_IRQ, true);
 
     // Now enable the UART to send interrupts - RX only
@@ -61,6 +61,8 @@ size_t log_message(char *message)
 {
 #if LOGGER_ENABLED
     uart_puts(UART_ID, message);
+#else
+    (void)message;
 #endif // LOGGER_ENABLED
 
     return 0;
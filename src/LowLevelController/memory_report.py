@@ -0,0 +1,107 @@
+# Copyright © Svetoslav Paregov. All rights reserved.
+#
+# Lists where the firmware symbols ended up after linking and how big they are.
+# Run by the build after linking, or by hand: python memory_report.py <nm> <elf>
+
+import subprocess
+import sys
+
+# Address ranges of the RP2350 memories, as used by memmap_default_rp2350.ld.
+REGIONS = [
+    ("FLASH", 0x10000000, 0x11000000),
+    ("RAM", 0x20000000, 0x20080000),
+    ("SCRATCH_X", 0x20080000, 0x20081000),
+    ("SCRATCH_Y", 0x20081000, 0x20082000),
+]
+
+# Code and data used by the interrupts and the control ticks. They must not be in flash,
+# a cache miss there stalls them, for example while the flash is written.
+HOT_SYMBOLS = [
+    "spi_irq_handler",
+    "spi_next_tx_byte",
+    "commands_buffer",
+    "responses_buffer",
+    "servo_motors_timer_callback",
+    "process_servo_motor_speed",
+    "should_servo_move",
+    "process_servo_tick",
+    "set_servo_position_in_degrees",
+    "servos_info_array",
+    "servos_speed_table",
+    "dc_motors_timer_callback",
+    "process_dc_motor_speed",
+    "process_dc_motors_tick",
+    "pwm_wrap_irq_handler",
+    "commit_pwm_levels",
+    "set_pwm_pulse_width_us",
+    "set_pwm_duty_cycle_in_percent",
+    "pio_servo_dma_irq_handler",
+    "build_pio_servo_frame",
+    "process_arm_kinematics",
+    "cordic_atan_table_mdeg",
+    "process_motion_recorder",
+]
+
+
+def region_of(address):
+    for name, start, end in REGIONS:
+        if start <= address < end:
+            return name
+    return None
+
+
+def main():
+    if len(sys.argv) != 3:
+        print("Usage: memory_report.py <nm> <elf>")
+        return 2
+
+    nm, elf = sys.argv[1], sys.argv[2]
+    output = subprocess.run(
+        [nm, "--print-size", "--size-sort", "--demangle", elf],
+        check=True, capture_output=True, text=True).stdout
+
+    symbols = {name: [] for name, _, _ in REGIONS}
+    for line in output.splitlines():
+        parts = line.split(maxsplit=3)
+        if len(parts) != 4:
+            continue
+        address, size, kind, name = int(parts[0], 16), int(parts[1], 16), parts[2], parts[3]
+        region = region_of(address)
+        if region is not None:
+            symbols[region].append((size, kind, name))
+
+    for region, _, _ in REGIONS:
+        entries = sorted(symbols[region], reverse=True)
+        print(f"{region}: {sum(size for size, _, _ in entries)} bytes in {len(entries)} symbols")
+
+        # Flash holds everything else, only show the biggest ones there.
+        shown = entries[:20] if region == "FLASH" else entries
+        for size, kind, name in shown:
+            print(f"    {size:8} {kind} {name}")
+
+    misplaced = []
+    for hot in HOT_SYMBOLS:
+        for size, kind, name in symbols["FLASH"]:
+            # Demangled names carry the arguments, compare without them.
+            if name.split("(")[0] == hot:
+                misplaced.append(name)
+
+    # Out of line copies of the queue templates must not end up in flash either.
+    for size, kind, name in symbols["FLASH"]:
+        if kind in "tT" and (name.startswith("CyclicBuffer<") or name.startswith("PublishBuffer<") or
+                             name.startswith("PublishedSetpoints<")):
+            misplaced.append(name)
+
+    for name in misplaced:
+        print(f"warning: hot path symbol in flash: {name}")
+
+    # The linker script asserts it as well, the core 0 stack needs all of SCRATCH_Y.
+    for size, kind, name in symbols["SCRATCH_Y"]:
+        if size != 0:
+            print(f"warning: symbol in the core 0 stack in SCRATCH_Y: {name}")
+
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,445 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <atomic>  // For std::atomic
+#include "pico/stdlib.h"
+#include "motion_recorder.hpp"
+#include "publish_buffer.hpp"
+#include "servo_control.hpp"
+
+// Encoding of the ticks, starting from the positions in the header:
+//   0x00 n              - n ticks (1..255) without a change.
+//   mask d0 d1 ...      - one tick, mask has a bit for each servo that moved,
+//                         followed by its change in degrees as int8, lowest servo first.
+// Changes bigger than int8 are spread over the next ticks.
+#define MOTION_IDLE_MARKER 0x00
+#define MOTION_MAX_IDLE_RUN 255
+
+static_assert(SERVOS_COUNT <= 8, "The change mask is one byte");
+
+typedef struct
+{
+    int16_t start_degrees[SERVOS_COUNT];
+
+    // Size of the encoded data and length in control ticks.
+    uint32_t length;
+    uint32_t ticks;
+
+    uint8_t data[MOTION_RECORDING_SIZE];
+} motion_recording_t;
+
+typedef enum {
+    MOTION_REQUEST_RECORD = 0,
+    MOTION_REQUEST_PLAY = 1,
+    MOTION_REQUEST_STOP = 2,
+} motion_request_type_t;
+
+typedef struct
+{
+    motion_request_type_t type;
+    uint8_t recording_id;
+    uint8_t speed_percent;
+    bool loop;
+
+    // Playback stops asked for before this request, a later one stops what it starts.
+    uint32_t stop_playback_requests;
+} motion_request_t;
+
+motion_recording_t motion_recordings[MOTION_RECORDINGS_COUNT];
+
+// Written by the command processing, taken over by the control tick.
+PublishBuffer<motion_request_t> motion_requests;
+
+// Kept apart from the requests, so joint commands sent right after a request do not replace it.
+// Counted, so the tick tells a stop sent before a play request from one sent after it.
+std::atomic<uint32_t> motion_stop_playback_requests(0);
+
+// Written by the control tick after each tick, read by the main loop. The tick publishes once
+// while the main loop copies at most, so the copy it gets is whole.
+PublishBuffer<motion_status_t> motion_published_status;
+
+// Last status read. Owned by the main loop.
+motion_status_t motion_status = {};
+
+// Owned by the control tick.
+motion_mode_t motion_mode = MOTION_MODE_IDLE;
+uint32_t motion_stop_playback_applied = 0;
+uint8_t motion_recording_id = 0;
+
+// Positions as encoded so far, while recording or playing.
+int16_t motion_degrees[SERVOS_COUNT];
+
+// Recording: ticks without a change not written yet.
+uint32_t motion_idle_ticks = 0;
+
+// Playback: read position, remaining ticks of a hold, speed and loop.
+uint32_t motion_read_position = 0;
+uint32_t motion_idle_remaining = 0;
+uint32_t motion_phase = 0;
+uint8_t motion_speed_percent = MOTION_DEFAULT_SPEED_PERCENT;
+bool motion_loop = false;
+
+// Playback: the joints are still on the way to the start pose.
+bool motion_approaching = false;
+
+volatile bool motion_recorder_suspended = false;
+
+static void submit_motion_request(motion_request_t *request)
+{
+    request->stop_playback_requests = motion_stop_playback_requests.load(std::memory_order_relaxed);
+    motion_requests.publish(*request);
+}
+
+static void __not_in_flash_func(publish_motion_status)()
+{
+    motion_status_t status = {
+        .mode = motion_mode,
+        .recording_id = motion_recording_id,
+        .length = motion_recordings[motion_recording_id].length,
+        .ticks = motion_recordings[motion_recording_id].ticks
+    };
+    motion_published_status.publish(status);
+}
+
+void init_motion_recorder()
+{
+    motion_mode = MOTION_MODE_IDLE;
+    for (int i = 0; i < MOTION_RECORDINGS_COUNT; i++)
+    {
+        motion_recordings[i].length = 0;
+        motion_recordings[i].ticks = 0;
+    }
+    publish_motion_status();
+}
+
+bool motion_record_start(uint8_t recording_id)
+{
+    if (recording_id >= MOTION_RECORDINGS_COUNT)
+    {
+        return false;
+    }
+
+    motion_request_t request = {};
+    request.type = MOTION_REQUEST_RECORD;
+    request.recording_id = recording_id;
+    submit_motion_request(&request);
+    return true;
+}
+
+bool motion_play(uint8_t recording_id, uint8_t speed_percent, bool loop)
+{
+    if (recording_id >= MOTION_RECORDINGS_COUNT)
+    {
+        return false;
+    }
+
+    motion_request_t request = {};
+    request.type = MOTION_REQUEST_PLAY;
+    request.recording_id = recording_id;
+    request.speed_percent = (speed_percent == 0) ? (uint8_t)MOTION_DEFAULT_SPEED_PERCENT : speed_percent;
+    request.loop = loop;
+    submit_motion_request(&request);
+    return true;
+}
+
+void motion_stop()
+{
+    motion_request_t request = {};
+    request.type = MOTION_REQUEST_STOP;
+    submit_motion_request(&request);
+}
+
+void motion_stop_playback()
+{
+    motion_stop_playback_requests.fetch_add(1, std::memory_order_release);
+}
+
+void get_motion_status(motion_status_t *status)
+{
+    motion_published_status.consume(motion_status);
+    *status = motion_status;
+}
+
+bool motion_playback_active()
+{
+    motion_status_t status;
+    get_motion_status(&status);
+    return motion_requests.pending() || status.mode == MOTION_MODE_PLAYING;
+}
+
+static bool __not_in_flash_func(write_idle_run)(motion_recording_t *recording)
+{
+    if (motion_idle_ticks == 0)
+    {
+        return true;
+    }
+
+    if (recording->length + 2 > MOTION_RECORDING_SIZE)
+    {
+        return false;
+    }
+
+    recording->data[recording->length++] = MOTION_IDLE_MARKER;
+    recording->data[recording->length++] = (uint8_t)motion_idle_ticks;
+    motion_idle_ticks = 0;
+    return true;
+}
+
+static void __not_in_flash_func(finish_recording)()
+{
+    write_idle_run(&motion_recordings[motion_recording_id]);
+    motion_mode = MOTION_MODE_IDLE;
+}
+
+static void __not_in_flash_func(start_recording)(uint8_t recording_id)
+{
+    motion_recording_t *recording = &motion_recordings[recording_id];
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        recording->start_degrees[i] = get_servo_info(i)->current_degrees;
+        motion_degrees[i] = recording->start_degrees[i];
+    }
+
+    recording->length = 0;
+    recording->ticks = 0;
+    motion_idle_ticks = 0;
+    motion_recording_id = recording_id;
+    motion_mode = MOTION_MODE_RECORDING;
+}
+
+static void __not_in_flash_func(record_tick)()
+{
+    motion_recording_t *recording = &motion_recordings[motion_recording_id];
+
+    uint8_t mask = 0;
+    uint8_t deltas_count = 0;
+    int8_t deltas[SERVOS_COUNT];
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        int32_t delta = get_servo_info(i)->current_degrees - motion_degrees[i];
+        if (delta == 0)
+        {
+            continue;
+        }
+
+        // The rest is taken on the next ticks.
+        if (delta > INT8_MAX)
+        {
+            delta = INT8_MAX;
+        }
+        else if (delta < INT8_MIN)
+        {
+            delta = INT8_MIN;
+        }
+
+        mask |= (uint8_t)(1u << i);
+        deltas[deltas_count++] = (int8_t)delta;
+    }
+
+    if (mask == 0)
+    {
+        motion_idle_ticks++;
+        recording->ticks++;
+        if (motion_idle_ticks == MOTION_MAX_IDLE_RUN && !write_idle_run(recording))
+        {
+            motion_idle_ticks--;
+            recording->ticks--;
+            finish_recording();
+        }
+        return;
+    }
+
+    uint32_t needed = (motion_idle_ticks ? 2 : 0) + 1 + deltas_count;
+    if (recording->length + needed > MOTION_RECORDING_SIZE)
+    {
+        // Full, the recording ends here.
+        finish_recording();
+        return;
+    }
+
+    write_idle_run(recording);
+    recording->data[recording->length++] = mask;
+    uint8_t delta_index = 0;
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        if (mask & (1u << i))
+        {
+            motion_degrees[i] += deltas[delta_index];
+            recording->data[recording->length++] = (uint8_t)deltas[delta_index++];
+        }
+    }
+    recording->ticks++;
+}
+
+// Playback goes to the start pose first, from wherever the joints are.
+static void __not_in_flash_func(rewind_playback)()
+{
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        motion_degrees[i] = get_servo_info(i)->current_degrees;
+    }
+
+    motion_read_position = 0;
+    motion_idle_remaining = 0;
+    motion_phase = 0;
+    motion_approaching = true;
+}
+
+// Moves the joints one step towards the start pose. The recording starts on the tick after
+// every joint is there.
+static void __not_in_flash_func(approach_tick)()
+{
+    const motion_recording_t *recording = &motion_recordings[motion_recording_id];
+
+    bool at_start = true;
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        int32_t step = recording->start_degrees[i] - motion_degrees[i];
+        if (step == 0)
+        {
+            continue;
+        }
+
+        if (step > MOTION_APPROACH_DEGREES_PER_TICK)
+        {
+            step = MOTION_APPROACH_DEGREES_PER_TICK;
+        }
+        else if (step < -MOTION_APPROACH_DEGREES_PER_TICK)
+        {
+            step = -MOTION_APPROACH_DEGREES_PER_TICK;
+        }
+
+        motion_degrees[i] += step;
+        set_servo_position_in_degrees(i, motion_degrees[i]);
+        at_start = at_start && motion_degrees[i] == recording->start_degrees[i];
+    }
+
+    motion_approaching = !at_start;
+}
+
+// Applies one recorded tick. Returns false at the end of the recording.
+static bool __not_in_flash_func(play_tick)()
+{
+    const motion_recording_t *recording = &motion_recordings[motion_recording_id];
+
+    if (motion_idle_remaining > 0)
+    {
+        motion_idle_remaining--;
+        return true;
+    }
+
+    if (motion_read_position >= recording->length)
+    {
+        return false;
+    }
+
+    uint8_t mask = recording->data[motion_read_position++];
+    if (mask == MOTION_IDLE_MARKER)
+    {
+        // This tick is the first of the run.
+        motion_idle_remaining = recording->data[motion_read_position++] - 1;
+        return true;
+    }
+
+    for (int i = 0; i < SERVOS_COUNT; i++)
+    {
+        if (mask & (1u << i))
+        {
+            motion_degrees[i] += (int8_t)recording->data[motion_read_position++];
+            set_servo_position_in_degrees(i, motion_degrees[i]);
+        }
+    }
+
+    return true;
+}
+
+static void __not_in_flash_func(playback_tick)()
+{
+    if (motion_approaching)
+    {
+        approach_tick();
+        return;
+    }
+
+    // Phase accumulator: at 100% one recorded tick per control tick, at 50% one every second tick.
+    motion_phase += motion_speed_percent;
+    while (motion_phase >= 100)
+    {
+        motion_phase -= 100;
+        if (!play_tick())
+        {
+            if (!motion_loop || motion_recordings[motion_recording_id].length == 0)
+            {
+                motion_mode = MOTION_MODE_IDLE;
+                return;
+            }
+
+            rewind_playback();
+            return;
+        }
+    }
+}
+
+void motion_recorder_suspend(bool suspended)
+{
+    motion_recorder_suspended = suspended;
+}
+
+void __not_in_flash_func(process_motion_recorder)()
+{
+    if (motion_recorder_suspended)
+    {
+        return;
+    }
+
+    motion_request_t request;
+    if (motion_requests.consume(request))
+    {
+        if (motion_mode == MOTION_MODE_RECORDING)
+        {
+            finish_recording();
+        }
+
+        if (request.type == MOTION_REQUEST_RECORD)
+        {
+            start_recording(request.recording_id);
+        }
+        else if (request.type == MOTION_REQUEST_PLAY)
+        {
+            motion_recording_id = request.recording_id;
+            motion_speed_percent = request.speed_percent;
+            motion_loop = request.loop;
+            motion_mode = MOTION_MODE_PLAYING;
+            rewind_playback();
+
+            // Stops sent before the play request are not for this playback.
+            motion_stop_playback_applied = request.stop_playback_requests;
+        }
+        else
+        {
+            motion_mode = MOTION_MODE_IDLE;
+        }
+    }
+
+    // After the play request, so a joint command sent right after it in the same tick stops it.
+    uint32_t stop_playback_requests = motion_stop_playback_requests.load(std::memory_order_acquire);
+    if (stop_playback_requests != motion_stop_playback_applied)
+    {
+        motion_stop_playback_applied = stop_playback_requests;
+        if (motion_mode == MOTION_MODE_PLAYING)
+        {
+            motion_mode = MOTION_MODE_IDLE;
+        }
+    }
+
+    if (motion_mode == MOTION_MODE_RECORDING)
+    {
+        record_tick();
+    }
+    else if (motion_mode == MOTION_MODE_PLAYING)
+    {
+        playback_tick();
+    }
+
+    publish_motion_status();
+}
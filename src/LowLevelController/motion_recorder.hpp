@@ -0,0 +1,70 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef MOTION_RECORDER_HPP
+#define MOTION_RECORDER_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// Number of recordings kept in RAM.
+#define MOTION_RECORDINGS_COUNT 4
+
+// Encoded data of one recording. At the 10ms control rate a continuous move of all six
+// joints takes 7 bytes per tick, holds take 2 bytes for up to 255 ticks.
+#define MOTION_RECORDING_SIZE 4096
+
+// Playback speed when the command does not give one, in percent of the recorded speed.
+#define MOTION_DEFAULT_SPEED_PERCENT 100
+
+// Largest step of a joint per control tick while playback moves it to the start pose of the
+// recording, at the start and before each loop. 1 degree per 10ms tick is 100 degrees per second.
+#define MOTION_APPROACH_DEGREES_PER_TICK 1
+
+typedef enum {
+    MOTION_MODE_IDLE = 0,
+    MOTION_MODE_RECORDING = 1,
+    MOTION_MODE_PLAYING = 2,
+} motion_mode_t;
+
+typedef struct
+{
+    motion_mode_t mode;
+
+    // Recording being recorded or played.
+    uint8_t recording_id;
+
+    // Size of the encoded data and length in control ticks of that recording.
+    uint32_t length;
+    uint32_t ticks;
+} motion_status_t;
+
+void init_motion_recorder();
+
+// Starts recording the servo positions from the current ones. Replaces the recording with this ID.
+bool motion_record_start(uint8_t recording_id);
+
+// Plays a recording from its start positions, moving the joints there at MOTION_APPROACH_DEGREES_PER_TICK
+// first, also before each loop. Speed in percent, 0 uses MOTION_DEFAULT_SPEED_PERCENT.
+bool motion_play(uint8_t recording_id, uint8_t speed_percent, bool loop);
+
+// Stops recording or playback. A recording is kept up to this point.
+void motion_stop();
+
+// Stops playback only. Used when a joint is moved by other commands.
+void motion_stop_playback();
+
+// As of the last control tick. Main loop only.
+void get_motion_status(motion_status_t *status);
+
+// True while a recording plays, or a request is not taken over by the control tick yet.
+// Main loop only, with the interrupts off for an answer the tick cannot change meanwhile.
+bool motion_playback_active();
+
+// Control tick. Called from the servo timer inside a PWM update group, after the other motion.
+void process_motion_recorder();
+
+// While suspended the control tick leaves the recorder alone, a recording keeps its place and
+// nothing is written to it. The benchmark runs the tick on motion that is not the robot's.
+void motion_recorder_suspend(bool suspended);
+
+#endif // MOTION_RECORDER_HPP
@@ -3,18 +3,75 @@
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "pico/time.h"
+#include "hardware/irq.h"
 #include "hardware/pwm.h"
 #include "pico_native_pwm.hpp"
+#include "pio_servo_pwm.hpp"
+#include "irq_tiers.hpp"
 
 // GP numbers
 uint16_t pwmNumberToGpio[PWMS_COUNT] = { 2, 3, 6, 7, 8, 9, 10, 11, 21, 20 };
 
+// Levels computed by the control code for the current update.
+uint16_t pwm_staged_levels[PWMS_COUNT];
+
+// Two complete sets of committed levels. The wrap interrupt reads the published one,
+// while the next commit is written to the other one, so no set is ever seen half written.
+uint16_t pwm_committed_levels[2][PWMS_COUNT];
+volatile uint8_t pwm_committed_index = 0;
+volatile bool pwm_commit_pending = false;
+
+// Nesting depth of begin_pwm_update() / end_pwm_update().
+volatile uint8_t pwm_update_depth = 0;
+
+// Slice which wrap interrupt marks the frame boundary. All slices run in phase.
+uint pwm_frame_slice;
+
+// Called once per PWM frame, right after all slices wrapped together.
+// Compare values written here are latched by every slice at the next wrap, in the same frame.
+void __not_in_flash_func(pwm_wrap_irq_handler)()
+{
+    uint32_t entered_us = time_us_32();
+
+    // The counter started again at the wrap, so it tells how late this entry is.
+    uint32_t latency_us = pwm_get_counter(pwm_frame_slice) * PWM_PERIOD / (PWM_WRAP + 1);
+    pwm_clear_irq(pwm_frame_slice);
+
+    if (pwm_commit_pending)
+    {
+        const uint16_t *levels = pwm_committed_levels[pwm_committed_index];
+        for (uint8_t i = 0; i < PWMS_COUNT; i++)
+        {
+            pwm_set_gpio_level(pwmNumberToGpio[i], levels[i]);
+        }
+
+        pwm_commit_pending = false;
+    }
+
+    irq_tier_record(IRQ_TIER_OUTPUT, latency_us, entered_us);
+}
+
+void __not_in_flash_func(commit_pwm_levels)()
+{
+    uint8_t index = pwm_committed_index ^ 1;
+    for (uint8_t i = 0; i < PWMS_COUNT; i++)
+    {
+        pwm_committed_levels[index][i] = pwm_staged_levels[i];
+    }
+
+    pwm_committed_index = index;
+    pwm_commit_pending = true;
+
+    pio_servo_commit();
+}
+
 void init_pwms()
 {
     // Set LED pins to use PWM
     for (uint8_t i = 0; i < PWMS_COUNT; i++)
     {
         gpio_set_function(pwmNumberToGpio[i], GPIO_FUNC_PWM);
+        pwm_staged_levels[i] = 0;
     }
 
     // Configure PWM settings
@@ -24,33 +81,75 @@ void init_pwms()
     pwm_config_set_clkdiv(&config, PWM_CLOCK_DIVIDER);
     pwm_config_set_wrap(&config, PWM_WRAP);
 
-    // Initialize PWM for each servo
+    // Initialize PWM for each servo.
+    // The slices are started later all at once, so their counters and frames stay aligned.
     uint slice_num;
+    uint32_t slices_mask = 0;
     for (uint8_t i = 0; i < PWMS_COUNT; i++)
     {
         slice_num = pwm_gpio_to_slice_num(pwmNumberToGpio[i]);
-        pwm_init(slice_num, &config, true);
+        pwm_init(slice_num, &config, false);
+        slices_mask |= (1u << slice_num);
+    }
+
+    pwm_frame_slice = pwm_gpio_to_slice_num(pwmNumberToGpio[0]);
+    pwm_clear_irq(pwm_frame_slice);
+    pwm_set_irq_enabled(pwm_frame_slice, true);
+    irq_set_exclusive_handler(PWM_IRQ_WRAP, pwm_wrap_irq_handler);
+
+    // Must not be interrupted by the control ticks, which produce the commits.
+    irq_set_priority(PWM_IRQ_WRAP, IRQ_PRIORITY_OUTPUT);
+    irq_set_enabled(PWM_IRQ_WRAP, true);
+
+    pwm_set_mask_enabled(slices_mask);
+
+    init_pio_servos();
+}
+
+void __not_in_flash_func(begin_pwm_update)()
+{
+    pwm_update_depth++;
+}
+
+void __not_in_flash_func(end_pwm_update)()
+{
+    if (pwm_update_depth > 0)
+    {
+        pwm_update_depth--;
+    }
+
+    if (pwm_update_depth == 0)
+    {
+        commit_pwm_levels();
     }
 }
 
-void set_pwm_pulse_width_us(uint8_t pwmNumber, uint16_t pulseWidthUs)
+void __not_in_flash_func(set_pwm_pulse_width_us)(uint8_t pwmNumber, uint16_t pulseWidthUs)
 {
-    if (0 == pulseWidthUs)
+    begin_pwm_update();
+
+    if (pwmNumber >= PIO_PWM_NUMBER_FIRST)
+    {
+        pio_servo_set_pulse_width_us(pwmNumber - PIO_PWM_NUMBER_FIRST, pulseWidthUs);
+    }
+    else if (0 == pulseWidthUs)
     {
-        pwm_set_gpio_level(pwmNumberToGpio[pwmNumber], 0);
+        pwm_staged_levels[pwmNumber] = 0;
     }
     else if (PWM_PERIOD <= pulseWidthUs)
     {
-        pwm_set_gpio_level(pwmNumberToGpio[pwmNumber], PWM_WRAP);
+        pwm_staged_levels[pwmNumber] = PWM_WRAP;
     }
     else
     {
         float pwmValue = ((float)PWM_WRAP * (float)pulseWidthUs) / 20000.0f;
-        pwm_set_gpio_level(pwmNumberToGpio[pwmNumber], (uint16_t)pwmValue);
+        pwm_staged_levels[pwmNumber] = (uint16_t)pwmValue;
     }
+
+    end_pwm_update();
 }
 
-void set_pwm_duty_cycle_in_percent(uint8_t pwmNumber, float percent)
+void __not_in_flash_func(set_pwm_duty_cycle_in_percent)(uint8_t pwmNumber, float percent)
 {
     if (percent < 0.0f)
     {
@@ -61,6 +160,18 @@ void set_pwm_duty_cycle_in_percent(uint8_t pwmNumber, float percent)
         percent = 100.0f;
     }
 
-    uint16_t level = (uint16_t)((percent / 100.0f) * PWM_WRAP);
-    set_pwm_pulse_width_us(pwmNumber, level);
+    uint16_t pulseWidthUs = (uint16_t)((percent / 100.0f) * PWM_PERIOD);
+    set_pwm_pulse_width_us(pwmNumber, pulseWidthUs);
+}
+
+uint16_t __not_in_flash_func(get_pwm_level)(uint8_t pwmNumber)
+{
+    return pwm_staged_levels[pwmNumber];
+}
+
+void __not_in_flash_func(set_pwm_level)(uint8_t pwmNumber, uint16_t level)
+{
+    begin_pwm_update();
+    pwm_staged_levels[pwmNumber] = level;
+    end_pwm_update();
 }
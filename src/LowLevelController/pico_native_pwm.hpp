@@ -16,8 +16,24 @@
 #define PWM_NUMBER_DC_MOTOR_LEFT    8
 #define PWM_NUMBER_DC_MOTOR_RIGHT   9
 
+// Outputs of the PIO servo pulse engine follow the hardware PWM channels.
+// PWM number PIO_PWM_NUMBER_FIRST + n drives PIO servo n.
+#define PIO_PWM_NUMBER_FIRST PWMS_COUNT
+
 void init_pwms();
+
+// Groups PWM changes. Between begin and end the new values are only staged.
+// The last end_pwm_update() commits them and all channels switch together at the next frame boundary.
+// A change outside of a group is committed on its own.
+void begin_pwm_update();
+void end_pwm_update();
+
 void set_pwm_pulse_width_us(uint8_t pwmNumber, uint16_t pulseWidthUs);
 void set_pwm_duty_cycle_in_percent(uint8_t pwmNumber, float percent);
 
+// Level staged for a hardware PWM channel, below PIO_PWM_NUMBER_FIRST, in counts up to PWM_WRAP.
+// The benchmarks put the levels back before the update commits, so the outputs do not change.
+uint16_t get_pwm_level(uint8_t pwmNumber);
+void set_pwm_level(uint8_t pwmNumber, uint16_t level);
+
 #endif // PICO_NATIVE_PWM_HPP
@@ -0,0 +1,223 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "pio_servo_pwm.hpp"
+#include "irq_tiers.hpp"
+#include "pio_servo_pwm.pio.h"
+
+#define PIO_SERVO_PIO pio0
+
+// Cycles spent by the program on top of the loaded segment length.
+#define PIO_SERVO_SEGMENT_OVERHEAD 3
+
+#define PIO_SERVO_FRAME_TICKS (PIO_SERVO_FRAME_US * PIO_SERVO_TICKS_PER_US)
+#define PIO_SERVO_MAX_WIDTH_TICKS (PIO_SERVO_FRAME_TICKS - (PIO_SERVOS_COUNT + 2) * PIO_SERVO_SEGMENT_OVERHEAD)
+
+// GP numbers from PIO_SERVOS_GPIOS. Only pins that are not used by anything else on the board.
+// Read by the DMA interrupt when the frame is rebuilt, so kept in RAM.
+const uint8_t __not_in_flash("pio_servo_pwm") pioServoNumberToGpio[] = { PIO_SERVOS_GPIOS };
+
+static_assert(sizeof(pioServoNumberToGpio) == PIO_SERVOS_COUNT, "PIO_SERVOS_GPIOS needs one pin per output");
+
+// One segment of the frame as it is consumed by the state machine.
+typedef struct
+{
+    // Outputs that are high during this segment.
+    uint32_t pin_mask;
+
+    // Segment length in PIO cycles minus PIO_SERVO_SEGMENT_OVERHEAD.
+    uint32_t delay;
+} pio_servo_segment_t;
+
+// Pulse widths in PIO ticks staged by the control code for the current update.
+uint32_t pio_servo_widths[PIO_SERVOS_COUNT];
+
+// Two complete sets of committed widths. The next frame is built from the published one,
+// while the following commit goes to the other one.
+uint32_t pio_servo_committed_widths[2][PIO_SERVOS_COUNT];
+volatile uint8_t pio_servo_committed_index = 0;
+volatile bool pio_servo_commit_pending = false;
+
+// Frame table streamed by DMA. At most one segment per output plus the closing low segment.
+pio_servo_segment_t pio_servo_frame[PIO_SERVOS_COUNT + 1];
+uint32_t pio_servo_frame_length = 0;
+
+uint pio_servo_sm;
+int pio_servo_dma_channel = -1;
+
+// Builds the frame table from the requested pulse widths.
+// Outputs with the same width share one segment, so the table is never longer than needed.
+// Widths closer than the segment overhead are merged, the shorter one ends up to 0.3us late.
+void __not_in_flash_func(build_pio_servo_frame)()
+{
+    const uint32_t *widths = pio_servo_committed_widths[pio_servo_committed_index];
+    uint8_t order[PIO_SERVOS_COUNT];
+    uint8_t active = 0;
+    uint32_t mask = 0;
+
+    // Insertion sort of the active outputs by pulse width. Small count, runs once per frame.
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        if (widths[i] == 0)
+        {
+            continue;
+        }
+
+        uint8_t j = active++;
+        while (j > 0 && widths[order[j - 1]] > widths[i])
+        {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+        mask |= (1u << pioServoNumberToGpio[i]);
+    }
+
+    uint32_t length = 0;
+    uint32_t elapsed = 0;
+    uint8_t i = 0;
+    while (i < active)
+    {
+        uint32_t end = widths[order[i]];
+        if (end < elapsed + PIO_SERVO_SEGMENT_OVERHEAD)
+        {
+            end = elapsed + PIO_SERVO_SEGMENT_OVERHEAD;
+        }
+
+        pio_servo_frame[length].pin_mask = mask;
+        pio_servo_frame[length].delay = end - elapsed - PIO_SERVO_SEGMENT_OVERHEAD;
+        length++;
+        elapsed = end;
+
+        // Drop every output that ends within this segment.
+        while (i < active && widths[order[i]] <= end)
+        {
+            mask &= ~(1u << pioServoNumberToGpio[order[i]]);
+            i++;
+        }
+    }
+
+    // Hold everything low for the rest of the frame.
+    pio_servo_frame[length].pin_mask = 0;
+    pio_servo_frame[length].delay = PIO_SERVO_FRAME_TICKS - elapsed - PIO_SERVO_SEGMENT_OVERHEAD;
+    length++;
+
+    pio_servo_frame_length = length;
+}
+
+// Called when DMA has pushed the whole frame into the FIFO.
+// The state machine is still playing the last (long) low segment, so there is plenty of time
+// to prepare the next frame before it stalls.
+void __not_in_flash_func(pio_servo_dma_irq_handler)()
+{
+    if (!dma_channel_get_irq0_status(pio_servo_dma_channel))
+    {
+        return;
+    }
+
+    uint32_t entered_us = time_us_32();
+    dma_channel_acknowledge_irq0(pio_servo_dma_channel);
+
+    if (pio_servo_commit_pending)
+    {
+        pio_servo_commit_pending = false;
+        build_pio_servo_frame();
+    }
+
+    dma_channel_set_read_addr(pio_servo_dma_channel, pio_servo_frame, false);
+    dma_channel_set_trans_count(pio_servo_dma_channel, pio_servo_frame_length * 2, true);
+
+    // The low segment at the end of the frame leaves the time, there is no deadline to be late for.
+    irq_tier_record(IRQ_TIER_OUTPUT, 0, entered_us);
+}
+
+void init_pio_servos()
+{
+#if PIO_SERVOS_ENABLED
+    uint32_t pins_mask = 0;
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        pio_gpio_init(PIO_SERVO_PIO, pioServoNumberToGpio[i]);
+        pins_mask |= (1u << pioServoNumberToGpio[i]);
+        pio_servo_widths[i] = 0;
+        pio_servo_committed_widths[0][i] = 0;
+        pio_servo_committed_widths[1][i] = 0;
+    }
+
+    build_pio_servo_frame();
+
+    pio_servo_sm = pio_claim_unused_sm(PIO_SERVO_PIO, true);
+    uint offset = pio_add_program(PIO_SERVO_PIO, &servo_pulse_program);
+
+    pio_sm_set_pins_with_mask(PIO_SERVO_PIO, pio_servo_sm, 0, pins_mask);
+    pio_sm_set_pindirs_with_mask(PIO_SERVO_PIO, pio_servo_sm, pins_mask, pins_mask);
+
+    float clock_divider = (float)clock_get_hz(clk_sys) / (PIO_SERVO_TICKS_PER_US * 1000000.0f);
+    servo_pulse_program_init(PIO_SERVO_PIO, pio_servo_sm, offset, clock_divider);
+
+    pio_servo_dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(pio_servo_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_32);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(PIO_SERVO_PIO, pio_servo_sm, true));
+
+    // DMA_IRQ_0 is shared, other modules may add their own channels to it.
+    dma_channel_set_irq0_enabled(pio_servo_dma_channel, true);
+    irq_add_shared_handler(DMA_IRQ_0, pio_servo_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    irq_set_priority(DMA_IRQ_0, IRQ_PRIORITY_OUTPUT);
+    irq_set_enabled(DMA_IRQ_0, true);
+
+    dma_channel_configure(
+        pio_servo_dma_channel,
+        &config,
+        &PIO_SERVO_PIO->txf[pio_servo_sm],
+        pio_servo_frame,
+        pio_servo_frame_length * 2,
+        true);
+
+    pio_sm_set_enabled(PIO_SERVO_PIO, pio_servo_sm, true);
+#endif // PIO_SERVOS_ENABLED
+}
+
+void __not_in_flash_func(pio_servo_set_pulse_width_ticks)(uint8_t servo, uint32_t pulseWidthTicks)
+{
+    if (servo >= PIO_SERVOS_COUNT)
+    {
+        return;
+    }
+
+    // Keep room for merged segments and the closing low segment.
+    if (pulseWidthTicks > PIO_SERVO_MAX_WIDTH_TICKS)
+    {
+        pulseWidthTicks = PIO_SERVO_MAX_WIDTH_TICKS;
+    }
+    else if (pulseWidthTicks != 0 && pulseWidthTicks < PIO_SERVO_SEGMENT_OVERHEAD)
+    {
+        pulseWidthTicks = PIO_SERVO_SEGMENT_OVERHEAD;
+    }
+
+    pio_servo_widths[servo] = pulseWidthTicks;
+}
+
+void __not_in_flash_func(pio_servo_set_pulse_width_us)(uint8_t servo, uint16_t pulseWidthUs)
+{
+    pio_servo_set_pulse_width_ticks(servo, (uint32_t)pulseWidthUs * PIO_SERVO_TICKS_PER_US);
+}
+
+void __not_in_flash_func(pio_servo_commit)()
+{
+    uint8_t index = pio_servo_committed_index ^ 1;
+    for (uint8_t i = 0; i < PIO_SERVOS_COUNT; i++)
+    {
+        pio_servo_committed_widths[index][i] = pio_servo_widths[i];
+    }
+
+    pio_servo_committed_index = index;
+    pio_servo_commit_pending = true;
+}
@@ -0,0 +1,42 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef PIO_SERVO_PWM_HPP
+#define PIO_SERVO_PWM_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// Set to 0 to leave the PIO block and the extra pins untouched.
+#define PIO_SERVOS_ENABLED 1
+
+// One state machine can drive up to 32 outputs from a single table.
+#define PIO_SERVOS_MAX 32
+
+// Outputs wired on this board and their GP numbers, set at build time for another board.
+// The Pico 2 has only a few free pins left. Boards with more can drive up to PIO_SERVOS_MAX
+// outputs, on pins below 32 that nothing else uses.
+#ifndef PIO_SERVOS_COUNT
+#define PIO_SERVOS_COUNT 5
+#endif
+
+#ifndef PIO_SERVOS_GPIOS
+#define PIO_SERVOS_GPIOS 4, 5, 12, 13, 22
+#endif
+
+// Servo frame length. Same 50Hz as the hardware PWM.
+#define PIO_SERVO_FRAME_US 20000
+
+// PIO ticks per microsecond. 10 gives 0.1us resolution of the pulse width.
+#define PIO_SERVO_TICKS_PER_US 10
+
+static_assert(PIO_SERVOS_COUNT > 0 && PIO_SERVOS_COUNT <= PIO_SERVOS_MAX, "One state machine drives 1 to PIO_SERVOS_MAX outputs");
+
+void init_pio_servos();
+
+// Pulse width in PIO ticks (1/PIO_SERVO_TICKS_PER_US us). 0 keeps the output low.
+// The width is only staged, pio_servo_commit() hands all staged widths to the next frame.
+void pio_servo_set_pulse_width_ticks(uint8_t servo, uint32_t pulseWidthTicks);
+void pio_servo_set_pulse_width_us(uint8_t servo, uint16_t pulseWidthUs);
+void pio_servo_commit();
+
+#endif // PIO_SERVO_PWM_HPP
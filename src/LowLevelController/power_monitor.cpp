@@ -0,0 +1,193 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/adc.h"
+#include "hardware/dma.h"
+#include "power_monitor.hpp"
+#include "irq_tiers.hpp"
+
+#define TIMER_INTERVAL_US 10000
+
+// The order of the channels is the round robin order, lowest ADC input first.
+#define POWER_LOAD_CURRENT_CHANNEL 0
+#define POWER_BATTERY_CHANNEL 1
+#define POWER_CHANNELS_COUNT 2
+
+#define POWER_LOAD_CURRENT_ADC_INPUT 2
+#define POWER_BATTERY_ADC_INPUT 3
+
+// Samples per second of each channel. The ADC clock is 48MHz.
+#define POWER_SAMPLE_RATE_HZ 2000
+#define POWER_ADC_CLOCK_HZ 48000000
+
+// Ring of 256 samples, 64ms of samples at 4000 samples per second.
+// The DMA wraps the write address, so the ring is aligned to its size.
+#define POWER_RING_SIZE_BITS 9
+#define POWER_RING_SAMPLES ((1u << POWER_RING_SIZE_BITS) / sizeof(uint16_t))
+
+// Moving average over this many tick averages.
+#define POWER_AVERAGE_TICKS 8
+
+// Filtered values are in ADC counts with 4 fractional bits.
+#define POWER_FRACTION_BITS 4
+
+#define ADC_REFERENCE_MV 3300
+#define ADC_FULL_SCALE 4096
+
+// VSYS is divided by 3 on the Pico 2 board.
+#define POWER_BATTERY_DIVIDER 3
+
+// Current sense amplifier output: 50V/V over a 10mOhm shunt is 500mV per ampere.
+#define POWER_CURRENT_SENSE_MV_PER_A 500
+#define POWER_CURRENT_SENSE_OFFSET_MV 0
+
+static_assert(POWER_RING_SAMPLES % POWER_CHANNELS_COUNT == 0, "Each ring slot must stay on one channel");
+
+uint16_t power_samples[POWER_RING_SAMPLES] __attribute__((aligned(1 << POWER_RING_SIZE_BITS)));
+
+int power_dma_channel = -1;
+
+// Owned by the power tick.
+uint32_t power_read_index = 0;
+uint32_t power_tick_averages[POWER_CHANNELS_COUNT][POWER_AVERAGE_TICKS];
+uint8_t power_window_index = 0;
+
+// Written by the power tick, read by the main loop. Only the load current is needed
+// by the cut-offs in the ticks, the rest is converted when it is read.
+volatile uint32_t power_window_sums[POWER_CHANNELS_COUNT];
+volatile uint32_t power_peak_current_q = 0;
+
+// Written by the power tick, read by the control ticks.
+volatile uint16_t power_load_current_ma_value = 0;
+volatile bool power_peak_reset_requested = false;
+
+struct repeating_timer power_monitor_timer;
+irq_tick_t power_monitor_tick;
+
+static uint32_t __not_in_flash_func(counts_to_mv)(uint32_t counts_q)
+{
+    return counts_q * ADC_REFERENCE_MV / (ADC_FULL_SCALE << POWER_FRACTION_BITS);
+}
+
+static uint16_t __not_in_flash_func(counts_to_current_ma)(uint32_t counts_q)
+{
+    int32_t mv = (int32_t)counts_to_mv(counts_q) - POWER_CURRENT_SENSE_OFFSET_MV;
+    if (mv <= 0)
+    {
+        return 0;
+    }
+
+    uint32_t ma = (uint32_t)mv * 1000 / POWER_CURRENT_SENSE_MV_PER_A;
+    return (ma > 0xFFFF) ? 0xFFFF : (uint16_t)ma;
+}
+
+static void __not_in_flash_func(process_power_tick)()
+{
+    // Where the DMA writes next. 32 bits of the address are enough for the offset in the ring.
+    uint32_t write_offset = dma_channel_hw_addr(power_dma_channel)->write_addr - (uint32_t)(uintptr_t)power_samples;
+    uint32_t write_index = (write_offset / sizeof(uint16_t)) % POWER_RING_SAMPLES;
+
+    // Whole round robin rounds only, so the read index stays on the first channel.
+    uint32_t available = (write_index + POWER_RING_SAMPLES - power_read_index) % POWER_RING_SAMPLES;
+    available -= available % POWER_CHANNELS_COUNT;
+    if (available == 0)
+    {
+        return;
+    }
+
+    uint32_t sums[POWER_CHANNELS_COUNT] = { 0 };
+    for (uint32_t i = 0; i < available; i++)
+    {
+        sums[i % POWER_CHANNELS_COUNT] += power_samples[(power_read_index + i) % POWER_RING_SAMPLES];
+    }
+    power_read_index = (power_read_index + available) % POWER_RING_SAMPLES;
+
+    uint32_t samples_per_channel = available / POWER_CHANNELS_COUNT;
+    for (int channel = 0; channel < POWER_CHANNELS_COUNT; channel++)
+    {
+        uint32_t tick_average = (sums[channel] << POWER_FRACTION_BITS) / samples_per_channel;
+        power_window_sums[channel] += tick_average - power_tick_averages[channel][power_window_index];
+        power_tick_averages[channel][power_window_index] = tick_average;
+    }
+    power_window_index = (power_window_index + 1) % POWER_AVERAGE_TICKS;
+
+    if (power_peak_reset_requested)
+    {
+        power_peak_reset_requested = false;
+        power_peak_current_q = 0;
+    }
+
+    uint32_t tick_current_q = power_tick_averages[POWER_LOAD_CURRENT_CHANNEL][(power_window_index + POWER_AVERAGE_TICKS - 1) % POWER_AVERAGE_TICKS];
+    if (tick_current_q > power_peak_current_q)
+    {
+        power_peak_current_q = tick_current_q;
+    }
+
+    power_load_current_ma_value = counts_to_current_ma(power_window_sums[POWER_LOAD_CURRENT_CHANNEL] / POWER_AVERAGE_TICKS);
+}
+
+bool __not_in_flash_func(power_monitor_timer_callback)(struct repeating_timer *t)
+{
+    (void)t;
+    uint32_t entered_us = irq_tick_begin(&power_monitor_tick);
+    process_power_tick();
+    irq_tick_end(&power_monitor_tick, entered_us);
+
+    return true; // Keep the timer repeating
+}
+
+void init_power_monitor()
+{
+    adc_init();
+    adc_gpio_init(26 + POWER_LOAD_CURRENT_ADC_INPUT);
+    adc_gpio_init(26 + POWER_BATTERY_ADC_INPUT);
+    adc_select_input(POWER_LOAD_CURRENT_ADC_INPUT);
+    adc_set_round_robin((1u << POWER_LOAD_CURRENT_ADC_INPUT) | (1u << POWER_BATTERY_ADC_INPUT));
+
+    // A DMA request for every sample, 12 bits in the low bits of each halfword.
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_set_clkdiv((float)POWER_ADC_CLOCK_HZ / (POWER_SAMPLE_RATE_HZ * POWER_CHANNELS_COUNT) - 1);
+
+    power_dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(power_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_16);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, POWER_RING_SIZE_BITS);
+    channel_config_set_dreq(&config, DREQ_ADC);
+    dma_channel_configure(
+        power_dma_channel,
+        &config,
+        power_samples,
+        &adc_hw->fifo,
+        dma_encode_endless_transfer_count(),
+        true);
+
+    adc_run(true);
+
+    irq_tick_start(&power_monitor_tick, TIMER_INTERVAL_US);
+    add_repeating_timer_us(-TIMER_INTERVAL_US, power_monitor_timer_callback, NULL, &power_monitor_timer);
+}
+
+uint16_t power_battery_mv()
+{
+    return (uint16_t)(counts_to_mv(power_window_sums[POWER_BATTERY_CHANNEL] / POWER_AVERAGE_TICKS) * POWER_BATTERY_DIVIDER);
+}
+
+uint16_t __not_in_flash_func(power_load_current_ma)()
+{
+    return power_load_current_ma_value;
+}
+
+void power_get_readings(power_readings_t *readings)
+{
+    readings->battery_mv = power_battery_mv();
+    readings->load_current_ma = power_load_current_ma_value;
+    readings->load_current_peak_ma = counts_to_current_ma(power_peak_current_q);
+}
+
+void power_reset_peak()
+{
+    power_peak_reset_requested = true;
+}
@@ -0,0 +1,42 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef POWER_MONITOR_HPP
+#define POWER_MONITOR_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// The ADC samples all channels round robin, paced by its own clock, and a DMA channel writes the
+// samples to a ring buffer. No interrupt per sample, the CPU only filters what is in the ring
+// once per control tick.
+//
+// GP26 and GP27 drive the left DC motor, so two ADC inputs are left on the Pico 2:
+//   ADC2 (GP28) - current sense of the motors and servos supply, one sensor for both.
+//   ADC3 (GP29) - VSYS through the divider on the board.
+
+typedef struct
+{
+    // VSYS, averaged over POWER_AVERAGE_TICKS.
+    uint16_t battery_mv;
+
+    // Load current, averaged over POWER_AVERAGE_TICKS.
+    uint16_t load_current_ma;
+
+    // Highest tick average of the load current since the last power_reset_peak().
+    uint16_t load_current_peak_ma;
+} power_readings_t;
+
+void init_power_monitor();
+
+// Latest average of the load current, safe to read from the control ticks.
+uint16_t power_load_current_ma();
+
+// Latest average of VSYS, converted on the call. For the main loop.
+uint16_t power_battery_mv();
+
+void power_get_readings(power_readings_t *readings);
+
+// Starts a new peak hold, from the next tick.
+void power_reset_peak();
+
+#endif // POWER_MONITOR_HPP
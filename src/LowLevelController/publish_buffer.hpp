@@ -0,0 +1,103 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef PUBLISH_BUFFER_HPP
+#define PUBLISH_BUFFER_HPP
+
+#include <cstddef> // For size_t
+#include <cstdint> // For uint32_t
+#include <atomic>  // For std::atomic
+
+// Hands the latest value from a writer to a reader without locks or masking interrupts.
+// The writer fills the buffer that is not published and then publishes it with a single store,
+// so the reader always gets a complete value.
+// Single writer, single reader. The reader must not be preempted by the writer, which is the
+// case for a reader in an ISR and a writer in the main loop on the same core.
+template <typename T>
+class PublishBuffer
+{
+public:
+    PublishBuffer() : _sequence(0), _consumed(0) {}
+
+    // Publishes a new value (writer side).
+    void publish(const T& value) {
+        const auto next = _sequence.load(std::memory_order_relaxed) + 1;
+        _buffer[next & 1] = value;
+        _sequence.store(next, std::memory_order_release);
+    }
+
+    // Copies the latest value if it was not consumed yet (reader side).
+    bool consume(T& value) {
+        const auto current = _sequence.load(std::memory_order_acquire);
+        if (current == _consumed) {
+            return false; // Nothing new
+        }
+        value = _buffer[current & 1];
+        _consumed = current;
+        return true;
+    }
+
+    // Whether a value was published that the reader did not consume yet. Call it where the reader
+    // cannot run meanwhile, e.g. from the main loop with the interrupts off.
+    bool pending() const {
+        return _sequence.load(std::memory_order_acquire) != _consumed;
+    }
+
+private:
+    T _buffer[2];
+    alignas(4) std::atomic<uint32_t> _sequence;
+    uint32_t _consumed;
+};
+
+// Setpoints of a group of actuators, published together through a PublishBuffer.
+// Each setpoint carries a generation, so the reader only takes over the ones that were set
+// since it last looked, and setting one actuator does not restart the others.
+template <typename T, size_t Count>
+class PublishedSetpoints
+{
+public:
+    PublishedSetpoints() : _requested(), _applied_generations() {}
+
+    // Stages a setpoint (writer side). Nothing is visible to the reader before publish().
+    void set(size_t index, const T& value) {
+        _requested.values[index] = value;
+        _requested.generations[index]++;
+    }
+
+    // Makes all staged setpoints visible to the reader at once (writer side).
+    void publish() {
+        _published.publish(_requested);
+    }
+
+    // Copies the setpoints set since the last take into working (reader side).
+    // Returns a mask of the updated indices.
+    uint32_t take(T (&working)[Count]) {
+        static_assert(Count <= 32, "The updated mask has 32 bits");
+
+        Setpoints setpoints;
+        if (!_published.consume(setpoints)) {
+            return 0;
+        }
+
+        uint32_t updated = 0;
+        for (size_t i = 0; i < Count; i++) {
+            if (setpoints.generations[i] != _applied_generations[i]) {
+                working[i] = setpoints.values[i];
+                _applied_generations[i] = setpoints.generations[i];
+                updated |= (1u << i);
+            }
+        }
+        return updated;
+    }
+
+private:
+    struct Setpoints {
+        T values[Count];
+        uint32_t generations[Count];
+    };
+
+    Setpoints _requested;                   // Owned by the writer.
+    PublishBuffer<Setpoints> _published;
+    uint32_t _applied_generations[Count];   // Owned by the reader.
+};
+
+#endif // PUBLISH_BUFFER_HPP
@@ -0,0 +1,519 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <string.h> // For memcpy
+#include "pico/stdlib.h"
+#include "register_map.hpp"
+#include "arm_kinematics.hpp"
+#include "dc_motors_control.hpp"
+#include "emergency_stop.hpp"
+#include "motion_recorder.hpp"
+#include "power_monitor.hpp"
+#include "servo_control.hpp"
+#include "spi_frame_parser.hpp"
+#include "spi_transport.hpp"
+
+// Same sync byte as the 8-byte responses, so the host finds both in the MISO stream.
+#define REGISTER_BURST_SYNC_BYTE 0xA5
+
+// The queued write frame carries its slot and the generation of the slot it was received in.
+#define REGISTER_WRITE_SLOT_DATA 5
+#define REGISTER_WRITE_GENERATION_DATA 6
+
+typedef struct
+{
+    uint8_t bytes[REGISTER_MAP_SIZE];
+} register_block_t;
+
+// Payload of a write, from its first byte. The generation changes when the slot is taken again.
+typedef struct
+{
+    uint8_t generation;
+    uint8_t bytes[REGISTER_MAP_SIZE];
+} register_write_slot_t;
+
+// State for the reads. Owned by the main loop.
+register_block_t register_state;
+
+// Taken in turn by the SPI interrupt, copied by the main loop with the interrupts off.
+register_write_slot_t register_write_slots[REGISTER_WRITE_SLOTS];
+uint8_t register_write_next_slot = 0;
+
+// Setpoints as last written. Owned by the main loop.
+uint8_t register_written[REGISTER_MAP_SIZE];
+
+// Write payload being received. Only used by the SPI interrupt.
+received_command_t register_write_frame;
+register_write_slot_t *register_write_slot = NULL;
+uint32_t register_write_address = 0;
+uint32_t register_write_length = 0;
+uint32_t register_write_received = 0;
+uint32_t register_write_last_byte_us = 0;
+uint8_t register_write_checksum = 0;
+bool register_write_active = false;
+
+// Payload of a write refused or for another board, received but not kept.
+bool register_write_discard = false;
+
+// Read asked for in the SPI interrupt, built by the main loop.
+volatile bool register_read_requested = false;
+volatile uint32_t register_read_address = 0;
+volatile uint32_t register_read_request_length = 0;
+
+// Burst response going out on MISO. Built by the main loop while the length is 0, then only
+// read by the SPI interrupt.
+uint8_t register_read_frame[REGISTER_BURST_HEADER_SIZE + REGISTER_MAP_SIZE + 1];
+volatile uint32_t register_read_length = 0;
+volatile uint32_t register_read_index = 0;
+
+// Updated by the SPI interrupt.
+volatile uint32_t register_burst_errors = 0;
+volatile uint32_t register_broken_writes = 0;
+
+// Values the modules refused and writes whose slot was taken again. Owned by the main loop.
+uint32_t register_refused_values = 0;
+uint32_t register_overwritten_writes = 0;
+
+static uint16_t __not_in_flash_func(read_uint16_be)(const uint8_t *data)
+{
+    return (uint16_t)(data[0] << 8 | data[1]);
+}
+
+static void write_uint16_be(uint8_t *data, uint16_t value)
+{
+    data[0] = (uint8_t)(value >> 8);
+    data[1] = (uint8_t)value;
+}
+
+static void write_uint32_be(uint8_t *data, uint32_t value)
+{
+    data[0] = (uint8_t)(value >> 24);
+    data[1] = (uint8_t)(value >> 16);
+    data[2] = (uint8_t)(value >> 8);
+    data[3] = (uint8_t)value;
+}
+
+static bool __not_in_flash_func(is_register_range)(uint32_t address, uint32_t length)
+{
+    return length > 0 && address < REGISTER_MAP_SIZE && length <= REGISTER_MAP_SIZE - address;
+}
+
+// Whether the written range touches any byte of the field.
+static bool overlaps(uint32_t field, uint32_t size, uint32_t address, uint32_t length)
+{
+    return field < address + length && address < field + size;
+}
+
+void init_register_map()
+{
+    memset(register_written, 0, sizeof(register_written));
+    register_map_refresh(false);
+}
+
+register_byte_result_t __not_in_flash_func(register_map_receive_byte)(uint8_t byte, uint32_t now_us, received_command_t *received)
+{
+    if (!register_write_active)
+    {
+        return REGISTER_BYTE_NOT_TAKEN;
+    }
+
+    // The payload goes in the same transfer as its frame. After a gap the rest was lost,
+    // and this byte starts a new frame.
+    if (now_us - register_write_last_byte_us > SPI_FRAME_GAP_TIMEOUT_US)
+    {
+        register_write_active = false;
+        register_broken_writes++;
+        return REGISTER_BYTE_NOT_TAKEN;
+    }
+
+    register_write_last_byte_us = now_us;
+    if (!register_write_discard)
+    {
+        register_write_slot->bytes[register_write_received] = byte;
+    }
+    register_write_received++;
+    register_write_checksum ^= byte;
+    if (register_write_received < register_write_length)
+    {
+        return REGISTER_BYTE_TAKEN;
+    }
+
+    register_write_active = false;
+    if (register_write_discard)
+    {
+        return REGISTER_BYTE_TAKEN;
+    }
+
+    if (register_write_checksum != register_write_frame.command.data[4])
+    {
+        register_burst_errors++;
+        return REGISTER_BYTE_TAKEN;
+    }
+
+    *received = register_write_frame;
+    return REGISTER_BYTE_WRITE_DONE;
+}
+
+static void __not_in_flash_func(start_register_write)(const received_command_t &received, bool for_this_board)
+{
+    uint32_t address = read_uint16_be(&received.command.data[0]);
+    uint32_t length = read_uint16_be(&received.command.data[2]);
+
+    // A refused payload is still taken off the stream, it would not parse as frames.
+    bool is_valid = is_register_range(address, length) && address >= REGISTER_WRITABLE_START;
+    if (!is_valid)
+    {
+        register_burst_errors++;
+        if (length > REGISTER_MAP_SIZE)
+        {
+            // Too long to skip safely, the frame parser finds the next frame after the gap.
+            return;
+        }
+    }
+
+    register_write_frame = received;
+    register_write_address = address;
+    register_write_length = length;
+    register_write_received = 0;
+    register_write_checksum = 0;
+    register_write_last_byte_us = received.received_us;
+    register_write_discard = !is_valid || !for_this_board;
+    register_write_active = (length > 0);
+
+    // The slot is taken from the first byte, so a write still waiting in it is not applied torn.
+    if (register_write_active && !register_write_discard)
+    {
+        uint8_t slot = register_write_next_slot;
+        register_write_next_slot = (uint8_t)((slot + 1) % REGISTER_WRITE_SLOTS);
+        register_write_slot = &register_write_slots[slot];
+        register_write_slot->generation++;
+        register_write_frame.command.data[REGISTER_WRITE_SLOT_DATA] = slot;
+        register_write_frame.command.data[REGISTER_WRITE_GENERATION_DATA] = register_write_slot->generation;
+    }
+}
+
+static void __not_in_flash_func(start_register_read)(const received_command_t &received)
+{
+    uint32_t address = read_uint16_be(&received.command.data[0]);
+    uint32_t length = read_uint16_be(&received.command.data[2]);
+
+    // A burst half way out cannot be replaced. One that has not started yet is.
+    if (!is_register_range(address, length) || (register_read_index > 0 && register_read_index < register_read_length))
+    {
+        register_burst_errors++;
+        return;
+    }
+
+    register_read_address = address;
+    register_read_request_length = length;
+    register_read_requested = true;
+}
+
+// Up to the whole map, too long for the SPI interrupt.
+static void build_register_read()
+{
+    // A burst that started out after the request is left to finish, the read is built on the next pass.
+    uint32_t interrupts = save_and_disable_interrupts();
+    bool is_sending = register_read_index > 0 && register_read_index < register_read_length;
+    bool is_requested = register_read_requested && !is_sending;
+    uint32_t address = register_read_address;
+    uint32_t length = register_read_request_length;
+    if (is_requested)
+    {
+        register_read_requested = false;
+        register_read_length = 0;
+    }
+    restore_interrupts(interrupts);
+
+    if (!is_requested)
+    {
+        return;
+    }
+
+    uint8_t *frame = register_read_frame;
+    frame[0] = REGISTER_BURST_SYNC_BYTE;
+    frame[1] = REGISTER_BURST_RESPONSE;
+    frame[2] = (uint8_t)(address >> 8);
+    frame[3] = (uint8_t)address;
+    frame[4] = (uint8_t)(length >> 8);
+    frame[5] = (uint8_t)length;
+
+    uint8_t checksum = 0;
+    for (uint32_t i = 1; i < REGISTER_BURST_HEADER_SIZE; i++)
+    {
+        checksum ^= frame[i];
+    }
+    for (uint32_t i = 0; i < length; i++)
+    {
+        frame[REGISTER_BURST_HEADER_SIZE + i] = register_state.bytes[address + i];
+        checksum ^= register_state.bytes[address + i];
+    }
+    frame[REGISTER_BURST_HEADER_SIZE + length] = checksum;
+
+    interrupts = save_and_disable_interrupts();
+    register_read_index = 0;
+    register_read_length = REGISTER_BURST_HEADER_SIZE + length + 1;
+    restore_interrupts(interrupts);
+}
+
+bool __not_in_flash_func(register_map_receive)(const received_command_t &received, bool for_this_board)
+{
+    if (received.command.type == REGISTER_WRITE_COMMAND)
+    {
+        start_register_write(received, for_this_board);
+        return true;
+    }
+
+    if (received.command.type == REGISTER_READ_COMMAND && for_this_board)
+    {
+        start_register_read(received);
+        return true;
+    }
+
+    return false;
+}
+
+bool __not_in_flash_func(register_map_next_tx_byte)(uint8_t *byte)
+{
+    if (register_read_index >= register_read_length)
+    {
+        return false;
+    }
+
+    *byte = register_read_frame[register_read_index++];
+    return true;
+}
+
+static motor_direction_speed_t read_setpoint(const uint8_t *data)
+{
+    motor_direction_speed_t speed = {
+        .direction = (int8_t)data[0],
+        .speed = data[1],
+        .elapsed_time = 0,
+        .timeout = (int16_t)read_uint16_be(&data[2])
+    };
+    return speed;
+}
+
+static void apply_wheel_setpoints(uint32_t address, uint32_t length)
+{
+    bool left = overlaps(REG_WHEEL_SETPOINTS, REGISTER_SETPOINT_SIZE, address, length);
+    bool right = overlaps(REG_WHEEL_SETPOINTS + REGISTER_SETPOINT_SIZE, REGISTER_SETPOINT_SIZE, address, length);
+    motor_direction_speed_t left_speed = read_setpoint(&register_written[REG_WHEEL_SETPOINTS]);
+    motor_direction_speed_t right_speed = read_setpoint(&register_written[REG_WHEEL_SETPOINTS + REGISTER_SETPOINT_SIZE]);
+
+    if (left && right)
+    {
+        set_dc_motors_speed(left_speed, right_speed);
+    }
+    else if (left)
+    {
+        set_left_dc_motor_speed(left_speed);
+    }
+    else if (right)
+    {
+        set_right_dc_motor_speed(right_speed);
+    }
+}
+
+// As the joint direction commands, but all joints of the write start in the same tick.
+static void apply_joint_setpoints(uint32_t address, uint32_t length)
+{
+    motor_direction_speed_t speeds[SERVOS_COUNT];
+    uint32_t servos_mask = 0;
+    bool is_cartesian = false;
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        uint32_t field = REG_JOINT_SETPOINTS + i * REGISTER_SETPOINT_SIZE;
+        if (robot_joints[i].type == JOINT_NONE || !overlaps(field, REGISTER_SETPOINT_SIZE, address, length))
+        {
+            continue;
+        }
+
+        speeds[i] = read_setpoint(&register_written[field]);
+        servos_mask |= (1u << i);
+        is_cartesian |= robot_joints[i].is_cartesian;
+    }
+
+    if (servos_mask == 0)
+    {
+        return;
+    }
+
+    if (is_cartesian)
+    {
+        arm_stop_cartesian();
+    }
+
+    motion_stop_playback();
+    set_servos_motor_direction_speed(speeds, servos_mask);
+}
+
+static void apply_joint_limits(uint32_t address, uint32_t length)
+{
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        uint32_t field = REG_JOINT_LIMITS + i * REGISTER_LIMITS_SIZE;
+        if (robot_joints[i].type == JOINT_NONE || !overlaps(field, REGISTER_LIMITS_SIZE, address, length))
+        {
+            continue;
+        }
+
+        int16_t bottom = (int16_t)read_uint16_be(&register_written[field]);
+        int16_t top = (int16_t)read_uint16_be(&register_written[field + 2]);
+
+        // A bottom above the old top only fits once the top moved, so try it again after.
+        bool bottom_set = set_servo_calibration_field(i, SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT, bottom);
+        bool top_set = set_servo_calibration_field(i, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, top);
+        if (!bottom_set)
+        {
+            bottom_set = set_servo_calibration_field(i, SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT, bottom);
+        }
+
+        if (!bottom_set || !top_set)
+        {
+            register_refused_values++;
+        }
+    }
+}
+
+static void apply_speed_profiles(uint32_t address, uint32_t length)
+{
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        // A free slot has no profile, a write to its rows is ignored.
+        if (robot_joints[i].type == JOINT_NONE)
+        {
+            continue;
+        }
+
+        for (uint8_t row = 0; row < SERVO_SPEED_TABLE_SIZE; row++)
+        {
+            uint32_t field = REG_SPEED_PROFILES + (i * SERVO_SPEED_TABLE_SIZE + row) * REGISTER_PROFILE_ROW_SIZE;
+            if (!overlaps(field, REGISTER_PROFILE_ROW_SIZE, address, length))
+            {
+                continue;
+            }
+
+            servo_speed_settings_t settings = {
+                .min_percentage = register_written[field],
+                .max_percentage = register_written[field + 1],
+                .min_time_ms = read_uint16_be(&register_written[field + 2])
+            };
+            if (!set_servo_speed_profile(i, row, settings))
+            {
+                register_refused_values++;
+            }
+        }
+    }
+}
+
+void register_map_apply_write(const command_8_bytes_t &command)
+{
+    // The range was checked before the frame was queued.
+    uint32_t address = read_uint16_be(&command.data[0]);
+    uint32_t length = read_uint16_be(&command.data[2]);
+
+    uint8_t slot = command.data[REGISTER_WRITE_SLOT_DATA] % REGISTER_WRITE_SLOTS;
+    uint8_t generation = command.data[REGISTER_WRITE_GENERATION_DATA];
+
+    // A write coming in meanwhile must not tear the values.
+    uint32_t interrupts = save_and_disable_interrupts();
+    bool is_kept = register_write_slots[slot].generation == generation;
+    if (is_kept)
+    {
+        memcpy(&register_written[address], register_write_slots[slot].bytes, length);
+    }
+    restore_interrupts(interrupts);
+
+    if (!is_kept)
+    {
+        register_overwritten_writes++;
+        return;
+    }
+
+    apply_wheel_setpoints(address, length);
+    apply_joint_setpoints(address, length);
+    apply_joint_limits(address, length);
+    apply_speed_profiles(address, length);
+}
+
+void register_map_refresh(bool motion_held)
+{
+    uint8_t *bytes = register_state.bytes;
+
+    write_uint16_be(&bytes[REG_MAGIC], REGISTER_MAP_MAGIC);
+    bytes[REG_VERSION] = REGISTER_MAP_VERSION;
+    bytes[REG_SERVO_SLOTS] = SERVOS_COUNT;
+
+    power_readings_t power;
+    power_get_readings(&power);
+    motion_status_t motion;
+    get_motion_status(&motion);
+    motor_direction_speed_t left;
+    motor_direction_speed_t right;
+    get_dc_motors_speed(&left, &right);
+
+    write_uint32_be(&bytes[REG_UPTIME_US], time_us_32());
+    write_uint16_be(&bytes[REG_BATTERY_MV], power.battery_mv);
+    write_uint16_be(&bytes[REG_LOAD_CURRENT_MA], power.load_current_ma);
+    write_uint16_be(&bytes[REG_LOAD_CURRENT_PEAK_MA], power.load_current_peak_ma);
+    bytes[REG_STATUS_FLAGS] = (dc_motors_running() ? REGISTER_STATUS_DC_MOTORS_RUNNING : 0) |
+        (motion_held ? REGISTER_STATUS_MOTION_HELD : 0);
+    bytes[REG_MOTION_MODE] = (uint8_t)motion.mode;
+    bytes[REG_WHEELS] = (uint8_t)left.direction;
+    bytes[REG_WHEELS + 1] = left.speed;
+    bytes[REG_WHEELS + 2] = (uint8_t)right.direction;
+    bytes[REG_WHEELS + 3] = right.speed;
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        write_uint16_be(&bytes[REG_SERVO_DEGREES + i * 2], (uint16_t)get_servo_info(i)->current_degrees);
+    }
+
+    spi_transport_stats_t transport;
+    spi_get_transport_stats(&transport);
+    register_map_stats_t stats;
+    register_map_get_stats(&stats);
+
+    write_uint32_be(&bytes[REG_SPI_FRAMES], transport.frames);
+    write_uint32_be(&bytes[REG_SPI_QUEUE_OVERFLOWS], transport.queue_overflows);
+    write_uint32_be(&bytes[REG_SPI_RESPONSE_DROPS], transport.response_drops);
+    write_uint32_be(&bytes[REG_DC_MOTORS_STALLS], dc_motors_stall_count());
+    write_uint32_be(&bytes[REG_SERVOS_OVERCURRENTS], servos_overcurrent_count());
+    write_uint32_be(&bytes[REG_EMERGENCY_STOPS], emergency_stop_count());
+    write_uint32_be(&bytes[REG_REGISTER_ERRORS], stats.errors + stats.broken_writes + stats.refused_values + stats.overwritten_writes);
+
+    memcpy(&bytes[REG_WHEEL_SETPOINTS], &register_written[REG_WHEEL_SETPOINTS], REG_JOINT_LIMITS - REG_WHEEL_SETPOINTS);
+
+    // Limits and profiles as in use, the commands change them too.
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        int32_t bottom = 0;
+        int32_t top = 0;
+        get_servo_calibration_field(i, SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT, &bottom);
+        get_servo_calibration_field(i, SERVO_CALIBRATION_TOP_DEGREES_LIMIT, &top);
+        write_uint16_be(&bytes[REG_JOINT_LIMITS + i * REGISTER_LIMITS_SIZE], (uint16_t)bottom);
+        write_uint16_be(&bytes[REG_JOINT_LIMITS + i * REGISTER_LIMITS_SIZE + 2], (uint16_t)top);
+
+        for (uint8_t row = 0; row < SERVO_SPEED_TABLE_SIZE; row++)
+        {
+            servo_speed_settings_t settings = {};
+            get_servo_speed_profile(i, row, &settings);
+
+            uint8_t *field = &bytes[REG_SPEED_PROFILES + (i * SERVO_SPEED_TABLE_SIZE + row) * REGISTER_PROFILE_ROW_SIZE];
+            field[0] = settings.min_percentage;
+            field[1] = settings.max_percentage;
+            write_uint16_be(&field[2], settings.min_time_ms);
+        }
+    }
+
+    build_register_read();
+}
+
+void register_map_get_stats(register_map_stats_t *stats)
+{
+    stats->errors = register_burst_errors;
+    stats->broken_writes = register_broken_writes;
+    stats->refused_values = register_refused_values;
+    stats->overwritten_writes = register_overwritten_writes;
+}
@@ -0,0 +1,134 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef REGISTER_MAP_HPP
+#define REGISTER_MAP_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "common_types.hpp"
+#include "robot_description.hpp"
+
+// The controller state as a register file at fixed addresses, next to the 8-byte commands.
+// A burst reads or writes any range of it in one transaction, e.g. the whole state, or the
+// setpoints of every joint and wheel at once.
+//
+// Write: a REGISTER_WRITE_COMMAND frame (address, length, XOR of the payload) with the payload
+// right after it in the same transfer. The SPI interrupt takes the payload bytes straight into
+// a write slot, without the frame parser and the commands queue. Once complete and checked,
+// the frame is queued as a command with its slot, and the main loop applies the written range
+// in order with the other commands, also when it was scheduled or held. Up to
+// REGISTER_WRITE_SLOTS writes can wait at once, a later one takes the slot of the oldest,
+// which is then refused when its turn comes.
+//
+// Read: a REGISTER_READ_COMMAND frame (address, length). The main loop builds the answer from
+// the current state on its next pass, and the SPI interrupt sends it from the start of the next
+// response frame, as a REGISTER_BURST_RESPONSE on MISO:
+// sync byte, type, address and length (big-endian uint16), payload, XOR of everything from the type.
+// The host polls with idle frames until it comes.
+//
+// All fields are big-endian, as in the commands. Per servo slot fields are in slot order.
+
+#define REGISTER_MAP_MAGIC 0x524D // "RM"
+#define REGISTER_WRITE_SLOTS 4
+#define REGISTER_MAP_VERSION 1
+
+// Identity, read only.
+#define REG_MAGIC                   0x0000 // uint16
+#define REG_VERSION                 0x0002 // uint8, layout version
+#define REG_SERVO_SLOTS             0x0003 // uint8
+
+// Status, read only.
+#define REG_UPTIME_US               0x0010 // uint32
+#define REG_BATTERY_MV              0x0014 // uint16
+#define REG_LOAD_CURRENT_MA         0x0016 // uint16
+#define REG_LOAD_CURRENT_PEAK_MA    0x0018 // uint16
+#define REG_STATUS_FLAGS            0x001A // uint8, REGISTER_STATUS_* bits
+#define REG_MOTION_MODE             0x001B // uint8, motion recorder mode
+#define REG_WHEELS                  0x001C // Left then right: direction int8, speed uint8
+#define REG_SERVO_DEGREES           0x0020 // int16 per slot, current position
+
+// Counters since boot, read only, uint32 each.
+#define REG_SPI_FRAMES              0x0030
+#define REG_SPI_QUEUE_OVERFLOWS     0x0034
+#define REG_DC_MOTORS_STALLS        0x0038
+#define REG_SERVOS_OVERCURRENTS     0x003C
+#define REG_EMERGENCY_STOPS         0x0040
+#define REG_REGISTER_ERRORS         0x0044 // Bursts refused, see register_map_stats_t.
+#define REG_SPI_RESPONSE_DROPS      0x0048
+
+// Setpoints, read back as last written. Each record as the data of the matching command:
+// direction int8, speed uint8, timeout in ms uint16.
+#define REG_WHEEL_SETPOINTS         0x0080 // Left then right.
+#define REG_JOINT_SETPOINTS         0x0088 // Per slot, as the joint direction commands. Free slots are ignored.
+
+// Limits, per slot: bottom and top degrees limit, int16 each.
+// Free slots read back as 0 and writes to them are ignored, also for the speed profiles.
+#define REG_JOINT_LIMITS            0x00C0
+
+// Speed profiles, per slot SERVO_SPEED_TABLE_SIZE rows of: min percentage uint8,
+// max percentage uint8, min time in ms uint16.
+#define REG_SPEED_PROFILES          0x0100
+
+#define REGISTER_SETPOINT_SIZE 4
+#define REGISTER_LIMITS_SIZE 4
+#define REGISTER_PROFILE_ROW_SIZE 4
+
+#define REGISTER_MAP_SIZE (REG_SPEED_PROFILES + SERVOS_COUNT * SERVO_SPEED_TABLE_SIZE * REGISTER_PROFILE_ROW_SIZE)
+
+// Everything from the setpoints on can be written.
+#define REGISTER_WRITABLE_START REG_WHEEL_SETPOINTS
+
+#define REGISTER_STATUS_DC_MOTORS_RUNNING 0x01
+#define REGISTER_STATUS_MOTION_HELD 0x02
+
+static_assert(REG_SERVO_DEGREES + SERVOS_COUNT * 2 <= REG_SPI_FRAMES, "Servo degrees overlap the counters");
+static_assert(REG_JOINT_SETPOINTS + SERVOS_COUNT * REGISTER_SETPOINT_SIZE <= REG_JOINT_LIMITS, "Joint setpoints overlap the limits");
+static_assert(REG_JOINT_LIMITS + SERVOS_COUNT * REGISTER_LIMITS_SIZE <= REG_SPEED_PROFILES, "Limits overlap the profiles");
+
+// Burst response header: sync, type, address, length. The checksum byte follows the payload.
+#define REGISTER_BURST_HEADER_SIZE 6
+
+typedef struct
+{
+    // Bursts out of the map, reaching the read only part, or with a wrong checksum.
+    uint32_t errors;
+
+    // Write payloads cut off by a gap in the transfer.
+    uint32_t broken_writes;
+
+    // Written values the modules refused, e.g. a limit outside the servo range.
+    uint32_t refused_values;
+
+    // Writes that waited while REGISTER_WRITE_SLOTS later ones came in, not applied.
+    uint32_t overwritten_writes;
+} register_map_stats_t;
+
+// Taking a byte of the MOSI stream, see register_map_receive_byte().
+typedef enum {
+    REGISTER_BYTE_NOT_TAKEN = 0,    // Not part of a write payload, goes to the frame parser.
+    REGISTER_BYTE_TAKEN = 1,
+    REGISTER_BYTE_WRITE_DONE = 2,   // Last byte of a good payload, the write frame is ready to queue.
+} register_byte_result_t;
+
+void init_register_map();
+
+// From the SPI interrupt, for each received byte before the frame parser.
+// Returns REGISTER_BYTE_WRITE_DONE with the write frame in received.
+register_byte_result_t register_map_receive_byte(uint8_t byte, uint32_t now_us, received_command_t *received);
+
+// From the SPI interrupt, for each parsed frame before the board address check, as the payload of
+// a write for another board must be skipped too. Returns true if the frame was taken.
+bool register_map_receive(const received_command_t &received, bool for_this_board);
+
+// From the SPI interrupt, when a response frame is done. Returns false if no burst is going out.
+bool register_map_next_tx_byte(uint8_t *byte);
+
+// Main loop. Applies the range of a REGISTER_WRITE_COMMAND taken from the queue.
+void register_map_apply_write(const command_8_bytes_t &command);
+
+// Main loop. Updates the state and builds the read the SPI interrupt was asked for, if any.
+void register_map_refresh(bool motion_held);
+
+void register_map_get_stats(register_map_stats_t *stats);
+
+#endif // REGISTER_MAP_HPP
@@ -0,0 +1,201 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef ROBOT_DESCRIPTION_HPP
+#define ROBOT_DESCRIPTION_HPP
+
+#include <stdint.h>
+#include "common_types.hpp"
+
+// The robot arm, one entry per servo slot of the protocol.
+// The joint indices, the PWM mapping, the default calibration, the command dispatch and
+// the control tick are all generated from this list at compile time. Only the slots with a
+// joint get calibration, speed tables and tick state, a free slot takes no RAM or flash.
+
+#define SERVO_SPEED_TABLE_SIZE 10
+
+// Default geometry of the arm in micrometers, the calibration of each joint can change it.
+// Height of the shoulder axis above the base plane.
+#define ARM_BASE_HEIGHT_UM      70000
+// Shoulder axis to elbow axis.
+#define ARM_UPPER_LINK_UM       105000
+// Elbow axis to wrist angle axis.
+#define ARM_FOREARM_LINK_UM     98000
+// Wrist angle axis to the tip of the gripper.
+#define ARM_GRIPPER_LINK_UM     150000
+
+// Represents the speed settings for each servo motor.
+typedef struct {
+    uint8_t min_percentage; // Minimum speed percentage.
+    uint8_t max_percentage; // Maximum speed percentage.
+    uint16_t min_time_ms;   // Minimum time in milliseconds before change degrees.
+} servo_speed_settings_t;
+
+typedef enum {
+    JOINT_NONE = 0,  // Free slot, nothing connected.
+    JOINT_SERVO = 1, // Hobby servo driven by a 50Hz pulse.
+} joint_type_t;
+
+// Default speed settings, picked per joint.
+// Used to determine how fast the servo should move based on the speed percentage and elapsed time.
+typedef enum {
+    SERVO_SPEED_PROFILE_HEAVY = 0, // Joints carrying the rest of the arm, a step takes longer.
+    SERVO_SPEED_PROFILE_LIGHT = 1,
+    SERVO_SPEED_PROFILES_COUNT
+} servo_speed_profile_t;
+
+typedef struct
+{
+    joint_type_t type;
+
+    // Range the servo supports, 180 or 270 degrees.
+    int16_t degrees;
+
+    // PWM channel number for the servo.
+    uint8_t pwm_number;
+
+    // If true, the servo is mounted to move in the opposite direction.
+    bool is_inverted;
+
+    // Moved by the Cartesian motion in arm_kinematics.
+    bool is_cartesian;
+
+    // Link of the Cartesian motion the joint carries, to the next axis, in micrometers.
+    // For the base the height of the shoulder axis. 0 for the other joints.
+    int32_t link_um;
+
+    servo_speed_profile_t speed_profile;
+
+    // Command that jogs the joint.
+    command_type_t direction_command;
+} joint_description_t;
+
+constexpr servo_speed_settings_t servo_speed_profiles[SERVO_SPEED_PROFILES_COUNT][SERVO_SPEED_TABLE_SIZE] = {
+    {   // Heavy
+        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 110 },
+        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 100 },
+        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 90 },
+        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 80 },
+        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 70 },
+        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 60 },
+        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 50 },
+        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 40 },
+        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 30 },
+        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 20 }
+    },
+    {   // Light
+        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
+        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 },
+        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 },
+        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
+        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
+        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
+        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
+        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
+        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
+        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
+    }
+};
+
+constexpr joint_description_t robot_joints[] = {
+    // Base
+    { JOINT_SERVO, 270, 0, false, true, ARM_BASE_HEIGHT_UM, SERVO_SPEED_PROFILE_HEAVY, BASE_MOTOR_DIRECTION_COMMAND },
+    // Shoulder, inverted for this robot arm
+    { JOINT_SERVO, 270, 1, true, true, ARM_UPPER_LINK_UM, SERVO_SPEED_PROFILE_HEAVY, SHOULDER_MOTOR_DIRECTION_COMMAND },
+    // Elbow
+    { JOINT_SERVO, 270, 2, false, true, ARM_FOREARM_LINK_UM, SERVO_SPEED_PROFILE_LIGHT, ELBOW_MOTOR_DIRECTION_COMMAND },
+    // Arm, the wrist pitch of the Cartesian motion
+    { JOINT_SERVO, 270, 3, false, true, ARM_GRIPPER_LINK_UM, SERVO_SPEED_PROFILE_LIGHT, ARM_MOTOR_DIRECTION_COMMAND },
+    // Wrist
+    { JOINT_SERVO, 270, 4, false, false, 0, SERVO_SPEED_PROFILE_LIGHT, WRIST_MOTOR_DIRECTION_COMMAND },
+    // Wrist 2, not present in this robot arm
+    { JOINT_NONE, 270, 5, false, false, 0, SERVO_SPEED_PROFILE_LIGHT, WRIST_2_MOTOR_DIRECTION_COMMAND },
+    // Gripper
+    { JOINT_SERVO, 180, 6, false, false, 0, SERVO_SPEED_PROFILE_LIGHT, GRIPPER_MOTOR_DIRECTION_COMMAND },
+    // Free
+    { JOINT_NONE, 270, 7, false, false, 0, SERVO_SPEED_PROFILE_LIGHT, INVALID_COMMAND },
+};
+
+constexpr uint8_t SERVOS_COUNT = sizeof(robot_joints) / sizeof(robot_joints[0]);
+
+// Not a joint index, for the lookups that find nothing.
+#define NO_JOINT 0xFF
+
+constexpr uint8_t count_robot_joints()
+{
+    uint8_t count = 0;
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        count += (robot_joints[i].type != JOINT_NONE) ? 1 : 0;
+    }
+
+    return count;
+}
+
+// Slots with a joint on the robot. The calibration and the state of the joints are kept in this
+// many entries, in the order of their slots.
+constexpr uint8_t JOINTS_COUNT = count_robot_joints();
+
+// Entry of the joint in a slot, NO_JOINT for a free slot or a slot past the list.
+constexpr uint8_t robot_joint_entry(uint8_t slot)
+{
+    if (slot >= SERVOS_COUNT || robot_joints[slot].type == JOINT_NONE)
+    {
+        return NO_JOINT;
+    }
+
+    uint8_t entry = 0;
+    for (uint8_t i = 0; i < slot; i++)
+    {
+        entry += (robot_joints[i].type != JOINT_NONE) ? 1 : 0;
+    }
+
+    return entry;
+}
+
+// Slot of the joint jogged by the command, NO_JOINT if the command does not move a joint on this robot.
+constexpr uint8_t robot_joint_for_command(uint8_t command)
+{
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        if (robot_joints[i].type != JOINT_NONE && robot_joints[i].direction_command == command)
+        {
+            return i;
+        }
+    }
+
+    return NO_JOINT;
+}
+
+constexpr uint8_t BASE_MOTOR_INDEX = robot_joint_for_command(BASE_MOTOR_DIRECTION_COMMAND);
+constexpr uint8_t SHOULDER_MOTOR_INDEX = robot_joint_for_command(SHOULDER_MOTOR_DIRECTION_COMMAND);
+constexpr uint8_t ELBOW_MOTOR_INDEX = robot_joint_for_command(ELBOW_MOTOR_DIRECTION_COMMAND);
+constexpr uint8_t ARM_MOTOR_INDEX = robot_joint_for_command(ARM_MOTOR_DIRECTION_COMMAND);
+constexpr uint8_t WRIST_MOTOR_INDEX = robot_joint_for_command(WRIST_MOTOR_DIRECTION_COMMAND);
+constexpr uint8_t GRIPPER_MOTOR_INDEX = robot_joint_for_command(GRIPPER_MOTOR_DIRECTION_COMMAND);
+
+// The Cartesian motion drives exactly these four.
+static_assert(BASE_MOTOR_INDEX != NO_JOINT && robot_joints[BASE_MOTOR_INDEX].is_cartesian, "Base joint missing");
+static_assert(SHOULDER_MOTOR_INDEX != NO_JOINT && robot_joints[SHOULDER_MOTOR_INDEX].is_cartesian, "Shoulder joint missing");
+static_assert(ELBOW_MOTOR_INDEX != NO_JOINT && robot_joints[ELBOW_MOTOR_INDEX].is_cartesian, "Elbow joint missing");
+static_assert(ARM_MOTOR_INDEX != NO_JOINT && robot_joints[ARM_MOTOR_INDEX].is_cartesian, "Arm joint missing");
+
+// Joint of each command type, generated from the list. Read once per command by the main loop.
+typedef struct
+{
+    uint8_t joints[COMMAND_TYPES_COUNT];
+} command_joint_table_t;
+
+constexpr command_joint_table_t make_command_joint_table()
+{
+    command_joint_table_t table = {};
+    for (uint8_t command = 0; command < COMMAND_TYPES_COUNT; command++)
+    {
+        table.joints[command] = robot_joint_for_command(command);
+    }
+
+    return table;
+}
+
+constexpr command_joint_table_t command_joint_table = make_command_joint_table();
+
+#endif // ROBOT_DESCRIPTION_HPP
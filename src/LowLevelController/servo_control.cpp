@@ -1,16 +1,34 @@
 // Copyright © Svetoslav Paregov. All rights reserved.
 
 #include <stdio.h>
+#include <string.h> // For memcpy
+#include <utility> // For std::index_sequence
 #include "pico/stdlib.h"
 #include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "hardware/timer.h"
+#include "arm_kinematics.hpp"
+#include "calibration_store.hpp"
+#include "dc_motors_control.hpp"
+#include "emergency_stop.hpp"
+#include "motion_recorder.hpp"
 #include "pico_native_pwm.hpp"
+#include "pio_servo_pwm.hpp"
+#include "power_monitor.hpp"
+#include "publish_buffer.hpp"
 #include "servo_control.hpp"
+#include "irq_tiers.hpp"
 
 #define TIMER_INTERVAL_US 10000
 #define TIMER_INTERVAL_MS (TIMER_INTERVAL_US / 1000)
 
-#define SERVO_SPEED_TABLE_SIZE 10
+// Load current the servos may draw with the DC motors stopped. Above it for this long a joint
+// is pushing against something, all servos then hold where they are.
+#define SERVOS_OVERCURRENT_MA 2000
+#define SERVOS_OVERCURRENT_TICKS 50
+
+// Longest link of the Cartesian motion, keeps its fixed-point math in range.
+#define SERVO_LINK_MAX_UM 1000000
 
 // Internal type used to represent the internal state of the servo motor and the current control settings.
 typedef struct
@@ -31,159 +49,106 @@ typedef struct
     int16_t timeout;
 } servo_motor_state_t;
 
-// Represents the speed settings for each servo motor.
-typedef struct {
-    uint8_t min_percentage; // Minimum speed percentage.
-    uint8_t max_percentage; // Maximum speed percentage.
-    uint16_t min_time_ms;   // Minimum time in milliseconds before change degrees.
-} servo_speed_settings_t;
-
-// Default servo configuration for 180 degrees servo.
-const servo_info_t servo_180 = {
-    .degrees = 180,
-    .bottom_degrees_limit = 0,
-    .top_degrees_limit = 180,
-    .left_us = 500.0f,
-    .center_us = 1500.0f,
-    .right_us = 2500.0f,
-    .degree_to_us = ((2500.0f - 500.0f) / 180.0f),
-    .pwm_number = 0,    // This will be set later in init_servos()
-    .is_inverted = false
-};
-
-// Default servo configuration for 270 degrees servo.
-const servo_info_t servo_270 = {
-    .degrees = 270,
-    .bottom_degrees_limit = 0,
-    .top_degrees_limit = 270,
-    .left_us = 500.0f,
-    .center_us = 1500.0f,
-    .right_us = 2500.0f,
-    .degree_to_us = ((2500.0f - 500.0f) / 270.0f),
-    .pwm_number = 0,    // This will be set later in init_servos()
-    .is_inverted = false
-};
-
-// Speed settings for each servo motor.
-// Used to determine how fast the servo should move based on the speed percentage and elapsed time.
-const servo_speed_settings_t servos_speed_table[SERVOS_COUNT][SERVO_SPEED_TABLE_SIZE] = {
-    {   // Base servo speed settings
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 110 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 100 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 90 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 80 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 70 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 60 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 50 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 40 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 30 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 20 }
-    },
-    {   // Shoulder servo speed settings
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 110 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 100 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 90 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 80 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 70 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 60 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 50 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 40 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 30 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 20 }
-    },
-    {   // Elbow servo speed settings
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    },
-    {   // Arm used right now
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    },
-    {   // Wrist servo speed settings
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    },
-    {   // Not used
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    },
-    {   // Gripper servo speed settings
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    },
-    {   // Not used
-        { .min_percentage = 10, .max_percentage = 20, .min_time_ms = 100 },
-        { .min_percentage = 20, .max_percentage = 30, .min_time_ms = 90 }, 
-        { .min_percentage = 30, .max_percentage = 40, .min_time_ms = 80 }, 
-        { .min_percentage = 40, .max_percentage = 50, .min_time_ms = 70 },
-        { .min_percentage = 50, .max_percentage = 60, .min_time_ms = 60 },
-        { .min_percentage = 60, .max_percentage = 70, .min_time_ms = 50 },
-        { .min_percentage = 70, .max_percentage = 80, .min_time_ms = 40 },
-        { .min_percentage = 80, .max_percentage = 90, .min_time_ms = 30 },
-        { .min_percentage = 90, .max_percentage = 100, .min_time_ms = 20 },
-        { .min_percentage = 100, .max_percentage = 110, .min_time_ms = 10 }
-    }
-};
-
-// Array to hold servo information for each servo motor.
-servo_info_t servos_info_array[SERVOS_COUNT];
-
-motor_direction_speed_t servo_motor_speeds_array[SERVOS_COUNT] = {
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 },
-    { .direction = 0, .speed = 0, .elapsed_time = 0, .timeout = 0 }
-};
+// Everything that can be calibrated at runtime and is kept in the calibration store.
+// One entry per joint, see JOINTS_COUNT.
+typedef struct
+{
+    servo_info_t servos[JOINTS_COUNT];
+    servo_speed_settings_t speed_table[JOINTS_COUNT][SERVO_SPEED_TABLE_SIZE];
+} servo_calibration_t;
+
+// Default calibration of a joint, as described in robot_description.hpp.
+static constexpr servo_info_t default_servo_info(const joint_description_t &joint)
+{
+    servo_info_t info = {};
+    info.degrees = joint.degrees;
+    info.bottom_degrees_limit = 0;
+    info.top_degrees_limit = joint.degrees;
+    info.left_us = 500.0f;
+    info.center_us = 1500.0f;
+    info.right_us = 2500.0f;
+    info.degree_to_us = (2500.0f - 500.0f) / joint.degrees;
+    info.link_um = joint.link_um;
+    info.pwm_number = joint.pwm_number;
+    info.is_inverted = joint.is_inverted;
+    return info;
+}
+
+static constexpr servo_calibration_t make_default_servo_calibration()
+{
+    servo_calibration_t calibration = {};
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
+    {
+        uint8_t joint = robot_joint_entry(i);
+        if (joint == NO_JOINT)
+        {
+            continue;
+        }
+
+        calibration.servos[joint] = default_servo_info(robot_joints[i]);
+        for (uint8_t row = 0; row < SERVO_SPEED_TABLE_SIZE; row++)
+        {
+            calibration.speed_table[joint][row] = servo_speed_profiles[robot_joints[i].speed_profile][row];
+        }
+    }
+
+    return calibration;
+}
+
+// The compiled in calibration, generated from the robot description.
+constexpr servo_calibration_t default_servo_calibration = make_default_servo_calibration();
+
+// Array to hold servo information for each joint, indexed by the joint entry, not the slot.
+// It and the speed settings are read on every control tick, so they are in a scratch bank.
+servo_info_t __scratch_x("servo_control") servos_info_array[JOINTS_COUNT];
+
+// Speed settings in use. Start as the defaults and can be changed at runtime.
+servo_speed_settings_t __scratch_x("servo_control") servos_speed_table[JOINTS_COUNT][SERVO_SPEED_TABLE_SIZE];
+
+// Working state of the joints. Owned by the control tick.
+motor_direction_speed_t servo_motor_speeds_array[JOINTS_COUNT] = {};
+
+// Speeds set by the command processing, taken over by the control tick.
+PublishedSetpoints<motor_direction_speed_t, JOINTS_COUNT> servo_motor_setpoints;
+
+// What a free slot reads back, it never moves.
+static const servo_info_t free_slot_info = {};
 
 // Timer to handle servo control updates.
 struct repeating_timer servo_control_timer;
+irq_tick_t servo_control_tick;
+
+// Ticks in a row over the servo current, and trips since boot.
+uint16_t servos_overcurrent_ticks = 0;
+volatile uint32_t servos_overcurrent_trips = 0;
+
+// Set on an overcurrent trip or an emergency stop, cleared by the main loop once the motions are stopped.
+volatile bool servos_hold = false;
+
+// Emergency stops already applied to the working state.
+uint32_t servos_stop_count = 0;
+
+static bool __not_in_flash_func(check_servos_overcurrent)()
+{
+    // With the DC motors running the current is theirs, their stall check handles it.
+    if (dc_motors_running() || power_load_current_ma() < SERVOS_OVERCURRENT_MA)
+    {
+        servos_overcurrent_ticks = 0;
+        return false;
+    }
+
+    if (++servos_overcurrent_ticks < SERVOS_OVERCURRENT_TICKS)
+    {
+        return false;
+    }
+
+    servos_overcurrent_ticks = 0;
+    servos_overcurrent_trips++;
+    return true;
+}
 
 // Function to determine if a servo should move based on its speed settings.
-bool should_servo_move(
+bool __not_in_flash_func(should_servo_move)(
     servo_speed_settings_t *settings,
     uint8_t speed_percentage,
     uint16_t time_elapsed)
@@ -203,7 +168,41 @@ bool should_servo_move(
     return false;
 }
 
-void process_servo_motor_speed(motor_direction_speed_t *motor, uint8_t motor_index)
+// Moves a joint, by its entry. Clamped to the range of its servo.
+static void __not_in_flash_func(set_joint_position_in_degrees)(uint8_t joint, int16_t degrees)
+{
+    servo_info_t *info = &servos_info_array[joint];
+
+    // If we try to set a bigger than allowed degrees, we will set the maximum allowed degrees.
+    if (degrees > info->degrees)
+    {
+        degrees = info->degrees;
+    }
+    else if (degrees <= 0)
+    {
+        degrees = 0; // If we try to set a negative degrees, we will set 0 degrees.
+    }
+
+    // Since we are using absolute position in degrees, we are getting the left position in microseconds.
+    float pulse_width = info->left_us + (info->degree_to_us * degrees);
+    if (pulse_width > info->right_us)
+    {
+        // If we try to set a bigger than allowed pulse width, we will set the maximum allowed pulse width.
+        pulse_width = info->right_us;
+    }
+
+    if (pulse_width < info->left_us)
+    {
+        // If we try to set a smaller than allowed pulse width, we will set the minimum allowed pulse width.
+        pulse_width = info->left_us;
+    }
+
+    info->current_degrees = degrees;
+
+    set_pwm_pulse_width_us(info->pwm_number, (uint16_t)pulse_width);
+}
+
+void __not_in_flash_func(process_servo_motor_speed)(motor_direction_speed_t *motor, uint8_t motor_index)
 {
     motor->timeout -= TIMER_INTERVAL_MS;
     if (motor->timeout <= 0)
@@ -225,7 +224,6 @@ void process_servo_motor_speed(motor_direction_speed_t *motor, uint8_t motor_ind
         motor->elapsed_time))
     {
         uint16_t new_degrees = servos_info_array[motor_index].current_degrees;
-        uint8_t pwm_number = servos_info_array[motor_index].pwm_number;
         bool is_inverted = servos_info_array[motor_index].is_inverted;
 
         if (motor->direction > 0 && !is_inverted)
@@ -251,8 +249,77 @@ void process_servo_motor_speed(motor_direction_speed_t *motor, uint8_t motor_ind
         motor->elapsed_time = 0; // Reset elapsed time after processing
 
         // Set the PWM duty cycle based on the speed percentage
-        set_servo_position_in_degrees(pwm_number, new_degrees);
+        set_joint_position_in_degrees(motor_index, new_degrees);
+    }
+}
+
+// One call per joint on the robot, unrolled at compile time. The free slots are not in the tick at all.
+template <size_t... Joints>
+static void __not_in_flash_func(process_servo_joints)(std::index_sequence<Joints...>)
+{
+    (process_servo_motor_speed(&servo_motor_speeds_array[Joints], Joints), ...);
+}
+
+// One control tick: setpoints, the servos, the cartesian motion and the motion recorder.
+void __not_in_flash_func(process_servo_tick)()
+{
+    servo_motor_setpoints.take(servo_motor_speeds_array);
+
+    uint32_t stop_count = emergency_stop_count();
+    if (check_servos_overcurrent() || stop_count != servos_stop_count)
+    {
+        servos_stop_count = stop_count;
+        servos_hold = true;
+    }
+
+    // Nothing moves until the main loop has cancelled the cartesian motion and the playback.
+    if (servos_hold)
+    {
+        for (int i = 0; i < JOINTS_COUNT; i++)
+        {
+            servo_motor_speeds_array[i].timeout = 0;
+        }
+        return;
+    }
+
+    // All joints moved in this tick reach the outputs in the same PWM frame.
+    begin_pwm_update();
+
+    // Process each servo motor speed.
+    process_servo_joints(std::make_index_sequence<JOINTS_COUNT>());
+
+    // Cartesian motion of the arm, if any.
+    process_arm_kinematics(TIMER_INTERVAL_MS);
+
+    // Records the positions set above, or plays a recording.
+    process_motion_recorder();
+
+    end_pwm_update();
+}
+
+void __not_in_flash_func(get_servo_tick_state)(servo_tick_state_t *state)
+{
+    servo_motor_setpoints.take(servo_motor_speeds_array);
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        state->speeds[i] = servo_motor_speeds_array[i];
+        state->degrees[i] = servos_info_array[i].current_degrees;
+    }
+    state->overcurrent_ticks = servos_overcurrent_ticks;
+    state->stop_count = servos_stop_count;
+    state->hold = servos_hold;
+}
+
+void __not_in_flash_func(set_servo_tick_state)(const servo_tick_state_t *state)
+{
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        servo_motor_speeds_array[i] = state->speeds[i];
+        servos_info_array[i].current_degrees = state->degrees[i];
     }
+    servos_overcurrent_ticks = state->overcurrent_ticks;
+    servos_stop_count = state->stop_count;
+    servos_hold = state->hold;
 }
 
 /*
@@ -264,70 +331,63 @@ void process_servo_motor_speed(motor_direction_speed_t *motor, uint8_t motor_ind
  * * @param t Pointer to the repeating_timer structure.
  * @return bool Must return true to continue the timer. Returning false would stop it.
  */
-bool servo_motors_timer_callback(struct repeating_timer *t)
+bool __not_in_flash_func(servo_motors_timer_callback)(struct repeating_timer *t)
 {
-    // Process each servo motor speed.
-    process_servo_motor_speed(&servo_motor_speeds_array[BASE_MOTOR_INDEX], BASE_MOTOR_INDEX);
-    process_servo_motor_speed(&servo_motor_speeds_array[SHOULDER_MOTOR_INDEX], SHOULDER_MOTOR_INDEX);
-    process_servo_motor_speed(&servo_motor_speeds_array[ELBOW_MOTOR_INDEX], ELBOW_MOTOR_INDEX);
-    process_servo_motor_speed(&servo_motor_speeds_array[ARM_MOTOR_INDEX], ARM_MOTOR_INDEX);
-    process_servo_motor_speed(&servo_motor_speeds_array[WRIST_MOTOR_INDEX], WRIST_MOTOR_INDEX);
-    process_servo_motor_speed(&servo_motor_speeds_array[GRIPPER_MOTOR_INDEX], GRIPPER_MOTOR_INDEX);
+    (void)t;
+    uint32_t entered_us = irq_tick_begin(&servo_control_tick);
+    process_servo_tick();
+    irq_tick_end(&servo_control_tick, entered_us);
 
     return true; // Keep the timer repeating
 }
 
+static int16_t clamp_servo_degrees(const servo_info_t *info, int16_t degrees)
+{
+    if (degrees < info->bottom_degrees_limit)
+    {
+        return info->bottom_degrees_limit;
+    }
+
+    if (degrees > info->top_degrees_limit)
+    {
+        return info->top_degrees_limit;
+    }
+
+    return degrees;
+}
+
+static void load_default_servo_calibration()
+{
+    memcpy(servos_info_array, default_servo_calibration.servos, sizeof(servos_info_array));
+    memcpy(servos_speed_table, default_servo_calibration.speed_table, sizeof(servos_speed_table));
+}
+
 void init_servos()
 {
-    // TODO: Get the servos info from the main controller. This way we can set the degrees and limits dynamically.
-    // And change the them without recompiling the code.
-    // For now, we will use the predefined servos info.
-
-    // Base
-    servos_info_array[BASE_MOTOR_INDEX] = servo_270;
-    servos_info_array[BASE_MOTOR_INDEX].pwm_number = 0;
-
-    // Shoulder
-    servos_info_array[SHOULDER_MOTOR_INDEX] = servo_270;
-    servos_info_array[SHOULDER_MOTOR_INDEX].pwm_number = 1;
-    servos_info_array[SHOULDER_MOTOR_INDEX].is_inverted = true; // Inverted for this robot arm
-    //servos_info_array[SHOULDER_MOTOR_INDEX].bottom_degrees_limit = 45;
-    //servos_info_array[SHOULDER_MOTOR_INDEX].top_degrees_limit = 225;
-
-    // Elbow
-    servos_info_array[ELBOW_MOTOR_INDEX] = servo_270;
-    servos_info_array[ELBOW_MOTOR_INDEX].pwm_number = 2;
-
-    // Arm
-    servos_info_array[ARM_MOTOR_INDEX] = servo_270;
-    servos_info_array[ARM_MOTOR_INDEX].pwm_number = 3;
-
-    // Wrist
-    servos_info_array[WRIST_MOTOR_INDEX] = servo_270; 
-    servos_info_array[WRIST_MOTOR_INDEX].pwm_number = 4;
-
-    // Wrist2 - Not present in this Robot Arm
-    servos_info_array[5] = servo_270;
-    servos_info_array[5].pwm_number = 5;
-
-    // Gripper
-    servos_info_array[GRIPPER_MOTOR_INDEX] = servo_180;
-    servos_info_array[GRIPPER_MOTOR_INDEX].pwm_number = 6;
-    //servos_info_array[GRIPPER_MOTOR_INDEX].bottom_degrees_limit = 45;
-    //servos_info_array[GRIPPER_MOTOR_INDEX].top_degrees_limit = 225;
-
-    // Not present in this Robot Arm
-    servos_info_array[7] = servo_270;
-    servos_info_array[7].pwm_number = 7;
-    
-    set_servo_position_in_degrees(0, servos_info_array[0].degrees/2); // base
-    set_servo_position_in_degrees(1, servos_info_array[1].degrees/2); // shoulder
-    set_servo_position_in_degrees(2, servos_info_array[2].degrees/2); // elbow
-    set_servo_position_in_degrees(3, servos_info_array[3].degrees/2); // arm
-    set_servo_position_in_degrees(4, servos_info_array[4].degrees/2); // wrist
-    // set_servo_position_in_degrees(5, servos[5].degrees/2); // wrist2 - Not present in this Robot Arm
-    set_servo_position_in_degrees(6, servos_info_array[6].degrees/2); // gripper
-    // set_servo_position_in_degrees(7, servos[7].degrees/2); // - Not present in this Robot Arm
+    // The compiled in values are the defaults. The calibration saved by the main controller
+    // replaces them, so the limits can be changed without recompiling the code.
+    load_default_servo_calibration();
+
+    servo_calibration_t calibration;
+    if (calibration_store_load(&calibration, sizeof(calibration)))
+    {
+        // The start position stays the default one, only moved inside the new limits.
+        for (int i = 0; i < JOINTS_COUNT; i++)
+        {
+            int16_t start_degrees = servos_info_array[i].current_degrees;
+            servos_info_array[i] = calibration.servos[i];
+            servos_info_array[i].current_degrees = clamp_servo_degrees(&servos_info_array[i], start_degrees);
+        }
+        memcpy(servos_speed_table, calibration.speed_table, sizeof(servos_speed_table));
+    }
+
+    // Joints on the robot start in the middle of their range.
+    begin_pwm_update();
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        set_joint_position_in_degrees(i, servos_info_array[i].degrees / 2);
+    }
+    end_pwm_update();
 
 
     // Create a repeating timer that calls servo_motors_timer_callback.
@@ -335,80 +395,340 @@ void init_servos()
     // A negative value means the timer will be fired relative to the previous scheduled fire time,
     // which is better for periodic tasks to avoid drift.
     // The last argument is a pointer where the SDK will store timer information.
+    irq_tick_start(&servo_control_tick, TIMER_INTERVAL_US);
     add_repeating_timer_us(-TIMER_INTERVAL_US, servo_motors_timer_callback, NULL, &servo_control_timer);
 }
 
-void set_servo_position_in_degrees(uint8_t servo, int16_t degrees)
+void __not_in_flash_func(set_servo_position_in_degrees)(uint8_t servo, int16_t degrees)
 {
-    // If we try to set a bigger than allowed degrees, we will set the maximum allowed degrees.
-    if (degrees > servos_info_array[servo].degrees)
+    // A free slot has no output.
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint != NO_JOINT)
     {
-        degrees = servos_info_array[servo].degrees;
+        set_joint_position_in_degrees(joint, degrees);
     }
-    else if (degrees <= 0)
+}
+
+bool set_servo_motor_direction_speed(uint8_t servo, motor_direction_speed_t speed)
+{
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint == NO_JOINT)
     {
-        degrees = 0; // If we try to set a negative degrees, we will set 0 degrees.
+        printf("Error: Invalid servo index %d. Must be a joint between 0 and %d.\n", servo, SERVOS_COUNT - 1);
+        return false;
     }
 
-    // Since we are using absolute position in degrees, we are getting the left position in microseconds.
-    float pulse_width = servos_info_array[servo].left_us +
-                        (servos_info_array[servo].degree_to_us * degrees);
-    if (pulse_width > servos_info_array[servo].right_us)
+    servo_motor_setpoints.set(joint, speed);
+    servo_motor_setpoints.publish();
+
+    return true;
+}
+
+void set_servos_motor_direction_speed(const motor_direction_speed_t speeds[SERVOS_COUNT], uint32_t servos_mask)
+{
+    for (uint8_t i = 0; i < SERVOS_COUNT; i++)
     {
-        // If we try to set a bigger than allowed pulse width, we will set the maximum allowed pulse width.
-        pulse_width = servos_info_array[servo].right_us;
+        if ((servos_mask & (1u << i)) && robot_joint_entry(i) != NO_JOINT)
+        {
+            servo_motor_setpoints.set(robot_joint_entry(i), speeds[i]);
+        }
     }
 
-    if (pulse_width < servos_info_array[servo].left_us)
+    servo_motor_setpoints.publish();
+}
+
+const servo_info_t *__not_in_flash_func(get_servo_info)(uint8_t servo)
+{
+    uint8_t joint = robot_joint_entry(servo);
+    return (joint == NO_JOINT) ? &free_slot_info : &servos_info_array[joint];
+}
+
+void restore_default_servo_calibration()
+{
+    // The control tick reads the calibration on every run, and must not see it half copied.
+    uint32_t interrupts = save_and_disable_interrupts();
+    servo_info_t previous[JOINTS_COUNT];
+    memcpy(previous, servos_info_array, sizeof(previous));
+    load_default_servo_calibration();
+
+    // Do not jump, the servos continue from where they are. A remapped output goes idle.
+    begin_pwm_update();
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
     {
-        // If we try to set a smaller than allowed pulse width, we will set the minimum allowed pulse width.
-        pulse_width = servos_info_array[servo].left_us;
+        servos_info_array[i].current_degrees = clamp_servo_degrees(&servos_info_array[i], previous[i].current_degrees);
+        if (servos_info_array[i].pwm_number != previous[i].pwm_number)
+        {
+            set_pwm_pulse_width_us(previous[i].pwm_number, 0);
+        }
     }
 
-    servos_info_array[servo].current_degrees = degrees;
-
-    set_pwm_pulse_width_us(servos_info_array[servo].pwm_number, (uint16_t)pulse_width);
+    // After all the remapped outputs went idle, one of them may be another joint's default.
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        if (servos_info_array[i].pwm_number != previous[i].pwm_number)
+        {
+            set_joint_position_in_degrees(i, servos_info_array[i].current_degrees);
+        }
+    }
+    end_pwm_update();
+    restore_interrupts(interrupts);
 }
 
-void set_base_servo_speed(motor_direction_speed_t speed)
+// Recalculates the derived values after a change of the range.
+static void update_servo_degree_to_us(servo_info_t *info)
 {
-    servo_motor_speeds_array[BASE_MOTOR_INDEX] = speed;
+    if (info->degrees > 0)
+    {
+        info->degree_to_us = (info->right_us - info->left_us) / (float)info->degrees;
+    }
 }
 
-void set_shoulder_servo_speed(motor_direction_speed_t speed)
+bool get_servo_calibration_field(uint8_t servo, servo_calibration_field_t field, int32_t *value)
 {
-    servo_motor_speeds_array[SHOULDER_MOTOR_INDEX] = speed;
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint == NO_JOINT)
+    {
+        return false;
+    }
+
+    const servo_info_t *info = &servos_info_array[joint];
+    switch (field)
+    {
+        case SERVO_CALIBRATION_DEGREES:
+            *value = info->degrees;
+            break;
+        case SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT:
+            *value = info->bottom_degrees_limit;
+            break;
+        case SERVO_CALIBRATION_TOP_DEGREES_LIMIT:
+            *value = info->top_degrees_limit;
+            break;
+        case SERVO_CALIBRATION_LEFT_NS:
+            *value = (int32_t)(info->left_us * 1000.0f);
+            break;
+        case SERVO_CALIBRATION_CENTER_NS:
+            *value = (int32_t)(info->center_us * 1000.0f);
+            break;
+        case SERVO_CALIBRATION_RIGHT_NS:
+            *value = (int32_t)(info->right_us * 1000.0f);
+            break;
+        case SERVO_CALIBRATION_PWM_NUMBER:
+            *value = info->pwm_number;
+            break;
+        case SERVO_CALIBRATION_INVERTED:
+            *value = info->is_inverted ? 1 : 0;
+            break;
+        case SERVO_CALIBRATION_CURRENT_DEGREES:
+            *value = info->current_degrees;
+            break;
+        case SERVO_CALIBRATION_LINK_UM:
+            *value = info->link_um;
+            break;
+        default:
+            return false;
+    }
+
+    return true;
 }
 
-void set_elbow_servo_speed(motor_direction_speed_t speed)
+// A servo output no other joint uses. The native channels of the DC motors are not servo outputs.
+static bool is_servo_pwm_number_free(uint8_t joint, int32_t pwm_number)
 {
-    servo_motor_speeds_array[ELBOW_MOTOR_INDEX] = speed;
+    if (pwm_number < 0 || pwm_number >= PIO_PWM_NUMBER_FIRST + PIO_SERVOS_COUNT ||
+        pwm_number == PWM_NUMBER_DC_MOTOR_LEFT || pwm_number == PWM_NUMBER_DC_MOTOR_RIGHT)
+    {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        if (i != joint && servos_info_array[i].pwm_number == pwm_number)
+        {
+            return false;
+        }
+    }
+
+    return true;
 }
 
-void set_arm_servo_speed(motor_direction_speed_t speed)
+// Degrees within the range the servo of the joint supports. Checked before the value is
+// narrowed to the int16_t of the record, so it cannot wrap into the range.
+static bool is_servo_degrees_in_range(uint8_t servo, int32_t degrees)
 {
-    servo_motor_speeds_array[ARM_MOTOR_INDEX] = speed;
+    return degrees >= 0 && degrees <= robot_joints[servo].degrees;
 }
 
-void set_wrist_servo_speed(motor_direction_speed_t speed)
+// A pulse width the outputs can produce, within the servo frame.
+static bool is_servo_pulse_ns_in_range(int32_t pulse_ns)
 {
-    servo_motor_speeds_array[WRIST_MOTOR_INDEX] = speed;
+    return pulse_ns > 0 && pulse_ns < PWM_PERIOD * 1000;
 }
 
-void set_gripper_servo_speed(motor_direction_speed_t speed)
+bool set_servo_calibration_field(uint8_t servo, servo_calibration_field_t field, int32_t value)
 {
-    servo_motor_speeds_array[GRIPPER_MOTOR_INDEX] = speed;
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint == NO_JOINT)
+    {
+        return false;
+    }
+
+    // Work on a copy, so the control tick never sees a half validated value.
+    servo_info_t info = servos_info_array[joint];
+    switch (field)
+    {
+        case SERVO_CALIBRATION_DEGREES:
+            if (!is_servo_degrees_in_range(servo, value))
+            {
+                return false;
+            }
+            info.degrees = (int16_t)value;
+            break;
+        case SERVO_CALIBRATION_BOTTOM_DEGREES_LIMIT:
+            if (!is_servo_degrees_in_range(servo, value))
+            {
+                return false;
+            }
+            info.bottom_degrees_limit = (int16_t)value;
+            break;
+        case SERVO_CALIBRATION_TOP_DEGREES_LIMIT:
+            if (!is_servo_degrees_in_range(servo, value))
+            {
+                return false;
+            }
+            info.top_degrees_limit = (int16_t)value;
+            break;
+        case SERVO_CALIBRATION_LEFT_NS:
+            if (!is_servo_pulse_ns_in_range(value))
+            {
+                return false;
+            }
+            info.left_us = (float)value / 1000.0f;
+            break;
+        case SERVO_CALIBRATION_CENTER_NS:
+            if (!is_servo_pulse_ns_in_range(value))
+            {
+                return false;
+            }
+            info.center_us = (float)value / 1000.0f;
+            break;
+        case SERVO_CALIBRATION_RIGHT_NS:
+            if (!is_servo_pulse_ns_in_range(value))
+            {
+                return false;
+            }
+            info.right_us = (float)value / 1000.0f;
+            break;
+        case SERVO_CALIBRATION_PWM_NUMBER:
+            if (!is_servo_pwm_number_free(joint, value))
+            {
+                return false;
+            }
+            info.pwm_number = (uint8_t)value;
+            break;
+        case SERVO_CALIBRATION_INVERTED:
+            info.is_inverted = (value != 0);
+            break;
+        case SERVO_CALIBRATION_LINK_UM:
+            info.link_um = value;
+            break;
+        default:
+            // Current degrees is read only, use the motion commands.
+            return false;
+    }
+
+    if (info.degrees <= 0 ||
+        info.bottom_degrees_limit < 0 ||
+        info.top_degrees_limit > info.degrees ||
+        info.bottom_degrees_limit > info.top_degrees_limit ||
+        info.left_us >= info.right_us ||
+        info.link_um < 0 || info.link_um > SERVO_LINK_MAX_UM)
+    {
+        return false;
+    }
+
+    update_servo_degree_to_us(&info);
+
+    // The control tick moves the current degrees meanwhile, and must not see the record half copied.
+    uint32_t interrupts = save_and_disable_interrupts();
+    uint8_t old_pwm_number = servos_info_array[joint].pwm_number;
+    info.current_degrees = clamp_servo_degrees(&info, servos_info_array[joint].current_degrees);
+    servos_info_array[joint] = info;
+
+    // The old output goes idle and the joint holds where it is on the new one, in the same frame.
+    if (info.pwm_number != old_pwm_number)
+    {
+        begin_pwm_update();
+        set_pwm_pulse_width_us(old_pwm_number, 0);
+        set_joint_position_in_degrees(joint, info.current_degrees);
+        end_pwm_update();
+    }
+    restore_interrupts(interrupts);
+
+    return true;
 }
 
-bool set_servo_motor_direction_speed(uint8_t servo, motor_direction_speed_t speed)
+bool get_servo_speed_profile(uint8_t servo, uint8_t row, servo_speed_settings_t *settings)
 {
-    if (servo >= SERVOS_COUNT)
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint == NO_JOINT || row >= SERVO_SPEED_TABLE_SIZE)
     {
-        printf("Error: Invalid servo index %d. Must be between 0 and %d.\n", servo, SERVOS_COUNT - 1);
         return false;
     }
 
-    servo_motor_speeds_array[servo] = speed;
+    *settings = servos_speed_table[joint][row];
+    return true;
+}
+
+bool set_servo_speed_profile(uint8_t servo, uint8_t row, servo_speed_settings_t settings)
+{
+    uint8_t joint = robot_joint_entry(servo);
+    if (joint == NO_JOINT || row >= SERVO_SPEED_TABLE_SIZE ||
+        settings.min_percentage > settings.max_percentage)
+    {
+        return false;
+    }
 
+    servos_speed_table[joint][row] = settings;
     return true;
 }
+
+bool save_servo_calibration()
+{
+    servo_calibration_t calibration;
+    memcpy(calibration.servos, servos_info_array, sizeof(calibration.servos));
+    memcpy(calibration.speed_table, servos_speed_table, sizeof(calibration.speed_table));
+
+    return calibration_store_save(&calibration, sizeof(calibration));
+}
+
+bool servos_hold_pending()
+{
+    return servos_hold;
+}
+
+void release_servos_hold()
+{
+    servos_hold = false;
+}
+
+bool servos_moving()
+{
+    // With the interrupts off the tick cannot run meanwhile. Joint setpoints published but not
+    // taken over yet are taken here, as the next tick would.
+    uint32_t interrupts = save_and_disable_interrupts();
+    servo_motor_setpoints.take(servo_motor_speeds_array);
+
+    bool moving = arm_cartesian_active() || motion_playback_active();
+    for (uint8_t i = 0; i < JOINTS_COUNT; i++)
+    {
+        moving = moving || (servo_motor_speeds_array[i].speed != 0 && servo_motor_speeds_array[i].timeout > 0);
+    }
+
+    restore_interrupts(interrupts);
+    return moving;
+}
+
+uint32_t servos_overcurrent_count()
+{
+    return servos_overcurrent_trips;
+}
@@ -1,17 +1,12 @@
 // Copyright © Svetoslav Paregov. All rights reserved.
 
+#ifndef SERVO_CONTROL_HPP
+#define SERVO_CONTROL_HPP
+
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "common_types.hpp"
-
-#define SERVOS_COUNT 8
-
-#define BASE_MOTOR_INDEX 0
-#define SHOULDER_MOTOR_INDEX 1
-#define ELBOW_MOTOR_INDEX 2
-#define ARM_MOTOR_INDEX 3
-#define WRIST_MOTOR_INDEX 4
-#define GRIPPER_MOTOR_INDEX 6
+#include "robot_description.hpp"
 
 // TODO: Check if I need to use integer instead of unsigned interger.
 typedef struct
@@ -44,6 +39,9 @@ typedef struct
     // How many us is one degree of movement.
     float degree_to_us;
 
+    // Link of the Cartesian motion the joint carries, in micrometers. See joint_description_t.
+    int32_t link_um;
+
     // PWM channel number for the servo
     uint8_t pwm_number;
 
@@ -51,13 +49,60 @@ typedef struct
     bool is_inverted;
 } servo_info_t;
 
+// Working state of the control tick, saved and put back by the benchmark around each run.
+// One entry per joint on the robot, see JOINTS_COUNT.
+typedef struct
+{
+    motor_direction_speed_t speeds[JOINTS_COUNT];
+    int16_t degrees[JOINTS_COUNT];
+    uint16_t overcurrent_ticks;
+    uint32_t stop_count;
+    bool hold;
+} servo_tick_state_t;
+
 void init_servos();
-void set_servo_position_in_degrees(uint8_t servo, int16_t degrees);
-void set_base_servo_speed(motor_direction_speed_t speed);
-void set_shoulder_servo_speed(motor_direction_speed_t speed);
-void set_elbow_servo_speed(motor_direction_speed_t speed);
-void set_arm_servo_speed(motor_direction_speed_t speed);
-void set_wrist_servo_speed(motor_direction_speed_t speed);
-void set_gripper_servo_speed(motor_direction_speed_t speed);
 
+// The work of one control tick, without the timer bookkeeping. The benchmarks run it with
+// interrupts disabled, so it cannot race the timer.
+void process_servo_tick();
+
+// Call with the interrupts disabled. Getting it takes the pending setpoints over first, as the tick
+// would. Setting it does not move the outputs, the degrees are where the tick goes on from.
+void get_servo_tick_state(servo_tick_state_t *state);
+void set_servo_tick_state(const servo_tick_state_t *state);
+// Servo numbers are the slots of robot_description.hpp. A free slot is left alone.
+void set_servo_position_in_degrees(uint8_t servo, int16_t degrees);
 bool set_servo_motor_direction_speed(uint8_t servo, motor_direction_speed_t speed);
+
+// Sets the servos in the mask together, the control tick takes them over in the same tick.
+void set_servos_motor_direction_speed(const motor_direction_speed_t speeds[SERVOS_COUNT], uint32_t servos_mask);
+
+// On an overcurrent or an emergency stop the control tick holds all servos where they are and
+// stops the jogging joints. The main loop then stops the cartesian motion and the playback
+// and releases the hold.
+bool servos_hold_pending();
+void release_servos_hold();
+
+// True while a joint jogs, the arm follows a cartesian motion or a recording plays, counting the
+// commands the control tick did not take over yet. Main loop only.
+bool servos_moving();
+
+uint32_t servos_overcurrent_count();
+
+// A free slot reads back as all zero.
+const servo_info_t *get_servo_info(uint8_t servo);
+
+// Runtime calibration. Changes take effect immediately and are kept over a reboot
+// only after save_servo_calibration(). Degrees must be within the range of the joint's servo
+// in robot_description.hpp, pulse widths within the servo frame, anything else is refused.
+// Free slots have no calibration, reading or changing it fails.
+// A PWM number must be a servo output no other joint uses, on a change the old output goes idle.
+// Restoring the defaults also moves the remapped joints back to their default outputs.
+bool get_servo_calibration_field(uint8_t servo, servo_calibration_field_t field, int32_t *value);
+bool set_servo_calibration_field(uint8_t servo, servo_calibration_field_t field, int32_t value);
+bool get_servo_speed_profile(uint8_t servo, uint8_t row, servo_speed_settings_t *settings);
+bool set_servo_speed_profile(uint8_t servo, uint8_t row, servo_speed_settings_t settings);
+void restore_default_servo_calibration();
+bool save_servo_calibration();
+
+#endif // SERVO_CONTROL_HPP
@@ -0,0 +1,132 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <string.h> // For memset
+#include "spi_frame_parser.hpp"
+
+#ifndef __not_in_flash_func
+// Host build.
+#define __not_in_flash_func(func_name) func_name
+#endif
+
+// Size of the extension fields after the flags byte.
+static uint32_t __not_in_flash_func(command_extension_size)(uint8_t flags)
+{
+    uint32_t size = 0;
+    if (flags & COMMAND_EXTENSION_SEQUENCE)
+    {
+        size += COMMAND_EXTENSION_SEQUENCE_SIZE;
+    }
+    if (flags & COMMAND_EXTENSION_EXECUTE_AT)
+    {
+        size += COMMAND_EXTENSION_EXECUTE_AT_SIZE;
+    }
+    if (flags & COMMAND_EXTENSION_ADDRESS)
+    {
+        size += COMMAND_EXTENSION_ADDRESS_SIZE;
+    }
+
+    return size;
+}
+
+static uint32_t __not_in_flash_func(read_uint32_be)(const uint8_t *data)
+{
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+static void __not_in_flash_func(decode_frame)(const uint8_t *frame, uint32_t now_us, received_command_t *received)
+{
+    received->received_us = now_us;
+
+    command_8_bytes_t &command = received->command;
+    command.type = (command_type_t)(frame[0] & ~COMMAND_EXTENSION_FLAG); // The first byte is the command type
+    for (int i = 0; i < 7; i++)
+    {
+        command.data[i] = frame[1 + i];
+    }
+
+    received->extension_flags = 0;
+    received->sequence = 0;
+    received->host_timestamp = 0;
+    received->execute_at_us = 0;
+    received->address = BOARD_BROADCAST_ADDRESS;
+    if (frame[0] & COMMAND_EXTENSION_FLAG)
+    {
+        uint32_t field = SPI_FRAME_COMMAND_SIZE + 1;
+        received->extension_flags = frame[SPI_FRAME_COMMAND_SIZE];
+        if (received->extension_flags & COMMAND_EXTENSION_SEQUENCE)
+        {
+            received->sequence = (uint16_t)(frame[field] << 8 | frame[field + 1]);
+            received->host_timestamp = read_uint32_be(&frame[field + 2]);
+            field += COMMAND_EXTENSION_SEQUENCE_SIZE;
+        }
+        if (received->extension_flags & COMMAND_EXTENSION_EXECUTE_AT)
+        {
+            received->execute_at_us = read_uint32_be(&frame[field]);
+            field += COMMAND_EXTENSION_EXECUTE_AT_SIZE;
+        }
+        if (received->extension_flags & COMMAND_EXTENSION_ADDRESS)
+        {
+            received->address = frame[field];
+            field += COMMAND_EXTENSION_ADDRESS_SIZE;
+        }
+    }
+}
+
+void spi_frame_parser_reset(spi_frame_parser_t *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->message_length = SPI_FRAME_COMMAND_SIZE;
+}
+
+bool __not_in_flash_func(spi_frame_parser_feed)(spi_frame_parser_t *parser, uint8_t byte, uint32_t now_us, received_command_t *received)
+{
+    if (parser->received_count > 0 && (now_us - parser->last_byte_us) > SPI_FRAME_GAP_TIMEOUT_US)
+    {
+        // The rest of the frame was lost.
+        parser->dropped_frames++;
+        parser->received_count = 0;
+        parser->message_length = SPI_FRAME_COMMAND_SIZE;
+    }
+    parser->last_byte_us = now_us;
+
+    if (parser->received_count == 0 && (byte & ~COMMAND_EXTENSION_FLAG) >= COMMAND_TYPES_COUNT)
+    {
+        // Not a command type, so not the start of a frame. Dropping it gets back in step sooner.
+        parser->dropped_bytes++;
+        return false;
+    }
+
+    parser->buffer[parser->received_count++] = byte;
+
+    if (parser->received_count == SPI_FRAME_COMMAND_SIZE && (parser->buffer[0] & COMMAND_EXTENSION_FLAG))
+    {
+        // Extended command, the flags byte comes next.
+        parser->message_length = SPI_FRAME_COMMAND_SIZE + 1;
+    }
+    else if (parser->received_count == SPI_FRAME_COMMAND_SIZE + 1 &&
+             parser->message_length == SPI_FRAME_COMMAND_SIZE + 1)
+    {
+        uint8_t flags = parser->buffer[SPI_FRAME_COMMAND_SIZE];
+        if (flags & ~COMMAND_EXTENSION_KNOWN_FLAGS)
+        {
+            // Unknown length, drop it.
+            parser->dropped_frames++;
+            parser->received_count = 0;
+            parser->message_length = SPI_FRAME_COMMAND_SIZE;
+            return false;
+        }
+
+        parser->message_length += command_extension_size(flags);
+    }
+
+    if (parser->received_count < parser->message_length)
+    {
+        return false;
+    }
+
+    decode_frame(parser->buffer, now_us, received);
+    parser->frames++;
+    parser->received_count = 0;
+    parser->message_length = SPI_FRAME_COMMAND_SIZE;
+    return true;
+}
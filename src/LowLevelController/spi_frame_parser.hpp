@@ -0,0 +1,38 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SPI_FRAME_PARSER_HPP
+#define SPI_FRAME_PARSER_HPP
+
+#include <stdint.h>
+#include "common_types.hpp"
+
+// Plain command: type and 7 data bytes. An extended one adds the flags byte and the fields.
+#define SPI_FRAME_COMMAND_SIZE 8
+#define SPI_FRAME_MAX_SIZE (SPI_FRAME_COMMAND_SIZE + 1 + COMMAND_EXTENSION_SEQUENCE_SIZE + COMMAND_EXTENSION_EXECUTE_AT_SIZE + \
+    COMMAND_EXTENSION_ADDRESS_SIZE)
+
+// The main controller sends a frame in one transfer. A longer pause in the middle of a frame
+// means bytes were lost, the partial frame is dropped and the next byte starts a new one.
+#define SPI_FRAME_GAP_TIMEOUT_US 1000
+
+// Parses the command frames from the MOSI byte stream.
+// Pure code without hardware access, so it also runs in the host tests.
+typedef struct
+{
+    uint8_t buffer[SPI_FRAME_MAX_SIZE];
+    uint32_t received_count;
+    uint32_t message_length;
+    uint32_t last_byte_us;
+
+    // Statistics.
+    uint32_t frames;
+    uint32_t dropped_bytes;     // Bytes that could not start a frame.
+    uint32_t dropped_frames;    // Partial frames dropped after a gap and frames with unknown flags.
+} spi_frame_parser_t;
+
+void spi_frame_parser_reset(spi_frame_parser_t *parser);
+
+// Feeds one received byte. Returns true when it completed a frame, which is then in received.
+bool spi_frame_parser_feed(spi_frame_parser_t *parser, uint8_t byte, uint32_t now_us, received_command_t *received);
+
+#endif // SPI_FRAME_PARSER_HPP
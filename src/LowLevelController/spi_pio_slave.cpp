@@ -0,0 +1,205 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/pio.h"
+#include "spi_pio_slave.hpp"
+#include "spi_transport.hpp"
+#include "irq_tiers.hpp"
+#include "spi_pio_slave.pio.h"
+
+#if SPI_TRANSPORT_USE_PIO
+
+// Not pio0: the servo engine there drives every pin given to pio0 from its OUT mask,
+// MISO would follow the servo edges in the middle of a burst.
+#define SPI_PIO_SLAVE_PIO pio1
+
+// Receive ring of 512 bytes in two halves. Each half has its own DMA channel, which wraps
+// within its half and starts the other channel when done, so the ring is written without a gap.
+#define SPI_PIO_RX_HALF_BITS 8
+#define SPI_PIO_RX_HALF_SIZE (1u << SPI_PIO_RX_HALF_BITS)
+#define SPI_PIO_RX_RING_SIZE (2 * SPI_PIO_RX_HALF_SIZE)
+
+uint8_t spi_pio_rx_ring[SPI_PIO_RX_RING_SIZE] __attribute__((aligned(SPI_PIO_RX_RING_SIZE)));
+
+int spi_pio_rx_channels[2] = { -1, -1 };
+int spi_pio_tx_channel = -1;
+
+uint spi_pio_sm;
+uint spi_pio_offset;
+uint spi_pio_pin_cs;
+uint spi_pio_pin_miso;
+
+// Halves filled and bytes taken since init. Only used by the transport interrupts.
+uint32_t spi_pio_rx_halves = 0;
+uint32_t spi_pio_rx_taken = 0;
+
+spi_pio_slave_handler_t spi_pio_handler = NULL;
+
+// Counts the halves the DMA completed since the last call.
+static void __not_in_flash_func(take_filled_halves)()
+{
+    for (int i = 0; i < 2; i++)
+    {
+        if (dma_channel_get_irq1_status(spi_pio_rx_channels[i]))
+        {
+            dma_channel_acknowledge_irq1(spi_pio_rx_channels[i]);
+            spi_pio_rx_halves++;
+        }
+    }
+}
+
+uint32_t __not_in_flash_func(spi_pio_slave_received)(const uint8_t **bytes)
+{
+    take_filled_halves();
+
+    // The first channel fills the even halves. A half done but not counted yet reads as empty,
+    // the completion interrupt that follows takes it.
+    int channel = spi_pio_rx_channels[spi_pio_rx_halves % 2];
+    uint32_t offset = (dma_channel_hw_addr(channel)->write_addr - (uint32_t)(uintptr_t)spi_pio_rx_ring) % SPI_PIO_RX_HALF_SIZE;
+    uint32_t written = spi_pio_rx_halves * SPI_PIO_RX_HALF_SIZE + offset;
+
+    if (written - spi_pio_rx_taken > SPI_PIO_RX_RING_SIZE)
+    {
+        // The ring went round over bytes not taken. Go on from the start of the half being written.
+        irq_tier_miss(IRQ_TIER_TRANSPORT);
+        spi_pio_rx_taken = written - offset;
+    }
+
+    uint32_t index = spi_pio_rx_taken % SPI_PIO_RX_RING_SIZE;
+    uint32_t available = written - spi_pio_rx_taken;
+    if (available > SPI_PIO_RX_RING_SIZE - index)
+    {
+        available = SPI_PIO_RX_RING_SIZE - index;
+    }
+
+    *bytes = &spi_pio_rx_ring[index];
+    return available;
+}
+
+void __not_in_flash_func(spi_pio_slave_consume)(uint32_t count)
+{
+    spi_pio_rx_taken += count;
+}
+
+bool __not_in_flash_func(spi_pio_slave_tx_busy)()
+{
+    return dma_channel_is_busy(spi_pio_tx_channel);
+}
+
+void __not_in_flash_func(spi_pio_slave_transmit)(const uint8_t *bytes, uint32_t length)
+{
+    dma_channel_transfer_from_buffer_now(spi_pio_tx_channel, bytes, length);
+}
+
+void __not_in_flash_func(spi_pio_slave_set_output)(bool enabled)
+{
+    gpio_set_oeover(spi_pio_pin_miso, enabled ? GPIO_OVERRIDE_NORMAL : GPIO_OVERRIDE_LOW);
+}
+
+// The master released chip select half way through a byte. The state machine would take the
+// next burst out of step, so it starts over from the wait for chip select. The bits it had are dropped.
+static void __not_in_flash_func(restart_if_within_byte)()
+{
+    uint idle_pc = spi_pio_offset + spi_slave_wrap_target;
+    if (gpio_get(spi_pio_pin_cs) && pio_sm_get_pc(SPI_PIO_SLAVE_PIO, spi_pio_sm) != idle_pc)
+    {
+        pio_sm_restart(SPI_PIO_SLAVE_PIO, spi_pio_sm);
+        pio_sm_exec(SPI_PIO_SLAVE_PIO, spi_pio_sm, pio_encode_jmp(idle_pc));
+    }
+}
+
+static void __not_in_flash_func(spi_pio_cs_callback)(uint gpio, uint32_t events)
+{
+    (void)gpio;
+    bool asserted = (events & GPIO_IRQ_EDGE_FALL) != 0;
+    bool released = (events & GPIO_IRQ_EDGE_RISE) != 0;
+
+    // Both edges in one entry: the gap between two bursts if selected now, else a whole short burst.
+    bool released_first = released && !gpio_get(spi_pio_pin_cs);
+    if (released_first)
+    {
+        spi_pio_handler(SPI_PIO_SLAVE_RELEASED);
+    }
+
+    if (asserted)
+    {
+        spi_pio_handler(SPI_PIO_SLAVE_SELECTED);
+    }
+
+    if (released && !released_first)
+    {
+        restart_if_within_byte();
+        spi_pio_handler(SPI_PIO_SLAVE_RELEASED);
+    }
+}
+
+static void __not_in_flash_func(spi_pio_dma_irq_handler)()
+{
+    take_filled_halves();
+    spi_pio_handler(SPI_PIO_SLAVE_RECEIVED);
+}
+
+void init_spi_pio_slave(uint pin_mosi, uint pin_miso, spi_pio_slave_handler_t handler)
+{
+    spi_pio_handler = handler;
+    spi_pio_pin_cs = pin_mosi + 1;
+    spi_pio_pin_miso = pin_miso;
+
+    for (uint pin = pin_mosi; pin <= pin_mosi + 2; pin++)
+    {
+        pio_gpio_init(SPI_PIO_SLAVE_PIO, pin);
+    }
+    pio_gpio_init(SPI_PIO_SLAVE_PIO, pin_miso);
+
+    spi_pio_sm = pio_claim_unused_sm(SPI_PIO_SLAVE_PIO, true);
+    spi_pio_offset = pio_add_program(SPI_PIO_SLAVE_PIO, &spi_slave_program);
+    spi_slave_program_init(SPI_PIO_SLAVE_PIO, spi_pio_sm, spi_pio_offset, pin_mosi, pin_miso);
+
+    spi_pio_rx_channels[0] = dma_claim_unused_channel(true);
+    spi_pio_rx_channels[1] = dma_claim_unused_channel(true);
+    for (int i = 0; i < 2; i++)
+    {
+        dma_channel_config config = dma_channel_get_default_config(spi_pio_rx_channels[i]);
+        channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+        channel_config_set_read_increment(&config, false);
+        channel_config_set_write_increment(&config, true);
+        channel_config_set_ring(&config, true, SPI_PIO_RX_HALF_BITS);
+        channel_config_set_dreq(&config, pio_get_dreq(SPI_PIO_SLAVE_PIO, spi_pio_sm, false));
+        channel_config_set_chain_to(&config, spi_pio_rx_channels[1 - i]);
+
+        // The servo DMA has DMA_IRQ_0 at the output tier, the receive ring takes the other one.
+        dma_channel_set_irq1_enabled(spi_pio_rx_channels[i], true);
+
+        // The byte pushed by the program is in the low bits of the FIFO word.
+        dma_channel_configure(
+            spi_pio_rx_channels[i],
+            &config,
+            &spi_pio_rx_ring[i * SPI_PIO_RX_HALF_SIZE],
+            &SPI_PIO_SLAVE_PIO->rxf[spi_pio_sm],
+            SPI_PIO_RX_HALF_SIZE,
+            i == 0);
+    }
+
+    irq_set_exclusive_handler(DMA_IRQ_1, spi_pio_dma_irq_handler);
+    irq_set_priority(DMA_IRQ_1, IRQ_PRIORITY_TRANSPORT);
+    irq_set_enabled(DMA_IRQ_1, true);
+
+    spi_pio_tx_channel = dma_claim_unused_channel(true);
+    dma_channel_config config = dma_channel_get_default_config(spi_pio_tx_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, true);
+    channel_config_set_write_increment(&config, false);
+    channel_config_set_dreq(&config, pio_get_dreq(SPI_PIO_SLAVE_PIO, spi_pio_sm, true));
+    dma_channel_configure(spi_pio_tx_channel, &config, &SPI_PIO_SLAVE_PIO->txf[spi_pio_sm], NULL, 0, false);
+
+    gpio_set_irq_enabled_with_callback(spi_pio_pin_cs, GPIO_IRQ_EDGE_FALL | GPIO_IRQ_EDGE_RISE, true, spi_pio_cs_callback);
+    irq_set_priority(IO_IRQ_BANK0, IRQ_PRIORITY_TRANSPORT);
+
+    pio_sm_set_enabled(SPI_PIO_SLAVE_PIO, spi_pio_sm, true);
+}
+
+#endif // SPI_TRANSPORT_USE_PIO
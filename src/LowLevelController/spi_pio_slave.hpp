@@ -0,0 +1,42 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef SPI_PIO_SLAVE_HPP
+#define SPI_PIO_SLAVE_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+// SPI slave on a PIO state machine, for the transport when built with SPI_TRANSPORT_USE_PIO.
+// Chip select can stay low for a whole burst of any length. The received bytes go by DMA into
+// a ring and the bytes for MISO come by DMA from a buffer, so there is no interrupt per byte.
+// The handler runs at the chip select edges and each time half of the ring is filled.
+
+typedef enum {
+    SPI_PIO_SLAVE_SELECTED = 0,     // Chip select asserted, a burst starts.
+    SPI_PIO_SLAVE_RELEASED = 1,     // Chip select released, the burst is over.
+    SPI_PIO_SLAVE_RECEIVED = 2,     // Half of the ring filled during a burst.
+} spi_pio_slave_event_t;
+
+// Called from the transport interrupts. Takes the received bytes and queues the next ones to send.
+typedef void (*spi_pio_slave_handler_t)(spi_pio_slave_event_t event);
+
+// CS and SCK must be the two pins right after MOSI.
+void init_spi_pio_slave(uint pin_mosi, uint pin_miso, spi_pio_slave_handler_t handler);
+
+// New bytes in the ring, in one contiguous run. Call again after spi_pio_slave_consume() for the
+// rest, when the run reached the end of the ring. Not reentrant, call from the handler or with
+// the interrupts off.
+uint32_t spi_pio_slave_received(const uint8_t **bytes);
+void spi_pio_slave_consume(uint32_t count);
+
+// Whether the last buffer given to spi_pio_slave_transmit() is still being read.
+bool spi_pio_slave_tx_busy();
+
+// Sends the bytes, from the next byte the master clocks. The buffer must stay untouched
+// until spi_pio_slave_tx_busy() returns false. With nothing to send the idle byte 0 goes out.
+void spi_pio_slave_transmit(const uint8_t *bytes, uint32_t length);
+
+// Drives MISO or leaves it to another board sharing the bus.
+void spi_pio_slave_set_output(bool enabled);
+
+#endif // SPI_PIO_SLAVE_HPP
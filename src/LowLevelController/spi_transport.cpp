@@ -8,6 +8,13 @@
 #include "spi_transport.hpp"
 #include "common_types.hpp" // For common types like motor_commant_t
 #include "cyclic_buffer.hpp" // For CyclicBuffer class
+#include "spi_frame_parser.hpp"
+#include "link_training.hpp"
+#include "update_agent.hpp"
+#include "emergency_stop.hpp"
+#include "irq_tiers.hpp"
+#include "register_map.hpp"
+#include "spi_pio_slave.hpp"
 
 // SPI Configuration Defines
 // We will use SPI0 peripheral on the Raspberry Pi Pico W.
@@ -23,48 +30,330 @@
 
 #define LED_PIN PICO_DEFAULT_LED_PIN
 
-#define SPI_SYNC_BYTE 0xAF
-#define SPI_SYNC_BYTES_COUNT 4 // Number of sync bytes to expect at the start of a message
-
 #define COMMANDS_BUFFER_SIZE 64
 
-// Protocol and Buffer Configuration
-#define MAX_BUFFER_SIZE 512
-#define LENGTH_SIZE 4
+// Responses go out on MISO while the main controller clocks in its frames.
+// Each response is framed as sync byte, type, 7 data bytes and XOR of type and data.
+// The main controller can poll for responses with all zero frames, which are ignored as invalid commands.
+#define SPI_RESPONSE_SYNC_BYTE 0xA5
+#define SPI_RESPONSE_FRAME_SIZE 10
+#define SPI_IDLE_BYTE 0x00
+
+// Frames from the MOSI stream. Only used by the ISR.
+spi_frame_parser_t spi_parser;
+
+// The queues are in a scratch bank, so the SPI interrupt does not compete with the DMA traffic
+// in the main SRAM. Not in SCRATCH_Y, that is the core 0 stack.
+CyclicBuffer<received_command_t, COMMANDS_BUFFER_SIZE> __scratch_x("spi_transport") commands_buffer;
+CyclicBuffer<response_8_bytes_t, RESPONSES_BUFFER_SIZE> __scratch_x("spi_transport") responses_buffer;
+
+// Updated by the ISR.
+volatile uint32_t spi_queue_overflows = 0;
+volatile uint32_t spi_queue_high_water = 0;
+volatile uint32_t spi_other_board_frames = 0;
+
+// Updated by the main loop.
+uint32_t spi_response_drops = 0;
 
-uint8_t debug_buffer[1024];
-uint32_t debug_buffer_index = 0;
+// Whether this board drives MISO. Only used by the ISR after init.
+bool spi_answering = !BOARD_SHARED_CHIP_SELECT;
 
-// Double buffers for receiving data
-uint8_t buffer_a[MAX_BUFFER_SIZE];
-uint8_t buffer_b[MAX_BUFFER_SIZE];
-// Buffer to hold the length of the message
-uint8_t length_buffer[LENGTH_SIZE];
+// Answer to the last GET_QUEUE_CREDITS_COMMAND, it goes out ahead of the queued responses.
+// Only used by the transport interrupts, or with them off.
+response_8_bytes_t spi_credits_response;
+bool spi_credits_pending = false;
 
-// Volatile pointers and flags to manage buffers and state between main loop and ISRs (if used)
-// `active_buffer` is where the SPI hardware is currently writing data.
-volatile uint8_t *active_buffer = buffer_a;
-// `processing_buffer` points to the buffer that is full and ready for the main loop to use.
-volatile uint8_t *processing_buffer = NULL;
-volatile uint32_t message_length = 8;
-volatile uint32_t received_count = 0;
-volatile uint32_t length_received_count = 0;
-volatile uint8_t sync_bytes_received = 0;
+static_assert(COMMANDS_BUFFER_SIZE <= 256, "The free entries are sent in one byte");
 
-volatile uint8_t spi_return_byte = 0x00;
+#if SPI_TRANSPORT_USE_PIO
+// Room for a burst of the whole register map, the credits and every queued response after it.
+#define SPI_PIO_TX_BUFFER_SIZE (REGISTER_BURST_HEADER_SIZE + REGISTER_MAP_SIZE + 1 + (1 + RESPONSES_BUFFER_SIZE) * SPI_RESPONSE_FRAME_SIZE)
 
-CyclicBuffer<command_8_bytes_t, COMMANDS_BUFFER_SIZE> commands_buffer;
+// Bytes the DMA is sending. Only used by the transport interrupts, or with them off.
+uint8_t spi_pio_tx_buffer[SPI_PIO_TX_BUFFER_SIZE];
+
+// When the current chip select burst started. The frame parser takes it as the receive time of
+// all bytes of the burst, they came without a gap. Only used by the transport interrupts.
+uint32_t spi_pio_burst_us = 0;
+#else
+// Response being shifted out. Only used by the ISR.
+uint8_t response_frame[SPI_RESPONSE_FRAME_SIZE];
+uint32_t response_frame_index = SPI_RESPONSE_FRAME_SIZE;
 
 void spi_irq_handler();
+#endif // SPI_TRANSPORT_USE_PIO
+
+static void __not_in_flash_func(frame_response)(const response_8_bytes_t &response, uint8_t *frame)
+{
+    uint8_t checksum = (uint8_t)response.type;
+    frame[0] = SPI_RESPONSE_SYNC_BYTE;
+    frame[1] = (uint8_t)response.type;
+    for (int i = 0; i < 7; i++)
+    {
+        frame[2 + i] = response.data[i];
+        checksum ^= response.data[i];
+    }
+    frame[9] = checksum;
+}
+
+#if !SPI_TRANSPORT_USE_PIO
+// Next byte to go out on MISO. Starts the next queued response when the current one is done.
+static uint8_t __not_in_flash_func(spi_next_tx_byte)()
+{
+    // Responses wait for this board to be selected, the bytes would go nowhere.
+    if (!spi_answering && response_frame_index >= SPI_RESPONSE_FRAME_SIZE)
+    {
+        return SPI_IDLE_BYTE;
+    }
+
+    if (response_frame_index >= SPI_RESPONSE_FRAME_SIZE)
+    {
+        // A register read goes out before the queued responses, the host is clocking it out now.
+        uint8_t burst_byte;
+        if (register_map_next_tx_byte(&burst_byte))
+        {
+            return burst_byte;
+        }
+
+        response_8_bytes_t response;
+        if (spi_credits_pending)
+        {
+            response = spi_credits_response;
+            spi_credits_pending = false;
+        }
+        else if (!responses_buffer.pop(response))
+        {
+            return SPI_IDLE_BYTE;
+        }
+
+        frame_response(response, response_frame);
+        response_frame_index = 0;
+    }
+
+    return response_frame[response_frame_index++];
+}
+#else
+// Hands the next responses to the DMA once it sent the last ones. A burst or a response is
+// always queued whole, so the idle bytes of an empty FIFO only ever fall between them.
+static void __not_in_flash_func(spi_pio_fill_tx)()
+{
+    // Responses wait for this board to be selected, the bytes would go nowhere.
+    if (!spi_answering || spi_pio_slave_tx_busy())
+    {
+        return;
+    }
+
+    uint32_t length = 0;
+    uint8_t burst_byte;
+    while (register_map_next_tx_byte(&burst_byte))
+    {
+        spi_pio_tx_buffer[length++] = burst_byte;
+    }
+
+    if (spi_credits_pending)
+    {
+        frame_response(spi_credits_response, &spi_pio_tx_buffer[length]);
+        length += SPI_RESPONSE_FRAME_SIZE;
+        spi_credits_pending = false;
+    }
+
+    response_8_bytes_t response;
+    while (length + SPI_RESPONSE_FRAME_SIZE <= SPI_PIO_TX_BUFFER_SIZE && responses_buffer.pop(response))
+    {
+        frame_response(response, &spi_pio_tx_buffer[length]);
+        length += SPI_RESPONSE_FRAME_SIZE;
+    }
+
+    if (length > 0)
+    {
+        spi_pio_slave_transmit(spi_pio_tx_buffer, length);
+    }
+}
+#endif // SPI_TRANSPORT_USE_PIO
+
+static void __not_in_flash_func(spi_set_answering)(bool answering)
+{
+    spi_answering = answering;
+#if SPI_TRANSPORT_USE_PIO
+    spi_pio_slave_set_output(answering);
+#else
+    if (answering)
+    {
+        hw_clear_bits(&spi_get_hw(SPI_PORT)->cr1, SPI_SSPCR1_SOD_BITS);
+    }
+    else
+    {
+        hw_set_bits(&spi_get_hw(SPI_PORT)->cr1, SPI_SSPCR1_SOD_BITS);
+    }
+#endif
+}
+
+// Drops the frames for other boards. Picks the board that answers, every board takes that frame.
+static bool __not_in_flash_func(board_address_receive)(const received_command_t &received)
+{
+    if (received.address != BOARD_BROADCAST_ADDRESS && received.address != BOARD_ADDRESS)
+    {
+        spi_other_board_frames++;
+        return true;
+    }
+
+    if (received.command.type == BOARD_SELECT_COMMAND)
+    {
+        spi_set_answering(received.command.data[0] == BOARD_ADDRESS);
+        return true;
+    }
+
+    return false;
+}
+
+// Answers a GET_QUEUE_CREDITS_COMMAND with the free entries now, before any frame after it is queued.
+static bool __not_in_flash_func(queue_credits_receive)(const received_command_t &received)
+{
+    if (received.command.type != GET_QUEUE_CREDITS_COMMAND)
+    {
+        return false;
+    }
+
+    uint32_t overflows = spi_queue_overflows;
+    spi_credits_response.type = QUEUE_CREDITS_RESPONSE;
+    spi_credits_response.data[0] = (uint8_t)(commands_buffer.capacity() - commands_buffer.size());
+    spi_credits_response.data[1] = (uint8_t)commands_buffer.capacity();
+    spi_credits_response.data[2] = (uint8_t)(overflows >> 24);
+    spi_credits_response.data[3] = (uint8_t)(overflows >> 16);
+    spi_credits_response.data[4] = (uint8_t)(overflows >> 8);
+    spi_credits_response.data[5] = (uint8_t)overflows;
+    spi_credits_response.data[6] = 0;
+    spi_credits_pending = true;
+    return true;
+}
+
+static void __not_in_flash_func(queue_received_command)(received_command_t &received)
+{
+    // A full queue keeps the queued commands and drops the new one.
+    received.stop_count = (uint8_t)emergency_stop_count();
+    if (!commands_buffer.push(received))
+    {
+        spi_queue_overflows++;
+        return;
+    }
+
+    uint32_t queued = commands_buffer.size();
+    if (queued > spi_queue_high_water)
+    {
+        spi_queue_high_water = queued;
+    }
+}
+
+// One byte of the MOSI stream, received at now_us.
+static void __not_in_flash_func(spi_receive_byte)(uint8_t received_byte, uint32_t now_us)
+{
+    // Register write payloads go past the frame parser.
+    received_command_t received;
+    register_byte_result_t register_byte = register_map_receive_byte(received_byte, now_us, &received);
+    if (register_byte == REGISTER_BYTE_WRITE_DONE)
+    {
+        queue_received_command(received);
+        return;
+    }
+
+    if (register_byte == REGISTER_BYTE_TAKEN)
+    {
+        return;
+    }
+
+    if (spi_frame_parser_feed(&spi_parser, received_byte, now_us, &received))
+    {
+        bool for_this_board = (received.address == BOARD_BROADCAST_ADDRESS || received.address == BOARD_ADDRESS);
+        if (register_map_receive(received, for_this_board))
+        {
+            return;
+        }
+
+        if (board_address_receive(received))
+        {
+            return;
+        }
+
+        if (queue_credits_receive(received))
+        {
+            return;
+        }
+
+        if (emergency_stop_receive(received))
+        {
+            return;
+        }
+
+        if (link_training_receive(received.command))
+        {
+            return;
+        }
+
+        if (update_agent_receive(received.command))
+        {
+            return;
+        }
+
+        // Idle frames the master clocks out to read the responses carry nothing to run.
+        // Queued, they would fill the queue during a long read.
+        if (received.command.type == INVALID_COMMAND)
+        {
+            return;
+        }
+
+        queue_received_command(received);
+    }
+}
+
+#if SPI_TRANSPORT_USE_PIO
+// Takes the bytes of the burst received so far, then queues what goes out next.
+static void __not_in_flash_func(spi_pio_event)(spi_pio_slave_event_t event)
+{
+    uint32_t entered_us = time_us_32();
+    uint32_t received_bytes = 0;
+
+    // Twice when the new bytes wrap round the end of the ring.
+    const uint8_t *bytes;
+    uint32_t count;
+    while ((count = spi_pio_slave_received(&bytes)) > 0)
+    {
+        for (uint32_t i = 0; i < count; i++)
+        {
+            spi_receive_byte(bytes[i], spi_pio_burst_us);
+        }
+
+        spi_pio_slave_consume(count);
+        received_bytes += count;
+    }
+
+    if (event == SPI_PIO_SLAVE_SELECTED)
+    {
+        spi_pio_burst_us = entered_us;
+    }
+
+    spi_pio_fill_tx();
+
+    irq_tier_record(IRQ_TIER_TRANSPORT, received_bytes, entered_us);
+}
+#endif // SPI_TRANSPORT_USE_PIO
 
 void init_spi()
 {
+    spi_frame_parser_reset(&spi_parser);
+
+#if SPI_TRANSPORT_USE_PIO
+    static_assert(PIN_CS == PIN_MOSI + 1 && PIN_SCK == PIN_MOSI + 2, "The PIO slave reads CS and SCK right after MOSI");
+    spi_pio_burst_us = time_us_32();
+    init_spi_pio_slave(PIN_MOSI, PIN_MISO, spi_pio_event);
+    spi_set_answering(spi_answering);
+#else
     // Initialize the SPI peripheral.
     spi_init(SPI_PORT, 500 * 1000);
 
     // Configure the SPI peripheral to operate in slave mode.
     // This is crucial for the Pico to act as a receiver.
     spi_set_slave(SPI_PORT, true);
+    spi_set_answering(spi_answering);
 
     // Set up the GPIO pins for their SPI functions.
     // These functions map the physical pins to the SPI peripheral's signals.
@@ -73,68 +362,106 @@ void init_spi()
     gpio_set_function(PIN_SCK,  GPIO_FUNC_SPI); // SCK as SPI function
     gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI); // MOSI as SPI function
 
+    // The slave must have a byte in the TX FIFO before the master starts clocking.
+    // The ISR keeps it that way by writing one byte for each byte it reads.
+    spi_get_hw(SPI_PORT)->dr = SPI_IDLE_BYTE;
+
     // Enable the SPI interrupt (specifically for receive FIFO not empty)
     // The '1' enables the RX FIFO interrupt. The other '0's disable other sources.
     spi_get_hw(SPI_PORT)->imsc = (1 << SPI_SSPIMSC_RXIM_LSB);
 
     // Set the handler function for the SPI IRQ
     irq_set_exclusive_handler(SPI_IRQ, spi_irq_handler);
+    irq_set_priority(SPI_IRQ, IRQ_PRIORITY_TRANSPORT);
     
     // Enable the IRQ in the Nested Vector Interrupt Controller (NVIC)
     irq_set_enabled(SPI_IRQ, true);
     
     hw_set_bits(&spi_get_hw(SPI_PORT)->imsc, SPI_SSPIMSC_RXIM_BITS);
+#endif // SPI_TRANSPORT_USE_PIO
 }
 
+#if !SPI_TRANSPORT_USE_PIO
 // This function is called automatically whenever the SPI peripheral has data.
-void spi_irq_handler()
+void __not_in_flash_func(spi_irq_handler)()
 {
+    uint32_t entered_us = time_us_32();
+    uint32_t received_bytes = 0;
+
     // As long as data is in the receive FIFO, process it.
     while (spi_is_readable(SPI_PORT))
     {
-        uint8_t received_byte;
-        spi_read_blocking(SPI_PORT, spi_return_byte, &received_byte, 1);
+        uint8_t received_byte = (uint8_t)spi_get_hw(SPI_PORT)->dr;
+        received_bytes++;
+        spi_get_hw(SPI_PORT)->dr = spi_next_tx_byte();
 
-        if (received_count < MAX_BUFFER_SIZE)
-        {
-            active_buffer[received_count++] = received_byte;
-        }
+        spi_receive_byte(received_byte, time_us_32());
+    }
 
-        if (received_count >= message_length)
-        {
-            // Message complete. Make it available for the main loop.
-            processing_buffer = active_buffer;
-            received_count = 0;
-
-            // Switch to the other buffer for the next reception.
-            active_buffer = (active_buffer == buffer_a) ? buffer_b : buffer_a;
-
-            command_8_bytes_t command;
-            command.type = (command_type_t)processing_buffer[0]; // The first byte is the command type
-            command.data[0] = processing_buffer[1];
-            command.data[1] = processing_buffer[2];
-            command.data[2] = processing_buffer[3];
-            command.data[3] = processing_buffer[4];
-            command.data[4] = processing_buffer[5];
-            command.data[5] = processing_buffer[6];
-            command.data[6] = processing_buffer[7];
-
-            commands_buffer.push(command);
-        }
+    irq_tier_record(IRQ_TIER_TRANSPORT, received_bytes, entered_us);
+
+    // A byte arrived with the receive FIFO full, this entry came too late.
+    if (spi_get_hw(SPI_PORT)->ris & SPI_SSPRIS_RORRIS_BITS)
+    {
+        spi_get_hw(SPI_PORT)->icr = SPI_SSPICR_RORIC_BITS;
+        irq_tier_miss(IRQ_TIER_TRANSPORT);
     }
 }
+#endif // !SPI_TRANSPORT_USE_PIO
 
-command_8_bytes_t spi_get_received_command()
+received_command_t spi_get_received_command()
 {
-    command_8_bytes_t command;
-    if (commands_buffer.pop(command))
+    received_command_t received;
+    if (commands_buffer.pop(received))
     {
-        return command;
+        return received;
     }
     else
     {
         // If no command is available, return an invalid command
-        command.type = INVALID_COMMAND;
-        return command;
+        received.command.type = INVALID_COMMAND;
+        received.extension_flags = 0;
+        return received;
+    }
+}
+
+bool spi_send_response(const response_8_bytes_t &response)
+{
+    if (!responses_buffer.push(response))
+    {
+        spi_response_drops++;
+        return false;
+    }
+
+#if SPI_TRANSPORT_USE_PIO
+    // Ready before the next burst starts, the master may be reading the responses already.
+    uint32_t interrupts = save_and_disable_interrupts();
+    spi_pio_fill_tx();
+    restore_interrupts(interrupts);
+#endif
+    return true;
+}
+
+void spi_get_transport_stats(spi_transport_stats_t *stats)
+{
+    stats->frames = spi_parser.frames;
+    stats->queue_overflows = spi_queue_overflows;
+    stats->queued = commands_buffer.size();
+    stats->queue_high_water = spi_queue_high_water;
+    stats->other_board_frames = spi_other_board_frames;
+    stats->response_drops = spi_response_drops;
+}
+
+uint32_t spi_responses_free()
+{
+    return (uint32_t)(responses_buffer.capacity() - responses_buffer.size());
+}
+
+void __not_in_flash_func(spi_receive_bytes)(const uint8_t *bytes, uint32_t length)
+{
+    uint32_t now_us = time_us_32();
+    for (uint32_t i = 0; i < length; i++)
+    {
+        spi_receive_byte(bytes[i], now_us);
     }
 }
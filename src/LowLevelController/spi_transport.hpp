@@ -1,11 +1,76 @@
 // Copyright © Svetoslav Paregov. All rights reserved.
 
+#ifndef SPI_TRANSPORT_HPP
+#define SPI_TRANSPORT_HPP
+
 #include <stdio.h>
 #include "pico/stdlib.h"
 #include "common_types.hpp"
 
+// Address of this board when several share the host, 0 to 254. Set per board at build time.
+// Frames with the address extension for another board are dropped in the SPI interrupt.
+#ifndef BOARD_ADDRESS
+#define BOARD_ADDRESS 0
+#endif
+
+// 1 when the boards share the chip select as well as the bus. MISO then stays off until
+// a BOARD_SELECT_COMMAND picks this board, so only one board answers at a time.
+// With a chip select per board, every board answers when selected by its chip select.
+#ifndef BOARD_SHARED_CHIP_SELECT
+#define BOARD_SHARED_CHIP_SELECT 0
+#endif
+
+// 1 to run the SPI slave on a PIO state machine, see spi_pio_slave.hpp. Chip select can then stay
+// low for a whole burst and the bytes move by DMA. 0 for the SSP hardware slave, which needs
+// chip select released after each byte and takes an interrupt per FIFO batch.
+#ifndef SPI_TRANSPORT_USE_PIO
+#define SPI_TRANSPORT_USE_PIO 0
+#endif
+
+// Responses waiting to go out on MISO. The main loop keeps room in it for the commands it has
+// taken, see process_commands_protocol(). A power of two, one entry stays free.
+#define RESPONSES_BUFFER_SIZE 64
+
+static_assert(BOARD_ADDRESS < BOARD_BROADCAST_ADDRESS, "The broadcast address is not a board address");
+
+// Counters of the receive path.
+typedef struct
+{
+    // Frames parsed from the MOSI stream.
+    uint32_t frames;
+
+    // Frames dropped because the commands queue was full.
+    uint32_t queue_overflows;
+
+    // Commands waiting in the queue now, and the most there ever were.
+    uint32_t queued;
+    uint32_t queue_high_water;
+
+    // Frames for other boards.
+    uint32_t other_board_frames;
+
+    // Responses dropped because the responses queue was full.
+    uint32_t response_drops;
+} spi_transport_stats_t;
+
 void init_spi();
 
 // If command is received, it will return the length of the command.
 uint32_t spi_get_received_message(uint8_t* buffer, uint32_t max_length);
-command_8_bytes_t spi_get_received_command();
+// Returns a command with type INVALID_COMMAND if none was received.
+received_command_t spi_get_received_command();
+
+// Queues a response to be sent on MISO during the next transfers.
+// Returns false and counts the drop if the responses queue is full.
+bool spi_send_response(const response_8_bytes_t &response);
+
+// Responses that fit in the queue now.
+uint32_t spi_responses_free();
+
+void spi_get_transport_stats(spi_transport_stats_t *stats);
+
+// Runs the bytes through the receive path of the SPI interrupt, as if they came on MOSI now.
+// For the benchmarks. Call with interrupts disabled, the interrupt must not feed the parser meanwhile.
+void spi_receive_bytes(const uint8_t *bytes, uint32_t length);
+
+#endif // SPI_TRANSPORT_HPP
@@ -0,0 +1,72 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <string.h> // For memset
+#include "uart_frame_parser.hpp"
+
+// Define the start and end of message markers
+static const uint8_t START_BYTES[UART_FRAME_MARKER_LEN] = {0xAA, 0xBB, 0xCC};
+static const uint8_t END_BYTES[UART_FRAME_MARKER_LEN] = {0xDD, 0xEE, 0xFF};
+
+// Next marker index after ch. A byte that breaks the sequence can still start it again,
+// otherwise AA AA BB CC would miss the start. The markers have no repeated bytes, so this is enough.
+static uint32_t match_marker(const uint8_t *marker, uint32_t match_idx, uint8_t ch)
+{
+    if (ch == marker[match_idx])
+    {
+        return match_idx + 1;
+    }
+
+    return (ch == marker[0]) ? 1 : 0;
+}
+
+void uart_frame_parser_reset(uart_frame_parser_t *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = UART_FRAME_WAITING_FOR_START;
+}
+
+bool uart_frame_parser_feed(uart_frame_parser_t *parser, uint8_t ch, uint32_t *message_length)
+{
+    switch (parser->state)
+    {
+        // Looking for the 3-byte start sequence
+        case UART_FRAME_WAITING_FOR_START:
+            parser->marker_match_idx = match_marker(START_BYTES, parser->marker_match_idx, ch);
+            if (parser->marker_match_idx >= UART_FRAME_MARKER_LEN)
+            {
+                parser->state = UART_FRAME_RECEIVING_DATA;
+                parser->marker_match_idx = 0; // Reset marker index for the end sequence
+                parser->buffer_idx = 0;
+            }
+            break;
+
+        // Capture data until the end sequence
+        case UART_FRAME_RECEIVING_DATA:
+            if (parser->buffer_idx >= UART_FRAME_BUFFER_SIZE)
+            {
+                // Buffer overflow! Discard message and go back to waiting for a new one.
+                // The byte may already be the start of the next one.
+                parser->overflows++;
+                parser->state = UART_FRAME_WAITING_FOR_START;
+                parser->buffer_idx = 0;
+                parser->marker_match_idx = match_marker(START_BYTES, 0, ch);
+                break;
+            }
+
+            parser->buffer[parser->buffer_idx++] = ch;
+            parser->marker_match_idx = match_marker(END_BYTES, parser->marker_match_idx, ch);
+            if (parser->marker_match_idx >= UART_FRAME_MARKER_LEN)
+            {
+                // The message length is the buffer index minus the end bytes
+                *message_length = parser->buffer_idx - UART_FRAME_MARKER_LEN;
+                parser->messages++;
+                parser->state = UART_FRAME_WAITING_FOR_START;
+                parser->marker_match_idx = 0;
+                parser->buffer_idx = 0;
+                return true;
+            }
+            break;
+    }
+
+    return false;
+}
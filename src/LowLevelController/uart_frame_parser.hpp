@@ -0,0 +1,45 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef UART_FRAME_PARSER_HPP
+#define UART_FRAME_PARSER_HPP
+
+#include <stdint.h>
+
+// Messages are framed as AA BB CC, payload, DD EE FF.
+#define UART_FRAME_MARKER_LEN 3
+
+// Maximum size of the payload including the end marker.
+#define UART_FRAME_BUFFER_SIZE 512
+
+// State machine for parsing the UART stream
+typedef enum
+{
+    UART_FRAME_WAITING_FOR_START,
+    UART_FRAME_RECEIVING_DATA
+} uart_frame_state_t;
+
+// Parses the marker framed messages from the UART byte stream.
+// Pure code without hardware access, so it also runs in the host tests.
+typedef struct
+{
+    // Payload followed by the end marker.
+    uint8_t buffer[UART_FRAME_BUFFER_SIZE];
+    uart_frame_state_t state;
+
+    // Index for matching start/end byte sequences
+    uint32_t marker_match_idx;
+    // Index for writing data into the buffer
+    uint32_t buffer_idx;
+
+    // Statistics.
+    uint32_t messages;
+    uint32_t overflows;
+} uart_frame_parser_t;
+
+void uart_frame_parser_reset(uart_frame_parser_t *parser);
+
+// Feeds one received byte. Returns true when it completed a message, then the payload
+// is at the start of the buffer and its length in message_length.
+bool uart_frame_parser_feed(uart_frame_parser_t *parser, uint8_t ch, uint32_t *message_length);
+
+#endif // UART_FRAME_PARSER_HPP
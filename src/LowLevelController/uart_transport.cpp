@@ -5,6 +5,8 @@
 #include "hardware/uart.h"
 #include "hardware/irq.h"
 #include "uart_transport.hpp"
+#include "uart_frame_parser.hpp"
+#include "irq_tiers.hpp"
 
 // Configuration
 #define UART_ID         uart0
@@ -12,111 +14,49 @@
 #define UART_TX_PIN     0
 #define UART_RX_PIN     1
 
-// Define the start and end of message markers
-const uint8_t START_BYTES[] = {0xAA, 0xBB, 0xCC};
-const uint8_t END_BYTES[] = {0xDD, 0xEE, 0xFF};
-
-#define MARKER_LEN sizeof(START_BYTES)
-
-// Define the maximum size for the data payload (between start and end markers)
-#define DATA_BUFFER_SIZE 512
-
-// Buffer to store the incoming data payload
-volatile uint8_t data_buffer[DATA_BUFFER_SIZE];
+// Completed message, copied out of the parser so the next one can be received meanwhile.
+volatile uint8_t data_buffer[UART_FRAME_BUFFER_SIZE];
 // Stores the final length of the received message payload
 volatile uint32_t received_message_len = 0;
 // Flag to indicate that a complete message has been received and is ready for processing
 volatile bool message_ready = false;
 
-// State machine for parsing the UART stream
-typedef enum {
-    STATE_WAITING_FOR_START,
-    STATE_RECEIVING_DATA
-} receive_state_t;
-
-volatile receive_state_t current_state = STATE_WAITING_FOR_START;
-
-// Index for matching start/end byte sequences
-volatile uint32_t marker_match_idx = 0;
-// Index for writing data into the main buffer
-volatile uint32_t buffer_idx = 0;
+// Only used by the ISR.
+uart_frame_parser_t uart_parser;
 
 // --- UART RX Interrupt Service Routine ---
 // This function is called every time the UART receives data.
 void on_uart_rx()
 {
+    uint32_t entered_us = time_us_32();
+    uint32_t received_bytes = 0;
+
     while (uart_is_readable(UART_ID))
     {
         uint8_t ch = uart_getc(UART_ID);
+        received_bytes++;
 
-        switch (current_state)
+        uint32_t message_length;
+        if (uart_frame_parser_feed(&uart_parser, ch, &message_length) && !message_ready)
         {
-            // State 1: Looking for the 3-byte start sequence
-            case STATE_WAITING_FOR_START:
-                if (ch == START_BYTES[marker_match_idx])
-                {
-                    marker_match_idx++;
-                    // If all 3 start bytes have been matched in order
-                    if (marker_match_idx >= MARKER_LEN)
-                    {
-                        current_state = STATE_RECEIVING_DATA; // Change state
-                        marker_match_idx = 0; // Reset marker index for the end sequence
-                        buffer_idx = 0; // Reset data buffer index
-                    }
-                }
-                else
-                {
-                    // If the byte does not match, reset the sequence matching
-                    marker_match_idx = 0;
-                }
-                break;
-
-            // State 2: We have found the start sequence, now capture data until the end sequence
-            case STATE_RECEIVING_DATA:
-                // First, store the character in the buffer
-                if (buffer_idx < DATA_BUFFER_SIZE)
-                {
-                    data_buffer[buffer_idx++] = ch;
-                }
-                else
-                {
-                    // Buffer overflow! Discard message and go back to waiting for a new one.
-                    current_state = STATE_WAITING_FOR_START;
-                    marker_match_idx = 0;
-                    buffer_idx = 0;
-                    break; // Exit the switch
-                }
-                
-                // Now, check if this byte is part of the end sequence
-                if (ch == END_BYTES[marker_match_idx])
-                {
-                    marker_match_idx++;
-                    // If all 3 end bytes have been matched
-                    if (marker_match_idx >= MARKER_LEN)
-                    {
-                        // A complete message is received!
-                        message_ready = true;
-                        // The final message length is the buffer index minus the end bytes
-                        received_message_len = buffer_idx - MARKER_LEN;
-                        // Reset state machine to look for the next message
-                        current_state = STATE_WAITING_FOR_START;
-                        marker_match_idx = 0;
-                        buffer_idx = 0;
-                    }
-                }
-                else
-                {
-                    // If byte doesn't match the end sequence, reset the end-marker matching
-                    marker_match_idx = 0;
-                }
-                break;
+            // A message that comes before the last one was taken is dropped.
+            for (uint32_t i = 0; i < message_length; i++)
+            {
+                data_buffer[i] = uart_parser.buffer[i];
+            }
+            received_message_len = message_length;
+            message_ready = true;
         }
     }
+
+    irq_tier_record(IRQ_TIER_TRANSPORT, received_bytes, entered_us);
 }
 
 
 void init_uart_transport()
 {
+    uart_frame_parser_reset(&uart_parser);
+
     // Initialize the UART with the specified baud rate
     uart_init(UART_ID, BAUD_RATE);
 
@@ -136,6 +76,7 @@ void init_uart_transport()
     // Set up the RX interrupt handler
     int UART_IRQ = (UART_ID == uart0) ? UART0_IRQ : UART1_IRQ;
     irq_set_exclusive_handler(UART_IRQ, on_uart_rx);
+    irq_set_priority(UART_IRQ, IRQ_PRIORITY_TRANSPORT);
     irq_set_enabled(UART_IRQ, true);
     
     // Enable RX interrupts
@@ -0,0 +1,373 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <string.h> // For memcmp, memcpy, memset
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include "hardware/watchdog.h"
+#include "crc32.hpp"
+#include "dc_motors_control.hpp"
+#include "servo_control.hpp"
+#include "update_agent.hpp"
+
+#define UPDATE_FLASH_TIMEOUT_MS 100
+
+static_assert(UPDATE_MAX_IMAGE_SIZE / FLASH_SECTOR_SIZE <= 0xFFFF, "Chunk index must fit 16 bits");
+
+// Filled by the SPI interrupt, taken by the main loop with the next operation.
+uint8_t update_transfer_buffer[UPDATE_TRANSFER_BUFFER_SIZE];
+volatile uint32_t update_transfer_length = 0;
+volatile uint32_t update_transfer_overflows = 0;
+
+// Overflows of the buffer taken by the last operation.
+uint32_t update_last_overflows = 0;
+
+firmware_update_state_t update_state = FIRMWARE_UPDATE_IDLE;
+firmware_update_result_t update_last_result = FIRMWARE_UPDATE_OK;
+uint32_t update_image_size = 0;
+uint8_t update_image_sha256[FIRMWARE_UPDATE_HASH_SIZE];
+uint16_t update_next_chunk = 0;
+
+// Sector and record prepared for programming. Flash is programmed from RAM.
+uint8_t update_sector[FLASH_SECTOR_SIZE];
+uint32_t update_sector_offset = 0;
+update_record_t update_record;
+
+static uint16_t update_chunks()
+{
+    return (uint16_t)((update_image_size + FLASH_SECTOR_SIZE - 1) / FLASH_SECTOR_SIZE);
+}
+
+// Runs with the other core and the interrupts held off by flash_safe_execute().
+static void update_flash_write_sector(void *param)
+{
+    (void)param;
+    flash_range_erase(update_sector_offset, FLASH_SECTOR_SIZE);
+    flash_range_program(update_sector_offset, update_sector, FLASH_SECTOR_SIZE);
+}
+
+// A new record goes to an erased sector. Activating only programs the erased word.
+static void update_flash_write_record(void *param)
+{
+    if (param != NULL)
+    {
+        flash_range_erase(UPDATE_RECORD_OFFSET, FLASH_SECTOR_SIZE);
+    }
+
+    flash_range_program(UPDATE_RECORD_OFFSET, (const uint8_t *)&update_record, sizeof(update_record));
+}
+
+static void update_flash_erase_record(void *param)
+{
+    (void)param;
+    flash_range_erase(UPDATE_RECORD_OFFSET, FLASH_SECTOR_SIZE);
+}
+
+bool __not_in_flash_func(update_agent_receive)(const command_8_bytes_t &command)
+{
+    if (command.type != FIRMWARE_UPDATE_COMMAND || command.data[0] != FIRMWARE_UPDATE_DATA)
+    {
+        return false;
+    }
+
+    uint32_t length = update_transfer_length;
+    if (length + FIRMWARE_UPDATE_DATA_SIZE > UPDATE_TRANSFER_BUFFER_SIZE)
+    {
+        update_transfer_overflows++;
+        return true;
+    }
+
+    for (uint32_t i = 0; i < FIRMWARE_UPDATE_DATA_SIZE; i++)
+    {
+        update_transfer_buffer[length + i] = command.data[1 + i];
+    }
+    update_transfer_length = length + FIRMWARE_UPDATE_DATA_SIZE;
+    return true;
+}
+
+// Unpacks an LZSS payload to exactly output_size bytes.
+static bool lzss_decode(const uint8_t *input, uint32_t input_size, uint8_t *output, uint32_t output_size)
+{
+    uint32_t in = 0;
+    uint32_t out = 0;
+    while (out < output_size)
+    {
+        if (in >= input_size)
+        {
+            return false;
+        }
+
+        uint8_t flags = input[in++];
+        for (int bit = 0; bit < 8 && out < output_size; bit++)
+        {
+            if (flags & (1u << bit))
+            {
+                if (in >= input_size)
+                {
+                    return false;
+                }
+                output[out++] = input[in++];
+                continue;
+            }
+
+            if (in + 2 > input_size)
+            {
+                return false;
+            }
+
+            uint32_t distance = ((uint32_t)input[in] << 4 | input[in + 1] >> 4) + 1;
+            uint32_t length = (input[in + 1] & 0x0F) + 3;
+            in += 2;
+            if (distance > out || length > output_size - out)
+            {
+                return false;
+            }
+
+            // Byte by byte, a reference can overlap what it writes.
+            for (uint32_t i = 0; i < length; i++, out++)
+            {
+                output[out] = output[out - distance];
+            }
+        }
+    }
+
+    return in == input_size;
+}
+
+// A flash erase holds the interrupts off for tens of milliseconds: no control ticks, no stall
+// checks and no emergency stop meanwhile. Nothing may be moving then.
+static bool actuators_stopped()
+{
+    return !dc_motors_moving() && !servos_moving();
+}
+
+static firmware_update_result_t begin_update(uint32_t image_size)
+{
+    if (update_transfer_length < FIRMWARE_UPDATE_HASH_SIZE || image_size == 0 || image_size > UPDATE_MAX_IMAGE_SIZE)
+    {
+        return FIRMWARE_UPDATE_ERROR_SIZE;
+    }
+
+    // The same image again goes on from where it stopped.
+    bool same_image = (image_size == update_image_size) &&
+        memcmp(update_transfer_buffer, update_image_sha256, FIRMWARE_UPDATE_HASH_SIZE) == 0;
+    if (same_image && update_state != FIRMWARE_UPDATE_IDLE)
+    {
+        return FIRMWARE_UPDATE_OK;
+    }
+
+    // Staged and verified before a reboot, nothing left to send. A record of another image
+    // must not be installed over a half written one.
+    const update_record_t *record = update_staged_record();
+    bool staged = update_is_valid_record(record) && record->image_size == image_size &&
+        memcmp(record->sha256, update_transfer_buffer, FIRMWARE_UPDATE_HASH_SIZE) == 0;
+    bool erase_record = !staged && record->magic != 0xFFFFFFFF;
+    if (erase_record && !actuators_stopped())
+    {
+        return FIRMWARE_UPDATE_ERROR_MOVING;
+    }
+
+    update_image_size = image_size;
+    memcpy(update_image_sha256, update_transfer_buffer, FIRMWARE_UPDATE_HASH_SIZE);
+    update_next_chunk = 0;
+    update_state = FIRMWARE_UPDATE_RECEIVING;
+
+    if (staged)
+    {
+        update_next_chunk = update_chunks();
+        update_state = FIRMWARE_UPDATE_VERIFIED;
+        return FIRMWARE_UPDATE_OK;
+    }
+
+    if (erase_record && flash_safe_execute(update_flash_erase_record, NULL, UPDATE_FLASH_TIMEOUT_MS) != PICO_OK)
+    {
+        return FIRMWARE_UPDATE_ERROR_FLASH;
+    }
+
+    return FIRMWARE_UPDATE_OK;
+}
+
+static firmware_update_result_t receive_chunk(uint16_t index, uint32_t crc)
+{
+    if (update_state != FIRMWARE_UPDATE_RECEIVING)
+    {
+        return FIRMWARE_UPDATE_ERROR_STATE;
+    }
+
+    // Written already, the answer got lost on the way.
+    if (index < update_next_chunk)
+    {
+        return FIRMWARE_UPDATE_OK;
+    }
+
+    if (index > update_next_chunk || index >= update_chunks())
+    {
+        return FIRMWARE_UPDATE_ERROR_ORDER;
+    }
+
+    uint32_t length = update_transfer_length;
+    if (length < FIRMWARE_CHUNK_HEADER_SIZE)
+    {
+        return FIRMWARE_UPDATE_ERROR_SIZE;
+    }
+
+    if (crc32_update(0, update_transfer_buffer, length) != crc)
+    {
+        return FIRMWARE_UPDATE_ERROR_CRC;
+    }
+
+    uint8_t encoding = update_transfer_buffer[0];
+    uint32_t payload_size = (uint32_t)update_transfer_buffer[1] << 8 | update_transfer_buffer[2];
+    const uint8_t *payload = &update_transfer_buffer[FIRMWARE_CHUNK_HEADER_SIZE];
+    if (FIRMWARE_CHUNK_HEADER_SIZE + payload_size > length)
+    {
+        return FIRMWARE_UPDATE_ERROR_SIZE;
+    }
+
+    uint32_t chunk_offset = (uint32_t)index * FLASH_SECTOR_SIZE;
+    uint32_t chunk_size = update_image_size - chunk_offset;
+    if (chunk_size > FLASH_SECTOR_SIZE)
+    {
+        chunk_size = FLASH_SECTOR_SIZE;
+    }
+
+    // The rest of the last sector stays erased.
+    memset(update_sector, 0xFF, sizeof(update_sector));
+    if (encoding == FIRMWARE_CHUNK_RAW && payload_size == chunk_size)
+    {
+        memcpy(update_sector, payload, chunk_size);
+    }
+    else if (encoding != FIRMWARE_CHUNK_LZSS || !lzss_decode(payload, payload_size, update_sector, chunk_size))
+    {
+        return FIRMWARE_UPDATE_ERROR_DECODE;
+    }
+
+    // A sector that already holds these bytes, from a transfer that broke off, is not written again.
+    update_sector_offset = UPDATE_SLOT_B_OFFSET + chunk_offset;
+    const uint8_t *staged = (const uint8_t *)(XIP_BASE + update_sector_offset);
+    if (memcmp(staged, update_sector, FLASH_SECTOR_SIZE) != 0)
+    {
+        if (!actuators_stopped())
+        {
+            return FIRMWARE_UPDATE_ERROR_MOVING;
+        }
+
+        if (flash_safe_execute(update_flash_write_sector, NULL, UPDATE_FLASH_TIMEOUT_MS) != PICO_OK ||
+            memcmp(staged, update_sector, FLASH_SECTOR_SIZE) != 0)
+        {
+            return FIRMWARE_UPDATE_ERROR_FLASH;
+        }
+    }
+
+    update_next_chunk++;
+    return FIRMWARE_UPDATE_OK;
+}
+
+static firmware_update_result_t finish_update()
+{
+    if (update_state == FIRMWARE_UPDATE_VERIFIED)
+    {
+        return FIRMWARE_UPDATE_OK;
+    }
+
+    if (update_state != FIRMWARE_UPDATE_RECEIVING || update_next_chunk != update_chunks())
+    {
+        return FIRMWARE_UPDATE_ERROR_STATE;
+    }
+
+    if (!update_staged_image_matches(update_image_sha256, update_image_size))
+    {
+        // Start over, every chunk is checked against flash again.
+        update_next_chunk = 0;
+        return FIRMWARE_UPDATE_ERROR_HASH;
+    }
+
+    if (!actuators_stopped())
+    {
+        return FIRMWARE_UPDATE_ERROR_MOVING;
+    }
+
+    memset(&update_record, 0xFF, sizeof(update_record));
+    update_record.magic = UPDATE_RECORD_MAGIC;
+    update_record.image_size = update_image_size;
+    memcpy(update_record.sha256, update_image_sha256, FIRMWARE_UPDATE_HASH_SIZE);
+    update_record.crc = update_record_crc(&update_record);
+
+    if (flash_safe_execute(update_flash_write_record, &update_record, UPDATE_FLASH_TIMEOUT_MS) != PICO_OK ||
+        !update_is_valid_record(update_staged_record()))
+    {
+        return FIRMWARE_UPDATE_ERROR_FLASH;
+    }
+
+    update_state = FIRMWARE_UPDATE_VERIFIED;
+    return FIRMWARE_UPDATE_OK;
+}
+
+static firmware_update_result_t activate_update()
+{
+    if (update_state != FIRMWARE_UPDATE_VERIFIED)
+    {
+        return FIRMWARE_UPDATE_ERROR_STATE;
+    }
+
+    if (!actuators_stopped())
+    {
+        return FIRMWARE_UPDATE_ERROR_MOVING;
+    }
+
+    // Only the activate word is programmed, the rest of the page stays as it is.
+    memset(&update_record, 0xFF, sizeof(update_record));
+    update_record.activate = UPDATE_RECORD_ACTIVATE;
+    if (flash_safe_execute(update_flash_write_record, NULL, UPDATE_FLASH_TIMEOUT_MS) != PICO_OK ||
+        update_staged_record()->activate != UPDATE_RECORD_ACTIVATE)
+    {
+        return FIRMWARE_UPDATE_ERROR_FLASH;
+    }
+
+    // The bootloader starts the installer, which installs the image before slot A starts.
+    update_state = FIRMWARE_UPDATE_ACTIVATING;
+    watchdog_reboot(0, 0, UPDATE_REBOOT_DELAY_MS);
+    return FIRMWARE_UPDATE_OK;
+}
+
+static uint32_t read_uint32_be(const uint8_t *data)
+{
+    return (uint32_t)data[0] << 24 | (uint32_t)data[1] << 16 | (uint32_t)data[2] << 8 | data[3];
+}
+
+void update_agent_command(const command_8_bytes_t &command)
+{
+    switch (command.data[0])
+    {
+    case FIRMWARE_UPDATE_BEGIN:
+        update_last_result = begin_update(read_uint32_be(&command.data[1]));
+        break;
+    case FIRMWARE_UPDATE_CHUNK:
+        update_last_result = receive_chunk((uint16_t)(command.data[1] << 8 | command.data[2]), read_uint32_be(&command.data[3]));
+        break;
+    case FIRMWARE_UPDATE_FINISH:
+        update_last_result = finish_update();
+        break;
+    case FIRMWARE_UPDATE_ACTIVATE:
+        update_last_result = activate_update();
+        break;
+    default:
+        // Report only.
+        return;
+    }
+
+    // The data frames of the next chunk start a new buffer.
+    update_last_overflows = update_transfer_overflows;
+    update_transfer_length = 0;
+    update_transfer_overflows = 0;
+}
+
+void update_agent_get_status(update_agent_status_t *status)
+{
+    status->state = update_state;
+    status->last_result = update_last_result;
+    status->next_chunk = update_next_chunk;
+    status->chunks = update_chunks();
+    status->overflows = update_last_overflows;
+}
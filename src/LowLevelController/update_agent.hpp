@@ -0,0 +1,57 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef UPDATE_AGENT_HPP
+#define UPDATE_AGENT_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "common_types.hpp"
+#include "update_record.hpp"
+
+// Receives a new firmware image over the SPI link while the controller keeps running.
+//
+// The image is staged in slot B, see update_record.hpp for the flash layout. Activating marks the
+// record and reboots, the installer then copies slot B over slot A before slot A starts.
+//
+// Chunks are unpacked and written to slot B in order. A chunk already written is taken again
+// without writing, and a sector that already holds the right bytes is not written, so a transfer
+// that broke off goes on from where it stopped. Where it stopped is kept in RAM only: after a
+// reboot BEGIN starts at chunk 0 again, the chunks already staged are then compared, not written.
+//
+// Every flash write holds the interrupts off. Chunk writes, the record and the activation are
+// refused with FIRMWARE_UPDATE_ERROR_MOVING while a DC motor runs or a joint moves.
+//
+// LZSS payload: a flags byte for each group of 8 items, bit 0 first. A set bit is a literal byte,
+// a clear one a reference of 2 bytes: distance back - 1 in the high 12 bits, length - 3 in the low 4.
+// References only reach back within the chunk.
+
+// A raw chunk with its header, in whole data frames.
+#define UPDATE_TRANSFER_BUFFER_SIZE \
+    (((FIRMWARE_CHUNK_HEADER_SIZE + FLASH_SECTOR_SIZE + FIRMWARE_UPDATE_DATA_SIZE - 1) / FIRMWARE_UPDATE_DATA_SIZE) * FIRMWARE_UPDATE_DATA_SIZE)
+
+// Time for the update response to go out before the reboot.
+#define UPDATE_REBOOT_DELAY_MS 100
+
+typedef struct
+{
+    firmware_update_state_t state;
+    firmware_update_result_t last_result;
+    uint16_t next_chunk;
+    uint16_t chunks;
+
+    // Data frames that did not fit the transfer buffer of the last operation.
+    uint32_t overflows;
+} update_agent_status_t;
+
+// Data frames go straight into the transfer buffer from the SPI interrupt, so the bytes
+// of a chunk do not wait in the commands queue. Returns true if the command was taken.
+bool update_agent_receive(const command_8_bytes_t &command);
+
+// Runs the other operations from the main loop. A chunk write holds the interrupts off
+// for a sector erase and program, so it is refused unless the actuators are stopped.
+void update_agent_command(const command_8_bytes_t &command);
+
+void update_agent_get_status(update_agent_status_t *status);
+
+#endif // UPDATE_AGENT_HPP
@@ -0,0 +1,68 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+// Installs an activated firmware image and starts slot A. A program of its own, linked between
+// the bootloader and slot A by memmap_installer_rp2350.ld, started by the bootloader in place of
+// slot A. The update agent never writes it, so it runs from flash while slot A is rewritten.
+//
+// The image is copied from slot B over slot A a sector at a time, each marked done in the record
+// sector once written. After a power loss the copy goes on from the first sector not done. Until
+// the record is erased at the end, every boot comes back here instead of starting slot A.
+
+#include <stdio.h>
+#include <string.h> // For memcpy
+#include "pico/stdlib.h"
+#include "pico/bootrom.h"
+#include "hardware/flash.h"
+#include "update_record.hpp"
+
+// The bootrom needs this much RAM to look for the image in slot A and start it.
+#define UPDATE_CHAIN_WORKAREA_SIZE (4 * 1024)
+
+// Sector and progress page prepared for programming. Flash is programmed from RAM.
+static uint8_t install_sector[FLASH_SECTOR_SIZE];
+static uint8_t install_progress_page[FLASH_PAGE_SIZE];
+
+static uint8_t chain_workarea[UPDATE_CHAIN_WORKAREA_SIZE];
+
+static void install_image(uint32_t size)
+{
+    uint32_t install_size = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    const uint8_t *progress = (const uint8_t *)(XIP_BASE + UPDATE_PROGRESS_OFFSET);
+
+    for (uint32_t offset = 0; offset < install_size; offset += FLASH_SECTOR_SIZE)
+    {
+        uint32_t index = offset / FLASH_SECTOR_SIZE;
+        if (progress[index] == UPDATE_PROGRESS_DONE)
+        {
+            continue;
+        }
+
+        memcpy(install_sector, (const uint8_t *)(XIP_BASE + UPDATE_SLOT_B_OFFSET + offset), FLASH_SECTOR_SIZE);
+        flash_range_erase(UPDATE_SLOT_A_OFFSET + offset, FLASH_SECTOR_SIZE);
+        flash_range_program(UPDATE_SLOT_A_OFFSET + offset, install_sector, FLASH_SECTOR_SIZE);
+
+        // Only the byte of this sector is programmed, the erased ones around it stay as they are.
+        memset(install_progress_page, 0xFF, sizeof(install_progress_page));
+        install_progress_page[index % FLASH_PAGE_SIZE] = UPDATE_PROGRESS_DONE;
+        flash_range_program(UPDATE_PROGRESS_OFFSET + index / FLASH_PAGE_SIZE * FLASH_PAGE_SIZE, install_progress_page, FLASH_PAGE_SIZE);
+    }
+}
+
+int main()
+{
+    const update_record_t *record = update_staged_record();
+    if (update_is_valid_record(record) && record->activate == UPDATE_RECORD_ACTIVATE)
+    {
+        // Checked again, slot B may have changed since it was verified. Better the running image
+        // than a damaged one.
+        if (update_staged_image_matches(record->sha256, record->image_size))
+        {
+            install_image(record->image_size);
+        }
+
+        flash_range_erase(UPDATE_RECORD_OFFSET, FLASH_SECTOR_SIZE);
+    }
+
+    // Does not come back if slot A holds an image. The bootloader's UART update is the way back otherwise.
+    return rom_chain_image(chain_workarea, sizeof(chain_workarea), XIP_BASE + UPDATE_SLOT_A_OFFSET, UPDATE_SLOT_SIZE);
+}
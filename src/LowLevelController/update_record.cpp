@@ -0,0 +1,41 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#include <stdio.h>
+#include <string.h> // For memcmp
+#include "pico/stdlib.h"
+#include "pico/sha256.h"
+#include "crc32.hpp"
+#include "update_record.hpp"
+
+const update_record_t *update_staged_record()
+{
+    return (const update_record_t *)(XIP_BASE + UPDATE_RECORD_OFFSET);
+}
+
+uint32_t update_record_crc(const update_record_t *record)
+{
+    uint32_t crc = crc32_update(0, (const uint8_t *)&record->image_size, sizeof(record->image_size));
+    return crc32_update(crc, record->sha256, sizeof(record->sha256));
+}
+
+bool update_is_valid_record(const update_record_t *record)
+{
+    return record->magic == UPDATE_RECORD_MAGIC &&
+           record->image_size <= UPDATE_MAX_IMAGE_SIZE &&
+           record->crc == update_record_crc(record);
+}
+
+bool update_staged_image_matches(const uint8_t *sha256, uint32_t size)
+{
+    pico_sha256_state_t state;
+    if (pico_sha256_start_blocking(&state, SHA256_BIG_ENDIAN, false) != PICO_OK)
+    {
+        return false;
+    }
+
+    pico_sha256_update_blocking(&state, (const uint8_t *)(XIP_BASE + UPDATE_SLOT_B_OFFSET), size);
+
+    sha256_result_t result;
+    pico_sha256_finish(&state, &result);
+    return memcmp(result.bytes, sha256, FIRMWARE_UPDATE_HASH_SIZE) == 0;
+}
@@ -0,0 +1,75 @@
+// Copyright © Svetoslav Paregov. All rights reserved.
+
+#ifndef UPDATE_RECORD_HPP
+#define UPDATE_RECORD_HPP
+
+#include <stdio.h>
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+#include "calibration_store.hpp"
+#include "common_types.hpp"
+
+// Flash layout of the firmware update, shared by the update agent in the firmware and the installer.
+//
+// The flash holds the picoboot3 bootloader, the installer, slot A with the running image, slot B
+// where the new image is staged, and the calibration store. The bootloader starts the installer,
+// which installs an activated image from slot B over slot A and then starts slot A. Neither the
+// bootloader nor the installer is written by the update, so the code doing the copy never changes
+// under it. The bootloader's UART update writes both, see combine_images.py.
+
+// The first 32k hold the bootloader. Keep FLASH in memmap_installer_rp2350.ld at UPDATE_INSTALLER_SIZE
+// and in memmap_default_rp2350.ld at UPDATE_SLOT_SIZE.
+#define UPDATE_BOOTLOADER_SIZE (32 * 1024)
+#define UPDATE_INSTALLER_SIZE (16 * 1024)
+
+#define UPDATE_INSTALLER_OFFSET UPDATE_BOOTLOADER_SIZE
+#define UPDATE_SLOT_SIZE (((PICO_FLASH_SIZE_BYTES - UPDATE_BOOTLOADER_SIZE - UPDATE_INSTALLER_SIZE - CALIBRATION_STORE_SECTORS * FLASH_SECTOR_SIZE) / 2) & ~(FLASH_SECTOR_SIZE - 1))
+#define UPDATE_SLOT_A_OFFSET (UPDATE_INSTALLER_OFFSET + UPDATE_INSTALLER_SIZE)
+#define UPDATE_SLOT_B_OFFSET (UPDATE_SLOT_A_OFFSET + UPDATE_SLOT_SIZE)
+
+// The last sector of slot B holds the record of the staged image.
+#define UPDATE_MAX_IMAGE_SIZE (UPDATE_SLOT_SIZE - FLASH_SECTOR_SIZE)
+#define UPDATE_RECORD_OFFSET (UPDATE_SLOT_B_OFFSET + UPDATE_MAX_IMAGE_SIZE)
+
+// 'UPD1'. Change it when the record layout changes.
+#define UPDATE_RECORD_MAGIC 0x31445055
+
+// 'SWAP', programmed over the erased word when the staged image is activated.
+#define UPDATE_RECORD_ACTIVATE 0x50415753
+
+// The rest of the record sector holds the install progress, a byte for each sector of slot A,
+// programmed to 0 once that sector holds the new image. Erased with the record.
+#define UPDATE_PROGRESS_OFFSET (UPDATE_RECORD_OFFSET + FLASH_PAGE_SIZE)
+#define UPDATE_PROGRESS_SIZE (FLASH_SECTOR_SIZE - FLASH_PAGE_SIZE)
+#define UPDATE_PROGRESS_DONE 0x00
+
+// Layout of the record page at the start of the last sector of slot B.
+typedef struct
+{
+    uint32_t magic;
+    uint32_t image_size;
+    uint8_t sha256[FIRMWARE_UPDATE_HASH_SIZE];
+
+    // CRC32 over the image size and the hash.
+    uint32_t crc;
+
+    // Erased until the image is activated.
+    uint32_t activate;
+
+    uint8_t reserved[FLASH_PAGE_SIZE - 48];
+} update_record_t;
+
+static_assert(sizeof(update_record_t) == FLASH_PAGE_SIZE, "Record must fill exactly one page");
+static_assert(UPDATE_MAX_IMAGE_SIZE / FLASH_SECTOR_SIZE <= UPDATE_PROGRESS_SIZE, "A progress byte for each sector");
+
+// The record in flash, read through XIP.
+const update_record_t *update_staged_record();
+
+uint32_t update_record_crc(const update_record_t *record);
+
+bool update_is_valid_record(const update_record_t *record);
+
+// Whether the first size bytes of slot B hash to sha256.
+bool update_staged_image_matches(const uint8_t *sha256, uint32_t size);
+
+#endif // UPDATE_RECORD_HPP
@@ -6,6 +6,7 @@ using Microsoft.AspNetCore.Mvc;
 using Microsoft.Extensions.Logging;
 using Paregov.RobotCar.Rest.Service.BusinessLogic.Interfaces;
 using Paregov.RobotCar.Rest.Service.Hardware;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
 using Paregov.RobotCar.Rest.Service.Models;
 using Paregov.RobotCar.Rest.Service.Models.LowLevel;
 
@@ -96,4 +97,53 @@ public class RemoteControlController : ControllerBase
 
         return Ok(new CommandResponse());
     }
+
+    [ApiVersion("1.0")]
+    [HttpPost("api/v{version:apiVersion}/remotecontrol/stop")]
+    public ActionResult<CommandResponse> EmergencyStop()
+    {
+        if (!_hardwareControl.EmergencyStop())
+        {
+            return StatusCode(500, new CommandResponse { IsSuccess = false });
+        }
+
+        return Ok(new CommandResponse());
+    }
+
+    [ApiVersion("1.0")]
+    [HttpPost("api/v{version:apiVersion}/remotecontrol/hold")]
+    public ActionResult<CommandResponse> HoldMotion()
+    {
+        if (!_hardwareControl.HoldMotion())
+        {
+            return StatusCode(500, new CommandResponse { IsSuccess = false });
+        }
+
+        return Ok(new CommandResponse());
+    }
+
+    [ApiVersion("1.0")]
+    [HttpPost("api/v{version:apiVersion}/remotecontrol/start")]
+    public ActionResult<CommandResponse> StartMotion()
+    {
+        if (!_hardwareControl.StartMotion())
+        {
+            return StatusCode(500, new CommandResponse { IsSuccess = false });
+        }
+
+        return Ok(new CommandResponse());
+    }
+
+    [ApiVersion("1.0")]
+    [HttpGet("api/v{version:apiVersion}/remotecontrol/link")]
+    public ActionResult<LinkTrainingResult> GetLinkTraining()
+    {
+        var result = _hardwareControl.GetLinkTrainingResult();
+        if (result == null)
+        {
+            return NotFound();
+        }
+
+        return Ok(result);
+    }
 }
@@ -0,0 +1,113 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Linq;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware
+{
+    /// <summary>
+    /// Latency percentiles of the sequence-numbered commands, in microseconds.
+    /// </summary>
+    public record CommandLatencyStatistics(
+        int Samples,
+        int Lost,
+        double RoundTripP50Us,
+        double RoundTripP99Us,
+        double QueueP50Us,
+        double QueueP99Us);
+
+    /// <summary>
+    /// Matches the echoes of the low level controller with the sent commands.
+    /// The round trip is from sending a command until its echo is read back, on the host clock.
+    /// The queue time is from receiving a command until applying it, on the firmware clock.
+    /// </summary>
+    public class CommandLatencyTracker
+    {
+        private const int MaxSamples = 1024;
+
+        private readonly Queue<double> _roundTripUs = new();
+        private readonly Queue<double> _queueUs = new();
+        private readonly object _lock = new();
+        private UInt16 _expectedSequence;
+        private bool _hasExpectedSequence;
+        private int _lost;
+
+        /// <summary>
+        /// Records the echo of a command.
+        /// </summary>
+        /// <param name="sequence">Echoed sequence number</param>
+        /// <param name="hostTimestampUs">Echoed host timestamp</param>
+        /// <param name="nowUs">Host time in microseconds when the echo was read</param>
+        public void OnEcho(UInt16 sequence, UInt32 hostTimestampUs, UInt32 nowUs)
+        {
+            lock (_lock)
+            {
+                // Signed, so the sequence wraps around and an echo behind the expected one is not a gap.
+                Int16 delta = _hasExpectedSequence ? (Int16)(sequence - _expectedSequence) : (Int16)0;
+                if (delta < 0)
+                {
+                    // Reordered, it was counted as lost when the later ones came.
+                    _lost = Math.Max(0, _lost - 1);
+                }
+                else
+                {
+                    // Dropped commands.
+                    _lost += delta;
+                    _expectedSequence = (UInt16)(sequence + 1);
+                    _hasExpectedSequence = true;
+                }
+
+                Add(_roundTripUs, (UInt32)(nowUs - hostTimestampUs));
+            }
+        }
+
+        /// <summary>
+        /// Records when a command was applied by the low level controller.
+        /// </summary>
+        /// <param name="queued100Us">Time in the receive queue in 100us units</param>
+        public void OnApplied(byte queued100Us)
+        {
+            lock (_lock)
+            {
+                Add(_queueUs, queued100Us * 100.0);
+            }
+        }
+
+        public CommandLatencyStatistics GetStatistics()
+        {
+            lock (_lock)
+            {
+                return new CommandLatencyStatistics(
+                    _roundTripUs.Count,
+                    _lost,
+                    Percentile(_roundTripUs, 0.50),
+                    Percentile(_roundTripUs, 0.99),
+                    Percentile(_queueUs, 0.50),
+                    Percentile(_queueUs, 0.99));
+            }
+        }
+
+        private static void Add(Queue<double> samples, double value)
+        {
+            if (samples.Count >= MaxSamples)
+            {
+                samples.Dequeue();
+            }
+
+            samples.Enqueue(value);
+        }
+
+        private static double Percentile(IEnumerable<double> samples, double percentile)
+        {
+            var sorted = samples.OrderBy(s => s).ToArray();
+            if (sorted.Length == 0)
+            {
+                return 0;
+            }
+
+            int index = (int)Math.Ceiling(percentile * sorted.Length) - 1;
+            return sorted[Math.Clamp(index, 0, sorted.Length - 1)];
+        }
+    }
+}
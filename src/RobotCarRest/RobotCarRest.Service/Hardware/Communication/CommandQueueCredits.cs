@@ -0,0 +1,141 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Diagnostics;
+using System.Threading;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Flow control of the low level controller's commands queue.
+    /// The controller answers a credits request from its SPI interrupt with the free queue entries
+    /// at the time the request arrived. Each frame sent after it may take one of them, so the host
+    /// spends a credit per frame and asks again once they run out. A full queue then holds the host back
+    /// instead of dropping commands.
+    /// </summary>
+    public class CommandQueueCredits
+    {
+        public const int FrameSize = 8;
+
+        // Answered at once, behind at most a response or a register burst already going out.
+        private const int ResponsePollAttempts = 20;
+
+        private readonly ResponsePoller _poller;
+        private readonly int _retryDelayMs;
+
+        /// <param name="transfer">Full duplex transfer to the controller, MOSI bytes and MISO buffer</param>
+        /// <param name="retryDelayMs">Wait before asking again when the queue is full, the main loop takes one command per 10 ms</param>
+        public CommandQueueCredits(Func<byte[], byte[], bool> transfer, int retryDelayMs = 10)
+        {
+            _poller = new ResponsePoller(transfer, 0);
+            _retryDelayMs = retryDelayMs;
+        }
+
+        /// <summary>
+        /// Gets the frames that can be sent now without overrunning the queue.
+        /// </summary>
+        public int Available { get; private set; }
+
+        /// <summary>
+        /// Gets the size of the controller's commands queue, 0 until the first answer.
+        /// </summary>
+        public int Capacity { get; private set; }
+
+        /// <summary>
+        /// Gets the commands the controller dropped on a full queue since it started.
+        /// </summary>
+        public UInt32 QueueOverflows { get; private set; }
+
+        /// <summary>
+        /// Credits a message takes. Each started frame counts, which is never less than the queue
+        /// entries it takes: an extension or a register write payload takes none.
+        /// Idle frames, all zero, are not queued and take none.
+        /// </summary>
+        public static int Cost(byte[] message)
+        {
+            return Array.TrueForAll(message, b => b == 0) ? 0 : (message.Length + FrameSize - 1) / FrameSize;
+        }
+
+        /// <summary>
+        /// Waits until the credits cover the message and spends them. A message larger than the queue
+        /// waits for the whole queue.
+        /// </summary>
+        /// <param name="message">Message about to be sent</param>
+        /// <param name="timeoutMs">How long the queue may stay full</param>
+        /// <returns>False if the controller did not answer, or the queue did not drain in time</returns>
+        public bool Acquire(byte[] message, int timeoutMs)
+        {
+            int cost = Cost(message);
+            if (cost == 0)
+            {
+                return true;
+            }
+
+            var waited = Stopwatch.StartNew();
+
+            // Asked only once the credits ran out, so a queue with room costs no extra transfer.
+            while (!Covers(cost))
+            {
+                if (!Refresh())
+                {
+                    return false;
+                }
+
+                if (Covers(cost))
+                {
+                    break;
+                }
+
+                if (waited.ElapsedMilliseconds >= timeoutMs)
+                {
+                    return false;
+                }
+
+                if (_retryDelayMs > 0)
+                {
+                    Thread.Sleep(_retryDelayMs);
+                }
+            }
+
+            Available = Math.Max(Available - cost, 0);
+            return true;
+        }
+
+        // Known credits for the cost, or for the whole queue when the message is larger.
+        private bool Covers(int cost)
+        {
+            return Capacity > 0 && Available >= Math.Min(cost, Capacity);
+        }
+
+        /// <summary>
+        /// Asks the controller for the free queue entries. Nothing is sent after the request but idle frames,
+        /// which the controller does not queue, so all of them are available.
+        /// </summary>
+        /// <returns>True if the controller answered</returns>
+        public bool Refresh()
+        {
+            var request = new CommandData8Bytes
+            {
+                CommandType = (byte)CommandType.GetQueueCreditsCommand,
+                Data = new byte[7],
+            };
+
+            var response = _poller.Request(
+                request.ToByteArray(),
+                new ResponseStreamDecoder(),
+                response => response.ResponseType == ResponseType.QueueCreditsResponse,
+                ResponsePollAttempts);
+            if (response == null)
+            {
+                return false;
+            }
+
+            Available = response.Value.Data[0];
+            Capacity = response.Value.Data[1];
+            QueueOverflows = response.Value.ReadUInt32(2);
+            return true;
+        }
+    }
+}
@@ -95,6 +95,11 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication.Config
         /// </summary>
         public bool EnableDebugLogging { get; set; } = false;
 
+        /// <summary>
+        /// Gets or sets whether the commands wait for free entries in the controller's commands queue.
+        /// </summary>
+        public bool UseQueueCredits { get; set; } = false;
+
         /// <summary>
         /// Validates the SPI configuration parameters.
         /// </summary>
@@ -115,6 +115,65 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication.Config
         /// </summary>
         public bool EnableDebugLogging { get; set; } = false;
 
+        /// <summary>
+        /// Gets or sets whether commands are sent with a sequence number and host timestamp.
+        /// The low level controller echoes them back, which is used to measure the command latency.
+        /// </summary>
+        public bool UseSequenceNumbers { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets whether the clock frequency is negotiated with the low level controller at startup.
+        /// The highest of the training rates that passes becomes the clock, ClockFrequency is kept if none does.
+        /// </summary>
+        public bool LinkTrainingEnabled { get; set; } = false;
+
+        /// <summary>
+        /// Gets or sets the clock frequencies tried by the link training, in Hz, lowest first.
+        /// The controller samples the bus with a twelfth of its peripheral clock, so 12.5 MHz is the upper limit.
+        /// </summary>
+        public int[] LinkTrainingRatesHz { get; set; } = { 1_000_000, 2_000_000, 4_000_000, 8_000_000, 12_000_000 };
+
+        /// <summary>
+        /// Gets or sets the number of pattern frames sent at each training rate.
+        /// </summary>
+        [Range(1, 0xFFFF, ErrorMessage = "LinkTrainingPatternFrames must be between 1 and 65535")]
+        public int LinkTrainingPatternFrames { get; set; } = 32;
+
+        /// <summary>
+        /// Gets or sets how far ahead, in milliseconds, the commands for all motors are scheduled on the controller's clock.
+        /// The controller applies them in the same pass, so the arm and the wheels start within one tick period.
+        /// 0 sends them to be applied on arrival.
+        /// </summary>
+        [Range(0, 60_000, ErrorMessage = "ScheduleAheadMs must be between 0 and 60000")]
+        public int ScheduleAheadMs { get; set; } = 0;
+
+        /// <summary>
+        /// Gets or sets the number of exchanges in a clock sync. The most precise one is kept.
+        /// </summary>
+        [Range(1, 256, ErrorMessage = "ClockSyncExchanges must be between 1 and 256")]
+        public int ClockSyncExchanges { get; set; } = 8;
+
+        /// <summary>
+        /// Gets or sets how often the clock is synchronised again, in milliseconds, to follow the drift between the clocks.
+        /// </summary>
+        [Range(1, int.MaxValue, ErrorMessage = "ClockSyncIntervalMs must be greater than 0")]
+        public int ClockSyncIntervalMs { get; set; } = 10_000;
+
+        /// <summary>
+        /// Gets or sets the address of the controller board the commands are for, when several share the bus.
+        /// -1 sends frames without an address, which every board takes.
+        /// </summary>
+        [Range(-1, 254, ErrorMessage = "BoardAddress must be between -1 and 254")]
+        public int BoardAddress { get; set; } = -1;
+
+        /// <summary>
+        /// Gets or sets whether the commands are paced by the free entries of the controller's commands queue.
+        /// The controller reports them on request, and the commands wait for room instead of being dropped.
+        /// The fixed OperationDelayMs after each command is then left out. Responses clocked out while
+        /// asking for the free entries are not passed on.
+        /// </summary>
+        public bool UseQueueCredits { get; set; } = false;
+
         /// <summary>
         /// Converts the options to a SpiConfig instance.
         /// </summary>
@@ -139,7 +198,8 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication.Config
                 AutoRetry = AutoRetry,
                 MaxRetryAttempts = MaxRetryAttempts,
                 RetryDelayMs = RetryDelayMs,
-                EnableDebugLogging = EnableDebugLogging
+                EnableDebugLogging = EnableDebugLogging,
+                UseQueueCredits = UseQueueCredits
             };
         }
     }
@@ -0,0 +1,117 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using Microsoft.Extensions.Logging;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Offset of the low level controller's microsecond timer from the host clock.
+    /// The firmware time is known to within plus or minus UncertaintyUs.
+    /// </summary>
+    public record FirmwareClockOffset(
+        Int32 OffsetUs,
+        UInt32 UncertaintyUs,
+        UInt32 SyncedAtHostUs)
+    {
+        /// <summary>
+        /// Converts a host time to the firmware timer, which wraps every 71 minutes like the host one.
+        /// </summary>
+        public UInt32 ToFirmwareTimeUs(UInt32 hostUs)
+        {
+            return (UInt32)(hostUs + OffsetUs);
+        }
+    }
+
+    /// <summary>
+    /// Synchronises the host clock with the low level controller's microsecond timer.
+    /// The controller stamps the time it received each sync request in the SPI interrupt,
+    /// at the end of the transfer that carried it. The host brackets that transfer with its own clock,
+    /// and the exchange with the shortest transfer gives the offset.
+    /// </summary>
+    public class FirmwareClockSync
+    {
+        private const int ResponsePollAttempts = 20;
+
+        private readonly ISpiCommunication _spiCommunication;
+        private readonly ILogger _logger;
+        private readonly Func<UInt32> _hostClockUs;
+        private readonly ResponsePoller _poller;
+        private byte _syncId;
+
+        public FirmwareClockSync(ISpiCommunication spiCommunication, ILogger logger, Func<UInt32> hostClockUs, int pollDelayMs = 10)
+        {
+            _spiCommunication = spiCommunication;
+            _logger = logger;
+            _hostClockUs = hostClockUs;
+            _poller = new ResponsePoller(spiCommunication.TransferBytesMessage, pollDelayMs);
+        }
+
+        /// <summary>
+        /// Offset from one exchange. The controller received the request while the host was sending it.
+        /// </summary>
+        /// <param name="hostSentUs">Host time before the request transfer</param>
+        /// <param name="hostDoneUs">Host time after the request transfer</param>
+        /// <param name="firmwareReceivedUs">Firmware time the request was received</param>
+        public static FirmwareClockOffset Estimate(UInt32 hostSentUs, UInt32 hostDoneUs, UInt32 firmwareReceivedUs)
+        {
+            UInt32 transferUs = hostDoneUs - hostSentUs;
+            UInt32 hostMiddleUs = hostSentUs + transferUs / 2;
+            return new FirmwareClockOffset((Int32)(firmwareReceivedUs - hostMiddleUs), (transferUs + 1) / 2, hostDoneUs);
+        }
+
+        /// <summary>
+        /// Runs the given number of exchanges and keeps the most precise one.
+        /// </summary>
+        /// <returns>The offset, or null if the controller did not answer any exchange</returns>
+        public FirmwareClockOffset? Synchronize(int exchanges)
+        {
+            FirmwareClockOffset? best = null;
+            for (int i = 0; i < exchanges; i++)
+            {
+                var offset = Exchange(_syncId++);
+                if (offset != null && (best == null || offset.UncertaintyUs < best.UncertaintyUs))
+                {
+                    best = offset;
+                }
+            }
+
+            if (best == null)
+            {
+                _logger.LogWarning("Clock sync: the controller did not answer.");
+                return null;
+            }
+
+            _logger.LogInformation("Clock sync: firmware offset {OffsetUs} us, +/- {UncertaintyUs} us.", best.OffsetUs, best.UncertaintyUs);
+            return best;
+        }
+
+        private FirmwareClockOffset? Exchange(byte syncId)
+        {
+            var request = new CommandData8Bytes
+            {
+                CommandType = (byte)CommandType.TimeSyncCommand,
+                Data = new byte[7],
+            };
+            request.Data[0] = syncId;
+
+            var decoder = new ResponseStreamDecoder();
+            UInt32 hostSentUs = _hostClockUs();
+            if (!_spiCommunication.TransferBytesMessage(request.ToByteArray(), new byte[8]))
+            {
+                return null;
+            }
+            UInt32 hostDoneUs = _hostClockUs();
+
+            // An answer to an earlier exchange that timed out is skipped by the id.
+            var answer = _poller.Poll(
+                decoder,
+                response => response.ResponseType == ResponseType.TimeSyncResponse && response.Data[0] == syncId,
+                ResponsePollAttempts);
+
+            return answer.HasValue ? Estimate(hostSentUs, hostDoneUs, answer.Value.ReadUInt32(1)) : null;
+        }
+    }
+}
@@ -0,0 +1,379 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Collections.Generic;
+using System.Security.Cryptography;
+using Microsoft.Extensions.Logging;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Outcome of streaming a firmware image to the low level controller.
+    /// </summary>
+    public record FirmwareStreamResult(
+        bool Success,
+        string Message,
+        int Chunks,
+        int PackedChunks,
+        int ResentChunks);
+
+    /// <summary>
+    /// Streams a firmware image to the staging slot of the low level controller over the command link,
+    /// while the controller keeps taking motion commands. Each chunk is one flash sector, packed with LZSS
+    /// when that makes it smaller, and goes in data frames followed by a chunk operation with its CRC32.
+    /// The controller checks the SHA-256 of the whole image before it can be activated.
+    /// A transfer that broke off goes on from the chunk the controller reports.
+    /// </summary>
+    public class FirmwareStreamer
+    {
+        public const int ChunkSize = 4096;
+        public const int ChunkHeaderSize = 3;
+        public const int DataFrameSize = 6;
+
+        private const byte OperationData = 0;
+        private const byte OperationBegin = 1;
+        private const byte OperationChunk = 2;
+        private const byte OperationFinish = 3;
+        private const byte OperationActivate = 4;
+
+        private const byte EncodingRaw = 0;
+        private const byte EncodingLzss = 1;
+
+        private const byte StateVerified = 2;
+        private const byte StateActivating = 3;
+
+        private const byte ResultOk = 0;
+        private const byte ResultCrc = 3;
+
+        // A chunk write erases and programs a sector, the finish hashes the whole image.
+        private const int StatusPollAttempts = 50;
+        private const int FinishPollAttempts = 300;
+        private const int ChunkAttempts = 3;
+
+        private const int LzssWindowSize = 4096;
+        private const int LzssMinMatch = 3;
+        private const int LzssMaxMatch = 18;
+
+        private static readonly string[] ResultNames =
+        {
+            "ok", "wrong state", "image too large", "CRC mismatch", "chunk out of order",
+            "chunk does not unpack", "flash write failed", "SHA-256 mismatch", "actuators moving",
+        };
+
+        private readonly ILogger _logger;
+        private readonly ResponsePoller _poller;
+
+        /// <param name="transferLock">Held for each transfer only, so motion commands go between the chunks</param>
+        public FirmwareStreamer(ISpiCommunication spiCommunication, ILogger logger, object transferLock, int pollDelayMs = 10)
+        {
+            _logger = logger;
+            _poller = new ResponsePoller(
+                (message, received) =>
+                {
+                    lock (transferLock)
+                    {
+                        return spiCommunication.TransferBytesMessage(message, received);
+                    }
+                },
+                pollDelayMs);
+        }
+
+        /// <summary>
+        /// Firmware update status as reported by the controller.
+        /// </summary>
+        private readonly record struct UpdateStatus(byte State, byte Result, int NextChunk, int Chunks);
+
+        /// <summary>
+        /// CRC-32 as in crc32.hpp in the firmware, the one of zlib.
+        /// </summary>
+        public static UInt32 Crc32(ReadOnlySpan<byte> data)
+        {
+            UInt32 crc = 0xFFFFFFFF;
+            foreach (byte b in data)
+            {
+                crc ^= b;
+                for (int bit = 0; bit < 8; bit++)
+                {
+                    crc = (crc >> 1) ^ (0xEDB88320 & (UInt32)(-(Int32)(crc & 1)));
+                }
+            }
+
+            return ~crc;
+        }
+
+        /// <summary>
+        /// Packs a chunk in the LZSS format of update_agent.hpp: a flags byte for each 8 items, bit 0 first,
+        /// a set bit is a literal, a clear one a 2 byte reference with distance - 1 in the high 12 bits
+        /// and length - 3 in the low 4.
+        /// </summary>
+        public static byte[] LzssEncode(ReadOnlySpan<byte> data)
+        {
+            var output = new List<byte>(data.Length + data.Length / 8 + 1);
+            int position = 0;
+            while (position < data.Length)
+            {
+                int flagsIndex = output.Count;
+                output.Add(0);
+                for (int bit = 0; bit < 8 && position < data.Length; bit++)
+                {
+                    int bestLength = 0;
+                    int bestDistance = 0;
+                    for (int distance = 1; distance <= LzssWindowSize && distance <= position; distance++)
+                    {
+                        int length = 0;
+                        while (length < LzssMaxMatch && position + length < data.Length &&
+                            data[position + length] == data[position + length - distance])
+                        {
+                            length++;
+                        }
+
+                        if (length > bestLength)
+                        {
+                            bestLength = length;
+                            bestDistance = distance;
+                            if (length == LzssMaxMatch)
+                            {
+                                break;
+                            }
+                        }
+                    }
+
+                    if (bestLength < LzssMinMatch)
+                    {
+                        output[flagsIndex] |= (byte)(1 << bit);
+                        output.Add(data[position++]);
+                        continue;
+                    }
+
+                    output.Add((byte)((bestDistance - 1) >> 4));
+                    output.Add((byte)((bestDistance - 1) << 4 | (bestLength - LzssMinMatch)));
+                    position += bestLength;
+                }
+            }
+
+            return output.ToArray();
+        }
+
+        /// <summary>
+        /// Unpacks an LZSS payload, as the controller does.
+        /// </summary>
+        /// <returns>The unpacked bytes, or null if the payload refers before its start</returns>
+        public static byte[]? LzssDecode(ReadOnlySpan<byte> input, int outputSize)
+        {
+            var output = new byte[outputSize];
+            int outputPosition = 0;
+            int inputPosition = 0;
+            while (outputPosition < outputSize && inputPosition < input.Length)
+            {
+                byte flags = input[inputPosition++];
+                for (int bit = 0; bit < 8 && outputPosition < outputSize && inputPosition < input.Length; bit++)
+                {
+                    if ((flags & (1 << bit)) != 0)
+                    {
+                        output[outputPosition++] = input[inputPosition++];
+                        continue;
+                    }
+
+                    if (inputPosition + 2 > input.Length)
+                    {
+                        return null;
+                    }
+
+                    int distance = (input[inputPosition] << 4 | input[inputPosition + 1] >> 4) + 1;
+                    int length = (input[inputPosition + 1] & 0x0F) + LzssMinMatch;
+                    inputPosition += 2;
+                    if (distance > outputPosition || outputPosition + length > outputSize)
+                    {
+                        return null;
+                    }
+
+                    for (int i = 0; i < length; i++, outputPosition++)
+                    {
+                        output[outputPosition] = output[outputPosition - distance];
+                    }
+                }
+            }
+
+            return outputPosition == outputSize ? output : null;
+        }
+
+        /// <summary>
+        /// Builds the transfer buffer of a chunk: encoding, payload length and the payload,
+        /// padded to whole data frames. Packs it only when that makes it smaller.
+        /// </summary>
+        public static byte[] BuildChunk(byte[] image, int index, out bool packed)
+        {
+            int offset = index * ChunkSize;
+            var raw = image.AsSpan(offset, Math.Min(ChunkSize, image.Length - offset));
+            var encoded = LzssEncode(raw);
+            packed = encoded.Length < raw.Length;
+            var payload = packed ? encoded.AsSpan() : raw;
+
+            int length = ChunkHeaderSize + payload.Length;
+            var chunk = new byte[(length + DataFrameSize - 1) / DataFrameSize * DataFrameSize];
+            chunk[0] = packed ? EncodingLzss : EncodingRaw;
+            chunk[1] = (byte)(payload.Length >> 8);
+            chunk[2] = (byte)payload.Length;
+            payload.CopyTo(chunk.AsSpan(ChunkHeaderSize));
+            return chunk;
+        }
+
+        /// <summary>
+        /// Streams the image and verifies it. Activating reboots the controller into the new image.
+        /// </summary>
+        public FirmwareStreamResult Stream(byte[] image, bool activate)
+        {
+            int chunks = (image.Length + ChunkSize - 1) / ChunkSize;
+            var sha256 = SHA256.HashData(image);
+
+            var begin = Operation(OperationBegin);
+            begin.Data[1] = (byte)(image.Length >> 24);
+            begin.Data[2] = (byte)(image.Length >> 16);
+            begin.Data[3] = (byte)(image.Length >> 8);
+            begin.Data[4] = (byte)image.Length;
+
+            var status = Request(DataFrames(sha256), begin, StatusPollAttempts);
+            if (status == null || status.Value.Result != ResultOk)
+            {
+                return Failed("begin", status, chunks, 0, 0);
+            }
+
+            if (status.Value.NextChunk > 0)
+            {
+                _logger.LogInformation("Firmware stream: the controller has {NextChunk} of {Chunks} chunks already.", status.Value.NextChunk, chunks);
+            }
+
+            int packedChunks = 0;
+            int resentChunks = 0;
+            int next = status.Value.NextChunk;
+            int attempts = 0;
+
+            // An image verified before needs no chunks.
+            bool verified = status.Value.State == StateVerified;
+            while (!verified && next < chunks)
+            {
+                var chunk = BuildChunk(image, next, out bool packed);
+                UInt32 crc = Crc32(chunk);
+
+                var operation = Operation(OperationChunk);
+                operation.Data[1] = (byte)(next >> 8);
+                operation.Data[2] = (byte)next;
+                operation.Data[3] = (byte)(crc >> 24);
+                operation.Data[4] = (byte)(crc >> 16);
+                operation.Data[5] = (byte)(crc >> 8);
+                operation.Data[6] = (byte)crc;
+
+                status = Request(DataFrames(chunk), operation, StatusPollAttempts);
+                bool written = status != null && status.Value.Result == ResultOk && status.Value.NextChunk > next;
+                if (!written)
+                {
+                    // A damaged transfer goes again, anything else ends the stream.
+                    bool retry = status == null || status.Value.Result == ResultCrc;
+                    if (!retry || ++attempts >= ChunkAttempts)
+                    {
+                        return Failed($"chunk {next}", status, chunks, packedChunks, resentChunks);
+                    }
+
+                    resentChunks++;
+                    _logger.LogWarning("Firmware stream: chunk {Chunk} goes again.", next);
+
+                    // The controller says where it is, unless it did not answer.
+                    if (status != null)
+                    {
+                        next = status.Value.NextChunk;
+                    }
+                    continue;
+                }
+
+                attempts = 0;
+                packedChunks += packed ? 1 : 0;
+                next = status!.Value.NextChunk;
+            }
+
+            status = Request(Array.Empty<byte>(), Operation(OperationFinish), FinishPollAttempts);
+            if (status == null || status.Value.Result != ResultOk || status.Value.State != StateVerified)
+            {
+                return Failed("verify", status, chunks, packedChunks, resentChunks);
+            }
+
+            _logger.LogInformation("Firmware stream: {Chunks} chunks verified, {Packed} packed, {Resent} sent again.", chunks, packedChunks, resentChunks);
+
+            if (activate)
+            {
+                status = Request(Array.Empty<byte>(), Operation(OperationActivate), StatusPollAttempts);
+                if (status == null || status.Value.Result != ResultOk || status.Value.State != StateActivating)
+                {
+                    return Failed("activate", status, chunks, packedChunks, resentChunks);
+                }
+
+                _logger.LogInformation("Firmware stream: the controller reboots into the new image.");
+            }
+
+            return new FirmwareStreamResult(true, activate ? "Image verified and activated." : "Image verified.", chunks, packedChunks, resentChunks);
+        }
+
+        private FirmwareStreamResult Failed(string step, UpdateStatus? status, int chunks, int packedChunks, int resentChunks)
+        {
+            string message = status == null
+                ? $"Firmware stream: no answer to {step}."
+                : $"Firmware stream: {step} failed, {ResultName(status.Value.Result)}.";
+            _logger.LogError(message);
+            return new FirmwareStreamResult(false, message, chunks, packedChunks, resentChunks);
+        }
+
+        private static string ResultName(byte result)
+        {
+            return result < ResultNames.Length ? ResultNames[result] : $"result {result}";
+        }
+
+        // The transfer buffer in data frames, which the controller takes in its SPI interrupt.
+        private static byte[] DataFrames(ReadOnlySpan<byte> bytes)
+        {
+            int frames = (bytes.Length + DataFrameSize - 1) / DataFrameSize;
+            var message = new byte[frames * 8];
+            for (int frame = 0; frame < frames; frame++)
+            {
+                int offset = frame * DataFrameSize;
+                message[frame * 8] = (byte)CommandType.FirmwareUpdateCommand;
+                message[frame * 8 + 1] = OperationData;
+                bytes.Slice(offset, Math.Min(DataFrameSize, bytes.Length - offset)).CopyTo(message.AsSpan(frame * 8 + 2));
+            }
+
+            return message;
+        }
+
+        // Sends the data frames and the operation in one transfer, then polls until the status arrives.
+        private UpdateStatus? Request(byte[] dataFrames, CommandData8Bytes operation, int pollAttempts)
+        {
+            var message = new byte[dataFrames.Length + 8];
+            dataFrames.CopyTo(message, 0);
+            operation.ToByteArray().CopyTo(message, dataFrames.Length);
+
+            var response = _poller.Request(
+                message,
+                new ResponseStreamDecoder(),
+                response => response.ResponseType == ResponseType.FirmwareUpdateResponse,
+                pollAttempts);
+            if (response == null)
+            {
+                return null;
+            }
+
+            var data = response.Value;
+            return new UpdateStatus(data.Data[0], data.Data[1], data.ReadUInt16(2), data.ReadUInt16(4));
+        }
+
+        private static CommandData8Bytes Operation(byte operation)
+        {
+            var command = new CommandData8Bytes
+            {
+                CommandType = (byte)CommandType.FirmwareUpdateCommand,
+                Data = new byte[7],
+            };
+            command.Data[0] = operation;
+            return command;
+        }
+    }
+}
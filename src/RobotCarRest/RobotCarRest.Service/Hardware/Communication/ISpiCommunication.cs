@@ -43,6 +43,14 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
         /// <returns>True if the message was sent successfully; otherwise, false</returns>
         bool SendBytesMessage(byte[] message);
 
+        /// <summary>
+        /// Sends a byte array and reads the bytes clocked in from the slave at the same time.
+        /// </summary>
+        /// <param name="message">The byte array to send</param>
+        /// <param name="response">Buffer for the received bytes, same length as the message</param>
+        /// <returns>True if the transfer was successful; otherwise, false</returns>
+        bool TransferBytesMessage(byte[] message, byte[] response);
+
         /// <summary>
         /// Re-initializes the SPI communication channel with a custom clock frequency override.
         /// </summary>
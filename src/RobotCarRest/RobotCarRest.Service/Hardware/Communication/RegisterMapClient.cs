@@ -0,0 +1,196 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Threading;
+using Microsoft.Extensions.Logging;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Reads and writes the register map of the low level controller in bursts, so the whole state
+    /// or the setpoints of every joint and wheel take one transfer. Addresses and layout follow
+    /// register_map.hpp in the firmware. All fields are big-endian.
+    /// </summary>
+    public class RegisterMapClient
+    {
+        public const int Magic = 0x0000;
+        public const int Version = 0x0002;
+        public const int ServoSlots = 0x0003;
+        public const int UptimeUs = 0x0010;
+        public const int BatteryMv = 0x0014;
+        public const int LoadCurrentMa = 0x0016;
+        public const int LoadCurrentPeakMa = 0x0018;
+        public const int StatusFlags = 0x001A;
+        public const int MotionMode = 0x001B;
+        public const int Wheels = 0x001C;
+        public const int ServoDegrees = 0x0020;
+        public const int SpiFrames = 0x0030;
+        public const int SpiQueueOverflows = 0x0034;
+        public const int DcMotorsStalls = 0x0038;
+        public const int ServosOvercurrents = 0x003C;
+        public const int EmergencyStops = 0x0040;
+        public const int RegisterErrors = 0x0044;
+        public const int SpiResponseDrops = 0x0048;
+        public const int WheelSetpoints = 0x0080;
+        public const int JointSetpoints = 0x0088;
+        public const int JointLimits = 0x00C0;
+        public const int SpeedProfiles = 0x0100;
+
+        public const int SetpointSize = 4;
+        public const int ServoSlotsCount = 8;
+        public const int SpeedProfileRows = 10;
+        public const int MapSize = SpeedProfiles + ServoSlotsCount * SpeedProfileRows * 4;
+
+        public const UInt16 MagicValue = 0x524D;
+
+        // The burst follows a response already going out, and the TX FIFO of the controller.
+        private const int ReadSlack = ResponseStreamDecoder.FrameSize + 8;
+        private const int ReadPollAttempts = 5;
+
+        private readonly ISpiCommunication _spiCommunication;
+        private readonly ILogger _logger;
+        private readonly object _transferLock;
+        private readonly int _pollDelayMs;
+
+        /// <param name="transferLock">Held for each transfer, so the frame and its payload stay together</param>
+        public RegisterMapClient(ISpiCommunication spiCommunication, ILogger logger, object transferLock, int pollDelayMs = 10)
+        {
+            _spiCommunication = spiCommunication;
+            _logger = logger;
+            _transferLock = transferLock;
+            _pollDelayMs = pollDelayMs;
+        }
+
+        /// <summary>
+        /// Encodes a setpoint record, as the data of the direction commands.
+        /// </summary>
+        public static void WriteSetpoint(Span<byte> record, sbyte direction, byte speed, UInt16 timeoutMs)
+        {
+            record[0] = (byte)direction;
+            record[1] = speed;
+            record[2] = (byte)(timeoutMs >> 8);
+            record[3] = (byte)timeoutMs;
+        }
+
+        /// <summary>
+        /// Builds the write frame with its payload, to go in one transfer.
+        /// </summary>
+        public static byte[] BuildWrite(int address, ReadOnlySpan<byte> payload)
+        {
+            byte checksum = 0;
+            foreach (byte b in payload)
+            {
+                checksum ^= b;
+            }
+
+            var message = new byte[8 + payload.Length];
+            message[0] = (byte)CommandType.RegisterWriteCommand;
+            message[1] = (byte)(address >> 8);
+            message[2] = (byte)address;
+            message[3] = (byte)(payload.Length >> 8);
+            message[4] = (byte)payload.Length;
+            message[5] = checksum;
+            payload.CopyTo(message.AsSpan(8));
+            return message;
+        }
+
+        /// <summary>
+        /// Builds the read frame followed by whole idle frames to clock the burst out.
+        /// </summary>
+        public static byte[] BuildRead(int address, int length)
+        {
+            var message = new byte[8 + IdleSize(length)];
+            message[0] = (byte)CommandType.RegisterReadCommand;
+            message[1] = (byte)(address >> 8);
+            message[2] = (byte)address;
+            message[3] = (byte)(length >> 8);
+            message[4] = (byte)length;
+            return message;
+        }
+
+        /// <summary>
+        /// Writes a range of the writable part of the map. The controller applies it from its main loop,
+        /// in order with the commands, and counts a refused write in RegisterErrors.
+        /// </summary>
+        public bool Write(int address, ReadOnlySpan<byte> payload)
+        {
+            if (address < WheelSetpoints || payload.Length == 0 || address + payload.Length > MapSize)
+            {
+                _logger.LogWarning("Register write of {Length} bytes at 0x{Address:X4} is outside the writable map.", payload.Length, address);
+                return false;
+            }
+
+            var message = BuildWrite(address, payload);
+            lock (_transferLock)
+            {
+                return _spiCommunication.SendBytesMessage(message);
+            }
+        }
+
+        /// <summary>
+        /// Reads a range of the map in one burst. Returns null if no good burst came back.
+        /// </summary>
+        public RegisterBurst? Read(int address, int length)
+        {
+            if (length <= 0 || address < 0 || address + length > MapSize)
+            {
+                _logger.LogWarning("Register read of {Length} bytes at 0x{Address:X4} is outside the map.", length, address);
+                return null;
+            }
+
+            var decoder = new ResponseStreamDecoder();
+            var burst = Transfer(BuildRead(address, length), decoder, address, length);
+
+            // The controller builds the burst on its next main loop pass, and with a shared chip select
+            // it waits until this board answers again.
+            for (int attempt = 0; burst == null && attempt < ReadPollAttempts; attempt++)
+            {
+                if (_pollDelayMs > 0)
+                {
+                    Thread.Sleep(_pollDelayMs);
+                }
+
+                burst = Transfer(new byte[IdleSize(length)], decoder, address, length);
+            }
+
+            if (burst == null)
+            {
+                _logger.LogWarning("No register burst for 0x{Address:X4}, {Checksum} checksum errors.", address, decoder.ChecksumErrors);
+            }
+
+            return burst;
+        }
+
+        // Whole idle frames to clock a burst of the given length out.
+        private static int IdleSize(int length)
+        {
+            return (ResponseStreamDecoder.BurstHeaderSize + length + 1 + ReadSlack + 7) / 8 * 8;
+        }
+
+        private RegisterBurst? Transfer(byte[] message, ResponseStreamDecoder decoder, int address, int length)
+        {
+            var received = new byte[message.Length];
+            lock (_transferLock)
+            {
+                if (!_spiCommunication.TransferBytesMessage(message, received))
+                {
+                    return null;
+                }
+            }
+
+            decoder.Decode(received);
+            while (decoder.Bursts.Count > 0)
+            {
+                var burst = decoder.Bursts.Dequeue();
+                if (burst.Address == address && burst.Data.Length == length)
+                {
+                    return burst;
+                }
+            }
+
+            return null;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Threading;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Sends a request to the low level controller and clocks its answer out with idle frames.
+    /// The controller answers from its main loop, which takes one command per 10 ms, so the polls
+    /// are spaced by the given delay. Answers from the SPI interrupt need none.
+    /// </summary>
+    public class ResponsePoller
+    {
+        // Whole idle command frames, so the controller stays in step.
+        public const int PollSize = 16;
+
+        private readonly Func<byte[], byte[], bool> _transfer;
+        private readonly int _pollDelayMs;
+
+        /// <param name="transfer">Full duplex transfer to the controller, MOSI bytes and MISO buffer</param>
+        /// <param name="pollDelayMs">Wait before each poll</param>
+        public ResponsePoller(Func<byte[], byte[], bool> transfer, int pollDelayMs)
+        {
+            _transfer = transfer;
+            _pollDelayMs = pollDelayMs;
+        }
+
+        /// <summary>
+        /// Sends the message, then polls until a response accepted by the filter is decoded.
+        /// </summary>
+        /// <param name="message">Frames of the request</param>
+        /// <param name="decoder">Decoder of the stream, responses it completes are checked from the message on</param>
+        /// <param name="accept">Picks the awaited response, the others are skipped</param>
+        /// <param name="pollAttempts">Polls after the message, 0 checks the message transfer only</param>
+        /// <returns>The response, or null if a transfer failed or it did not arrive</returns>
+        public ResponseData8Bytes? Request(byte[] message, ResponseStreamDecoder decoder, Func<ResponseData8Bytes, bool> accept, int pollAttempts)
+        {
+            if (!Transfer(message, decoder, accept, out var response))
+            {
+                return null;
+            }
+
+            return response ?? Poll(decoder, accept, pollAttempts);
+        }
+
+        /// <summary>
+        /// Polls for the answer to a request already sent.
+        /// </summary>
+        /// <returns>The response, or null if a transfer failed or it did not arrive</returns>
+        public ResponseData8Bytes? Poll(ResponseStreamDecoder decoder, Func<ResponseData8Bytes, bool> accept, int pollAttempts)
+        {
+            for (int attempt = 0; attempt < pollAttempts; attempt++)
+            {
+                if (_pollDelayMs > 0)
+                {
+                    Thread.Sleep(_pollDelayMs);
+                }
+
+                if (!Transfer(new byte[PollSize], decoder, accept, out var response))
+                {
+                    return null;
+                }
+
+                if (response != null)
+                {
+                    return response;
+                }
+            }
+
+            return null;
+        }
+
+        private bool Transfer(byte[] message, ResponseStreamDecoder decoder, Func<ResponseData8Bytes, bool> accept, out ResponseData8Bytes? accepted)
+        {
+            accepted = null;
+            var received = new byte[message.Length];
+            if (!_transfer(message, received))
+            {
+                return false;
+            }
+
+            foreach (var response in decoder.Decode(received))
+            {
+                if (accepted == null && accept(response))
+                {
+                    accepted = response;
+                }
+            }
+
+            return true;
+        }
+    }
+}
@@ -0,0 +1,109 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System.Collections.Generic;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Decodes the responses the low level controller sends on MISO.
+    /// Each response is a sync byte, the type, 7 data bytes and the XOR of type and data.
+    /// A register burst is a sync byte, the type, the address and length (big-endian), the payload
+    /// and the XOR of everything from the type.
+    /// Everything between responses is idle filler and is skipped.
+    /// </summary>
+    public class ResponseStreamDecoder
+    {
+        public const byte SyncByte = 0xA5;
+        public const int FrameSize = 10;
+        public const int BurstHeaderSize = 6;
+
+        // The whole register map is smaller. A longer length is a damaged header.
+        public const int MaxBurstLength = 1024;
+
+        private readonly List<byte> _frame = new(FrameSize);
+        private int _expected = FrameSize;
+
+        /// <summary>
+        /// Gets the number of frames dropped because of a wrong checksum.
+        /// </summary>
+        public int ChecksumErrors { get; private set; }
+
+        /// <summary>
+        /// Gets the register bursts decoded so far. The caller takes them out.
+        /// </summary>
+        public Queue<RegisterBurst> Bursts { get; } = new();
+
+        /// <summary>
+        /// Feeds received bytes to the decoder. Frames can span several calls.
+        /// </summary>
+        /// <param name="bytes">Bytes received from the controller</param>
+        /// <returns>The responses completed by these bytes</returns>
+        public List<ResponseData8Bytes> Decode(byte[] bytes)
+        {
+            var responses = new List<ResponseData8Bytes>();
+
+            foreach (byte b in bytes)
+            {
+                if (_frame.Count == 0 && b != SyncByte)
+                {
+                    continue;
+                }
+
+                _frame.Add(b);
+                if (_frame.Count == 2 && b == (byte)ResponseType.RegisterBurstResponse)
+                {
+                    _expected = BurstHeaderSize;
+                }
+                else if (_frame.Count == BurstHeaderSize && _expected == BurstHeaderSize)
+                {
+                    int length = _frame[4] << 8 | _frame[5];
+                    if (length > MaxBurstLength)
+                    {
+                        ChecksumErrors++;
+                        Reset();
+                        continue;
+                    }
+
+                    _expected = BurstHeaderSize + length + 1;
+                }
+
+                if (_frame.Count < _expected)
+                {
+                    continue;
+                }
+
+                byte checksum = 0;
+                for (int i = 1; i < _frame.Count - 1; i++)
+                {
+                    checksum ^= _frame[i];
+                }
+
+                if (checksum != _frame[^1])
+                {
+                    ChecksumErrors++;
+                }
+                else if (_frame[1] == (byte)ResponseType.RegisterBurstResponse)
+                {
+                    var payload = _frame.GetRange(BurstHeaderSize, _frame.Count - BurstHeaderSize - 1).ToArray();
+                    Bursts.Enqueue(new RegisterBurst(_frame[2] << 8 | _frame[3], payload));
+                }
+                else
+                {
+                    responses.Add(new ResponseData8Bytes((ResponseType)_frame[1], _frame.GetRange(2, 7).ToArray()));
+                }
+
+                Reset();
+            }
+
+            return responses;
+        }
+
+        private void Reset()
+        {
+            _frame.Clear();
+            _expected = FrameSize;
+        }
+    }
+}
@@ -21,6 +21,7 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
         private readonly IOptions<SpiOptions> _options;
         private SpiDevice? _spiDevice;
         private SpiConfig? _config;
+        private CommandQueueCredits? _credits;
 
         /// <summary>
         /// Initializes a new instance of the SpiCommunication class.
@@ -81,6 +82,7 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
                 };
 
                 _spiDevice = SpiDevice.Create(connectionSettings);
+                _credits = _config.UseQueueCredits ? new CommandQueueCredits(TransferFullDuplex) : null;
                 
                 _logger.LogInformation($"SPI device initialized successfully. {_config.GetConfigurationSummary()}");
                 return true;
@@ -135,6 +137,7 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
                 _spiDevice?.Dispose();
                 _spiDevice = null;
                 _config = null;
+                _credits = null;
                 _logger.LogInformation("SPI communication channel freed successfully.");
                 return true;
             }
@@ -232,7 +235,19 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
 
             try
             {
-                SendByteArray(message);
+                if (_credits == null)
+                {
+                    SendByteArray(message);
+                    return true;
+                }
+
+                if (!AcquireCredits(message))
+                {
+                    return false;
+                }
+
+                // Paced by the credits, without the fixed delay.
+                _spiDevice!.Write(message);
                 return true;
             }
             catch (Exception ex)
@@ -242,6 +257,68 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
             }
         }
 
+        /// <summary>
+        /// Sends raw bytes over SPI and reads the response bytes sent by the slave at the same time.
+        /// </summary>
+        /// <param name="message">The byte array to send</param>
+        /// <param name="response">Buffer for the received bytes, same length as the message</param>
+        /// <returns>True if the transfer was successful; otherwise, false</returns>
+        public bool TransferBytesMessage(byte[] message, byte[] response)
+        {
+            if (!IsChannelReady)
+            {
+                _logger.LogWarning("Cannot transfer bytes. SPI device is not initialized.");
+                return false;
+            }
+
+            if (message == null || message.Length == 0 || response == null || response.Length != message.Length)
+            {
+                _logger.LogWarning("Cannot transfer bytes. Message and response must have the same non-zero length.");
+                return false;
+            }
+
+            try
+            {
+                if (_credits != null && !AcquireCredits(message))
+                {
+                    return false;
+                }
+
+                _spiDevice!.TransferFullDuplex(message, response);
+                return true;
+            }
+            catch (Exception ex)
+            {
+                _logger.LogError(ex, "Error transferring bytes over SPI: {Message}", ex.Message);
+                return false;
+            }
+        }
+
+        // Waits for room in the controller's commands queue, see CommandQueueCredits.
+        private bool AcquireCredits(byte[] message)
+        {
+            bool reported = _credits!.Capacity > 0;
+            UInt32 overflows = _credits.QueueOverflows;
+            if (!_credits.Acquire(message, _config!.TimeoutMs))
+            {
+                _logger.LogWarning("Cannot send bytes. The controller's commands queue stayed full or it did not report the free entries.");
+                return false;
+            }
+
+            if (reported && _credits.QueueOverflows != overflows)
+            {
+                _logger.LogWarning("The controller dropped {Count} commands on a full queue.", _credits.QueueOverflows - overflows);
+            }
+
+            return true;
+        }
+
+        private bool TransferFullDuplex(byte[] message, byte[] response)
+        {
+            _spiDevice!.TransferFullDuplex(message, response);
+            return true;
+        }
+
         private bool WaitForAcknowledgment()
         {
             try
@@ -288,10 +365,9 @@ namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
 
             try
             {
-                foreach (byte b in data)
-                {
-                    _spiDevice!.WriteByte(b);
-                }
+                // One transfer, so the bytes of a frame arrive without gaps. The firmware drops
+                // a frame that pauses longer than its gap timeout in the middle.
+                _spiDevice!.Write(data);
 
                 if (_config!.OperationDelayMs > 0)
                 {
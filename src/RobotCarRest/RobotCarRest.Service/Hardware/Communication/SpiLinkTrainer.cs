@@ -0,0 +1,197 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using System.Collections.Generic;
+using Microsoft.Extensions.Logging;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace Paregov.RobotCar.Rest.Service.Hardware.Communication
+{
+    /// <summary>
+    /// Result of the link training at one clock frequency.
+    /// Frames missing from both counts were lost completely.
+    /// </summary>
+    public record LinkRateResult(
+        int ClockHz,
+        int Sent,
+        int Intact,
+        int Corrupted,
+        int ResponseErrors,
+        bool Passed);
+
+    /// <summary>
+    /// Clock frequency the link settled on and the results of the rates that were tried.
+    /// </summary>
+    public record LinkTrainingResult(
+        int ChosenClockHz,
+        IReadOnlyList<LinkRateResult> Rates);
+
+    /// <summary>
+    /// Negotiates the SPI clock frequency with the low level controller.
+    /// At each rate, lowest first, sends a burst of known patterns and reads back how many
+    /// the controller received intact. Stops at the first rate that loses or corrupts a frame
+    /// in either direction and commits the highest one that passed.
+    /// </summary>
+    public class SpiLinkTrainer
+    {
+        private const byte OperationStart = 0;
+        private const byte OperationPattern = 1;
+        private const byte OperationReport = 2;
+        private const byte OperationCommit = 3;
+
+        private const int PatternSize = 5;
+
+        private const int StatusPollAttempts = 20;
+
+        private static readonly byte[] Patterns = { 0x55, 0xAA, 0xFF, 0x00, 0x33, 0xCC, 0x0F, 0xF0 };
+
+        private readonly ISpiCommunication _spiCommunication;
+        private readonly ILogger _logger;
+        private readonly ResponsePoller _poller;
+
+        public SpiLinkTrainer(ISpiCommunication spiCommunication, ILogger logger, int pollDelayMs = 10)
+        {
+            _spiCommunication = spiCommunication;
+            _logger = logger;
+            _poller = new ResponsePoller(spiCommunication.TransferBytesMessage, pollDelayMs);
+        }
+
+        /// <summary>
+        /// Byte of a training pattern, the same as link_training_pattern_byte() in the firmware.
+        /// </summary>
+        /// <param name="index">Index of the pattern frame</param>
+        /// <param name="position">Position of the byte in the pattern, 0 to 4</param>
+        /// <returns>The expected byte</returns>
+        public static byte PatternByte(byte index, int position)
+        {
+            if (position == PatternSize - 1)
+            {
+                return (byte)(1 << (index & 7));
+            }
+
+            return Patterns[(index + position) & 7];
+        }
+
+        /// <summary>
+        /// Trains the link and leaves the channel at the chosen clock frequency.
+        /// </summary>
+        /// <param name="ratesHz">Clock frequencies to try, lowest first</param>
+        /// <param name="patternFrames">Pattern frames to send at each rate</param>
+        /// <param name="fallbackClockHz">Clock frequency to keep if no rate passes</param>
+        /// <returns>The chosen clock frequency and the result at each rate tried</returns>
+        public LinkTrainingResult Train(IReadOnlyList<int> ratesHz, int patternFrames, int fallbackClockHz)
+        {
+            var results = new List<LinkRateResult>();
+            int chosenClockHz = fallbackClockHz;
+
+            foreach (int clockHz in ratesHz)
+            {
+                var result = TrainRate(clockHz, patternFrames);
+                results.Add(result);
+                _logger.LogInformation(
+                    "SPI link training at {ClockHz} Hz: {Intact}/{Sent} intact, {Corrupted} corrupted, {ResponseErrors} response errors",
+                    result.ClockHz, result.Intact, result.Sent, result.Corrupted, result.ResponseErrors);
+
+                if (!result.Passed)
+                {
+                    break;
+                }
+
+                chosenClockHz = clockHz;
+            }
+
+            _spiCommunication.ReinitializeWithClockFrequency(chosenClockHz);
+            if (!Commit(chosenClockHz))
+            {
+                _logger.LogWarning("The controller did not confirm the SPI clock of {ClockHz} Hz", chosenClockHz);
+            }
+
+            return new LinkTrainingResult(chosenClockHz, results);
+        }
+
+        private LinkRateResult TrainRate(int clockHz, int patternFrames)
+        {
+            if (!_spiCommunication.ReinitializeWithClockFrequency(clockHz))
+            {
+                return new LinkRateResult(clockHz, patternFrames, 0, 0, 0, false);
+            }
+
+            var decoder = new ResponseStreamDecoder();
+            Send(Command(OperationStart).ToByteArray(), decoder);
+
+            var frames = new List<byte>(patternFrames * 8);
+            for (int i = 0; i < patternFrames; i++)
+            {
+                var command = Command(OperationPattern);
+                command.Data[1] = (byte)i;
+                for (int position = 0; position < PatternSize; position++)
+                {
+                    command.Data[2 + position] = PatternByte((byte)i, position);
+                }
+
+                frames.AddRange(command.ToByteArray());
+            }
+
+            // One transfer, as the burst a fast link would carry.
+            Send(frames.ToArray(), decoder);
+
+            var status = RequestStatus(Command(OperationReport), decoder, null);
+            if (!status.HasValue)
+            {
+                return new LinkRateResult(clockHz, patternFrames, 0, 0, decoder.ChecksumErrors, false);
+            }
+
+            int intact = status.Value.ReadUInt16(0);
+            int corrupted = status.Value.ReadUInt16(2);
+            bool passed = intact == patternFrames && corrupted == 0 && decoder.ChecksumErrors == 0;
+            return new LinkRateResult(clockHz, patternFrames, intact, corrupted, decoder.ChecksumErrors, passed);
+        }
+
+        private bool Commit(int clockHz)
+        {
+            var command = Command(OperationCommit);
+            command.Data[1] = (byte)(clockHz >> 24);
+            command.Data[2] = (byte)(clockHz >> 16);
+            command.Data[3] = (byte)(clockHz >> 8);
+            command.Data[4] = (byte)clockHz;
+
+            return RequestStatus(command, new ResponseStreamDecoder(), clockHz / 1000).HasValue;
+        }
+
+        // Sends the request and polls until the link status arrives.
+        // A status left over from an earlier rate is skipped by the committed clock, when one is expected.
+        private ResponseData8Bytes? RequestStatus(CommandData8Bytes request, ResponseStreamDecoder decoder, int? committedKhz)
+        {
+            return _poller.Request(request.ToByteArray(), decoder, status => IsExpectedStatus(status, committedKhz), StatusPollAttempts);
+        }
+
+        private static bool IsExpectedStatus(ResponseData8Bytes status, int? committedKhz)
+        {
+            return status.ResponseType == ResponseType.LinkStatusResponse &&
+                (committedKhz == null || ReadUInt24(status, 4) == committedKhz);
+        }
+
+        // The frames go through the decoder, so its errors count, but nothing is awaited.
+        private void Send(byte[] message, ResponseStreamDecoder decoder)
+        {
+            _poller.Request(message, decoder, _ => false, 0);
+        }
+
+        private static CommandData8Bytes Command(byte operation)
+        {
+            var command = new CommandData8Bytes
+            {
+                CommandType = (byte)CommandType.LinkTrainingCommand,
+                Data = new byte[7],
+            };
+            command.Data[0] = operation;
+            return command;
+        }
+
+        private static int ReadUInt24(ResponseData8Bytes response, int offset)
+        {
+            return response.Data[offset] << 16 | response.Data[offset + 1] << 8 | response.Data[offset + 2];
+        }
+    }
+}
@@ -1,8 +1,11 @@
 ﻿// Copyright © Svetoslav Paregov. All rights reserved.
 
 using System;
+using System.Diagnostics;
 using Microsoft.Extensions.Logging;
+using Microsoft.Extensions.Options;
 using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication.Config;
 using Paregov.RobotCar.Rest.Service.Models.Enums;
 using Paregov.RobotCar.Rest.Service.Models.LowLevel;
 
@@ -12,16 +15,27 @@ namespace Paregov.RobotCar.Rest.Service.Hardware
     {
         private readonly ILogger<HardwareControl> _logger;
         private readonly ISpiCommunication _spiCommunication;
+        private readonly SpiOptions _spiOptions;
+        private readonly bool _useSequenceNumbers;
+        private readonly ResponseStreamDecoder _responseDecoder = new();
+        private readonly CommandLatencyTracker _latencyTracker = new();
+        private readonly Stopwatch _clock = Stopwatch.StartNew();
 
         private readonly object _lock = new();
         private bool _normalOperationsAllowed;
+        private UInt16 _sequence;
+        private LinkTrainingResult? _linkTrainingResult;
+        private FirmwareClockOffset? _firmwareClock;
 
         public HardwareControl(
             ILogger<HardwareControl> logger,
-            ISpiCommunication spiCommunication)
+            ISpiCommunication spiCommunication,
+            IOptions<SpiOptions> spiOptions)
         {
             _logger = logger;
             _spiCommunication = spiCommunication;
+            _spiOptions = spiOptions.Value;
+            _useSequenceNumbers = _spiOptions.UseSequenceNumbers;
             _normalOperationsAllowed = true;
         }
 
@@ -52,34 +66,53 @@ namespace Paregov.RobotCar.Rest.Service.Hardware
 
             lock (_lock)
             {
+                // All scheduled for the same time, so the arm and the wheels start together.
+                UInt32? executeAtUs = GetScheduledExecutionTimeUs();
+
                 var baseRotation = new CommandData8Bytes(CommandType.BaseMotorDirectionCommand, command.Base);
-                Send8ByteCommand(baseRotation);
+                SendCommand(baseRotation, executeAtUs);
 
                 var shoulder = new CommandData8Bytes(CommandType.ShoulderMotorDirectionCommand, command.Shoulder);
-                Send8ByteCommand(shoulder);
+                SendCommand(shoulder, executeAtUs);
 
                 var elbow = new CommandData8Bytes(CommandType.ElbowMotorDirectionCommand, command.Elbow);
-                Send8ByteCommand(elbow);
+                SendCommand(elbow, executeAtUs);
 
                 var arm = new CommandData8Bytes(CommandType.ArmMotorCommand, command.Arm);
-                Send8ByteCommand(arm);
+                SendCommand(arm, executeAtUs);
 
                 var wrist = new CommandData8Bytes(CommandType.WristMotorCommand, command.Wrist);
-                Send8ByteCommand(wrist);
+                SendCommand(wrist, executeAtUs);
 
                 var gripper = new CommandData8Bytes(CommandType.GripperMotorCommand, command.Gripper);
-                Send8ByteCommand(gripper);
+                SendCommand(gripper, executeAtUs);
 
                 var leftMotor = new CommandData8Bytes(CommandType.LeftMotorCommand, command.LeftWheel);
-                Send8ByteCommand(leftMotor);
+                SendCommand(leftMotor, executeAtUs);
 
                 var rightMotor = new CommandData8Bytes(CommandType.RightMotorCommand, command.RightWheel);
-                Send8ByteCommand(rightMotor);
+                SendCommand(rightMotor, executeAtUs);
 
                 return true;
             }
         }
 
+        public bool EmergencyStop()
+        {
+            // Sent even while normal operations are disabled. The controller acts on it ahead of its queue.
+            lock (_lock)
+            {
+                _logger.LogWarning("Sending emergency stop.");
+                var stop = new CommandData8Bytes
+                {
+                    CommandType = (byte)CommandType.StopAllMotorsCommand,
+                    Data = new byte[7],
+                };
+
+                return _spiCommunication.SendBytesMessage(stop.ToByteArray());
+            }
+        }
+
         public bool Send8ByteCommand(CommandData8Bytes commandData)
         {
             if (!_normalOperationsAllowed)
@@ -90,9 +123,211 @@ namespace Paregov.RobotCar.Rest.Service.Hardware
 
             lock (_lock)
             {
-                _logger.LogInformation("Sending 8-byte command: {Command}", commandData);
+                return SendCommand(commandData, null);
+            }
+        }
+
+        public bool SendScheduled8ByteCommand(CommandData8Bytes commandData, UInt32 delayMs)
+        {
+            if (!_normalOperationsAllowed)
+            {
+                _logger.LogWarning("Normal operations are not allowed. Command will not be sent: {Command}", commandData);
+                return false;
+            }
+
+            lock (_lock)
+            {
+                var clock = GetFirmwareClock();
+                if (clock == null)
+                {
+                    return false;
+                }
+
+                return SendCommand(commandData, clock.ToFirmwareTimeUs(GetHostTimestampUs() + delayMs * 1000));
+            }
+        }
+
+        public FirmwareClockOffset? SynchronizeClock()
+        {
+            lock (_lock)
+            {
+                var sync = new FirmwareClockSync(_spiCommunication, _logger, GetHostTimestampUs);
+                _firmwareClock = sync.Synchronize(_spiOptions.ClockSyncExchanges);
+                return _firmwareClock;
+            }
+        }
+
+        public bool HoldMotion()
+        {
+            return SendBroadcast(CommandType.SyncHoldCommand, 1);
+        }
+
+        public bool StartMotion()
+        {
+            return SendBroadcast(CommandType.SyncHoldCommand, 0);
+        }
+
+        public bool SelectBoard(byte address)
+        {
+            return SendBroadcast(CommandType.BoardSelectCommand, address);
+        }
+
+        // One frame taken by every board on the bus, so they all act on it at the same time.
+        private bool SendBroadcast(CommandType commandType, byte value)
+        {
+            if (!_normalOperationsAllowed)
+            {
+                _logger.LogWarning("Normal operations are not allowed. Command will not be sent: {Command}", commandType);
+                return false;
+            }
+
+            lock (_lock)
+            {
+                var command = new CommandData8Bytes
+                {
+                    CommandType = (byte)commandType,
+                    Data = new byte[7],
+                };
+                command.Data[0] = value;
+
+                _logger.LogInformation("Sending {Command} to all boards: {Value}", commandType, value);
+                return _spiCommunication.SendBytesMessage(command.ToAddressedByteArray(CommandData8Bytes.BroadcastAddress));
+            }
+        }
+
+        // Called with the lock held. A command with an execution time always carries a sequence number.
+        private bool SendCommand(CommandData8Bytes commandData, UInt32? executeAtUs)
+        {
+            _logger.LogInformation("Sending 8-byte command: {Command}", commandData);
+            byte extensionFlags = 0;
+            if (_useSequenceNumbers || executeAtUs.HasValue)
+            {
+                extensionFlags |= CommandData8Bytes.ExtensionSequence;
+            }
+            if (executeAtUs.HasValue)
+            {
+                extensionFlags |= CommandData8Bytes.ExtensionExecuteAt;
+            }
+            if (_spiOptions.BoardAddress >= 0)
+            {
+                extensionFlags |= CommandData8Bytes.ExtensionAddress;
+            }
+
+            if (extensionFlags == 0)
+            {
                 return _spiCommunication.SendBytesMessage(commandData.ToByteArray());
             }
+
+            bool hasSequence = (extensionFlags & CommandData8Bytes.ExtensionSequence) != 0;
+            byte[] message = commandData.ToExtendedByteArray(
+                extensionFlags,
+                hasSequence ? _sequence++ : (UInt16)0,
+                GetHostTimestampUs(),
+                executeAtUs ?? 0,
+                (byte)_spiOptions.BoardAddress);
+            if (!hasSequence)
+            {
+                return _spiCommunication.SendBytesMessage(message);
+            }
+
+            byte[] received = new byte[message.Length];
+            if (!_spiCommunication.TransferBytesMessage(message, received))
+            {
+                return false;
+            }
+
+            ProcessResponses(received);
+            return true;
+        }
+
+        // Called with the lock held. Null when scheduling is off or the clock cannot be synchronised.
+        private UInt32? GetScheduledExecutionTimeUs()
+        {
+            if (_spiOptions.ScheduleAheadMs <= 0)
+            {
+                return null;
+            }
+
+            var clock = GetFirmwareClock();
+            return clock?.ToFirmwareTimeUs(GetHostTimestampUs() + (UInt32)_spiOptions.ScheduleAheadMs * 1000);
+        }
+
+        // Called with the lock held. Synchronises again once the last sync is older than the interval.
+        private FirmwareClockOffset? GetFirmwareClock()
+        {
+            if (_firmwareClock == null ||
+                GetHostTimestampUs() - _firmwareClock.SyncedAtHostUs > (UInt32)_spiOptions.ClockSyncIntervalMs * 1000)
+            {
+                var sync = new FirmwareClockSync(_spiCommunication, _logger, GetHostTimestampUs);
+                _firmwareClock = sync.Synchronize(_spiOptions.ClockSyncExchanges) ?? _firmwareClock;
+            }
+
+            return _firmwareClock;
+        }
+
+        public CommandLatencyStatistics GetCommandLatencyStatistics()
+        {
+            return _latencyTracker.GetStatistics();
+        }
+
+        public LinkTrainingResult TrainSpiLink()
+        {
+            lock (_lock)
+            {
+                var trainer = new SpiLinkTrainer(_spiCommunication, _logger);
+                _linkTrainingResult = trainer.Train(
+                    _spiOptions.LinkTrainingRatesHz,
+                    _spiOptions.LinkTrainingPatternFrames,
+                    _spiOptions.ClockFrequency);
+                return _linkTrainingResult;
+            }
+        }
+
+        public LinkTrainingResult? GetLinkTrainingResult()
+        {
+            lock (_lock)
+            {
+                return _linkTrainingResult;
+            }
+        }
+
+        public RegisterBurst? ReadRegisters(int address, int length)
+        {
+            var registers = new RegisterMapClient(_spiCommunication, _logger, _lock);
+            return registers.Read(address, length);
+        }
+
+        public bool WriteRegisters(int address, byte[] payload)
+        {
+            if (!_normalOperationsAllowed)
+            {
+                _logger.LogWarning("Normal operations are not allowed. Register write at 0x{Address:X4} will not be sent.", address);
+                return false;
+            }
+
+            var registers = new RegisterMapClient(_spiCommunication, _logger, _lock);
+            return registers.Write(address, payload);
+        }
+
+        private UInt32 GetHostTimestampUs()
+        {
+            return (UInt32)(_clock.ElapsedTicks * 1_000_000 / Stopwatch.Frequency);
+        }
+
+        private void ProcessResponses(byte[] received)
+        {
+            foreach (var response in _responseDecoder.Decode(received))
+            {
+                switch (response.ResponseType)
+                {
+                    case ResponseType.CommandEchoResponse:
+                        _latencyTracker.OnEcho(response.ReadUInt16(0), response.ReadUInt32(2), GetHostTimestampUs());
+                        break;
+                    case ResponseType.CommandAppliedResponse:
+                        _latencyTracker.OnApplied(response.Data[6]);
+                        break;
+                }
+            }
         }
 
         public bool PrepareForFirmwareUpdate()
@@ -115,6 +350,23 @@ namespace Paregov.RobotCar.Rest.Service.Hardware
             }
         }
 
+        public FirmwareStreamResult StreamFirmware(byte[] image, bool activate)
+        {
+            // Not under the lock as a whole, the motion commands go between the chunks.
+            var streamer = new FirmwareStreamer(_spiCommunication, _logger, _lock);
+            var result = streamer.Stream(image, activate);
+            if (result.Success && activate)
+            {
+                // The new image starts with its own clock.
+                lock (_lock)
+                {
+                    _firmwareClock = null;
+                }
+            }
+
+            return result;
+        }
+
         public void Dispose()
         {
             // SPI communication is managed by DI container
@@ -1,6 +1,7 @@
 ﻿// Copyright © Svetoslav Paregov. All rights reserved.
 
 using System;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
 using Paregov.RobotCar.Rest.Service.Models.LowLevel;
 
 namespace Paregov.RobotCar.Rest.Service.Hardware
@@ -11,10 +12,34 @@ namespace Paregov.RobotCar.Rest.Service.Hardware
 
         public bool Send8ByteCommand(CommandData8Bytes command);
 
+        public bool SendScheduled8ByteCommand(CommandData8Bytes command, UInt32 delayMs);
+
+        public FirmwareClockOffset? SynchronizeClock();
+
         public bool SendDirectionAndSpeedAllMotorsCommand(DirectionAndSpeedAllMotorsCommand command);
 
+        public bool EmergencyStop();
+
+        public bool HoldMotion();
+
+        public bool StartMotion();
+
+        public bool SelectBoard(byte address);
+
         public bool PrepareForFirmwareUpdate();
 
         public bool ResumeAfterFirmwareUpdate();
+
+        public FirmwareStreamResult StreamFirmware(byte[] image, bool activate);
+
+        public CommandLatencyStatistics GetCommandLatencyStatistics();
+
+        public LinkTrainingResult TrainSpiLink();
+
+        public LinkTrainingResult? GetLinkTrainingResult();
+
+        public RegisterBurst? ReadRegisters(int address, int length);
+
+        public bool WriteRegisters(int address, byte[] payload);
     }
 }
@@ -23,5 +23,29 @@ namespace Paregov.RobotCar.Rest.Service.Models.Enums
         ArmMotorPositionCommand = 16,
         WristMotorPositionCommand = 17,
         GripperMotorPositionCommand = 18,
+        CartesianMoveCommand = 19,
+        CartesianVelocityCommand = 20,
+        GetServoCalibrationCommand = 21,
+        SetServoCalibrationCommand = 22,
+        GetServoSpeedProfileCommand = 23,
+        SetServoSpeedProfileCommand = 24,
+        SaveCalibrationCommand = 25,
+        LoadDefaultCalibrationCommand = 26,
+        GetBootProfileCommand = 27,
+        MotionRecordCommand = 28,
+        MotionPlayCommand = 29,
+        MotionStopCommand = 30,
+        GetMotionStatusCommand = 31,
+        LinkTrainingCommand = 32,
+        GetPowerStatusCommand = 33,
+        TimeSyncCommand = 34,
+        SyncHoldCommand = 35,
+        BoardSelectCommand = 36,
+        FirmwareUpdateCommand = 37,
+        GetIrqStatsCommand = 38,
+        RegisterWriteCommand = 39,
+        RegisterReadCommand = 40,
+        GetQueueCreditsCommand = 41,
+        BenchmarkCommand = 42,
     }
 }
@@ -0,0 +1,25 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+namespace Paregov.RobotCar.Rest.Service.Models.Enums
+{
+    public enum ResponseType
+    {
+        InvalidResponse = 0,
+        ServoCalibrationResponse = 1,
+        ServoSpeedProfileResponse = 2,
+        CalibrationSavedResponse = 3,
+        BootProfileResponse = 4,
+        MotionStatusResponse = 5,
+        CommandEchoResponse = 6,
+        CommandAppliedResponse = 7,
+        LinkStatusResponse = 8,
+        PowerStatusResponse = 9,
+        EmergencyStopResponse = 10,
+        TimeSyncResponse = 11,
+        FirmwareUpdateResponse = 12,
+        IrqStatsResponse = 13,
+        RegisterBurstResponse = 14,
+        QueueCreditsResponse = 15,
+        BenchmarkResponse = 16,
+    }
+}
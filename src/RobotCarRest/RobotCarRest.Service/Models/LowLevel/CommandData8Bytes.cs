@@ -1,6 +1,7 @@
 ﻿// Copyright © Svetoslav Paregov. All rights reserved.
 
 using System;
+using System.Collections.Generic;
 using Paregov.RobotCar.Rest.Service.Models.Enums;
 
 namespace Paregov.RobotCar.Rest.Service.Models.LowLevel
@@ -37,6 +38,31 @@ namespace Paregov.RobotCar.Rest.Service.Models.LowLevel
             Data[6] = 0x00; // Reserved
         }
 
+        /// <summary>
+        /// Set in the command type byte when an extension follows the 8 bytes of the command.
+        /// </summary>
+        public const byte ExtensionFlag = 0x80;
+
+        /// <summary>
+        /// Extension flag for the sequence number and host timestamp fields.
+        /// </summary>
+        public const byte ExtensionSequence = 0x01;
+
+        /// <summary>
+        /// Extension flag for the firmware time at which the command is applied.
+        /// </summary>
+        public const byte ExtensionExecuteAt = 0x02;
+
+        /// <summary>
+        /// Extension flag for the address of the board the command is for.
+        /// </summary>
+        public const byte ExtensionAddress = 0x04;
+
+        /// <summary>
+        /// Address taken by every board on the bus. A frame without an address goes to every board too.
+        /// </summary>
+        public const byte BroadcastAddress = 0xFF;
+
         public byte CommandType { get; set; }
 
         public byte[] Data { get; init; } = new byte[7];
@@ -52,5 +78,90 @@ namespace Paregov.RobotCar.Rest.Service.Models.LowLevel
             Array.Copy(Data, 0, result, 1, 7);
             return result;
         }
+
+        /// <summary>
+        /// Converts the command data to a byte array with a sequence number and host timestamp.
+        /// The firmware echoes both back and reports when the command was applied.
+        /// </summary>
+        /// <param name="sequence">Sequence number of the command</param>
+        /// <param name="hostTimestampUs">Host time in microseconds when the command is sent</param>
+        /// <returns>A 15-byte array containing the command type, data and extension</returns>
+        public readonly byte[] ToExtendedByteArray(UInt16 sequence, UInt32 hostTimestampUs)
+        {
+            return ToExtendedByteArray(ExtensionSequence, sequence, hostTimestampUs, 0, BroadcastAddress);
+        }
+
+        /// <summary>
+        /// Converts the command data to a byte array with a sequence number, host timestamp and execution time.
+        /// The firmware holds the command until its timer reaches the execution time.
+        /// </summary>
+        /// <param name="sequence">Sequence number of the command</param>
+        /// <param name="hostTimestampUs">Host time in microseconds when the command is sent</param>
+        /// <param name="executeAtUs">Firmware time in microseconds when the command is applied</param>
+        /// <returns>A 19-byte array containing the command type, data and extension</returns>
+        public readonly byte[] ToScheduledByteArray(UInt16 sequence, UInt32 hostTimestampUs, UInt32 executeAtUs)
+        {
+            return ToExtendedByteArray(ExtensionSequence | ExtensionExecuteAt, sequence, hostTimestampUs, executeAtUs, BroadcastAddress);
+        }
+
+        /// <summary>
+        /// Converts the command data to a byte array for one board on a shared bus.
+        /// The other boards drop the frame.
+        /// </summary>
+        /// <param name="address">Address of the board, or <see cref="BroadcastAddress"/> for all of them</param>
+        /// <returns>A 10-byte array containing the command type, data and extension</returns>
+        public readonly byte[] ToAddressedByteArray(byte address)
+        {
+            return ToExtendedByteArray(ExtensionAddress, 0, 0, 0, address);
+        }
+
+        /// <summary>
+        /// Converts the command data to a byte array with the extension fields selected by the flags,
+        /// in the order of their flag bits.
+        /// </summary>
+        /// <param name="extensionFlags">Combination of the extension flags</param>
+        /// <param name="sequence">Sequence number of the command</param>
+        /// <param name="hostTimestampUs">Host time in microseconds when the command is sent</param>
+        /// <param name="executeAtUs">Firmware time in microseconds when the command is applied</param>
+        /// <param name="address">Address of the board the command is for</param>
+        /// <returns>The command type, data, extension flags and the selected fields</returns>
+        public readonly byte[] ToExtendedByteArray(
+            byte extensionFlags,
+            UInt16 sequence,
+            UInt32 hostTimestampUs,
+            UInt32 executeAtUs,
+            byte address)
+        {
+            var result = new List<byte>(20) { (byte)(CommandType | ExtensionFlag) };
+            result.AddRange(Data);
+            result.Add(extensionFlags);
+
+            if ((extensionFlags & ExtensionSequence) != 0)
+            {
+                result.Add((byte)(sequence >> 8)); // High byte
+                result.Add((byte)(sequence & 0xFF)); // Low byte
+                AddUInt32(result, hostTimestampUs);
+            }
+
+            if ((extensionFlags & ExtensionExecuteAt) != 0)
+            {
+                AddUInt32(result, executeAtUs);
+            }
+
+            if ((extensionFlags & ExtensionAddress) != 0)
+            {
+                result.Add(address);
+            }
+
+            return result.ToArray();
+        }
+
+        private static void AddUInt32(List<byte> bytes, UInt32 value)
+        {
+            bytes.Add((byte)(value >> 24));
+            bytes.Add((byte)(value >> 16));
+            bytes.Add((byte)(value >> 8));
+            bytes.Add((byte)(value & 0xFF));
+        }
     }
 }
@@ -0,0 +1,40 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+
+namespace Paregov.RobotCar.Rest.Service.Models.LowLevel
+{
+    /// <summary>
+    /// A range of the low level controller register map, as read in one burst.
+    /// </summary>
+    public readonly struct RegisterBurst
+    {
+        public RegisterBurst(int address, byte[] data)
+        {
+            Address = address;
+            Data = data;
+        }
+
+        public int Address { get; }
+
+        public byte[] Data { get; }
+
+        /// <summary>
+        /// Reads a big-endian unsigned 16-bit register at a map address within the burst.
+        /// </summary>
+        public UInt16 ReadUInt16(int address)
+        {
+            int offset = address - Address;
+            return (UInt16)(Data[offset] << 8 | Data[offset + 1]);
+        }
+
+        /// <summary>
+        /// Reads a big-endian unsigned 32-bit register at a map address within the burst.
+        /// </summary>
+        public UInt32 ReadUInt32(int address)
+        {
+            int offset = address - Address;
+            return (UInt32)Data[offset] << 24 | (UInt32)Data[offset + 1] << 16 | (UInt32)Data[offset + 2] << 8 | Data[offset + 3];
+        }
+    }
+}
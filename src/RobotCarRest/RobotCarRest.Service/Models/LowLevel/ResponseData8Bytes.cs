@@ -0,0 +1,39 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace Paregov.RobotCar.Rest.Service.Models.LowLevel
+{
+    /// <summary>
+    /// A single response received from the low level controller.
+    /// </summary>
+    public readonly struct ResponseData8Bytes
+    {
+        public ResponseData8Bytes(ResponseType responseType, byte[] data)
+        {
+            ResponseType = responseType;
+            Data = data;
+        }
+
+        public ResponseType ResponseType { get; }
+
+        public byte[] Data { get; }
+
+        /// <summary>
+        /// Reads a big-endian unsigned 16-bit value from the data.
+        /// </summary>
+        public UInt16 ReadUInt16(int offset)
+        {
+            return (UInt16)(Data[offset] << 8 | Data[offset + 1]);
+        }
+
+        /// <summary>
+        /// Reads a big-endian unsigned 32-bit value from the data.
+        /// </summary>
+        public UInt32 ReadUInt32(int offset)
+        {
+            return (UInt32)Data[offset] << 24 | (UInt32)Data[offset + 1] << 16 | (UInt32)Data[offset + 2] << 8 | Data[offset + 3];
+        }
+    }
+}
@@ -6,6 +6,7 @@ using Microsoft.AspNetCore.Builder;
 using Microsoft.AspNetCore.Hosting;
 using Microsoft.Extensions.DependencyInjection;
 using Microsoft.Extensions.Logging;
+using Microsoft.Extensions.Options;
 using Microsoft.OpenApi.Models;
 using NetworkController.ZipUtilities;
 using Paregov.RobotCar.Rest.Service.BusinessLogic;
@@ -118,6 +119,13 @@ namespace Paregov.RobotCar.Rest.Service
 
                 logger.LogInformation("Independent communication services initialized:");
                 logger.LogInformation("  - SPI Communication: {Status}", spiComm.IsChannelReady ? "Ready" : "Not Ready");
+
+                var spiOptions = app.Services.GetRequiredService<IOptions<SpiOptions>>().Value;
+                if (spiOptions.LinkTrainingEnabled && spiComm.IsChannelReady)
+                {
+                    var training = app.Services.GetRequiredService<IHardwareControl>().TrainSpiLink();
+                    logger.LogInformation("  - SPI clock after link training: {ClockHz} Hz", training.ChosenClockHz);
+                }
             }
             catch (Exception ex)
             {
@@ -15,6 +15,12 @@ namespace Paregov.RobotCar.Rest.Service.SoftwareUpdate
         /// <summary>
         /// SPI communication interface
         /// </summary>
-        Spi = 1
+        Spi = 1,
+
+        /// <summary>
+        /// Streamed over the SPI command link while the controller keeps running,
+        /// then activated with a reboot. No bootloader mode needed.
+        /// </summary>
+        SpiStream = 2
     }
 }
@@ -35,6 +35,11 @@ public class FirmwareUpdater : IFirmwareUpdater
         byte[]? firmwareData,
         FirmwareUpdateInterface updateInterface = FirmwareUpdateInterface.Uart)
     {
+        if (updateInterface == FirmwareUpdateInterface.SpiStream)
+        {
+            return StreamFirmware(firmwareData);
+        }
+
         if (WriteFirmwareToFile(firmwareData))
         {
             try
@@ -98,6 +103,24 @@ public class FirmwareUpdater : IFirmwareUpdater
         return result;
     }
 
+    /// <summary>
+    /// Streams the image to the running controller, which keeps taking commands until it reboots into it.
+    /// </summary>
+    private (bool, string) StreamFirmware(byte[]? firmwareData)
+    {
+        if (firmwareData == null || firmwareData.Length == 0)
+        {
+            _logger.LogError("No firmware data to stream.");
+            return (false, "No firmware data to stream.");
+        }
+
+        _logger.LogInformation("Starting streamed SPI firmware update...");
+        var result = _hardwareControl.StreamFirmware(firmwareData, activate: true);
+        _logger.LogInformation($"Streamed firmware update completed. Success = {result.Success}.");
+
+        return (result.Success, $"{result.Message} Chunks: {result.Chunks}, packed: {result.PackedChunks}, sent again: {result.ResentChunks}.");
+    }
+
     private bool WriteFirmwareToFile(byte[]? firmwareData)
     {
         try
@@ -0,0 +1,64 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+using Paregov.RobotCar.Rest.Service.Models.LowLevel;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class CommandData8BytesTests
+{
+    private static CommandData8Bytes CreateCommand()
+    {
+        return new CommandData8Bytes(
+            CommandType.LeftMotorCommand,
+            new DirectionAndSpeedMotorCommand { Direction = 1, Speed = 60, TimeOutMilliseconds = 30000 });
+    }
+
+    [TestMethod]
+    public void ScheduledFrameKeepsTheFieldOrder()
+    {
+        // Arrange
+        var command = CreateCommand();
+
+        // Act
+        byte[] frame = command.ToScheduledByteArray(0x0102, 0x03040506, 0x0708090A);
+
+        // Assert
+        CollectionAssert.AreEqual(
+            new byte[] { 0x88, 1, 60, 0x75, 0x30, 0, 0, 0, 0x03, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A },
+            frame);
+    }
+
+    [TestMethod]
+    public void AddressedFrameCarriesOnlyTheAddress()
+    {
+        // Arrange
+        var command = CreateCommand();
+
+        // Act
+        byte[] frame = command.ToAddressedByteArray(3);
+
+        // Assert
+        CollectionAssert.AreEqual(
+            new byte[] { 0x88, 1, 60, 0x75, 0x30, 0, 0, 0, CommandData8Bytes.ExtensionAddress, 3 },
+            frame);
+    }
+
+    [TestMethod]
+    public void AddressFollowsTheOtherFields()
+    {
+        // Arrange
+        var command = CreateCommand();
+        byte flags = CommandData8Bytes.ExtensionSequence | CommandData8Bytes.ExtensionExecuteAt | CommandData8Bytes.ExtensionAddress;
+
+        // Act
+        byte[] frame = command.ToExtendedByteArray(flags, 1, 2, 3, CommandData8Bytes.BroadcastAddress);
+
+        // Assert
+        Assert.AreEqual(20, frame.Length);
+        Assert.AreEqual(flags, frame[8]);
+        Assert.AreEqual((byte)3, frame[18]);
+        Assert.AreEqual(CommandData8Bytes.BroadcastAddress, frame[19]);
+    }
+}
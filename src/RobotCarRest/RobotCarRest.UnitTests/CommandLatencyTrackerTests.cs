@@ -0,0 +1,48 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Paregov.RobotCar.Rest.Service.Hardware;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class CommandLatencyTrackerTests
+{
+    [TestMethod]
+    public void CountsGapAcrossSequenceWrap()
+    {
+        var tracker = new CommandLatencyTracker();
+
+        tracker.OnEcho(65534, 0, 100);
+        tracker.OnEcho(1, 0, 100);
+
+        var statistics = tracker.GetStatistics();
+        Assert.AreEqual(2, statistics.Samples);
+        Assert.AreEqual(2, statistics.Lost);
+    }
+
+    [TestMethod]
+    public void ReorderedEchoIsNotCountedAsLost()
+    {
+        var tracker = new CommandLatencyTracker();
+
+        tracker.OnEcho(10, 0, 100);
+        tracker.OnEcho(12, 0, 100);
+        tracker.OnEcho(11, 0, 100);
+        tracker.OnEcho(13, 0, 100);
+
+        Assert.AreEqual(0, tracker.GetStatistics().Lost);
+    }
+
+    [TestMethod]
+    public void LateEchoAcrossWrapIsNotCountedAsLost()
+    {
+        var tracker = new CommandLatencyTracker();
+
+        tracker.OnEcho(65535, 0, 100);
+        tracker.OnEcho(0, 0, 100);
+        tracker.OnEcho(65535, 0, 100);
+        tracker.OnEcho(1, 0, 100);
+
+        Assert.AreEqual(0, tracker.GetStatistics().Lost);
+    }
+}
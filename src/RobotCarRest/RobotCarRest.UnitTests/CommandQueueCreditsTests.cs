@@ -0,0 +1,203 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class CommandQueueCreditsTests
+{
+    /// <summary>
+    /// The commands queue as the firmware keeps it. Credits requests are answered at once with the
+    /// free entries, the main loop takes the given number of commands per transfer.
+    /// </summary>
+    private sealed class FakeControllerQueue(int capacity, int takenPerTransfer, bool answersCredits = true)
+    {
+        private readonly Queue<byte> _miso = new();
+
+        public int Queued { get; private set; }
+
+        public int Received { get; private set; }
+
+        public uint Overflows { get; private set; }
+
+        public int CreditRequests { get; private set; }
+
+        public bool Transfer(byte[] message, byte[] response)
+        {
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            for (int frame = 0; frame + 8 <= message.Length; frame += 8)
+            {
+                byte type = message[frame];
+                if (type == (byte)CommandType.GetQueueCreditsCommand)
+                {
+                    // Firmware before the credits drops the unknown type.
+                    if (answersCredits)
+                    {
+                        CreditRequests++;
+                        SendCredits();
+                    }
+                }
+                else if (type != 0 && Queued < capacity)
+                {
+                    Queued++;
+                    Received++;
+                }
+                else if (type != 0)
+                {
+                    Overflows++;
+                }
+            }
+
+            Queued = Math.Max(Queued - takenPerTransfer, 0);
+            return true;
+        }
+
+        private void SendCredits()
+        {
+            byte[] data = [(byte)(capacity - Queued), (byte)capacity, (byte)(Overflows >> 24), (byte)(Overflows >> 16), (byte)(Overflows >> 8), (byte)Overflows, 0];
+            byte checksum = (byte)ResponseType.QueueCreditsResponse;
+            _miso.Enqueue(ResponseStreamDecoder.SyncByte);
+            _miso.Enqueue((byte)ResponseType.QueueCreditsResponse);
+            foreach (byte b in data)
+            {
+                _miso.Enqueue(b);
+                checksum ^= b;
+            }
+
+            _miso.Enqueue(checksum);
+        }
+    }
+
+    private static byte[] Command(byte speed)
+    {
+        return [(byte)CommandType.LeftMotorCommand, 1, speed, 0x75, 0x30, 0, 0, 0];
+    }
+
+    [TestMethod]
+    public void CostCountsStartedFramesAndSkipsIdleFrames()
+    {
+        // Act & Assert
+        Assert.AreEqual(1, CommandQueueCredits.Cost(Command(10)));
+        Assert.AreEqual(2, CommandQueueCredits.Cost(new byte[10] { 0x88, 0, 0, 0, 0, 0, 0, 0, 0x04, 1 }));
+        Assert.AreEqual(0, CommandQueueCredits.Cost(new byte[16]));
+    }
+
+    [TestMethod]
+    public void AcquireAsksOnlyWhenTheCreditsRunOut()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(63, 0);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+
+        // Act
+        for (int i = 0; i < 63; i++)
+        {
+            Assert.IsTrue(credits.Acquire(Command(10), 100));
+            controller.Transfer(Command(10), new byte[8]);
+        }
+
+        // Assert
+        Assert.AreEqual(1, controller.CreditRequests);
+        Assert.AreEqual(63, credits.Capacity);
+        Assert.AreEqual(0, credits.Available);
+    }
+
+    [TestMethod]
+    public void PacedSenderNeverOverrunsTheQueue()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(63, 1);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+
+        // Act
+        for (int i = 0; i < 500; i++)
+        {
+            Assert.IsTrue(credits.Acquire(Command((byte)i), 1000));
+            controller.Transfer(Command((byte)i), new byte[8]);
+        }
+
+        // Assert
+        Assert.AreEqual(500, controller.Received);
+        Assert.AreEqual(0u, controller.Overflows);
+        Assert.AreEqual(0u, credits.QueueOverflows);
+    }
+
+    [TestMethod]
+    public void AcquireFailsWhenTheQueueStaysFull()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(4, 0);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+        for (int i = 0; i < 4; i++)
+        {
+            controller.Transfer(Command(10), new byte[8]);
+        }
+
+        // Act
+        bool acquired = credits.Acquire(Command(10), 0);
+
+        // Assert
+        Assert.IsFalse(acquired);
+        Assert.AreEqual(0, credits.Available);
+    }
+
+    [TestMethod]
+    public void MessageLargerThanTheQueueWaitsForTheWholeQueue()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(4, 1);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+        controller.Transfer(Command(10), new byte[8]);
+        var payload = new byte[80];
+        payload[0] = (byte)CommandType.RegisterWriteCommand;
+
+        // Act
+        bool acquired = credits.Acquire(payload, 1000);
+
+        // Assert
+        Assert.IsTrue(acquired);
+        Assert.AreEqual(0, controller.Queued);
+        Assert.AreEqual(0, credits.Available);
+    }
+
+    [TestMethod]
+    public void DropsReportedByTheController()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(4, 0);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+        for (int i = 0; i < 6; i++)
+        {
+            controller.Transfer(Command(10), new byte[8]);
+        }
+
+        // Act
+        bool answered = credits.Refresh();
+
+        // Assert
+        Assert.IsTrue(answered);
+        Assert.AreEqual(2u, credits.QueueOverflows);
+        Assert.AreEqual(0, credits.Available);
+    }
+
+    [TestMethod]
+    public void AcquireFailsWithoutCreditsSupport()
+    {
+        // Arrange
+        var controller = new FakeControllerQueue(63, 0, answersCredits: false);
+        var credits = new CommandQueueCredits(controller.Transfer, 0);
+
+        // Act
+        bool acquired = credits.Acquire(Command(10), 1000);
+
+        // Assert
+        Assert.IsFalse(acquired);
+        Assert.AreEqual(0, controller.Received);
+    }
+}
@@ -0,0 +1,150 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Microsoft.Extensions.Logging.Abstractions;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication.Config;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class FirmwareClockSyncTests
+{
+    /// <summary>
+    /// Answers the time sync requests as the firmware does, with its timer a fixed offset from the host clock.
+    /// Each transfer takes the next of the given durations, the request is stamped when its transfer ends.
+    /// </summary>
+    private sealed class FakeControllerSpi(uint firmwareOffsetUs, uint[] transferDurationsUs) : ISpiCommunication
+    {
+        private readonly Queue<byte> _miso = new();
+        private int _transfers;
+
+        public uint HostNowUs { get; set; }
+
+        public bool IsChannelReady => true;
+
+        public bool InitializeChannel(SpiConfig config) => true;
+
+        public bool FreeChannel() => true;
+
+        public bool SendMessage(string message) => true;
+
+        public bool SendBytesMessage(byte[] message) => true;
+
+        public bool ReinitializeWithChipSelectLine(int chipSelectLineOverride) => true;
+
+        public bool ReinitializeWithClockFrequency(int clockFrequencyOverride) => true;
+
+        public bool TransferBytesMessage(byte[] message, byte[] response)
+        {
+            HostNowUs += transferDurationsUs[_transfers++ % transferDurationsUs.Length];
+
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            if (message[0] == (byte)CommandType.TimeSyncCommand)
+            {
+                SendTimeSync(message[1], HostNowUs + firmwareOffsetUs);
+            }
+
+            return true;
+        }
+
+        public void Dispose()
+        {
+        }
+
+        private void SendTimeSync(byte syncId, uint receivedUs)
+        {
+            byte[] data = [syncId, (byte)(receivedUs >> 24), (byte)(receivedUs >> 16), (byte)(receivedUs >> 8), (byte)receivedUs, 0, 0x10];
+            byte checksum = (byte)ResponseType.TimeSyncResponse;
+            _miso.Enqueue(ResponseStreamDecoder.SyncByte);
+            _miso.Enqueue((byte)ResponseType.TimeSyncResponse);
+            foreach (byte b in data)
+            {
+                _miso.Enqueue(b);
+                checksum ^= b;
+            }
+
+            _miso.Enqueue(checksum);
+        }
+    }
+
+    [TestMethod]
+    public void EstimateTakesMiddleOfTransfer()
+    {
+        // Act
+        var offset = FirmwareClockSync.Estimate(1_000, 1_200, 51_100);
+
+        // Assert
+        Assert.AreEqual(50_000, offset.OffsetUs);
+        Assert.AreEqual(100u, offset.UncertaintyUs);
+        Assert.AreEqual(61_100u, offset.ToFirmwareTimeUs(11_100));
+    }
+
+    [TestMethod]
+    public void EstimateHandlesTimerWrap()
+    {
+        // Act
+        var offset = FirmwareClockSync.Estimate(0xFFFF_FF00, 0x0000_0100, 0x0001_0000);
+
+        // Assert
+        Assert.AreEqual(0x1_0000, offset.OffsetUs);
+        Assert.AreEqual(0x0001_0000u, offset.ToFirmwareTimeUs(0));
+    }
+
+    [TestMethod]
+    public void SynchronizeKeepsShortestTransfer()
+    {
+        // Arrange
+        // Request transfers of 900, 60 and 400 us, the polls 80 us each.
+        var spi = new FakeControllerSpi(3_000_000, [900, 80, 60, 80, 400, 80]);
+        var sync = new FirmwareClockSync(spi, NullLogger.Instance, () => spi.HostNowUs, pollDelayMs: 0);
+
+        // Act
+        var offset = sync.Synchronize(3);
+
+        // Assert
+        Assert.IsNotNull(offset);
+        Assert.AreEqual(30u, offset.UncertaintyUs);
+        Assert.AreEqual(3_000_030, offset.OffsetUs);
+    }
+
+    [TestMethod]
+    public void SynchronizeReturnsNullWithoutAnswer()
+    {
+        // Arrange
+        var sync = new FirmwareClockSync(new SilentSpi(), NullLogger.Instance, () => 0u, pollDelayMs: 0);
+
+        // Act
+        var offset = sync.Synchronize(2);
+
+        // Assert
+        Assert.IsNull(offset);
+    }
+
+    private sealed class SilentSpi : ISpiCommunication
+    {
+        public bool IsChannelReady => true;
+
+        public bool InitializeChannel(SpiConfig config) => true;
+
+        public bool FreeChannel() => true;
+
+        public bool SendMessage(string message) => true;
+
+        public bool SendBytesMessage(byte[] message) => true;
+
+        public bool ReinitializeWithChipSelectLine(int chipSelectLineOverride) => true;
+
+        public bool ReinitializeWithClockFrequency(int clockFrequencyOverride) => true;
+
+        public bool TransferBytesMessage(byte[] message, byte[] response) => true;
+
+        public void Dispose()
+        {
+        }
+    }
+}
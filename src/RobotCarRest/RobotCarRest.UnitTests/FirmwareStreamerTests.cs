@@ -0,0 +1,282 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using System.Security.Cryptography;
+using System.Text;
+using Microsoft.Extensions.Logging.Abstractions;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication.Config;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class FirmwareStreamerTests
+{
+    /// <summary>
+    /// Takes the update operations as update_agent.cpp does and keeps the staged image.
+    /// The first chunk with the given index arrives damaged once.
+    /// </summary>
+    private sealed class FakeControllerSpi(int damagedChunk) : ISpiCommunication
+    {
+        private readonly Queue<byte> _miso = new();
+        private readonly List<byte> _buffer = new();
+        private byte[] _sha256 = [];
+        private int _size;
+        private byte _state;
+        private bool _damaged;
+
+        public byte[] Staged { get; } = new byte[64 * 1024];
+
+        public int NextChunk { get; set; }
+
+        public bool Activated { get; private set; }
+
+        public bool IsChannelReady => true;
+
+        public bool InitializeChannel(SpiConfig config) => true;
+
+        public bool FreeChannel() => true;
+
+        public bool SendMessage(string message) => true;
+
+        public bool SendBytesMessage(byte[] message) => true;
+
+        public bool ReinitializeWithChipSelectLine(int chipSelectLineOverride) => true;
+
+        public bool ReinitializeWithClockFrequency(int clockFrequencyOverride) => true;
+
+        public bool TransferBytesMessage(byte[] message, byte[] response)
+        {
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            for (int offset = 0; offset + 8 <= message.Length; offset += 8)
+            {
+                Receive(message[offset..(offset + 8)]);
+            }
+
+            return true;
+        }
+
+        public void Dispose()
+        {
+        }
+
+        private void Receive(byte[] frame)
+        {
+            if (frame[0] != (byte)CommandType.FirmwareUpdateCommand)
+            {
+                return;
+            }
+
+            if (frame[1] == 0)
+            {
+                _buffer.AddRange(frame[2..8]);
+                return;
+            }
+
+            byte result = frame[1] switch
+            {
+                1 => Begin(frame),
+                2 => Chunk(frame),
+                3 => Finish(),
+                4 => Activate(),
+                _ => 1,
+            };
+            _buffer.Clear();
+            SendStatus(result);
+        }
+
+        private byte Begin(byte[] frame)
+        {
+            int size = frame[2] << 24 | frame[3] << 16 | frame[4] << 8 | frame[5];
+            var sha256 = _buffer.Take(32).ToArray();
+            if (size != _size || !sha256.SequenceEqual(_sha256))
+            {
+                NextChunk = 0;
+            }
+
+            _size = size;
+            _sha256 = sha256;
+            _state = 1;
+            return 0;
+        }
+
+        private byte Chunk(byte[] frame)
+        {
+            int index = frame[2] << 8 | frame[3];
+            uint crc = (uint)(frame[4] << 24 | frame[5] << 16 | frame[6] << 8 | frame[7]);
+            if (index < NextChunk)
+            {
+                return 0;
+            }
+
+            if (index > NextChunk)
+            {
+                return 4;
+            }
+
+            var buffer = _buffer.ToArray();
+            if (index == damagedChunk && !_damaged)
+            {
+                _damaged = true;
+                buffer[buffer.Length / 2] ^= 0x10;
+            }
+
+            if (FirmwareStreamer.Crc32(buffer) != crc)
+            {
+                return 3;
+            }
+
+            int offset = index * FirmwareStreamer.ChunkSize;
+            int size = Math.Min(FirmwareStreamer.ChunkSize, _size - offset);
+            int length = buffer[1] << 8 | buffer[2];
+            var payload = buffer.AsSpan(FirmwareStreamer.ChunkHeaderSize, length);
+            var unpacked = buffer[0] == 1 ? FirmwareStreamer.LzssDecode(payload, size) : payload.ToArray();
+            if (unpacked == null || unpacked.Length != size)
+            {
+                return 5;
+            }
+
+            unpacked.CopyTo(Staged, offset);
+            NextChunk++;
+            return 0;
+        }
+
+        private byte Finish()
+        {
+            if (!SHA256.HashData(Staged.AsSpan(0, _size)).SequenceEqual(_sha256))
+            {
+                NextChunk = 0;
+                return 7;
+            }
+
+            _state = 2;
+            return 0;
+        }
+
+        private byte Activate()
+        {
+            if (_state != 2)
+            {
+                return 1;
+            }
+
+            _state = 3;
+            Activated = true;
+            return 0;
+        }
+
+        private void SendStatus(byte result)
+        {
+            int chunks = (_size + FirmwareStreamer.ChunkSize - 1) / FirmwareStreamer.ChunkSize;
+            byte[] data = [_state, result, (byte)(NextChunk >> 8), (byte)NextChunk, (byte)(chunks >> 8), (byte)chunks, 0];
+            byte checksum = (byte)ResponseType.FirmwareUpdateResponse;
+            _miso.Enqueue(ResponseStreamDecoder.SyncByte);
+            _miso.Enqueue((byte)ResponseType.FirmwareUpdateResponse);
+            foreach (byte b in data)
+            {
+                _miso.Enqueue(b);
+                checksum ^= b;
+            }
+
+            _miso.Enqueue(checksum);
+        }
+    }
+
+    private static byte[] TestImage()
+    {
+        // Two sectors of repeating text, which pack well, then random bytes, which do not.
+        var image = new byte[3 * FirmwareStreamer.ChunkSize + 1000];
+        var text = Encoding.ASCII.GetBytes("LowLevelController servo and DC motor control loop. ");
+        for (int i = 0; i < 2 * FirmwareStreamer.ChunkSize; i++)
+        {
+            image[i] = text[i % text.Length];
+        }
+
+        new Random(7).NextBytes(image.AsSpan(2 * FirmwareStreamer.ChunkSize));
+        return image;
+    }
+
+    [TestMethod]
+    public void Crc32MatchesZlib()
+    {
+        // Act and Assert
+        Assert.AreEqual(0xCBF43926u, FirmwareStreamer.Crc32(Encoding.ASCII.GetBytes("123456789")));
+        Assert.AreEqual(0u, FirmwareStreamer.Crc32([]));
+    }
+
+    [TestMethod]
+    public void LzssRoundTrips()
+    {
+        // Arrange
+        var image = TestImage();
+        var sector = image.AsSpan(0, FirmwareStreamer.ChunkSize);
+
+        // Act
+        var encoded = FirmwareStreamer.LzssEncode(sector);
+        var decoded = FirmwareStreamer.LzssDecode(encoded, sector.Length);
+
+        // Assert
+        Assert.IsTrue(encoded.Length < sector.Length / 4);
+        Assert.IsNotNull(decoded);
+        CollectionAssert.AreEqual(sector.ToArray(), decoded);
+    }
+
+    [TestMethod]
+    public void RandomChunkGoesRaw()
+    {
+        // Arrange
+        var image = TestImage();
+
+        // Act
+        var chunk = FirmwareStreamer.BuildChunk(image, 2, out bool packed);
+
+        // Assert
+        Assert.IsFalse(packed);
+        Assert.AreEqual((byte)0, chunk[0]);
+        Assert.AreEqual(FirmwareStreamer.ChunkSize, chunk[1] << 8 | chunk[2]);
+        Assert.AreEqual(0, chunk.Length % FirmwareStreamer.DataFrameSize);
+    }
+
+    [TestMethod]
+    public void StreamsDamagedChunkAgainAndActivates()
+    {
+        // Arrange
+        var image = TestImage();
+        var spi = new FakeControllerSpi(damagedChunk: 1);
+        var streamer = new FirmwareStreamer(spi, NullLogger.Instance, new object(), pollDelayMs: 0);
+
+        // Act
+        var result = streamer.Stream(image, activate: true);
+
+        // Assert
+        Assert.IsTrue(result.Success, result.Message);
+        Assert.AreEqual(4, result.Chunks);
+        Assert.AreEqual(2, result.PackedChunks);
+        Assert.AreEqual(1, result.ResentChunks);
+        Assert.IsTrue(spi.Activated);
+        CollectionAssert.AreEqual(image, spi.Staged.AsSpan(0, image.Length).ToArray());
+    }
+
+    [TestMethod]
+    public void ResumesFromReportedChunk()
+    {
+        // Arrange
+        var image = TestImage();
+        var spi = new FakeControllerSpi(damagedChunk: -1);
+        var streamer = new FirmwareStreamer(spi, NullLogger.Instance, new object(), pollDelayMs: 0);
+        streamer.Stream(image, activate: false);
+
+        // Act
+        spi.NextChunk = 3;
+        var result = streamer.Stream(image, activate: false);
+
+        // Assert
+        Assert.IsTrue(result.Success, result.Message);
+        Assert.AreEqual(0, result.PackedChunks);
+        Assert.IsFalse(spi.Activated);
+    }
+}
@@ -0,0 +1,174 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Microsoft.Extensions.Logging.Abstractions;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication.Config;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class RegisterMapClientTests
+{
+    /// <summary>
+    /// Keeps a register file and answers the bursts as register_map.cpp does,
+    /// behind a response already going out. Answers the reads after the given number of polls.
+    /// </summary>
+    private sealed class FakeControllerSpi(int answerAfterPolls) : ISpiCommunication
+    {
+        private readonly Queue<byte> _miso = new();
+        private byte[]? _pendingBurst;
+        private int _polls;
+
+        public byte[] Registers { get; } = new byte[RegisterMapClient.MapSize];
+
+        public int Transfers { get; private set; }
+
+        public bool IsChannelReady => true;
+
+        public bool InitializeChannel(SpiConfig config) => true;
+
+        public bool FreeChannel() => true;
+
+        public bool SendMessage(string message) => true;
+
+        public bool SendBytesMessage(byte[] message)
+        {
+            return TransferBytesMessage(message, new byte[message.Length]);
+        }
+
+        public bool ReinitializeWithChipSelectLine(int chipSelectLineOverride) => true;
+
+        public bool ReinitializeWithClockFrequency(int clockFrequencyOverride) => true;
+
+        public bool TransferBytesMessage(byte[] message, byte[] response)
+        {
+            Transfers++;
+            Receive(message);
+            if (_pendingBurst != null && _polls++ >= answerAfterPolls)
+            {
+                foreach (byte b in _pendingBurst)
+                {
+                    _miso.Enqueue(b);
+                }
+
+                _pendingBurst = null;
+            }
+
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            return true;
+        }
+
+        public void Dispose()
+        {
+        }
+
+        private void Receive(byte[] message)
+        {
+            int address = message[1] << 8 | message[2];
+            int length = message[3] << 8 | message[4];
+            if (message[0] == (byte)CommandType.RegisterWriteCommand)
+            {
+                byte checksum = 0;
+                for (int i = 0; i < length; i++)
+                {
+                    checksum ^= message[8 + i];
+                }
+
+                if (checksum == message[5])
+                {
+                    Array.Copy(message, 8, Registers, address, length);
+                }
+            }
+            else if (message[0] == (byte)CommandType.RegisterReadCommand)
+            {
+                // The response in front of the burst.
+                _pendingBurst = [ResponseStreamDecoder.SyncByte, (byte)ResponseType.CommandAppliedResponse, 0, 0, 0, 0, 0, 0, 0, (byte)ResponseType.CommandAppliedResponse,
+                    ResponseStreamDecoder.SyncByte, (byte)ResponseType.RegisterBurstResponse, message[1], message[2], message[3], message[4],
+                    .. Registers[address..(address + length)], 0];
+                byte checksum = 0;
+                for (int i = 11; i < _pendingBurst.Length - 1; i++)
+                {
+                    checksum ^= _pendingBurst[i];
+                }
+
+                _pendingBurst[^1] = checksum;
+                _polls = 0;
+            }
+        }
+    }
+
+    [TestMethod]
+    public void WritesSetpointsAndReadsThemBack()
+    {
+        // Arrange
+        var spi = new FakeControllerSpi(0);
+        var client = new RegisterMapClient(spi, NullLogger.Instance, new object(), 0);
+        var setpoints = new byte[RegisterMapClient.JointSetpoints - RegisterMapClient.WheelSetpoints + RegisterMapClient.ServoSlotsCount * RegisterMapClient.SetpointSize];
+        RegisterMapClient.WriteSetpoint(setpoints, 1, 60, 30000);
+        RegisterMapClient.WriteSetpoint(setpoints.AsSpan(RegisterMapClient.SetpointSize), -1, 40, 30000);
+        RegisterMapClient.WriteSetpoint(setpoints.AsSpan(RegisterMapClient.JointSetpoints - RegisterMapClient.WheelSetpoints), 1, 100, 2000);
+
+        // Act
+        bool written = client.Write(RegisterMapClient.WheelSetpoints, setpoints);
+        var burst = client.Read(RegisterMapClient.WheelSetpoints, setpoints.Length);
+
+        // Assert
+        Assert.IsTrue(written);
+        Assert.IsNotNull(burst);
+        CollectionAssert.AreEqual(setpoints, burst.Value.Data);
+        Assert.AreEqual((ushort)30000, burst.Value.ReadUInt16(RegisterMapClient.WheelSetpoints + 2));
+        Assert.AreEqual(2, spi.Transfers);
+    }
+
+    [TestMethod]
+    public void PollsForBurstDelayedByOtherBoard()
+    {
+        // Arrange
+        var spi = new FakeControllerSpi(2);
+        spi.Registers[RegisterMapClient.Magic] = 0x52;
+        spi.Registers[RegisterMapClient.Magic + 1] = 0x4D;
+        var client = new RegisterMapClient(spi, NullLogger.Instance, new object(), 0);
+
+        // Act
+        var burst = client.Read(0, RegisterMapClient.RegisterErrors + 4);
+
+        // Assert
+        Assert.IsNotNull(burst);
+        Assert.AreEqual(RegisterMapClient.MagicValue, burst.Value.ReadUInt16(RegisterMapClient.Magic));
+        Assert.AreEqual(3, spi.Transfers);
+    }
+
+    [TestMethod]
+    public void RefusesWriteToReadOnlyPart()
+    {
+        // Arrange
+        var spi = new FakeControllerSpi(0);
+        var client = new RegisterMapClient(spi, NullLogger.Instance, new object(), 0);
+
+        // Act
+        bool written = client.Write(RegisterMapClient.UptimeUs, new byte[] { 1, 2, 3, 4 });
+
+        // Assert
+        Assert.IsFalse(written);
+        Assert.AreEqual(0, spi.Transfers);
+    }
+
+    [TestMethod]
+    public void BuildsWriteWithPayloadChecksum()
+    {
+        // Act
+        var message = RegisterMapClient.BuildWrite(RegisterMapClient.JointLimits, new byte[] { 0, 20, 0, 200 });
+
+        // Assert
+        Assert.AreEqual(12, message.Length);
+        Assert.AreEqual((byte)CommandType.RegisterWriteCommand, message[0]);
+        Assert.AreEqual((byte)0xC0, message[2]);
+        Assert.AreEqual((byte)4, message[4]);
+        Assert.AreEqual((byte)(20 ^ 200), message[5]);
+    }
+}
@@ -0,0 +1,98 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class ResponsePollerTests
+{
+    private static byte[] Frame(ResponseType type, byte first)
+    {
+        var frame = new byte[ResponseStreamDecoder.FrameSize];
+        frame[0] = ResponseStreamDecoder.SyncByte;
+        frame[1] = (byte)type;
+        frame[2] = first;
+        frame[9] = (byte)(frame[1] ^ first);
+        return frame;
+    }
+
+    /// <summary>
+    /// Clocks the queued MISO bytes out and records the MOSI messages.
+    /// </summary>
+    private sealed class FakeLink(params byte[][] miso)
+    {
+        private readonly Queue<byte> _miso = new(miso.SelectMany(bytes => bytes));
+
+        public List<byte[]> Sent { get; } = new();
+
+        public bool Fails { get; set; }
+
+        public bool Transfer(byte[] message, byte[] response)
+        {
+            if (Fails)
+            {
+                return false;
+            }
+
+            Sent.Add(message);
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            return true;
+        }
+    }
+
+    [TestMethod]
+    public void PollsWithIdleFramesUntilTheAcceptedResponse()
+    {
+        // Arrange
+        var link = new FakeLink(
+            new byte[8],
+            Frame(ResponseType.TimeSyncResponse, 1),
+            Frame(ResponseType.TimeSyncResponse, 2));
+        var poller = new ResponsePoller(link.Transfer, 0);
+
+        // Act
+        var response = poller.Request(new byte[8] { 1, 0, 0, 0, 0, 0, 0, 0 }, new ResponseStreamDecoder(),
+            r => r.ResponseType == ResponseType.TimeSyncResponse && r.Data[0] == 2, 5);
+
+        // Assert
+        Assert.IsNotNull(response);
+        Assert.AreEqual((byte)2, response.Value.Data[0]);
+        Assert.AreEqual(3, link.Sent.Count);
+        Assert.IsTrue(link.Sent.Skip(1).All(poll => poll.Length == ResponsePoller.PollSize && poll.All(b => b == 0)));
+    }
+
+    [TestMethod]
+    public void GivesUpAfterTheAttempts()
+    {
+        // Arrange
+        var link = new FakeLink();
+        var poller = new ResponsePoller(link.Transfer, 0);
+
+        // Act
+        var response = poller.Request(new byte[8], new ResponseStreamDecoder(), _ => true, 4);
+
+        // Assert
+        Assert.IsNull(response);
+        Assert.AreEqual(5, link.Sent.Count);
+    }
+
+    [TestMethod]
+    public void StopsOnAFailedTransfer()
+    {
+        // Arrange
+        var link = new FakeLink { Fails = true };
+        var poller = new ResponsePoller(link.Transfer, 0);
+
+        // Act
+        var response = poller.Poll(new ResponseStreamDecoder(), _ => true, 4);
+
+        // Assert
+        Assert.IsNull(response);
+    }
+}
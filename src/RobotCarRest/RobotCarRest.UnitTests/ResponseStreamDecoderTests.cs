@@ -0,0 +1,89 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class ResponseStreamDecoderTests
+{
+    private static byte[] Frame(ResponseType type, params byte[] data)
+    {
+        var frame = new byte[ResponseStreamDecoder.FrameSize];
+        frame[0] = ResponseStreamDecoder.SyncByte;
+        frame[1] = (byte)type;
+        byte checksum = frame[1];
+        for (int i = 0; i < 7; i++)
+        {
+            frame[2 + i] = data[i];
+            checksum ^= data[i];
+        }
+
+        frame[9] = checksum;
+        return frame;
+    }
+
+    [TestMethod]
+    public void DecodesFrameSplitOverTransfers()
+    {
+        // Arrange
+        var decoder = new ResponseStreamDecoder();
+        var frame = Frame(ResponseType.CommandEchoResponse, 0x12, 0x34, 0xDE, 0xAD, 0xBE, 0xEF, 0x01);
+
+        // Act
+        var first = decoder.Decode(new byte[] { 0x00, 0x00, frame[0], frame[1], frame[2] });
+        var second = decoder.Decode(frame[3..]);
+
+        // Assert
+        Assert.AreEqual(0, first.Count);
+        Assert.AreEqual(1, second.Count);
+        Assert.AreEqual(ResponseType.CommandEchoResponse, second[0].ResponseType);
+        Assert.AreEqual((ushort)0x1234, second[0].ReadUInt16(0));
+        Assert.AreEqual(0xDEADBEEFu, second[0].ReadUInt32(2));
+    }
+
+    [TestMethod]
+    public void DropsFrameWithWrongChecksum()
+    {
+        // Arrange
+        var decoder = new ResponseStreamDecoder();
+        var bad = Frame(ResponseType.CommandAppliedResponse, 1, 2, 3, 4, 5, 6, 7);
+        bad[9] ^= 0xFF;
+        var good = Frame(ResponseType.CommandAppliedResponse, 7, 6, 5, 4, 3, 2, 1);
+
+        // Act
+        var responses = decoder.Decode([.. bad, .. good]);
+
+        // Assert
+        Assert.AreEqual(1, responses.Count);
+        Assert.AreEqual((byte)7, responses[0].Data[0]);
+        Assert.AreEqual(1, decoder.ChecksumErrors);
+    }
+
+    [TestMethod]
+    public void DecodesRegisterBurstBetweenResponses()
+    {
+        // Arrange
+        var decoder = new ResponseStreamDecoder();
+        byte[] burst = [ResponseStreamDecoder.SyncByte, (byte)ResponseType.RegisterBurstResponse, 0x00, 0x10, 0x00, 0x04, 0x00, 0x0F, 0x42, 0x40, 0x00];
+        byte checksum = 0;
+        for (int i = 1; i < burst.Length - 1; i++)
+        {
+            checksum ^= burst[i];
+        }
+        burst[^1] = checksum;
+        var echo = Frame(ResponseType.CommandEchoResponse, 0, 1, 0, 0, 0, 2, 0);
+
+        // Act
+        var responses = decoder.Decode([.. echo, 0x00, .. burst, .. echo]);
+
+        // Assert
+        Assert.AreEqual(2, responses.Count);
+        Assert.AreEqual(1, decoder.Bursts.Count);
+        var registers = decoder.Bursts.Dequeue();
+        Assert.AreEqual(0x10, registers.Address);
+        Assert.AreEqual(1000000u, registers.ReadUInt32(0x10));
+        Assert.AreEqual(0, decoder.ChecksumErrors);
+    }
+}
@@ -0,0 +1,176 @@
+﻿// Copyright © Svetoslav Paregov. All rights reserved.
+
+using Microsoft.Extensions.Logging.Abstractions;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication;
+using Paregov.RobotCar.Rest.Service.Hardware.Communication.Config;
+using Paregov.RobotCar.Rest.Service.Models.Enums;
+
+namespace RobotCarRest.UnitTests;
+
+[TestClass]
+public sealed class SpiLinkTrainerTests
+{
+    private static readonly int[] Rates = [1_000_000, 2_000_000, 4_000_000, 8_000_000, 12_000_000];
+
+    /// <summary>
+    /// Answers the training commands as the firmware does.
+    /// Above the highest good clock every pattern arrives with a flipped bit.
+    /// </summary>
+    private sealed class FakeControllerSpi(int highestGoodClockHz) : ISpiCommunication
+    {
+        private readonly Queue<byte> _miso = new();
+        private int _clockHz;
+        private int _intact;
+        private int _corrupted;
+
+        public int CommittedClockHz { get; private set; }
+
+        public int ClockHz => _clockHz;
+
+        public bool IsChannelReady => true;
+
+        public bool InitializeChannel(SpiConfig config) => true;
+
+        public bool FreeChannel() => true;
+
+        public bool SendMessage(string message) => true;
+
+        public bool SendBytesMessage(byte[] message) => true;
+
+        public bool ReinitializeWithChipSelectLine(int chipSelectLineOverride) => true;
+
+        public bool ReinitializeWithClockFrequency(int clockFrequencyOverride)
+        {
+            _clockHz = clockFrequencyOverride;
+            return true;
+        }
+
+        public bool TransferBytesMessage(byte[] message, byte[] response)
+        {
+            for (int i = 0; i < response.Length; i++)
+            {
+                response[i] = _miso.Count > 0 ? _miso.Dequeue() : (byte)0;
+            }
+
+            for (int offset = 0; offset + 8 <= message.Length; offset += 8)
+            {
+                var frame = message[offset..(offset + 8)];
+                if (_clockHz > highestGoodClockHz && frame[1] == 1)
+                {
+                    frame[5] ^= 0x08;
+                }
+
+                Receive(frame);
+            }
+
+            return true;
+        }
+
+        public void Dispose()
+        {
+        }
+
+        private void Receive(byte[] frame)
+        {
+            if (frame[0] != (byte)CommandType.LinkTrainingCommand)
+            {
+                return;
+            }
+
+            switch (frame[1])
+            {
+                case 0:
+                    _intact = 0;
+                    _corrupted = 0;
+                    break;
+                case 1:
+                    bool intact = true;
+                    for (int position = 0; position < 5; position++)
+                    {
+                        intact &= frame[3 + position] == SpiLinkTrainer.PatternByte(frame[2], position);
+                    }
+
+                    if (intact)
+                    {
+                        _intact++;
+                    }
+                    else
+                    {
+                        _corrupted++;
+                    }
+                    break;
+                case 3:
+                    CommittedClockHz = frame[2] << 24 | frame[3] << 16 | frame[4] << 8 | frame[5];
+                    SendStatus();
+                    break;
+                default:
+                    SendStatus();
+                    break;
+            }
+        }
+
+        private void SendStatus()
+        {
+            int khz = CommittedClockHz / 1000;
+            byte[] data = [(byte)(_intact >> 8), (byte)_intact, (byte)(_corrupted >> 8), (byte)_corrupted, (byte)(khz >> 16), (byte)(khz >> 8), (byte)khz];
+            byte checksum = (byte)ResponseType.LinkStatusResponse;
+            _miso.Enqueue(ResponseStreamDecoder.SyncByte);
+            _miso.Enqueue((byte)ResponseType.LinkStatusResponse);
+            foreach (byte b in data)
+            {
+                _miso.Enqueue(b);
+                checksum ^= b;
+            }
+
+            _miso.Enqueue(checksum);
+        }
+    }
+
+    [TestMethod]
+    public void ChoosesHighestRateBeforeFirstFailure()
+    {
+        // Arrange
+        var spi = new FakeControllerSpi(4_000_000);
+        var trainer = new SpiLinkTrainer(spi, NullLogger.Instance, pollDelayMs: 0);
+
+        // Act
+        var result = trainer.Train(Rates, 32, 100_000);
+
+        // Assert
+        Assert.AreEqual(4_000_000, result.ChosenClockHz);
+        Assert.AreEqual(4, result.Rates.Count);
+        Assert.AreEqual(32, result.Rates[2].Intact);
+        Assert.IsFalse(result.Rates[3].Passed);
+        Assert.AreEqual(32, result.Rates[3].Corrupted);
+        Assert.AreEqual(4_000_000, spi.ClockHz);
+        Assert.AreEqual(4_000_000, spi.CommittedClockHz);
+    }
+
+    [TestMethod]
+    public void KeepsFallbackClockWhenNoRatePasses()
+    {
+        // Arrange
+        var spi = new FakeControllerSpi(500_000);
+        var trainer = new SpiLinkTrainer(spi, NullLogger.Instance, pollDelayMs: 0);
+
+        // Act
+        var result = trainer.Train(Rates, 16, 100_000);
+
+        // Assert
+        Assert.AreEqual(100_000, result.ChosenClockHz);
+        Assert.AreEqual(1, result.Rates.Count);
+        Assert.AreEqual(100_000, spi.ClockHz);
+        Assert.AreEqual(100_000, spi.CommittedClockHz);
+    }
+
+    [TestMethod]
+    public void PatternMatchesFirmwareTable()
+    {
+        // Act and Assert
+        Assert.AreEqual((byte)0x55, SpiLinkTrainer.PatternByte(0, 0));
+        Assert.AreEqual((byte)0xAA, SpiLinkTrainer.PatternByte(0, 1));
+        Assert.AreEqual((byte)0x55, SpiLinkTrainer.PatternByte(7, 1));
+        Assert.AreEqual((byte)0x08, SpiLinkTrainer.PatternByte(3, 4));
+        Assert.AreEqual((byte)0x01, SpiLinkTrainer.PatternByte(8, 4));
+    }
+}